@@ -0,0 +1,256 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Measures the cost of notifying every subscriber of a key change,
+ * for a growing number of subscribers. buxtond_notify_clients() is
+ * compared with keeping a copy of the last value and serializing the
+ * CHANGED message for each subscriber, as buxtond used to. Subscribers
+ * write to /dev/null, so the socket cost is a single cheap write() per
+ * subscriber in both cases.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buxton.h"
+#include "daemon.h"
+#include "hashmap.h"
+#include "util.h"
+
+#define error(...) { printf(__VA_ARGS__); }
+
+static int iterations = 2000;
+static const int counts[] = { 1, 10, 50, 200, 1000 };
+static BuxtonData *old_values[1000];
+
+/* The fan-out as done before the value and message were shared */
+static void per_subscriber_notify(BuxtonDaemon *self, _BuxtonKey *key,
+				  BuxtonData *value)
+{
+	_cleanup_free_ char *key_name = NULL;
+	BuxtonNotification *nitem;
+	BuxtonData **old_value;
+	BuxtonArray *out_list;
+	BuxtonWatch *watch;
+	uint8_t *response;
+	size_t response_len;
+
+	if (asprintf(&key_name, "%s\n%s", key->group.value,
+		     key->name.value) == -1) {
+		abort();
+	}
+	watch = hashmap_get(self->notify_mapping, key_name);
+
+	LIST_FOREACH(subscriber, nitem, watch->subscribers) {
+		old_value = &old_values[nitem->msgid];
+		response = NULL;
+
+		if (*old_value && (*old_value)->store.d_string.length ==
+		    value->store.d_string.length &&
+		    memcmp((*old_value)->store.d_string.value,
+			   value->store.d_string.value,
+			   value->store.d_string.length) == 0) {
+			continue;
+		}
+		free_buxton_data(old_value);
+		*old_value = malloc0(sizeof(BuxtonData));
+		if (!*old_value || !buxton_data_copy(value, *old_value)) {
+			abort();
+		}
+
+		out_list = buxton_array_new();
+		if (!out_list || !buxton_array_add(out_list, value)) {
+			abort();
+		}
+		response_len = buxton_serialize_message(&response,
+							BUXTON_CONTROL_CHANGED,
+							nitem->msgid, out_list);
+		buxton_array_free(&out_list, NULL);
+		if (response_len == 0) {
+			abort();
+		}
+		(void)queue_message(self, nitem->client, response, response_len,
+				    true);
+	}
+}
+
+static void shared_notify(BuxtonDaemon *self, _BuxtonKey *key,
+			  BuxtonData *value)
+{
+	buxtond_notify_clients(self, self->client_list, key, value);
+}
+
+static double elapsed_ns(struct timespec *tsi, struct timespec *tsf)
+{
+	return (double)(tsf->tv_nsec - tsi->tv_nsec) +
+		(double)(tsf->tv_sec - tsi->tv_sec) * 1000000000.0;
+}
+
+static double run(BuxtonDaemon *self, _BuxtonKey *key,
+		  void (*notify)(BuxtonDaemon *, _BuxtonKey *, BuxtonData *))
+{
+	struct timespec tsi, tsf;
+	BuxtonData value;
+
+	/* A new value each time, or unchanged values are skipped */
+	value.type = BUXTON_TYPE_STRING;
+	clock_gettime(CLOCK_MONOTONIC, &tsi);
+	for (int i = 0; i < iterations; i++) {
+		value.store.d_string = buxton_string_pack(i % 2 ?
+							  "connected" :
+							  "disconnected");
+		notify(self, key, &value);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tsf);
+
+	return elapsed_ns(&tsi, &tsf) / (double)iterations;
+}
+
+static void subscribe(BuxtonDaemon *self, client_list_item *clients,
+		      int count)
+{
+	BuxtonNotification *nitem;
+	BuxtonWatch *watch;
+
+	watch = malloc0(sizeof(BuxtonWatch));
+	if (!watch) {
+		abort();
+	}
+	for (int i = 0; i < count; i++) {
+		nitem = malloc0(sizeof(BuxtonNotification));
+		if (!nitem) {
+			abort();
+		}
+		nitem->client = &clients[i];
+		nitem->msgid = (uint32_t)i;
+		LIST_PREPEND(BuxtonNotification, subscriber, watch->subscribers,
+			     nitem);
+	}
+
+	watch->name = strdup("network\nstate");
+	if (!watch->name) {
+		abort();
+	}
+	if (hashmap_put(self->notify_mapping, watch->name, watch) != 1) {
+		abort();
+	}
+}
+
+static void unsubscribe(BuxtonDaemon *self)
+{
+	BuxtonWatch *watch;
+
+	watch = hashmap_remove(self->notify_mapping, "network\nstate");
+	free_watch(watch);
+	for (size_t i = 0; i < sizeof(old_values) / sizeof(old_values[0]); i++) {
+		free_buxton_data(&old_values[i]);
+		old_values[i] = NULL;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	BuxtonDaemon self;
+	client_list_item *clients;
+	_BuxtonKey key;
+	int max = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+	double before, after;
+	int fd;
+
+	if (argc == 2) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			exit(EXIT_FAILURE);
+		}
+	} else if (argc != 1) {
+		error("Usage: %s [iterations]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0) {
+		error("Unable to open /dev/null\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memzero(&self, sizeof(BuxtonDaemon));
+	self.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	clients = calloc((size_t)max, sizeof(client_list_item));
+	if (!self.notify_mapping || !clients) {
+		abort();
+	}
+	for (int i = 0; i < max; i++) {
+		clients[i].fd = fd;
+	}
+	self.client_list = clients;
+
+	memzero(&key, sizeof(_BuxtonKey));
+	key.group = buxton_string_pack("network");
+	key.name = buxton_string_pack("state");
+	key.type = BUXTON_TYPE_STRING;
+
+#ifdef DEBUG
+	printf("Built with debugging, which logs every notification.\n");
+#endif
+	printf("Notification fan-out timing tool. Using %i changes per count.\n",
+	       iterations);
+	printf("Subscribers:  Per subscriber:   Shared value:  Per change saved:\n");
+
+	for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++) {
+		subscribe(&self, clients, counts[n]);
+		before = run(&self, &key, per_subscriber_notify);
+		after = run(&self, &key, shared_notify);
+		unsubscribe(&self);
+
+		printf("%11d  %13.1lfns  %12.1lfns  %15.1lfns\n", counts[n],
+		       before, after, before - after);
+	}
+
+	hashmap_free(self.notify_mapping);
+	free(clients);
+	close(fd);
+
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,260 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Measures the cost of a Smack access check with 10000 loaded rules.
+ * The rules are written to a temporary load2 file and loaded into the
+ * label ID table buxtond uses, and into a string keyed table checked
+ * the way buxtond used to: formatting "subject object" for every check
+ * and looking that up. Both are run over the same subject and object
+ * pairs, a tenth of which no rule names.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buxton.h"
+#include "hashmap.h"
+#include "smack.h"
+#include "util.h"
+
+#define error(...) { printf(__VA_ARGS__); }
+
+#define SUBJECTS 100
+#define OBJECTS 100
+#define PAIRS 4096
+
+static int iterations = 1000000;
+
+static Hashmap *string_rules;
+static BuxtonString subjects[PAIRS];
+static BuxtonString objects[PAIRS];
+
+/* The string keyed lookup, as done before labels were interned */
+static bool string_check(BuxtonString *subject, BuxtonString *object,
+			 BuxtonKeyAccessType request)
+{
+	_cleanup_free_ char *key = NULL;
+	BuxtonKeyAccessType *access;
+
+	if (streq(subject->value, "*")) {
+		return false;
+	}
+	if (streq(object->value, "@") || streq(subject->value, "@")) {
+		return true;
+	}
+	if (streq(object->value, "*")) {
+		return true;
+	}
+	if (streq(subject->value, object->value)) {
+		return true;
+	}
+	if (request == ACCESS_READ) {
+		if (streq(object->value, "_")) {
+			return true;
+		}
+		if (streq(subject->value, "^")) {
+			return true;
+		}
+	}
+
+	if (asprintf(&key, "%s %s", subject->value, object->value) == -1) {
+		abort();
+	}
+
+	access = hashmap_get(string_rules, key);
+	if (!access) {
+		return false;
+	}
+
+	if (request == ACCESS_READ) {
+		return (*access & ACCESS_READ) != 0;
+	}
+	return (*access & ACCESS_READ) && (*access & ACCESS_WRITE);
+}
+
+static bool write_rules(char *path)
+{
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		return false;
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		return false;
+	}
+
+	string_rules = hashmap_new(string_hash_func, string_compare_func);
+	if (!string_rules) {
+		abort();
+	}
+
+	for (int s = 0; s < SUBJECTS; s++) {
+		for (int o = 0; o < OBJECTS; o++) {
+			BuxtonKeyAccessType *access;
+			char *key;
+
+			access = malloc0(sizeof(BuxtonKeyAccessType));
+			if (!access) {
+				abort();
+			}
+			*access = ACCESS_READ;
+			if ((s + o) % 2) {
+				*access |= ACCESS_WRITE;
+			}
+			fprintf(f, "subject%03d object%03d/key %s\n", s, o,
+				*access & ACCESS_WRITE ? "rw" : "r");
+
+			if (asprintf(&key, "subject%03d object%03d/key", s, o) == -1) {
+				abort();
+			}
+			if (hashmap_put(string_rules, key, access) != 1) {
+				abort();
+			}
+		}
+	}
+
+	return fclose(f) == 0;
+}
+
+static void make_pairs(void)
+{
+	char *label;
+
+	srand(672);
+	for (int i = 0; i < PAIRS; i++) {
+		if (asprintf(&label, "subject%03d", rand() % SUBJECTS) == -1) {
+			abort();
+		}
+		subjects[i] = buxton_string_pack(label);
+
+		/* Leave some objects without a rule */
+		if (i % 10 == 0) {
+			if (asprintf(&label, "unknown%03d/key", rand() % OBJECTS) == -1) {
+				abort();
+			}
+		} else if (asprintf(&label, "object%03d/key", rand() % OBJECTS) == -1) {
+			abort();
+		}
+		objects[i] = buxton_string_pack(label);
+	}
+}
+
+static double elapsed_ns(struct timespec *tsi, struct timespec *tsf)
+{
+	return (double)(tsf->tv_nsec - tsi->tv_nsec) +
+		(double)(tsf->tv_sec - tsi->tv_sec) * 1000000000.0;
+}
+
+static void run(const char *name,
+		bool (*check)(BuxtonString *, BuxtonString *, BuxtonKeyAccessType),
+		unsigned long long *granted)
+{
+	struct timespec tsi, tsf;
+	BuxtonKeyAccessType request;
+	int n;
+
+	*granted = 0;
+	clock_gettime(CLOCK_MONOTONIC, &tsi);
+	for (int i = 0; i < iterations; i++) {
+		n = i % PAIRS;
+		request = (i / PAIRS) % 2 ? ACCESS_WRITE : ACCESS_READ;
+		if (check(&subjects[n], &objects[n], request)) {
+			(*granted)++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tsf);
+
+	printf("%-24s  %10.1lfns  %10llu\n", name,
+	       elapsed_ns(&tsi, &tsf) / (double)iterations, *granted);
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/bxt_smack_timing.XXXXXX";
+	unsigned long long interned, strings;
+	int ret = EXIT_SUCCESS;
+
+	if (argc == 2) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			exit(EXIT_FAILURE);
+		}
+	} else if (argc != 1) {
+		error("Usage: %s [iterations]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!write_rules(path)) {
+		error("Unable to write Smack rules\n");
+		exit(EXIT_FAILURE);
+	}
+	if (!buxton_smack_load_rules(path)) {
+		error("Unable to load Smack rules\n");
+		unlink(path);
+		exit(EXIT_FAILURE);
+	}
+	unlink(path);
+	make_pairs();
+
+#ifdef DEBUG
+	printf("Built with debugging, which logs every interned check.\n");
+#endif
+	printf("Smack access check timing tool. Using %i checks with %i rules.\n",
+	       iterations, SUBJECTS * OBJECTS);
+	printf("Test Name:                 Per check:    Granted:\n");
+
+	run("interned_labels", buxton_check_smack_access, &interned);
+	run("string_pairs", string_check, &strings);
+
+	if (interned != strings) {
+		error("Lookups disagree on the granted checks\n");
+		ret = EXIT_FAILURE;
+	}
+
+	exit(ret);
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -31,6 +31,8 @@
 #include <math.h>
 
 #include "buxton.h"
+#include "buxtonarray.h"
+#include "serialize.h"
 #include "util.h"
 
 #define error(...) { printf(__VA_ARGS__); }
@@ -278,21 +280,221 @@ static void test(struct testcase *tc)
 	       tc->name, mean / 1000.0, sigma / 1000.0, errors);
 }
 
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL +
+		(unsigned long long)ts.tv_nsec;
+}
+
+/* Fill the parameters of the SET message a set testcase sends */
+static void wire_params(struct testcase *tc, BuxtonData *params, char *name)
+{
+	static char string4k[4096];
+
+	sprintf(name, "TimingTest-%d-%s", getpid(), tc->name + strlen("set_"));
+	params[0].type = BUXTON_TYPE_STRING;
+	params[0].store.d_string = buxton_string_pack("user");
+	params[1].type = BUXTON_TYPE_STRING;
+	params[1].store.d_string = buxton_string_pack("TimingTest");
+	params[2].type = BUXTON_TYPE_STRING;
+	params[2].store.d_string.value = name;
+	params[2].store.d_string.length = (uint32_t)strlen(name) + 1;
+
+	switch (tc->d) {
+		case TEST_INT32:
+			params[3].type = BUXTON_TYPE_INT32;
+			params[3].store.d_int32 = -672;
+			break;
+		case TEST_UINT32:
+			params[3].type = BUXTON_TYPE_UINT32;
+			params[3].store.d_uint32 = 672;
+			break;
+		case TEST_INT64:
+			params[3].type = BUXTON_TYPE_INT64;
+			params[3].store.d_int64 = -672 * 672;
+			break;
+		case TEST_UINT64:
+			params[3].type = BUXTON_TYPE_UINT64;
+			params[3].store.d_uint64 = 672 * 672;
+			break;
+		case TEST_BOOLEAN:
+			params[3].type = BUXTON_TYPE_BOOLEAN;
+			params[3].store.d_boolean = true;
+			break;
+		case TEST_STRING:
+			params[3].type = BUXTON_TYPE_STRING;
+			params[3].store.d_string = buxton_string_pack("672");
+			break;
+		case TEST_STRING4K:
+			memset(string4k, 'a', sizeof(string4k) - 1);
+			params[3].type = BUXTON_TYPE_STRING;
+			params[3].store.d_string.value = string4k;
+			params[3].store.d_string.length = sizeof(string4k);
+			break;
+		case TEST_FLOAT:
+			params[3].type = BUXTON_TYPE_FLOAT;
+			params[3].store.d_float = (float)3.14;
+			break;
+		case TEST_DOUBLE:
+			params[3].type = BUXTON_TYPE_DOUBLE;
+			params[3].store.d_double = 3.14;
+			break;
+		default:
+			abort();
+	}
+}
+
+/*
+ * Compare the wire encodings of a set testcase's message, without a
+ * daemon. Version 2 is measured once its string tables hold the key,
+ * as on a connection past its first message.
+ */
+static void wire_test(struct testcase *tc)
+{
+	BuxtonStringTable encode, decode;
+	BuxtonControlMessage msg;
+	BuxtonData params[4];
+	BuxtonData *view = NULL;
+	BuxtonArray *list;
+	size_t view_size = 0;
+	uint8_t *v1 = NULL, *v2 = NULL, *tmp;
+	size_t v1_size, v2_size;
+	unsigned long long start, ns[5];
+	unsigned long long errors = 0;
+	char name[64];
+	uint32_t msgid;
+	int i;
+
+	memzero(&encode, sizeof(BuxtonStringTable));
+	memzero(&decode, sizeof(BuxtonStringTable));
+	wire_params(tc, params, name);
+	list = buxton_array_new();
+	if (!list) {
+		abort();
+	}
+	for (i = 0; i < 4; i++) {
+		if (!buxton_array_add(list, &params[i])) {
+			abort();
+		}
+	}
+
+	v1_size = buxton_serialize_message(&v1, BUXTON_CONTROL_SET, 0, list);
+	v2_size = buxton_serialize_message_v2(&v2, BUXTON_CONTROL_SET, 0, list,
+					      &encode);
+	if (!v1_size || !v2_size ||
+	    buxton_deserialize_message_view(v2, &msg, v2_size, &msgid, &view,
+					    &view_size, &decode) != 4) {
+		error("%s: failed to encode\n", tc->name);
+		goto end;
+	}
+	free(v2);
+	v2_size = buxton_serialize_message_v2(&v2, BUXTON_CONTROL_SET, 0, list,
+					      &encode);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (buxton_serialize_message(&tmp, BUXTON_CONTROL_SET,
+					     (uint32_t)i, list)) {
+			free(tmp);
+		}
+	}
+	ns[0] = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (buxton_serialize_message_v2(&tmp, BUXTON_CONTROL_SET,
+						(uint32_t)i, list, &encode)) {
+			free(tmp);
+		}
+	}
+	ns[1] = now_ns() - start;
+
+	/* What a connection does, messages are built in version 1 */
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (buxton_transcode_message_v2(v1, v1_size, &encode, &tmp)) {
+			free(tmp);
+		}
+	}
+	ns[2] = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (buxton_deserialize_message_view(v1, &msg, v1_size, &msgid,
+						    &view, &view_size, NULL) != 4) {
+			errors++;
+		}
+	}
+	ns[3] = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		if (buxton_deserialize_message_view(v2, &msg, v2_size, &msgid,
+						    &view, &view_size,
+						    &decode) != 4) {
+			errors++;
+		}
+	}
+	ns[4] = now_ns() - start;
+
+	printf("%-20s  %6zu  %6zu  %8.1lf  %8.1lf  %8.1lf  %8.1lf  %8.1lf  %6llu\n",
+	       tc->name, v1_size, v2_size,
+	       (double)ns[0] / iterations, (double)ns[1] / iterations,
+	       (double)ns[2] / iterations, (double)ns[3] / iterations,
+	       (double)ns[4] / iterations, errors);
+
+end:
+	buxton_string_table_free(&encode);
+	buxton_string_table_free(&decode);
+	buxton_array_free(&list, NULL);
+	free(view);
+	free(v1);
+	free(v2);
+}
+
+static void wire_tests(void)
+{
+	printf("Buxton wire encoding timing. Using %i iterations per test.\n",
+	       iterations);
+	printf("Test Name:             v1 B:   v2 B:  v1 enc:  v2 enc:  v1->v2:"
+	       "  v1 dec:  v2 dec:  Errors:\n");
+
+	for (int i = 0; i < TEST_COUNT; i++) {
+		if (testcases[i].t == TEST_SET) {
+			wire_test(&testcases[i]);
+		}
+	}
+}
+
 int main(int argc, char **argv)
 {
 	int ret = EXIT_SUCCESS;
+	bool wire = false;
 	int i;
 
+	if (argc > 1 && streq(argv[1], "--wire")) {
+		wire = true;
+		argc--;
+		argv++;
+	}
 	if (argc == 2) {
 		iterations = atoi(argv[1]);
 		if (iterations <= 0) {
 			exit(EXIT_FAILURE);
 		}
 	} else if (argc != 1) {
-		error("Usage: %s [iterations]\n", argv[0]);
+		error("Usage: %s [--wire] [iterations]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
+	if (wire) {
+		wire_tests();
+		exit(ret);
+	}
+
 	if (!buxton_open(&__client)) {
 		error("Unable to open BuxtonClient\n");
 		exit(EXIT_FAILURE);
@@ -0,0 +1,248 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Measures how long buxtond takes to answer a request while a growing
+ * number of idle clients stay connected. Every idle client is a plain
+ * socket that never sends anything, so any growth in latency is the
+ * cost the daemon pays per wakeup for connections that are not ready.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "buxton.h"
+#include "configurator.h"
+#include "log.h"
+#include "util.h"
+
+#define error(...) { printf(__VA_ARGS__); }
+
+#define WARMUP_ITERATIONS 1000
+
+static int iterations = 10000;
+static int idle_counts[] = { 10, 100, 1000, 5000 };
+
+static BuxtonClient __client;
+static BuxtonKey __key;
+
+static void callback(BuxtonResponse response, void *userdata)
+{
+	bool *r;
+
+	if (!userdata) {
+		return;
+	}
+
+	r = (bool *)userdata;
+
+	if (buxton_response_status(response) == 0) {
+		*r = true;
+	}
+}
+
+static bool init_key(void)
+{
+	BuxtonKey group;
+	bool d = false;
+	int32_t value = 672;
+	char name[64];
+
+	group = buxton_key_create("WakeupTest", NULL, "user", BUXTON_TYPE_STRING);
+	if (!group) {
+		return false;
+	}
+	/* the group may already exist from an earlier run */
+	if (buxton_create_group(__client, group, callback, NULL, true)) {
+		buxton_debug("Unable to create group\n");
+	}
+	buxton_key_free(group);
+
+	sprintf(name, "WakeupTest-%d", getpid());
+	__key = buxton_key_create("WakeupTest", name, "user", BUXTON_TYPE_INT32);
+	if (!__key) {
+		return false;
+	}
+
+	return (!buxton_set_value(__client, __key, &value, callback, &d, true) && d);
+}
+
+static int connect_idle(void)
+{
+	struct sockaddr_un remote;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	memzero(&remote, sizeof(remote));
+	remote.sun_family = AF_UNIX;
+	strncpy(remote.sun_path, buxton_socket(), sizeof(remote.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&remote, sizeof(remote)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool timed_get(unsigned long long *elapsed)
+{
+	struct timespec tsi, tsf;
+	bool d = false;
+	int r;
+
+	clock_gettime(CLOCK_MONOTONIC, &tsi);
+	r = buxton_get_value(__client, __key, callback, &d, true);
+	clock_gettime(CLOCK_MONOTONIC, &tsf);
+
+	*elapsed = (unsigned long long)((tsf.tv_nsec - tsi.tv_nsec) + ((tsf.tv_sec - tsi.tv_sec) * 1000000000));
+	return (!r && d);
+}
+
+static void test(int *idle, int *nidle, int target)
+{
+	unsigned long long elapsed;
+	unsigned long long errors = 0;
+	double meansqr = 0.0;
+	double mean = 0.0;
+	double sigma;
+	int fd;
+	int i;
+
+	while (*nidle < target) {
+		fd = connect_idle();
+		if (fd < 0) {
+			error("Only %d idle clients could connect: %s\n", *nidle,
+			      strerror(errno));
+			break;
+		}
+		idle[(*nidle)++] = fd;
+	}
+
+	/* let buxtond accept every pending connection first */
+	for (i = 0; i < WARMUP_ITERATIONS; i++) {
+		(void)timed_get(&elapsed);
+	}
+
+	for (i = 0; i < iterations; i++) {
+		if (!timed_get(&elapsed)) {
+			errors++;
+		}
+
+		mean += (double)elapsed;
+		meansqr += (double)elapsed * (double)elapsed;
+	}
+	mean /= (double)iterations;
+	meansqr /= (double)iterations;
+	sigma = sqrt(meansqr - (mean * mean));
+
+	printf("%-14d  %10.3lfus  %10.3lfus  %10llu\n",
+	       *nidle, mean / 1000.0, sigma / 1000.0, errors);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit rl;
+	int *idle;
+	int nidle = 0;
+	size_t count = sizeof(idle_counts) / sizeof(idle_counts[0]);
+	bool d = false;
+
+	if (argc == 2) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			exit(EXIT_FAILURE);
+		}
+	} else if (argc != 1) {
+		error("Usage: %s [iterations]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* the idle clients need more descriptors than the usual default */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	idle = malloc0(sizeof(int) * (size_t)idle_counts[count - 1]);
+	if (!idle) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (!buxton_open(&__client)) {
+		error("Unable to open BuxtonClient\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!init_key()) {
+		error("Unable to set up test key\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("Buxton wakeup latency with idle clients. Using %i iterations per test.\n", iterations);
+	printf("Idle clients:      Average:        Sigma:     Errors:\n");
+
+	for (size_t i = 0; i < count; i++) {
+		test(idle, &nidle, idle_counts[i]);
+	}
+
+	for (int i = 0; i < nidle; i++) {
+		close(idle[i]);
+	}
+	free(idle);
+
+	if (buxton_unset_value(__client, __key, callback, &d, true) || !d) {
+		error("Unable to remove test key\n");
+	}
+	buxton_key_free(__key);
+	buxton_close(__client);
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
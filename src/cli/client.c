@@ -675,8 +675,8 @@ void free_data_in_array(void *item)
 
 bool get_list_names(BuxtonControl *control, char *layer, char *group, char *prefix, struct nameslist *list)
 {
-	uint16_t index;
-	uint16_t count;
+	uint32_t index;
+	uint32_t count;
 	BuxtonString slayer;
 	BuxtonString sgroup;
 	BuxtonString sprefix;
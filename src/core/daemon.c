@@ -18,14 +18,45 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <attr/xattr.h>
 
 #include "daemon.h"
 #include "direct.h"
 #include "log.h"
+#include "smack.h"
 #include "util.h"
 #include "buxtonlist.h"
 
+/**
+ * Largest number of queued messages handed to a single writev()
+ */
+#define FLUSH_IOV_MAX 64
+
+/**
+ * Initial number of slots in a client's output ring
+ */
+#define OUTPUT_RING_MIN 8
+
+/**
+ * Bytes of a streamed list chunk after which it is sent. A name that
+ * fits in a chunk on its own always fits in a message with the rest.
+ */
+#define STREAM_CHUNK_LENGTH (BUXTON_MESSAGE_MAX_LENGTH / 2)
+
+static void notify_clients(BuxtonDaemon *self, _BuxtonKey *key,
+			   const char *key_name, BuxtonData *value,
+			   BuxtonString *label);
+static int read_unset_label(BuxtonDaemon *self, _BuxtonKey *key,
+			    BuxtonString *label);
+static void notify_unset(BuxtonDaemon *self, _BuxtonKey *key,
+			 BuxtonString *label);
+static void subscribe(BuxtonDaemon *self, client_list_item *client,
+		      _BuxtonKey *key, const char *key_name, uint32_t msgid,
+		      uint32_t interval, int32_t *status);
+
 static char *notify_key_name(_BuxtonKey *key)
 {
 	int r;
@@ -41,6 +72,23 @@ static char *notify_key_name(_BuxtonKey *key)
 	return result;
 }
 
+/* Prefix subscriptions on a group are stored under "group\n" */
+static char *notify_prefix_name(_BuxtonKey *key)
+{
+	int r;
+	char *result;
+
+	if (!key->group.value || !*key->group.value)
+		return NULL;
+
+	r = asprintf(&result, "%s\n%s", key->group.value,
+		     key->name.value ? key->name.value : "");
+	if (r == -1) {
+		abort();
+	}
+	return result;
+}
+
 bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		_BuxtonKey *key, BuxtonData **value)
 {
@@ -171,6 +219,17 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		key->group = list[1].store.d_string;
 		key->name = list[2].store.d_string;
 		break;
+	case BUXTON_CONTROL_GET_GROUP:
+		if (count != 2) {
+			return false;
+		}
+		if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING) {
+			return false;
+		}
+		key->type = BUXTON_TYPE_STRING;
+		key->layer = list[0].store.d_string;
+		key->group = list[1].store.d_string;
+		break;
 	case BUXTON_CONTROL_UNSET:
 		if (count != 4) {
 			return false;
@@ -185,13 +244,20 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		key->type = list[3].store.d_uint32;
 		break;
 	case BUXTON_CONTROL_NOTIFY:
-		if (count != 3) {
+		if (count != 3 && count != 4) {
 			return false;
 		}
 		if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING ||
 		    list[2].type != BUXTON_TYPE_UINT32) {
 			return false;
 		}
+		/* Optional minimum interval in ms between notifications */
+		if (count == 4) {
+			if (list[3].type != BUXTON_TYPE_UINT32) {
+				return false;
+			}
+			*value = &(list[3]);
+		}
 		key->group = list[0].store.d_string;
 		key->name = list[1].store.d_string;
 		key->type = list[2].store.d_uint32;
@@ -208,6 +274,18 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 		key->name = list[1].store.d_string;
 		key->type = list[2].store.d_uint32;
 		break;
+	case BUXTON_CONTROL_NOTIFY_PREFIX:
+	case BUXTON_CONTROL_UNNOTIFY_PREFIX:
+		if (count != 2) {
+			return false;
+		}
+		if (list[0].type != BUXTON_TYPE_STRING || list[1].type != BUXTON_TYPE_STRING) {
+			return false;
+		}
+		key->type = BUXTON_TYPE_UNSET;
+		key->group = list[0].store.d_string;
+		key->name = list[1].store.d_string;
+		break;
 	default:
 		return false;
 	}
@@ -215,91 +293,80 @@ bool parse_list(BuxtonControlMessage msg, size_t count, BuxtonData *list,
 	return true;
 }
 
-bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t size)
-{
+/**
+ * A single request taken from a BATCH message
+ */
+typedef struct BatchRequest {
 	BuxtonControlMessage msg;
-	int32_t response;
-	BuxtonData *list = NULL;
-	_cleanup_buxton_data_ BuxtonData *data = NULL;
-	uint16_t i;
-	ssize_t p_count;
-	size_t response_len;
-	BuxtonData response_data, mdata;
-	BuxtonData *value = NULL;
-	_BuxtonKey key = {{0}, {0}, {0}, 0};
-	BuxtonArray *out_list = NULL, *key_list = NULL;
+	_BuxtonKey key;
+	BuxtonData *value;
+	BuxtonData *data;
+	BuxtonData d_count;
+	BuxtonData d_response;
+	BuxtonString label; /**<Label of an unset key, read before unsetting it */
+	int label_status; /**<-1 unless the label was read, then the result */
+} BatchRequest;
+
+/*
+ * Every request is parsed before any of them runs, so a malformed batch
+ * is refused as a whole like any other invalid message. The requests
+ * then run in order and each one's reply is framed by its parameter
+ * count in a single STATUS message.
+ */
+static bool handle_batch(BuxtonDaemon *self, client_list_item *client,
+			 BuxtonData *list, size_t count, uint32_t msgid)
+{
+	_cleanup_free_ BatchRequest *reqs = NULL;
 	_cleanup_free_ uint8_t *response_store = NULL;
-	uid_t uid;
+	BuxtonArray *out_list = NULL;
+	BuxtonData response_data;
+	BatchRequest *req;
+	size_t n_reqs = 0;
+	size_t response_len;
+	size_t pos = 0;
+	size_t n;
 	bool ret = false;
-	uint32_t msgid = 0;
-	uint32_t n_msgid = 0;
-
-	assert(self);
-	assert(client);
 
-	uid = self->buxton.client.uid;
-	p_count = buxton_deserialize_message((uint8_t*)client->data, &msg, size,
-					     &msgid, &list);
-	if (p_count < 0) {
-		if (errno == ENOMEM) {
-			abort();
-		}
-		/* Todo: terminate the client due to invalid message */
-		buxton_debug("Failed to deserialize message\n");
-		goto end;
+	if (count < 2) {
+		return false;
 	}
 
-	/* Check valid range */
-	if (msg <= BUXTON_CONTROL_MIN || msg >= BUXTON_CONTROL_MAX) {
-		goto end;
+	reqs = malloc0(sizeof(BatchRequest) * (count / 2));
+	if (!reqs) {
+		abort();
 	}
 
-	if (!parse_list(msg, (size_t)p_count, list, &key, &value)) {
-		goto end;
+	while (pos < count) {
+		req = &reqs[n_reqs];
+		if (count - pos < 2 || list[pos].type != BUXTON_TYPE_UINT32 ||
+		    list[pos + 1].type != BUXTON_TYPE_UINT32) {
+			return false;
+		}
+		req->msg = list[pos].store.d_uint32;
+		req->label_status = -1;
+		n = list[pos + 1].store.d_uint32;
+		pos += 2;
+		if (n > count - pos) {
+			return false;
+		}
+		switch (req->msg) {
+		case BUXTON_CONTROL_GET:
+		case BUXTON_CONTROL_SET:
+		case BUXTON_CONTROL_UNSET:
+		case BUXTON_CONTROL_GET_LABEL:
+			break;
+		default:
+			return false;
+		}
+		if (!parse_list(req->msg, n, &list[pos], &req->key, &req->value)) {
+			return false;
+		}
+		pos += n;
+		n_reqs++;
 	}
 
-	/* use internal function from buxtond */
-	switch (msg) {
-	case BUXTON_CONTROL_SET:
-		set_value(self, client, &key, value, &response);
-		break;
-	case BUXTON_CONTROL_SET_LABEL:
-		set_label(self, client, &key, value, &response);
-		break;
-	case BUXTON_CONTROL_CREATE_GROUP:
-		create_group(self, client, &key, &response);
-		break;
-	case BUXTON_CONTROL_REMOVE_GROUP:
-		remove_group(self, client, &key, &response);
-		break;
-	case BUXTON_CONTROL_GET:
-		data = get_value(self, client, &key, &response);
-		break;
-	case BUXTON_CONTROL_GET_LABEL:
-		data = get_label(self, client, &key, &response);
-		break;
-	case BUXTON_CONTROL_UNSET:
-		unset_value(self, client, &key, &response);
-		break;
-	case BUXTON_CONTROL_LIST:
-		key_list = list_keys(self, client, &value->store.d_string,
-				     &response);
-		break;
-	case BUXTON_CONTROL_LIST_NAMES:
-		key_list = list_names(self, client, &key, &response);
-		break;
-	case BUXTON_CONTROL_NOTIFY:
-		register_notification(self, client, &key, msgid, &response);
-		break;
-	case BUXTON_CONTROL_UNNOTIFY:
-		n_msgid = unregister_notification(self, client, &key, &response);
-		break;
-	default:
-		goto end;
-	}
-	/* Set a response code */
 	response_data.type = BUXTON_TYPE_INT32;
-	response_data.store.d_int32 = response;
+	response_data.store.d_int32 = 0;
 	out_list = buxton_array_new();
 	if (!out_list) {
 		abort();
@@ -308,102 +375,961 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 		abort();
 	}
 
+	for (size_t i = 0; i < n_reqs; i++) {
+		int32_t response = -1;
 
-	switch (msg) {
-		/* TODO: Use cascading switch */
-	case BUXTON_CONTROL_SET:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize set response message\n");
-			abort();
+		req = &reqs[i];
+		switch (req->msg) {
+		case BUXTON_CONTROL_GET:
+			req->data = get_value(self, client, &req->key, &response);
+			break;
+		case BUXTON_CONTROL_SET:
+			set_value(self, client, &req->key, req->value, &response);
+			break;
+		case BUXTON_CONTROL_UNSET:
+			req->label_status = read_unset_label(self, &req->key,
+							     &req->label);
+			unset_value(self, client, &req->key, &response);
+			break;
+		case BUXTON_CONTROL_GET_LABEL:
+			req->data = get_label(self, client, &req->key, &response);
+			break;
+		default:
+			assert(0);
 		}
-		break;
-	case BUXTON_CONTROL_SET_LABEL:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize set_label response message\n");
-			abort();
+		if (response != 0) {
+			response_data.store.d_int32 = -1;
 		}
-		break;
-	case BUXTON_CONTROL_CREATE_GROUP:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize create_group response message\n");
+
+		req->d_count.type = BUXTON_TYPE_UINT32;
+		req->d_count.store.d_uint32 = req->data ? 2 : 1;
+		req->d_response.type = BUXTON_TYPE_INT32;
+		req->d_response.store.d_int32 = response;
+		if (!buxton_array_add(out_list, &req->d_count) ||
+		    !buxton_array_add(out_list, &req->d_response)) {
 			abort();
 		}
-		break;
-	case BUXTON_CONTROL_REMOVE_GROUP:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize remove_group response message\n");
+		if (req->data && !buxton_array_add(out_list, req->data)) {
 			abort();
 		}
-		break;
-	case BUXTON_CONTROL_GET:
-		if (data && !buxton_array_add(out_list, data)) {
+	}
+
+	response_len = buxton_serialize_message(&response_store,
+						BUXTON_CONTROL_STATUS,
+						msgid, out_list);
+	if (response_len == 0) {
+		if (errno == ENOMEM) {
 			abort();
 		}
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize get response message\n");
+		buxton_log("Failed to serialize batch response message\n");
+		abort();
+	}
+
+	/* The client can't read a reply this big, only report failure */
+	if (response_len > BUXTON_MESSAGE_MAX_LENGTH) {
+		buxton_log("Batch response too large for client %d\n", client->fd);
+		free(response_store);
+		response_store = NULL;
+		buxton_array_free(&out_list, NULL);
+		response_data.store.d_int32 = -1;
+		out_list = buxton_array_new();
+		if (!out_list) {
 			abort();
 		}
-		break;
-	case BUXTON_CONTROL_GET_LABEL:
-		if (data && !buxton_array_add(out_list, data)) {
+		if (!buxton_array_add(out_list, &response_data)) {
 			abort();
 		}
 		response_len = buxton_serialize_message(&response_store,
 							BUXTON_CONTROL_STATUS,
 							msgid, out_list);
 		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
+			abort();
+		}
+	}
+
+	ret = queue_message(self, client, response_store, response_len, false);
+	response_store = NULL;
+
+	for (size_t i = 0; i < n_reqs; i++) {
+		req = &reqs[i];
+		if (ret && req->d_response.store.d_int32 == 0) {
+			if (req->msg == BUXTON_CONTROL_SET) {
+				buxtond_notify_clients(self, client, &req->key,
+						       req->value);
+			} else if (req->msg == BUXTON_CONTROL_UNSET) {
+				notify_unset(self, &req->key,
+					     req->label_status ? NULL : &req->label);
 			}
-			buxton_log("Failed to serialize get_label response message\n");
+		}
+		free(req->label.value);
+		free_buxton_data(&req->data);
+	}
+	buxton_array_free(&out_list, NULL);
+
+	return ret;
+}
+
+/*
+ * Agree on the highest protocol version both sides speak. The reply is
+ * still sent in version 1, the client switches once it has read it.
+ */
+static bool handle_hello(BuxtonDaemon *self, client_list_item *client,
+			 BuxtonData *list, size_t count, uint32_t msgid)
+{
+	BuxtonArray *out_list;
+	BuxtonData status, version;
+	uint8_t *response_store = NULL;
+	size_t response_len;
+	bool ret;
+
+	status.type = BUXTON_TYPE_INT32;
+	status.store.d_int32 = 0;
+	version.type = BUXTON_TYPE_UINT32;
+	version.store.d_uint32 = 1;
+
+	/* The version may only be agreed on once */
+	if (client->version || count != 1 ||
+	    list[0].type != BUXTON_TYPE_UINT32 ||
+	    list[0].store.d_uint32 < 1) {
+		status.store.d_int32 = -1;
+	} else if (list[0].store.d_uint32 < BUXTON_PROTOCOL_VERSION) {
+		version.store.d_uint32 = list[0].store.d_uint32;
+	} else {
+		version.store.d_uint32 = BUXTON_PROTOCOL_VERSION;
+	}
+
+	out_list = buxton_array_new();
+	if (!out_list) {
+		abort();
+	}
+	if (!buxton_array_add(out_list, &status) ||
+	    !buxton_array_add(out_list, &version)) {
+		abort();
+	}
+	response_len = buxton_serialize_message(&response_store,
+						BUXTON_CONTROL_STATUS,
+						msgid, out_list);
+	buxton_array_free(&out_list, NULL);
+	if (response_len == 0) {
+		abort();
+	}
+
+	ret = queue_message(self, client, response_store, response_len, false);
+	if (ret && status.store.d_int32 == 0) {
+		client->version = version.store.d_uint32;
+		buxton_debug("Client %d speaks protocol version %u\n",
+			     client->fd, client->version);
+	}
+
+	return ret;
+}
+
+/*
+ * The key is sent as for GET and copied once, with its notification
+ * name. The reply is the status followed by the handle, the index of
+ * the key plus one, so 0 is never a valid handle.
+ */
+static bool handle_register_key(BuxtonDaemon *self, client_list_item *client,
+				BuxtonData *list, size_t count, uint32_t msgid)
+{
+	BuxtonArray *out_list;
+	BuxtonData status, handle;
+	BuxtonKeyHandle *h;
+	BuxtonData *value = NULL;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	uint8_t *response_store = NULL;
+	size_t response_len;
+
+	status.type = BUXTON_TYPE_INT32;
+	status.store.d_int32 = -1;
+	handle.type = BUXTON_TYPE_UINT32;
+	handle.store.d_uint32 = 0;
+
+	if (parse_list(BUXTON_CONTROL_GET, count, list, &key, &value) &&
+	    key.type > BUXTON_TYPE_MIN && key.type < BUXTON_TYPE_MAX &&
+	    client->n_handles < BUXTON_MAX_KEY_HANDLES) {
+		if (!greedy_realloc((void **)&client->handles,
+				    &client->handles_alloc,
+				    sizeof(BuxtonKeyHandle) *
+				    (client->n_handles + 1))) {
 			abort();
 		}
-		break;
-	case BUXTON_CONTROL_UNSET:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
+		h = &client->handles[client->n_handles];
+		memzero(h, sizeof(BuxtonKeyHandle));
+		h->name = notify_key_name(&key);
+		if (h->name) {
+			if (!buxton_key_copy(&key, &h->key)) {
 				abort();
 			}
-			buxton_log("Failed to serialize unset response message\n");
-			abort();
+			client->n_handles++;
+			status.store.d_int32 = 0;
+			handle.store.d_uint32 = client->n_handles;
 		}
-		break;
-	case BUXTON_CONTROL_LIST:
-		if (key_list) {
-			for (i = 0; i < key_list->len; i++) {
+	}
+
+	out_list = buxton_array_new();
+	if (!out_list) {
+		abort();
+	}
+	if (!buxton_array_add(out_list, &status) ||
+	    !buxton_array_add(out_list, &handle)) {
+		abort();
+	}
+	response_len = buxton_serialize_message(&response_store,
+						BUXTON_CONTROL_STATUS,
+						msgid, out_list);
+	buxton_array_free(&out_list, NULL);
+	if (response_len == 0) {
+		abort();
+	}
+
+	return queue_message(self, client, response_store, response_len, false);
+}
+
+/*
+ * Turn a message addressed by handle into the GET, SET or NOTIFY it
+ * stands for, with the key the handle was registered with. The key's
+ * strings belong to the handle and must not be freed.
+ */
+static bool parse_handle(client_list_item *client, BuxtonControlMessage *msg,
+			 size_t count, BuxtonData *list, _BuxtonKey *key,
+			 BuxtonData **value, const char **key_name)
+{
+	BuxtonKeyHandle *h;
+
+	if (count < 1 || list[0].type != BUXTON_TYPE_UINT32 ||
+	    list[0].store.d_uint32 == 0 ||
+	    list[0].store.d_uint32 > client->n_handles) {
+		return false;
+	}
+	h = &client->handles[list[0].store.d_uint32 - 1];
+
+	switch (*msg) {
+	case BUXTON_CONTROL_GET_HANDLE:
+		if (count != 1) {
+			return false;
+		}
+		*key = h->key;
+		*msg = BUXTON_CONTROL_GET;
+		break;
+	case BUXTON_CONTROL_SET_HANDLE:
+		if (count != 2 || !h->key.layer.value ||
+		    list[1].type != h->key.type) {
+			return false;
+		}
+		*key = h->key;
+		*value = &list[1];
+		*msg = BUXTON_CONTROL_SET;
+		break;
+	case BUXTON_CONTROL_NOTIFY_HANDLE:
+		if (count == 2) {
+			if (list[1].type != BUXTON_TYPE_UINT32) {
+				return false;
+			}
+			*value = &list[1];
+		} else if (count != 1) {
+			return false;
+		}
+		/* Notifications are for a key in any layer */
+		*key = h->key;
+		key->layer.value = NULL;
+		key->layer.length = 0;
+		*msg = BUXTON_CONTROL_NOTIFY;
+		break;
+	default:
+		return false;
+	}
+	*key_name = h->name;
+
+	return true;
+}
+
+/*
+ * Every key is sent as its layer, group, name and type. The reply is
+ * the overall status followed by each key's status, and its value when
+ * the status is 0, in a single STATUS message.
+ */
+static bool handle_get_values(BuxtonDaemon *self, client_list_item *client,
+			      BuxtonData *list, size_t count, uint32_t msgid)
+{
+	_cleanup_free_ _BuxtonKey *keys = NULL;
+	_cleanup_free_ BuxtonData *data = NULL;
+	_cleanup_free_ int32_t *status = NULL;
+	_cleanup_free_ BuxtonData *d_status = NULL;
+	_cleanup_free_ uint8_t *response_store = NULL;
+	BuxtonArray *out_list = NULL;
+	BuxtonData response_data;
+	BuxtonData *d;
+	size_t n_keys;
+	size_t response_len;
+	bool ret;
+
+	if (count == 0 || count % 4 != 0) {
+		return false;
+	}
+	n_keys = count / 4;
+
+	keys = malloc0(sizeof(_BuxtonKey) * n_keys);
+	data = malloc0(sizeof(BuxtonData) * n_keys);
+	status = malloc0(sizeof(int32_t) * n_keys);
+	d_status = malloc0(sizeof(BuxtonData) * n_keys);
+	if (!keys || !data || !status || !d_status) {
+		abort();
+	}
+
+	for (size_t i = 0; i < n_keys; i++) {
+		d = &list[4 * i];
+		if (d[0].type != BUXTON_TYPE_STRING ||
+		    d[1].type != BUXTON_TYPE_STRING ||
+		    d[2].type != BUXTON_TYPE_STRING ||
+		    d[3].type != BUXTON_TYPE_UINT32) {
+			return false;
+		}
+		if (!d[1].store.d_string.value || !d[2].store.d_string.value) {
+			return false;
+		}
+		keys[i].layer = d[0].store.d_string;
+		keys[i].group = d[1].store.d_string;
+		keys[i].name = d[2].store.d_string;
+		keys[i].type = d[3].store.d_uint32;
+	}
+
+	buxton_debug("Daemon getting %zu values\n", n_keys);
+	self->buxton.client.uid = client->cred.uid;
+	buxton_direct_get_values(&self->buxton, keys, n_keys, data, status,
+				 client->smack_label);
+
+	response_data.type = BUXTON_TYPE_INT32;
+	response_data.store.d_int32 = 0;
+	out_list = buxton_array_new();
+	if (!out_list) {
+		abort();
+	}
+	if (!buxton_array_add(out_list, &response_data)) {
+		abort();
+	}
+
+	for (size_t i = 0; i < n_keys; i++) {
+		if (status[i] != 0) {
+			response_data.store.d_int32 = -1;
+			status[i] = -1;
+		}
+		d_status[i].type = BUXTON_TYPE_INT32;
+		d_status[i].store.d_int32 = status[i];
+		if (!buxton_array_add(out_list, &d_status[i])) {
+			abort();
+		}
+		if (status[i] == 0 && !buxton_array_add(out_list, &data[i])) {
+			abort();
+		}
+	}
+
+	response_len = buxton_serialize_message(&response_store,
+						BUXTON_CONTROL_STATUS,
+						msgid, out_list);
+	if (response_len == 0) {
+		if (errno == ENOMEM) {
+			abort();
+		}
+		buxton_log("Failed to serialize get_values response message\n");
+		abort();
+	}
+
+	/* The client can't read a reply this big, only report failure */
+	if (response_len > BUXTON_MESSAGE_MAX_LENGTH) {
+		buxton_log("Get values response too large for client %d\n",
+			   client->fd);
+		free(response_store);
+		response_store = NULL;
+		buxton_array_free(&out_list, NULL);
+		response_data.store.d_int32 = -1;
+		out_list = buxton_array_new();
+		if (!out_list) {
+			abort();
+		}
+		if (!buxton_array_add(out_list, &response_data)) {
+			abort();
+		}
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			abort();
+		}
+	}
+
+	ret = queue_message(self, client, response_store, response_len, false);
+	response_store = NULL;
+
+	for (size_t i = 0; i < n_keys; i++) {
+		if (status[i] == 0 && data[i].type == BUXTON_TYPE_STRING) {
+			free(data[i].store.d_string.value);
+		}
+	}
+	buxton_array_free(&out_list, NULL);
+
+	return ret;
+}
+
+/*
+ * Replies that can't be serialized or read by the client fall back to
+ * a bare failure status
+ */
+static size_t serialize_failure(uint8_t **dest, uint32_t msgid)
+{
+	BuxtonArray *out_list;
+	BuxtonData status;
+	size_t len;
+
+	status.type = BUXTON_TYPE_INT32;
+	status.store.d_int32 = -1;
+	out_list = buxton_array_new();
+	if (!out_list || !buxton_array_add(out_list, &status)) {
+		abort();
+	}
+	len = buxton_serialize_message(dest, BUXTON_CONTROL_STATUS, msgid,
+				       out_list);
+	buxton_array_free(&out_list, NULL);
+	if (len == 0) {
+		abort();
+	}
+	return len;
+}
+
+/**
+ * Names of a streamed list read since the last chunk was sent
+ */
+typedef struct NameChunk {
+	BuxtonDaemon *self; /**<buxtond instance being run */
+	client_list_item *client; /**<Client the list is sent to */
+	BuxtonData status; /**<First value of every message of the stream */
+	BuxtonArray *list; /**<The status, then owned copies of the names */
+	size_t bytes; /**<Serialized size of the message so far */
+	bool failed; /**<A name was too long to be sent */
+	bool closed; /**<The client is being disconnected */
+} NameChunk;
+
+static void chunk_reset(NameChunk *chunk)
+{
+	for (uint32_t i = 1; i < chunk->list->len; i++) {
+		data_free(buxton_array_get(chunk->list, i));
+	}
+	chunk->list->len = 1;
+	chunk->bytes = BUXTON_MESSAGE_HEADER_LENGTH + sizeof(uint16_t) +
+		sizeof(uint32_t) + sizeof(int32_t);
+}
+
+static bool chunk_send(NameChunk *chunk, BuxtonControlMessage type)
+{
+	uint8_t *response_store = NULL;
+	size_t response_len;
+
+	response_len = buxton_serialize_message(&response_store, type,
+						chunk->client->stream->msgid,
+						chunk->list);
+	if (response_len == 0) {
+		abort();
+	}
+	chunk_reset(chunk);
+	return queue_message(chunk->self, chunk->client, response_store,
+			     response_len, false);
+}
+
+/*
+ * A chunk is sent once it holds half a message worth of names, and the
+ * scan stops there if the client's output had to be queued, leaving
+ * the backend's cursor after the name just added
+ */
+static bool stream_name(BuxtonString *name, void *user_data)
+{
+	NameChunk *chunk = user_data;
+	BuxtonData *data;
+	size_t size;
+
+	size = sizeof(uint16_t) + sizeof(uint32_t) + name->length;
+	if (size > STREAM_CHUNK_LENGTH) {
+		chunk->failed = true;
+		return false;
+	}
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+	data->type = BUXTON_TYPE_STRING;
+	if (!buxton_string_copy(name, &data->store.d_string) ||
+	    !buxton_array_add(chunk->list, data)) {
+		abort();
+	}
+	chunk->bytes += size;
+	if (chunk->bytes < STREAM_CHUNK_LENGTH &&
+	    chunk->list->len < BUXTON_MESSAGE_MAX_PARAMS) {
+		return true;
+	}
+
+	if (!chunk_send(chunk, BUXTON_CONTROL_CHUNK)) {
+		chunk->closed = true;
+		return false;
+	}
+	return chunk->client->out_count == 0;
+}
+
+static void free_stream(client_list_item *client)
+{
+	BuxtonNameStream *stream = client->stream;
+
+	if (!stream) {
+		return;
+	}
+	free(stream->key.layer.value);
+	free(stream->key.group.value);
+	free(stream->key.name.value);
+	free(stream->cursor.value);
+	free(stream->held.value);
+	free(stream);
+	client->stream = NULL;
+}
+
+static bool hold_name(BuxtonString *name, void *user_data)
+{
+	BuxtonNameStream *stream = user_data;
+
+	if (!buxton_string_copy(name, &stream->held)) {
+		abort();
+	}
+	return false;
+}
+
+/*
+ * Scans resume after the key they stopped at, which must still exist.
+ * Before a key, or a group with all its keys, is removed, streams
+ * stopped there move on to the next name they list and send it first.
+ * A held name is that of the cursor, so it goes if the cursor does.
+ */
+static void move_streams(BuxtonDaemon *self, client_list_item *client,
+			 _BuxtonKey *key)
+{
+	BuxtonNameStream *stream;
+	BuxtonLayer *layer;
+	client_list_item *cl;
+	uint32_t len;
+	uid_t uid;
+	int r;
+
+	layer = hashmap_get(self->buxton.config.layers, key->layer.value);
+	if (!layer) {
+		return;
+	}
+	len = key->group.length + (key->name.value ? key->name.length : 0);
+
+	LIST_FOREACH(item, cl, self->client_list) {
+		stream = cl->stream;
+		if (!stream || !stream->cursor.value ||
+		    !streq(stream->key.layer.value, key->layer.value) ||
+		    (layer->type == LAYER_USER &&
+		     cl->cred.uid != client->cred.uid)) {
+			continue;
+		}
+		/* Keys are stored as "group\0name\0" */
+		if (stream->cursor.length < len ||
+		    memcmp(stream->cursor.value, key->group.value,
+			   key->group.length) ||
+		    (key->name.value &&
+		     (stream->cursor.length != len ||
+		      memcmp(stream->cursor.value + key->group.length,
+			     key->name.value, key->name.length)))) {
+			continue;
+		}
+
+		free(stream->held.value);
+		stream->held.value = NULL;
+		stream->held.length = 0;
+
+		/* Whatever the stream has left goes with the group */
+		if (!key->name.value && stream->key.group.value &&
+		    streq(stream->key.group.value, key->group.value)) {
+			free(stream->cursor.value);
+			stream->cursor.value = NULL;
+			stream->cursor.length = 0;
+			stream->done = true;
+			continue;
+		}
+
+		uid = self->buxton.client.uid;
+		self->buxton.client.uid = cl->cred.uid;
+		r = buxton_direct_scan_names(&self->buxton, &stream->key.layer,
+					     &stream->key.group,
+					     &stream->key.name,
+					     &stream->cursor, hold_name, stream);
+		self->buxton.client.uid = uid;
+		if (r) {
+			buxton_debug("Failed to move list of client %d past a removed key\n",
+				     cl->fd);
+		} else if (!stream->cursor.value) {
+			stream->done = true;
+		}
+	}
+}
+
+bool buxtond_continue_stream(BuxtonDaemon *self, client_list_item *client)
+{
+	BuxtonNameStream *stream;
+	NameChunk chunk;
+	uid_t uid;
+	int r = 0;
+	bool more = true;
+	bool ret;
+
+	assert(self);
+	assert(client);
+
+	stream = client->stream;
+	if (!stream) {
+		return true;
+	}
+
+	memzero(&chunk, sizeof(NameChunk));
+	chunk.self = self;
+	chunk.client = client;
+	chunk.status.type = BUXTON_TYPE_INT32;
+	chunk.status.store.d_int32 = 0;
+	chunk.list = buxton_array_new();
+	if (!chunk.list || !buxton_array_add(chunk.list, &chunk.status)) {
+		abort();
+	}
+	chunk_reset(&chunk);
+
+	if (stream->held.value) {
+		more = stream_name(&stream->held, &chunk);
+		free(stream->held.value);
+		stream->held.value = NULL;
+		stream->held.length = 0;
+	}
+
+	if (more && !stream->done) {
+		uid = self->buxton.client.uid;
+		self->buxton.client.uid = client->cred.uid;
+		r = buxton_direct_scan_names(&self->buxton, &stream->key.layer,
+					     &stream->key.group,
+					     &stream->key.name,
+					     &stream->cursor, stream_name,
+					     &chunk);
+		self->buxton.client.uid = uid;
+	}
+
+	if (chunk.closed) {
+		ret = false;
+		goto end;
+	}
+	/* Paused until the client reads what was queued */
+	if (!r && !chunk.failed && (!more || stream->cursor.value)) {
+		buxton_array_free(&chunk.list, NULL);
+		return true;
+	}
+
+	/* The final status ends the stream with the names left */
+	if (r || chunk.failed) {
+		buxton_debug("Failed to list names for client %d\n",
+			     client->fd);
+		chunk_reset(&chunk);
+		chunk.status.store.d_int32 = -1;
+	}
+	ret = chunk_send(&chunk, BUXTON_CONTROL_STATUS);
+
+end:
+	chunk_reset(&chunk);
+	buxton_array_free(&chunk.list, NULL);
+	free_stream(client);
+	return ret;
+}
+
+/*
+ * Clients speaking version 3 get the names as they are read, in CHUNK
+ * messages ended by the usual STATUS, so no reply outgrows a message
+ */
+static bool stream_list_names(BuxtonDaemon *self, client_list_item *client,
+			      _BuxtonKey *key, uint32_t msgid)
+{
+	BuxtonNameStream *stream;
+	uint8_t *response_store = NULL;
+	size_t response_len;
+
+	/* Requests aren't read while a stream waits, so this is a bug */
+	if (client->stream) {
+		buxton_log("Client %d already has a list streamed\n",
+			   client->fd);
+		response_len = serialize_failure(&response_store, msgid);
+		return queue_message(self, client, response_store,
+				     response_len, false);
+	}
+
+	stream = malloc0(sizeof(BuxtonNameStream));
+	if (!stream) {
+		abort();
+	}
+	if ((key->layer.length &&
+	     !buxton_string_copy(&key->layer, &stream->key.layer)) ||
+	    (key->group.length &&
+	     !buxton_string_copy(&key->group, &stream->key.group)) ||
+	    (key->name.length &&
+	     !buxton_string_copy(&key->name, &stream->key.name))) {
+		abort();
+	}
+	stream->msgid = msgid;
+	client->stream = stream;
+
+	return buxtond_continue_stream(self, client);
+}
+
+bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t size)
+{
+	BuxtonControlMessage msg;
+	int32_t response;
+	BuxtonData *list = NULL;
+	_cleanup_buxton_data_ BuxtonData *data = NULL;
+	uint32_t i;
+	ssize_t p_count;
+	size_t response_len;
+	BuxtonData response_data, mdata;
+	BuxtonData *value = NULL;
+	_BuxtonKey key = {{0}, {0}, {0}, 0};
+	BuxtonArray *out_list = NULL, *key_list = NULL;
+	_cleanup_free_ uint8_t *response_store = NULL;
+	uid_t uid;
+	bool ret = false;
+	uint32_t msgid = 0;
+	uint32_t n_msgid = 0;
+	const char *key_name = NULL;
+	BuxtonString label = { NULL, 0 };
+	int label_status = -1;
+
+	assert(self);
+	assert(client);
+
+	uid = self->buxton.client.uid;
+	/* Strings of the list point into client->data, left untouched here */
+	p_count = buxton_deserialize_message_view((uint8_t*)client->data, &msg,
+						  size, &msgid, &self->params,
+						  &self->params_size,
+						  client->version >= 2 ?
+						  &client->decode : NULL);
+	if (p_count < 0) {
+		if (errno == ENOMEM) {
+			abort();
+		}
+		/* Todo: terminate the client due to invalid message */
+		buxton_debug("Failed to deserialize message\n");
+		goto end;
+	}
+	list = p_count ? self->params : NULL;
+
+	/* Check valid range */
+	if (msg <= BUXTON_CONTROL_MIN || msg >= BUXTON_CONTROL_MAX) {
+		goto end;
+	}
+
+	if (msg == BUXTON_CONTROL_BATCH) {
+		ret = handle_batch(self, client, list, (size_t)p_count, msgid);
+		goto end;
+	}
+
+	if (msg == BUXTON_CONTROL_GET_VALUES) {
+		ret = handle_get_values(self, client, list, (size_t)p_count,
+					msgid);
+		goto end;
+	}
+
+	if (msg == BUXTON_CONTROL_HELLO) {
+		ret = handle_hello(self, client, list, (size_t)p_count, msgid);
+		goto end;
+	}
+
+	if (msg == BUXTON_CONTROL_REGISTER_KEY) {
+		ret = handle_register_key(self, client, list, (size_t)p_count,
+					  msgid);
+		goto end;
+	}
+
+	if (msg == BUXTON_CONTROL_GET_HANDLE ||
+	    msg == BUXTON_CONTROL_SET_HANDLE ||
+	    msg == BUXTON_CONTROL_NOTIFY_HANDLE) {
+		if (!parse_handle(client, &msg, (size_t)p_count, list, &key,
+				  &value, &key_name)) {
+			goto end;
+		}
+	} else if (!parse_list(msg, (size_t)p_count, list, &key, &value)) {
+		goto end;
+	}
+
+	/* use internal function from buxtond */
+	switch (msg) {
+	case BUXTON_CONTROL_SET:
+		set_value(self, client, &key, value, &response);
+		break;
+	case BUXTON_CONTROL_SET_LABEL:
+		set_label(self, client, &key, value, &response);
+		break;
+	case BUXTON_CONTROL_CREATE_GROUP:
+		create_group(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_REMOVE_GROUP:
+		remove_group(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_GET:
+		data = get_value(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_GET_LABEL:
+		data = get_label(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_UNSET:
+		label_status = read_unset_label(self, &key, &label);
+		unset_value(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_LIST:
+		key_list = list_keys(self, client, &value->store.d_string,
+				     &response);
+		break;
+	case BUXTON_CONTROL_LIST_NAMES:
+		if (client->version >= 3) {
+			ret = stream_list_names(self, client, &key, msgid);
+			goto end;
+		}
+		key_list = list_names(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_GET_GROUP:
+		key_list = get_group_values(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_NOTIFY:
+		if (key_name) {
+			subscribe(self, client, &key, key_name, msgid,
+				  value ? value->store.d_uint32 : 0, &response);
+		} else {
+			register_notification(self, client, &key, msgid,
+					      value ? value->store.d_uint32 : 0,
+					      &response);
+		}
+		break;
+	case BUXTON_CONTROL_UNNOTIFY:
+		n_msgid = unregister_notification(self, client, &key, &response);
+		break;
+	case BUXTON_CONTROL_NOTIFY_PREFIX:
+		register_prefix_notification(self, client, &key, msgid,
+					     &response);
+		break;
+	case BUXTON_CONTROL_UNNOTIFY_PREFIX:
+		n_msgid = unregister_prefix_notification(self, client, &key,
+							 &response);
+		break;
+	default:
+		goto end;
+	}
+	/* Set a response code */
+	response_data.type = BUXTON_TYPE_INT32;
+	response_data.store.d_int32 = response;
+	out_list = buxton_array_new();
+	if (!out_list) {
+		abort();
+	}
+	if (!buxton_array_add(out_list, &response_data)) {
+		abort();
+	}
+
+
+	switch (msg) {
+		/* TODO: Use cascading switch */
+	case BUXTON_CONTROL_SET:
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize set response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_SET_LABEL:
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize set_label response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_CREATE_GROUP:
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize create_group response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_REMOVE_GROUP:
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize remove_group response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_GET:
+		if (data && !buxton_array_add(out_list, data)) {
+			abort();
+		}
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize get response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_GET_LABEL:
+		if (data && !buxton_array_add(out_list, data)) {
+			abort();
+		}
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize get_label response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_UNSET:
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize unset response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_LIST:
+		if (key_list) {
+			for (i = 0; i < key_list->len; i++) {
 				if (!buxton_array_add(out_list, buxton_array_get(key_list, i))) {
 					abort();
 				}
@@ -428,7 +1354,80 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 					abort();
 				}
 			}
-			buxton_array_free(&key_list, NULL);
+		}
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0 && errno == ENOMEM) {
+			abort();
+		}
+		/* Older clients can't take the names in chunks */
+		if (response_len == 0 ||
+		    response_len > BUXTON_MESSAGE_MAX_LENGTH) {
+			buxton_log("List of names too long for client %d\n",
+				   client->fd);
+			free(response_store);
+			response_store = NULL;
+			response_len = serialize_failure(&response_store, msgid);
+		}
+		buxton_array_free(&key_list, (buxton_free_func)data_free);
+		break;
+	case BUXTON_CONTROL_GET_GROUP:
+		if (key_list) {
+			for (i = 0; i < key_list->len; i++) {
+				if (!buxton_array_add(out_list, buxton_array_get(key_list, i))) {
+					abort();
+				}
+			}
+		}
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize get group response message\n");
+			abort();
+		}
+		/* The client can't read a reply this big, only report failure */
+		if (response_len > BUXTON_MESSAGE_MAX_LENGTH) {
+			free(response_store);
+			response_store = NULL;
+			response_len = serialize_failure(&response_store, msgid);
+		}
+		buxton_array_free(&key_list, (buxton_free_func)data_free);
+		break;
+	case BUXTON_CONTROL_NOTIFY:
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize notify response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_NOTIFY_PREFIX:
+		response_len = buxton_serialize_message(&response_store,
+							BUXTON_CONTROL_STATUS,
+							msgid, out_list);
+		if (response_len == 0) {
+			if (errno == ENOMEM) {
+				abort();
+			}
+			buxton_log("Failed to serialize notify prefix response message\n");
+			abort();
+		}
+		break;
+	case BUXTON_CONTROL_UNNOTIFY:
+	case BUXTON_CONTROL_UNNOTIFY_PREFIX:
+		mdata.type = BUXTON_TYPE_UINT32;
+		mdata.store.d_uint32 = n_msgid;
+		if (!buxton_array_add(out_list, &mdata)) {
+			abort();
 		}
 		response_len = buxton_serialize_message(&response_store,
 							BUXTON_CONTROL_STATUS,
@@ -437,79 +1436,456 @@ bool buxtond_handle_message(BuxtonDaemon *self, client_list_item *client, size_t
 			if (errno == ENOMEM) {
 				abort();
 			}
-			buxton_log("Failed to serialize list names response message\n");
+			buxton_log("Failed to serialize unnotify response message\n");
+			abort();
+		}
+		break;
+	default:
+		goto end;
+	}
+
+	/* Now send the response, the queue owns the buffer from here on */
+	ret = queue_message(self, client, response_store, response_len, false);
+	response_store = NULL;
+	if (ret) {
+		if (msg == BUXTON_CONTROL_SET && response == 0 && key_name) {
+			notify_clients(self, &key, key_name, value, NULL);
+		} else if (msg == BUXTON_CONTROL_SET && response == 0) {
+			buxtond_notify_clients(self, client, &key, value);
+		} else if (msg == BUXTON_CONTROL_UNSET && response == 0) {
+			notify_unset(self, &key, label_status ? NULL : &label);
+		} else if ((msg == BUXTON_CONTROL_REMOVE_GROUP ||
+			    msg == BUXTON_CONTROL_SET_LABEL) && response == 0) {
+			buxtond_notify_group(self, &key);
+		}
+	}
+
+end:
+	/* Restore our own UID */
+	self->buxton.client.uid = uid;
+	free(label.value);
+	if (out_list) {
+		buxton_array_free(&out_list, NULL);
+	}
+	return ret;
+}
+
+/**
+ * A CHANGED message serialized once per change in each encoding, with
+ * message ID 0. Version 2 strings are all sent in full, as the frame
+ * is shared by subscribers whose string tables differ.
+ */
+typedef struct ChangedFrame {
+	uint8_t *v1; /**<Message in version 1, NULL until built */
+	size_t v1_len; /**<Size of v1 */
+	uint8_t *v2; /**<Message in version 2 */
+	size_t v2_len; /**<Size of v2 */
+} ChangedFrame;
+
+/**
+ * A change being sent to the prefix subscribers of a key
+ */
+typedef struct PrefixChange {
+	BuxtonDaemon *self; /**<buxtond instance being run */
+	_BuxtonKey *key; /**<Changed key */
+	BuxtonData *value; /**<New value, NULL if the key was unset */
+	BuxtonString label; /**<Label of the key once it has been read */
+	int label_status; /**<-1 until read, then the result of reading it */
+	ChangedFrame frame; /**<CHANGED message once built */
+} PrefixChange;
+
+static int read_key_label(BuxtonDaemon *self, _BuxtonKey *key,
+			  BuxtonString *label)
+{
+	BuxtonData data;
+	int ret;
+
+	memzero(&data, sizeof(BuxtonData));
+	ret = buxton_direct_get_value_for_layer(&self->buxton, key, &data,
+						label, NULL);
+	if (!ret && data.type == BUXTON_TYPE_STRING) {
+		free(data.store.d_string.value);
+	}
+	return ret;
+}
+
+/*
+ * An unset key can't be read once it is gone, so its label is read
+ * before unsetting it, and only if a prefix subscriber may be told.
+ * Returns -1 when nobody subscribes to a prefix of the key.
+ */
+static int read_unset_label(BuxtonDaemon *self, _BuxtonKey *key,
+			    BuxtonString *label)
+{
+	_cleanup_free_ char *key_name = NULL;
+
+	if (!self->notify_prefixes ||
+	    !buxton_trie_count(self->notify_prefixes)) {
+		return -1;
+	}
+
+	key_name = notify_key_name(key);
+	if (!key_name ||
+	    !buxton_trie_match_prefix(self->notify_prefixes, key_name)) {
+		return -1;
+	}
+
+	return read_key_label(self, key, label);
+}
+
+/*
+ * Subscribers were allowed to read the group when they registered,
+ * but keys within it carry their own labels. The label is read once
+ * per change, and only if a subscriber needs checking. Without the
+ * label of an unset key, nobody who needs checking is told.
+ */
+static bool may_read_change(PrefixChange *change, client_list_item *client)
+{
+	if (!client->smack_label) {
+		return true;
+	}
+
+	if (change->label_status == -1) {
+		change->label_status = read_key_label(change->self, change->key,
+						      &change->label);
+	}
+	if (change->label_status) {
+		return false;
+	}
+	if (!change->label.value) {
+		return true;
+	}
+
+	return buxton_check_smack_access(client->smack_label, &change->label,
+					 ACCESS_READ);
+}
+
+static bool queue_output(BuxtonDaemon *self, client_list_item *cl,
+			 uint8_t *data, size_t size, bool notification,
+			 bool transcode);
+
+/**
+ * Serialize a CHANGED message once per change, subscribers get copies
+ * carrying their own message ID
+ * @param out_list Parameters of the message
+ * @param frame Set to the message in both encodings
+ */
+static void build_changed_frame(BuxtonArray *out_list, ChangedFrame *frame)
+{
+	frame->v1_len = buxton_serialize_message(&frame->v1,
+						 BUXTON_CONTROL_CHANGED, 0,
+						 out_list);
+	frame->v2_len = buxton_serialize_message_v2(&frame->v2,
+						    BUXTON_CONTROL_CHANGED, 0,
+						    out_list, NULL);
+	if (frame->v1_len == 0 || frame->v2_len == 0) {
+		buxton_log("Failed to serialize notification\n");
+		abort();
+	}
+}
+
+static void free_changed_frame(ChangedFrame *frame)
+{
+	free(frame->v1);
+	free(frame->v2);
+}
+
+/* Copying the frame is all a subscriber costs, it is never encoded again */
+static void send_changed(BuxtonDaemon *self, client_list_item *cl,
+			 ChangedFrame *frame, uint32_t msgid)
+{
+	uint8_t *response;
+	size_t size;
+
+	if (cl->version >= 2) {
+		response = buxton_copy_message(frame->v2, frame->v2_len, msgid);
+		size = frame->v2_len;
+	} else {
+		response = buxton_copy_message(frame->v1, frame->v1_len, msgid);
+		size = frame->v1_len;
+	}
+
+	/* A slow subscriber only delays or loses its own notifications */
+	(void)queue_output(self, cl, response, size, true, false);
+}
+
+static void notify_prefix_client(void *item, void *user_data)
+{
+	BuxtonNotification *nitem = item;
+	PrefixChange *change = user_data;
+	BuxtonArray *out_list = NULL;
+	BuxtonData d_group, d_name;
+
+	if (!may_read_change(change, nitem->client)) {
+		return;
+	}
+
+	/* The subscriber can't tell which key changed from the msgid alone */
+	if (!change->frame.v1) {
+		buxton_string_to_data(&change->key->group, &d_group);
+		buxton_string_to_data(&change->key->name, &d_name);
+		out_list = buxton_array_new();
+		if (!out_list) {
+			abort();
+		}
+		if (!buxton_array_add(out_list, &d_group) ||
+		    !buxton_array_add(out_list, &d_name)) {
+			abort();
+		}
+		if (change->value && !buxton_array_add(out_list, change->value)) {
+			abort();
+		}
+		build_changed_frame(out_list, &change->frame);
+		buxton_array_free(&out_list, NULL);
+	}
+
+	buxton_debug("Notification to %d of key change (%s:%s)\n",
+		     nitem->client->fd, change->key->group.value,
+		     change->key->name.value);
+
+	send_changed(change->self, nitem->client, &change->frame,
+		     nitem->msgid);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Fires the timer at due ms, or disarms it when due is 0 */
+static void set_timer(BuxtonDaemon *self, uint64_t due)
+{
+	struct itimerspec its;
+
+	self->timer_due = due;
+	if (!self->timer) {
+		return;
+	}
+
+	memzero(&its, sizeof(struct itimerspec));
+	its.it_value.tv_sec = (time_t)(due / 1000);
+	its.it_value.tv_nsec = (long)(due % 1000) * 1000000;
+	if (timerfd_settime(self->timer->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		buxton_log("timerfd_settime(): %m\n");
+	}
+}
+
+static void add_pending(BuxtonDaemon *self, BuxtonNotification *nitem)
+{
+	LIST_PREPEND(BuxtonNotification, due, self->pending, nitem);
+	nitem->pending = true;
+	if (!self->timer_due || nitem->next < self->timer_due) {
+		set_timer(self, nitem->next);
+	}
+}
+
+void buxtond_send_pending(BuxtonDaemon *self)
+{
+	BuxtonNotification *nitem, *next;
+	BuxtonArray *out_list;
+	uint8_t *response;
+	size_t response_len;
+	uint64_t now;
+	uint64_t due = 0;
+
+	assert(self);
+
+	now = now_ms();
+	LIST_FOREACH_SAFE(due, nitem, next, self->pending) {
+		if (nitem->next > now) {
+			if (!due || nitem->next < due) {
+				due = nitem->next;
+			}
+			continue;
+		}
+
+		/* Only the latest value is sent, however many changes waited */
+		LIST_REMOVE(BuxtonNotification, due, self->pending, nitem);
+		nitem->pending = false;
+		nitem->next = now + nitem->interval;
+		nitem->version = nitem->watch->version;
+
+		out_list = buxton_array_new();
+		if (!out_list) {
+			abort();
+		}
+		if (nitem->watch->value) {
+			if (!buxton_array_add(out_list, nitem->watch->value)) {
+				abort();
+			}
+		}
+		/* Sent to a single client, so encoded for it alone */
+		response = NULL;
+		if (nitem->client->version >= 2) {
+			response_len = buxton_serialize_message_v2(&response,
+								   BUXTON_CONTROL_CHANGED,
+								   nitem->msgid,
+								   out_list,
+								   NULL);
+		} else {
+			response_len = buxton_serialize_message(&response,
+								BUXTON_CONTROL_CHANGED,
+								nitem->msgid,
+								out_list);
+		}
+		buxton_array_free(&out_list, NULL);
+		if (response_len == 0) {
+			buxton_log("Failed to serialize pending notification\n");
 			abort();
 		}
-		break;
-	case BUXTON_CONTROL_NOTIFY:
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize notify response message\n");
-			abort();
+		buxton_debug("Pending notification to %d\n", nitem->client->fd);
+
+		(void)queue_output(self, nitem->client, response,
+				   response_len, true, false);
+	}
+
+	set_timer(self, due);
+}
+
+/* Values of different types never compare equal, nor do set and unset */
+static bool same_value(BuxtonData *a, BuxtonData *b)
+{
+	if (!a || !b) {
+		return a == b;
+	}
+	if (a->type != b->type) {
+		return false;
+	}
+
+	switch (a->type) {
+	case BUXTON_TYPE_STRING:
+		if (a->store.d_string.length != b->store.d_string.length) {
+			return false;
+		}
+		return memcmp(a->store.d_string.value, b->store.d_string.value,
+			      a->store.d_string.length) == 0;
+	case BUXTON_TYPE_INT32:
+		return a->store.d_int32 == b->store.d_int32;
+	case BUXTON_TYPE_UINT32:
+		return a->store.d_uint32 == b->store.d_uint32;
+	case BUXTON_TYPE_INT64:
+		return a->store.d_int64 == b->store.d_int64;
+	case BUXTON_TYPE_UINT64:
+		return a->store.d_uint64 == b->store.d_uint64;
+	case BUXTON_TYPE_FLOAT:
+		return memcmp(&a->store.d_float, &b->store.d_float,
+			      sizeof(float)) == 0;
+	case BUXTON_TYPE_DOUBLE:
+		return memcmp(&a->store.d_double, &b->store.d_double,
+			      sizeof(double)) == 0;
+	case BUXTON_TYPE_BOOLEAN:
+		return a->store.d_boolean == b->store.d_boolean;
+	default:
+		buxton_log("Internal state corruption: Notification data type invalid\n");
+		abort();
+	}
+}
+
+/*
+ * label is that of an unset key, read before unsetting it, and stays
+ * owned by the caller. NULL if it is unknown or the key was set.
+ */
+static void notify_clients(BuxtonDaemon *self, _BuxtonKey *key,
+			   const char *key_name, BuxtonData *value,
+			   BuxtonString *label)
+{
+	BuxtonWatch *watch;
+	BuxtonNotification *nitem;
+	uint64_t now = 0;
+	ChangedFrame frame = { NULL, 0, NULL, 0 };
+	BuxtonArray *out_list = NULL;
+
+	/* Every prefix of "group\nname" is walked once, whatever the count */
+	if (self->notify_prefixes) {
+		PrefixChange change = { self, key, value, { NULL, 0 }, -1,
+					{ NULL, 0, NULL, 0 } };
+
+		if (label) {
+			change.label = *label;
+			change.label_status = 0;
+		}
+		(void)buxton_trie_foreach_prefix(self->notify_prefixes, key_name,
+						 notify_prefix_client, &change);
+		if (!label) {
+			free(change.label.value);
 		}
-		break;
-	case BUXTON_CONTROL_UNNOTIFY:
-		mdata.type = BUXTON_TYPE_UINT32;
-		mdata.store.d_uint32 = n_msgid;
-		if (!buxton_array_add(out_list, &mdata)) {
+		free_changed_frame(&change.frame);
+	}
+
+	watch = hashmap_get(self->notify_mapping, key_name);
+	if (!watch || same_value(watch->value, value)) {
+		return;
+	}
+
+	/* One copy of the value per key, however many subscribers */
+	free_buxton_data(&watch->value);
+	watch->value = NULL;
+	if (value) {
+		watch->value = malloc0(sizeof(BuxtonData));
+		if (!watch->value) {
 			abort();
 		}
-		response_len = buxton_serialize_message(&response_store,
-							BUXTON_CONTROL_STATUS,
-							msgid, out_list);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize unnotify response message\n");
+		if (!buxton_data_copy(value, watch->value)) {
 			abort();
 		}
-		break;
-	default:
-		goto end;
 	}
+	watch->version++;
 
-	/* Now write the response */
-	ret = _write(client->fd, response_store, response_len);
-	if (ret) {
-		if (msg == BUXTON_CONTROL_SET && response == 0) {
-			buxtond_notify_clients(self, client, &key, value);
-		} else if (msg == BUXTON_CONTROL_UNSET && response == 0) {
-			buxtond_notify_clients(self, client, &key, NULL);
+	LIST_FOREACH(subscriber, nitem, watch->subscribers) {
+		if (nitem->version == watch->version) {
+			continue;
 		}
-	}
 
-end:
-	/* Restore our own UID */
-	self->buxton.client.uid = uid;
-	if (out_list) {
-		buxton_array_free(&out_list, NULL);
-	}
-	if (list) {
-		for (i=0; i < p_count; i++) {
-			if (list[i].type == BUXTON_TYPE_STRING) {
-				free(list[i].store.d_string.value);
+		/* Within its interval a subscriber only gets the latest change */
+		if (nitem->interval) {
+			if (!now) {
+				now = now_ms();
+			}
+			if (nitem->pending) {
+				nitem->client->coalesced++;
+				buxton_debug("Coalesced notification to %d (%" PRIu64 " so far)\n",
+					     nitem->client->fd, nitem->client->coalesced);
+				continue;
+			}
+			if (now < nitem->next) {
+				add_pending(self, nitem);
+				continue;
+			}
+			nitem->next = now + nitem->interval;
+		}
+		nitem->version = watch->version;
+
+		/* Only the message ID differs between subscribers */
+		if (!frame.v1) {
+			out_list = buxton_array_new();
+			if (!out_list) {
+				abort();
+			}
+			if (value) {
+				if (!buxton_array_add(out_list, value)) {
+					abort();
+				}
 			}
+			build_changed_frame(out_list, &frame);
+			buxton_array_free(&out_list, NULL);
 		}
-		free(list);
+
+		buxton_debug("Notification to %d of key change (%s)\n", nitem->client->fd,
+			     key_name);
+		send_changed(self, nitem->client, &frame, nitem->msgid);
 	}
-	return ret;
+
+	free_changed_frame(&frame);
 }
 
 void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 			      _BuxtonKey *key, BuxtonData *value)
 {
-	BuxtonList *list = NULL;
-	BuxtonList *elem = NULL;
-	BuxtonNotification *nitem;
-	_cleanup_free_ uint8_t* response = NULL;
-	size_t response_len;
-	BuxtonArray *out_list = NULL;
 	_cleanup_free_ char *key_name;
 
 	assert(self);
@@ -520,111 +1896,78 @@ void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 	if (!key_name) {
 		return;
 	}
-	list = hashmap_get(self->notify_mapping, key_name);
-	if (!list) {
+
+	notify_clients(self, key, key_name, value, NULL);
+}
+
+/*
+ * Removing a group or changing a label touches keys nobody is told of
+ * one by one, so the subscribers of the group drop all they know of it.
+ * The change carries no value, so it isn't checked against any label.
+ */
+void buxtond_notify_group(BuxtonDaemon *self, _BuxtonKey *key)
+{
+	_BuxtonKey group = { {0}, {0}, {0}, 0};
+	_cleanup_free_ char *prefix = NULL;
+	ChangedFrame frame = { NULL, 0, NULL, 0 };
+	BuxtonArray *out_list;
+	BuxtonString name = buxton_string_pack("");
+	BuxtonData d_group, d_name;
+	BuxtonNotification *nitem;
+	BuxtonList *subscribers, *elem;
+
+	assert(self);
+	assert(key);
+
+	if (!self->notify_prefixes ||
+	    !buxton_trie_count(self->notify_prefixes)) {
 		return;
 	}
 
-	BUXTON_LIST_FOREACH(list, elem) {
-		nitem = elem->data;
-		int c = 1;
-		__attribute__((unused)) bool unused;
-		free(response);
-		response = NULL;
-
-		if (nitem->old_data && value) {
-			switch (value->type) {
-			case BUXTON_TYPE_STRING:
-				c = memcmp((const void *)
-					   (nitem->old_data->store.d_string.value),
-					   (const void *)(value->store.d_string.value),
-					   value->store.d_string.length);
-				break;
-			case BUXTON_TYPE_INT32:
-				c = memcmp((const void *)&(nitem->old_data->store.d_int32),
-					   (const void *)&(value->store.d_int32),
-					   sizeof(int32_t));
-				break;
-			case BUXTON_TYPE_UINT32:
-				c = memcmp((const void *)&(nitem->old_data->store.d_uint32),
-					   (const void *)&(value->store.d_uint32),
-					   sizeof(uint32_t));
-				break;
-			case BUXTON_TYPE_INT64:
-				c = memcmp((const void *)&(nitem->old_data->store.d_int64),
-					   (const void *)&(value->store.d_int64),
-					   sizeof(int64_t));
-				break;
-			case BUXTON_TYPE_UINT64:
-				c = memcmp((const void *)&(nitem->old_data->store.d_uint64),
-					   (const void *)&(value->store.d_uint64),
-					   sizeof(uint64_t));
-				break;
-			case BUXTON_TYPE_FLOAT:
-				c = memcmp((const void *)&(nitem->old_data->store.d_float),
-					   (const void *)&(value->store.d_float),
-					   sizeof(float));
-				break;
-			case BUXTON_TYPE_DOUBLE:
-				c = memcmp((const void *)&(nitem->old_data->store.d_double),
-					   (const void *)&(value->store.d_double),
-					   sizeof(double));
-				break;
-			case BUXTON_TYPE_BOOLEAN:
-				c = memcmp((const void *)&(nitem->old_data->store.d_boolean),
-					   (const void *)&(value->store.d_boolean),
-					   sizeof(bool));
-				break;
-			default:
-				buxton_log("Internal state corruption: Notification data type invalid\n");
-				abort();
-			}
-		}
+	group.group = key->group;
+	prefix = notify_prefix_name(&group);
+	if (!prefix) {
+		return;
+	}
+	subscribers = buxton_trie_get(self->notify_prefixes, prefix);
+	if (!subscribers) {
+		return;
+	}
 
-		if (!c) {
-			continue;
-		}
-		if (nitem->old_data && (nitem->old_data->type == BUXTON_TYPE_STRING)) {
-			free(nitem->old_data->store.d_string.value);
-		}
-		free(nitem->old_data);
+	buxton_string_to_data(&key->group, &d_group);
+	buxton_string_to_data(&name, &d_name);
+	out_list = buxton_array_new();
+	if (!out_list) {
+		abort();
+	}
+	if (!buxton_array_add(out_list, &d_group) ||
+	    !buxton_array_add(out_list, &d_name)) {
+		abort();
+	}
+	build_changed_frame(out_list, &frame);
+	buxton_array_free(&out_list, NULL);
 
-		nitem->old_data = malloc0(sizeof(BuxtonData));
-		if (!nitem->old_data) {
-			abort();
-		}
-		if (value) {
-			if (!buxton_data_copy(value, nitem->old_data)) {
-				abort();
-			}
-		}
+	BUXTON_LIST_FOREACH(subscribers, elem) {
+		nitem = elem->data;
+		buxton_debug("Notification to %d of group change (%s)\n",
+			     nitem->client->fd, key->group.value);
+		send_changed(self, nitem->client, &frame, nitem->msgid);
+	}
 
-		out_list = buxton_array_new();
-		if (!out_list) {
-			abort();
-		}
-		if (value) {
-			if (!buxton_array_add(out_list, value)) {
-				abort();
-			}
-		}
+	free_changed_frame(&frame);
+}
 
-		response_len = buxton_serialize_message(&response,
-							BUXTON_CONTROL_CHANGED,
-							nitem->msgid, out_list);
-		buxton_array_free(&out_list, NULL);
-		if (response_len == 0) {
-			if (errno == ENOMEM) {
-				abort();
-			}
-			buxton_log("Failed to serialize notification\n");
-			abort();
-		}
-		buxton_debug("Notification to %d of key change (%s)\n", nitem->client->fd,
-			     key_name);
+static void notify_unset(BuxtonDaemon *self, _BuxtonKey *key,
+			 BuxtonString *label)
+{
+	_cleanup_free_ char *key_name = NULL;
 
-		unused = _write(nitem->client->fd, response, response_len);
+	key_name = notify_key_name(key);
+	if (!key_name) {
+		return;
 	}
+
+	notify_clients(self, key, key_name, NULL, label);
 }
 
 void set_value(BuxtonDaemon *self, client_list_item *client, _BuxtonKey *key,
@@ -722,6 +2065,7 @@ void remove_group(BuxtonDaemon *self, client_list_item *client, _BuxtonKey *key,
 		     key->group.value);
 
 	self->buxton.client.uid = client->cred.uid;
+	move_streams(self, client, key);
 
 	/* Use internal library to create group */
 	if (!buxton_direct_remove_group(&self->buxton, key, client->smack_label)) {
@@ -749,6 +2093,7 @@ void unset_value(BuxtonDaemon *self, client_list_item *client,
 
 	/* Use internal library to unset value */
 	self->buxton.client.uid = client->cred.uid;
+	move_streams(self, client, key);
 	if (!buxton_direct_unset_value(&self->buxton, key, client->smack_label)) {
 		return;
 	}
@@ -854,215 +2199,365 @@ fail:
 	data = NULL;
 end:
 
-	return data;
+	return data;
+}
+
+BuxtonArray *list_keys(BuxtonDaemon *self, client_list_item *client,
+		       BuxtonString *layer, int32_t *status)
+{
+	BuxtonArray *ret_list = NULL;
+	assert(self);
+	assert(client);
+	assert(layer);
+	assert(status);
+
+	*status = -1;
+	if (buxton_direct_list_keys(&self->buxton, layer, &ret_list)) {
+		*status = 0;
+	}
+	return ret_list;
+}
+
+BuxtonArray *list_names(BuxtonDaemon *self,  client_list_item *client,
+			_BuxtonKey *key, int32_t *status)
+{
+	BuxtonArray *ret_list = NULL;
+	assert(self);
+	assert(client);
+	assert(status);
+
+	*status = -1;
+	if (buxton_direct_list_names(&self->buxton, &key->layer, &key->group,
+	    &key->name, &ret_list)) {
+		*status = 0;
+	}
+	return ret_list;
+}
+
+BuxtonArray *get_group_values(BuxtonDaemon *self, client_list_item *client,
+			      _BuxtonKey *key, int32_t *status)
+{
+	BuxtonArray *ret_list = NULL;
+
+	assert(self);
+	assert(client);
+	assert(key);
+	assert(status);
+
+	*status = -1;
+
+	buxton_debug("Daemon getting group [%s][%s]\n", key->layer.value,
+		     key->group.value);
+	self->buxton.client.uid = client->cred.uid;
+	if (buxton_direct_get_group(&self->buxton, key, client->smack_label,
+				    &ret_list) == 0) {
+		*status = 0;
+	}
+	return ret_list;
+}
+
+/* The group and name of a watch, in one allocation */
+static void watch_key(BuxtonWatch *watch, _BuxtonKey *key)
+{
+	char *bytes;
+
+	bytes = malloc(key->group.length + key->name.length);
+	if (!bytes) {
+		abort();
+	}
+	memcpy(bytes, key->group.value, key->group.length);
+	memcpy(bytes + key->group.length, key->name.value, key->name.length);
+	watch->key.group = (BuxtonString){ bytes, key->group.length };
+	watch->key.name = (BuxtonString){ bytes + key->group.length,
+					  key->name.length };
+	watch->key.type = BUXTON_TYPE_UNSET;
+}
+
+static void subscribe(BuxtonDaemon *self, client_list_item *client,
+		      _BuxtonKey *key, const char *key_name, uint32_t msgid,
+		      uint32_t interval, int32_t *status)
+{
+	BuxtonWatch *watch;
+	BuxtonNotification *nitem;
+	BuxtonData *value = NULL;
+	int32_t key_status;
+
+	*status = -1;
+
+	/* Also checks the client may read the key */
+	value = get_value(self, client, key, &key_status);
+	if (key_status != 0) {
+		return;
+	}
+
+	/* The first subscriber's read starts the key's last value */
+	watch = hashmap_get(self->notify_mapping, key_name);
+	if (!watch) {
+		watch = malloc0(sizeof(BuxtonWatch));
+		if (!watch) {
+			abort();
+		}
+		watch->name = strdup(key_name);
+		if (!watch->name) {
+			abort();
+		}
+		watch_key(watch, key);
+		watch->value = value;
+		if (hashmap_put(self->notify_mapping, watch->name, watch) < 0) {
+			abort();
+		}
+	} else {
+		free_buxton_data(&value);
+	}
+
+	nitem = malloc0(sizeof(BuxtonNotification));
+	if (!nitem) {
+		abort();
+	}
+	nitem->client = client;
+	nitem->watch = watch;
+	nitem->version = watch->version;
+	nitem->interval = interval;
+	nitem->msgid = msgid;
+	LIST_PREPEND(BuxtonNotification, subscriber, watch->subscribers, nitem);
+	LIST_PREPEND(BuxtonNotification, subscription, client->subscriptions,
+		     nitem);
+
+	/* A key registered twice is unregistered newest first */
+	if (!client->watched) {
+		client->watched = hashmap_new(key_hash_func, key_compare_func);
+		if (!client->watched) {
+			abort();
+		}
+	}
+	nitem->dup = hashmap_get(client->watched, &watch->key);
+	if (hashmap_replace(client->watched, &watch->key, nitem) < 0) {
+		abort();
+	}
+
+	*status = 0;
+}
+
+void register_notification(BuxtonDaemon *self, client_list_item *client,
+			   _BuxtonKey *key, uint32_t msgid,
+			   uint32_t interval, int32_t *status)
+{
+	_cleanup_free_ char *key_name = NULL;
+
+	assert(self);
+	assert(client);
+	assert(key);
+	assert(status);
+
+	*status = -1;
+
+	key_name = notify_key_name(key);
+	if (!key_name) {
+		return;
+	}
+
+	subscribe(self, client, key, key_name, msgid, interval, status);
+}
+
+/* Takes a registration out of its client's watched map */
+static void unwatch(BuxtonNotification *nitem)
+{
+	client_list_item *client = nitem->client;
+	BuxtonNotification *head;
+
+	head = hashmap_get(client->watched, &nitem->watch->key);
+	if (!head) {
+		return;
+	}
+	if (head == nitem) {
+		if (nitem->dup) {
+			if (hashmap_replace(client->watched,
+					    &nitem->watch->key, nitem->dup) < 0) {
+				abort();
+			}
+		} else {
+			(void)hashmap_remove(client->watched, &nitem->watch->key);
+		}
+		return;
+	}
+	for (; head->dup; head = head->dup) {
+		if (head->dup == nitem) {
+			head->dup = nitem->dup;
+			return;
+		}
+	}
+}
+
+/* Drops the key's last value along with its last subscriber */
+static void remove_subscriber(BuxtonDaemon *self, BuxtonNotification *nitem)
+{
+	BuxtonWatch *watch = nitem->watch;
+
+	if (nitem->pending) {
+		LIST_REMOVE(BuxtonNotification, due, self->pending, nitem);
+	}
+	LIST_REMOVE(BuxtonNotification, subscriber, watch->subscribers, nitem);
+	LIST_REMOVE(BuxtonNotification, subscription,
+		    nitem->client->subscriptions, nitem);
+	unwatch(nitem);
+	free(nitem);
+	if (watch->subscribers) {
+		return;
+	}
+
+	(void)hashmap_remove(self->notify_mapping, watch->name);
+	free_watch(watch);
 }
 
-BuxtonArray *list_keys(BuxtonDaemon *self, client_list_item *client,
-		       BuxtonString *layer, int32_t *status)
+void free_watch(BuxtonWatch *watch)
 {
-	BuxtonArray *ret_list = NULL;
-	assert(self);
-	assert(client);
-	assert(layer);
-	assert(status);
+	BuxtonNotification *nitem, *next;
 
-	*status = -1;
-	if (buxton_direct_list_keys(&self->buxton, layer, &ret_list)) {
-		*status = 0;
+	if (!watch) {
+		return;
 	}
-	return ret_list;
+	LIST_FOREACH_SAFE(subscriber, nitem, next, watch->subscribers) {
+		free(nitem);
+	}
+	free_buxton_data(&watch->value);
+	free(watch->name);
+	free(watch->key.group.value);
+	free(watch);
 }
 
-BuxtonArray *list_names(BuxtonDaemon *self,  client_list_item *client,
-			_BuxtonKey *key, int32_t *status)
+uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
+				 _BuxtonKey *key, int32_t *status)
 {
-	BuxtonArray *ret_list = NULL;
+	_BuxtonKey watched = { {0}, {0}, {0}, BUXTON_TYPE_UNSET };
+	BuxtonNotification *citem;
+	uint32_t msgid = 0;
+
 	assert(self);
 	assert(client);
+	assert(key);
 	assert(status);
 
 	*status = -1;
-	if (buxton_direct_list_names(&self->buxton, &key->layer, &key->group,
-	    &key->name, &ret_list)) {
-		*status = 0;
+	if (!key->group.value || !key->name.value) {
+		return 0;
 	}
-	return ret_list;
+
+	/* Client hasn't registered for notifications on this key */
+	watched.group = key->group;
+	watched.name = key->name;
+	citem = hashmap_get(client->watched, &watched);
+	if (!citem) {
+		return 0;
+	}
+
+	msgid = citem->msgid;
+	/* Remove client from notifications */
+	remove_subscriber(self, citem);
+
+	*status = 0;
+
+	return msgid;
 }
 
-void register_notification(BuxtonDaemon *self, client_list_item *client,
-			   _BuxtonKey *key, uint32_t msgid,
-			   int32_t *status)
+void register_prefix_notification(BuxtonDaemon *self, client_list_item *client,
+				  _BuxtonKey *key, uint32_t msgid,
+				  int32_t *status)
 {
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
+	_BuxtonKey group = {{0}, {0}, {0}, 0};
 	BuxtonNotification *nitem;
-	BuxtonData *old_data = NULL;
-	int32_t key_status;
-	char *key_name;
-	uint64_t *fd = NULL;
-	char *key_name_copy = NULL;
+	BuxtonData *group_data;
+	char *prefix;
 
 	assert(self);
+	assert(self->notify_prefixes);
 	assert(client);
 	assert(key);
 	assert(status);
 
 	*status = -1;
 
-	nitem = malloc0(sizeof(BuxtonNotification));
-	if (!nitem) {
-		abort();
-	}
-	nitem->client = client;
-
-	/* Store data now, cheap */
-	old_data = get_value(self, client, key, &key_status);
-	if (key_status != 0) {
-		free(nitem);
+	prefix = notify_prefix_name(key);
+	if (!prefix) {
 		return;
 	}
-	nitem->old_data = old_data;
-	nitem->msgid = msgid;
 
-	/* May be null, but will append regardless */
-	key_name = notify_key_name(key);
-	if (!key_name) {
+	/* The group must exist in some layer and be readable by the client */
+	group.group = key->group;
+	group.type = BUXTON_TYPE_STRING;
+	group_data = get_value(self, client, &group, status);
+	if (*status != 0) {
+		free(prefix);
 		return;
 	}
+	free_buxton_data(&group_data);
+	*status = -1;
 
-	key_name_copy = strdup(key_name);
-	if (!key_name_copy) {
+	nitem = malloc0(sizeof(BuxtonNotification));
+	if (!nitem) {
 		abort();
 	}
+	nitem->client = client;
+	nitem->msgid = msgid;
+	nitem->prefix = prefix;
 
-	n_list = hashmap_get(self->notify_mapping, key_name);
-	if (!n_list) {
-		if (!buxton_list_append(&n_list, nitem)) {
-			abort();
-		}
-
-		if (hashmap_put(self->notify_mapping, key_name, n_list) < 0) {
-			abort();
-		}
-	} else {
-		free(key_name);
-		if (!buxton_list_append(&n_list, nitem)) {
-			abort();
-		}
-	}
-
-	fd = malloc0(sizeof(uint64_t));
-	if (!fd) {
+	if (!buxton_trie_add(self->notify_prefixes, prefix, nitem)) {
 		abort();
 	}
-	*fd = (uint64_t)client->fd;
-
-	key_list = hashmap_get(self->client_key_mapping, fd);
-	if (!key_list) {
-		if (!buxton_list_append(&key_list, key_name_copy)) {
-			abort();
-		}
-		if(hashmap_put(self->client_key_mapping, fd, key_list) < 0) {
-			abort();
-		}
-	} else {
-		if (!buxton_list_append(&key_list, key_name_copy)) {
-			abort();
-		}
-		free(fd);
-	}
+	LIST_PREPEND(BuxtonNotification, subscription, client->prefixes, nitem);
 
 	*status = 0;
 }
 
-uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
-				 _BuxtonKey *key, int32_t *status)
+static void free_prefix_notification(BuxtonDaemon *self,
+				     BuxtonNotification *nitem)
+{
+	if (!buxton_trie_remove(self->notify_prefixes, nitem->prefix, nitem)) {
+		buxton_log("Internal state corruption: Prefix notification missing\n");
+		abort();
+	}
+	free(nitem->prefix);
+	free(nitem);
+}
+
+uint32_t unregister_prefix_notification(BuxtonDaemon *self,
+					client_list_item *client,
+					_BuxtonKey *key, int32_t *status)
 {
-	BuxtonList *plist;
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
-	BuxtonList *elem = NULL;
+	_cleanup_free_ char *prefix = NULL;
 	BuxtonNotification *nitem, *citem = NULL;
-	uint32_t msgid = 0;
-	_cleanup_free_ char *key_name = NULL;
-	void *old_key_name;
-	char *client_keyname = NULL;
-	uint64_t fd = 0;
-	void *old_fd = NULL;
+	BuxtonList *elem;
+	uint32_t msgid;
 
 	assert(self);
+	assert(self->notify_prefixes);
 	assert(client);
 	assert(key);
 	assert(status);
 
 	*status = -1;
-	key_name = notify_key_name(key);
-	if (!key_name) {
-		return 0;
-	}
-	n_list = hashmap_get2(self->notify_mapping, key_name, &old_key_name);
-	/* This key isn't actually registered for notifications */
-	if (!n_list) {
+
+	prefix = notify_prefix_name(key);
+	if (!prefix) {
 		return 0;
 	}
 
-	BUXTON_LIST_FOREACH(n_list, elem) {
+	/* Only the subscribers of this very prefix need looking at */
+	BUXTON_LIST_FOREACH(buxton_trie_get(self->notify_prefixes, prefix), elem) {
 		nitem = elem->data;
-		/* Find the list item for this client */
 		if (nitem->client == client) {
 			citem = nitem;
 			break;
 		}
-	};
-
-	/* Client hasn't registered for notifications on this key */
-	if (!citem) {
-		return 0;
 	}
 
-	fd = (uint64_t)client->fd;
-	/* Remove key name from client hashmap */
-	key_list = hashmap_get2(self->client_key_mapping, &fd, &old_fd);
-
-	if (!key_list || !old_fd) {
+	/* Client hasn't registered for notifications on this prefix */
+	if (!citem) {
 		return 0;
 	}
 
-	BUXTON_LIST_FOREACH(key_list, elem) {
-		if (!strcmp(elem->data, key_name)) {
-			client_keyname = elem->data;
-			break;
-		}
-	};
-
-	if (client_keyname) {
-		plist = key_list;
-		buxton_list_remove(&key_list, client_keyname, true);
-		if (!key_list) {
-			hashmap_remove(self->client_key_mapping, &fd);
-			free(old_fd);
-		} else if (plist != key_list) {
-			if (hashmap_update(self->client_key_mapping, &fd, key_list) < 0) {
-				abort();
-			}
-		}
-	}
-
 	msgid = citem->msgid;
-	/* Remove client from notifications */
-	free_buxton_data(&(citem->old_data));
-	plist = n_list;
-	buxton_list_remove(&n_list, citem, true);
-
-	/* If we removed the last item, remove the mapping too */
-	if (!n_list) {
-		(void)hashmap_remove(self->notify_mapping, key_name);
-		free(old_key_name);
-	} else if (plist != n_list) {
-		if (hashmap_update(self->notify_mapping, key_name, n_list) < 0) {
-			abort();
-		}
-	}
+	LIST_REMOVE(BuxtonNotification, subscription, client->prefixes, citem);
+	free_prefix_notification(self, citem);
 
 	*status = 0;
 
@@ -1132,51 +2627,327 @@ bool identify_client(client_list_item *cl)
 	return true;
 }
 
-void add_pollfd(BuxtonDaemon *self, int fd, short events, bool a)
+bool add_event_source(BuxtonDaemon *self, BuxtonEventSource *source,
+		      uint32_t events)
 {
+	struct epoll_event ev;
+
 	assert(self);
-	assert(fd >= 0);
+	assert(source);
+	assert(source->fd >= 0);
+
+	memzero(&ev, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.ptr = source;
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, source->fd, &ev) < 0) {
+		buxton_log("epoll_ctl(): %m\n");
+		return false;
+	}
+	self->nfds++;
 
-	if (!greedy_realloc((void **) &(self->pollfds), &(self->nfds_alloc),
-			    (size_t)((self->nfds + 1) * (sizeof(struct pollfd))))) {
-		abort();
+	buxton_debug("Added fd %d to our epoll set (type=%d)\n", source->fd,
+		     source->type);
+
+	return true;
+}
+
+bool mod_event_source(BuxtonDaemon *self, BuxtonEventSource *source,
+		      uint32_t events)
+{
+	struct epoll_event ev;
+
+	assert(self);
+	assert(source);
+
+	memzero(&ev, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.ptr = source;
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, source->fd, &ev) < 0) {
+		buxton_log("epoll_ctl(): %m\n");
+		return false;
+	}
+
+	return true;
+}
+
+void del_event_source(BuxtonDaemon *self, BuxtonEventSource *source)
+{
+	assert(self);
+	assert(source);
+	assert(self->nfds > 0);
+
+	buxton_debug("Removing fd %d from our epoll set\n", source->fd);
+
+	/*
+	 * Closing the fd would drop it from the set as well, but only
+	 * once every duplicate of it is closed, so remove it explicitly.
+	 */
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL) < 0) {
+		buxton_debug("epoll_ctl(): %m\n");
 	}
-	if (!greedy_realloc((void **) &(self->accepting), &(self->accepting_alloc),
-			    (size_t)((self->nfds + 1) * (sizeof(self->accepting))))) {
+	self->nfds--;
+}
+
+BuxtonEventSource *add_event_fd(BuxtonDaemon *self, int fd, uint32_t events,
+				BuxtonEventType type)
+{
+	BuxtonEventSource *source;
+
+	assert(self);
+	assert(type != BUXTON_EVENT_CLIENT);
+
+	source = malloc0(sizeof(BuxtonEventSource));
+	if (!source) {
 		abort();
 	}
-	self->pollfds[self->nfds].fd = fd;
-	self->pollfds[self->nfds].events = events;
-	self->pollfds[self->nfds].revents = 0;
-	self->accepting[self->nfds] = a;
-	self->nfds++;
 
-	buxton_debug("Added fd %d to our poll list (accepting=%d)\n", fd, a);
+	LIST_INIT(BuxtonEventSource, source, source);
+	source->type = type;
+	source->fd = fd;
+	if (!add_event_source(self, source, events)) {
+		free(source);
+		return NULL;
+	}
+	LIST_PREPEND(BuxtonEventSource, source, self->sources, source);
+
+	return source;
+}
+
+/*
+ * Shut the connection down rather than terminating the client right
+ * away, the client may be referenced by events or notifications that
+ * are still being processed. The hang up is reported by epoll and the
+ * client is terminated from its own event.
+ */
+static void disconnect_client(client_list_item *cl)
+{
+	if (cl->closing) {
+		return;
+	}
+	cl->closing = true;
+	if (shutdown(cl->fd, SHUT_RDWR) < 0) {
+		buxton_debug("shutdown(): %m\n");
+	}
+}
+
+static void output_push(client_list_item *cl, uint8_t *data, size_t size)
+{
+	BuxtonOutput *out;
+	size_t alloc;
+
+	if (cl->out_count == cl->out_alloc) {
+		alloc = cl->out_alloc ? cl->out_alloc * 2 : OUTPUT_RING_MIN;
+		out = malloc0(alloc * sizeof(BuxtonOutput));
+		if (!out) {
+			abort();
+		}
+		/* unwrap the ring so the oldest message is in slot 0 */
+		for (size_t i = 0; i < cl->out_count; i++) {
+			out[i] = cl->out[(cl->out_head + i) & (cl->out_alloc - 1)];
+		}
+		free(cl->out);
+		cl->out = out;
+		cl->out_alloc = alloc;
+		cl->out_head = 0;
+	}
+
+	out = &cl->out[(cl->out_head + cl->out_count) & (cl->out_alloc - 1)];
+	out->data = data;
+	out->size = size;
+	cl->out_count++;
+}
+
+static void output_pop(client_list_item *cl)
+{
+	BuxtonOutput *out;
+
+	assert(cl->out_count > 0);
+
+	out = &cl->out[cl->out_head];
+	free(out->data);
+	out->data = NULL;
+	cl->out_head = (cl->out_head + 1) & (cl->out_alloc - 1);
+	cl->out_count--;
+	cl->out_offset = 0;
 }
 
-void del_pollfd(BuxtonDaemon *self, nfds_t i)
+/* Messages not built in version 1 are already in the client's version */
+static bool queue_output(BuxtonDaemon *self, client_list_item *cl,
+			 uint8_t *data, size_t size, bool notification,
+			 bool transcode)
 {
+	uint8_t *v1;
+	uint32_t defined;
+	ssize_t l = 0;
+
 	assert(self);
-	assert(i < self->nfds);
-
-	buxton_debug("Removing fd %d from our list\n", self->pollfds[i].fd);
-
-	if (i != (self->nfds - 1)) {
-		memmove(&(self->pollfds[i]),
-			&(self->pollfds[i + 1]),
-			/*
-			 * nfds < max int because of kernel limit of
-			 * fds. i + 1 < nfds because of if and assert
-			 * so the casts below are always >= 0 and less
-			 * than long unsigned max int so no loss of
-			 * precision.
-			 */
-			(size_t)(self->nfds - i - 1) * sizeof(struct pollfd));
-		memmove(&(self->accepting[i]),
-			&(self->accepting[i + 1]),
-			(size_t)(self->nfds - i - 1) * sizeof(bool));
+	assert(cl);
+	assert(data);
+
+	if (cl->closing) {
+		free(data);
+		return false;
 	}
-	self->nfds--;
+	defined = cl->encode.count;
+
+	/*
+	 * Messages are built in version 1 and encoded for the client here,
+	 * so the limit is checked against the bytes that would be queued
+	 */
+	if (transcode && cl->version >= 2) {
+		v1 = data;
+		size = buxton_transcode_message_v2(v1, size, &cl->encode, &data);
+		free(v1);
+		if (size == 0) {
+			buxton_log("Failed to encode message for client %d\n",
+				   cl->fd);
+			disconnect_client(cl);
+			return false;
+		}
+	}
+
+	if (cl->out_count != 0 && self->queue_limit &&
+	    cl->out_bytes + size > self->queue_limit) {
+		free(data);
+		if (notification && self->queue_policy == BUXTON_QUEUE_DROP) {
+			/* The client never sees strings the message indexed */
+			buxton_string_table_truncate(&cl->encode, defined);
+			cl->dropped++;
+			cl->overflowed = true;
+			buxton_debug("Dropped notification for client %d (%" PRIu64 " total)\n",
+				     cl->fd, cl->dropped);
+			return true;
+		}
+		buxton_log("Output queue of client %d is full, disconnecting\n",
+			   cl->fd);
+		disconnect_client(cl);
+		return false;
+	}
+
+	/* Nothing queued yet, so try handing the message to the socket */
+	if (cl->out_count == 0) {
+		l = write(cl->fd, data, size);
+		if (l < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				buxton_debug("write(): %m\n");
+				free(data);
+				disconnect_client(cl);
+				return false;
+			}
+			l = 0;
+		}
+		if ((size_t)l == size) {
+			free(data);
+			return true;
+		}
+	}
+
+	/* Stop reading requests until the client catches up */
+	if (cl->out_count == 0) {
+		if (!mod_event_source(self, &cl->source, EPOLLOUT)) {
+			free(data);
+			disconnect_client(cl);
+			return false;
+		}
+		cl->out_offset = (size_t)l;
+	}
+	output_push(cl, data, size);
+	cl->out_bytes += size - (size_t)l;
+
+	return true;
+}
+
+bool queue_message(BuxtonDaemon *self, client_list_item *cl, uint8_t *data,
+		   size_t size, bool notification)
+{
+	return queue_output(self, cl, data, size, notification, true);
+}
+
+bool flush_client(BuxtonDaemon *self, client_list_item *cl)
+{
+	struct iovec iov[FLUSH_IOV_MAX];
+	BuxtonOutput *out;
+	BuxtonArray *out_list;
+	uint8_t *notice = NULL;
+	ssize_t l;
+	size_t left;
+	size_t size;
+	int n;
+
+	assert(self);
+	assert(cl);
+
+	if (cl->out_count == 0) {
+		return true;
+	}
+
+	while (cl->out_count > 0) {
+		n = 0;
+		for (size_t i = 0; i < cl->out_count && n < FLUSH_IOV_MAX; i++) {
+			out = &cl->out[(cl->out_head + i) & (cl->out_alloc - 1)];
+			iov[n].iov_base = out->data;
+			iov[n].iov_len = out->size;
+			if (i == 0) {
+				iov[n].iov_base = out->data + cl->out_offset;
+				iov[n].iov_len -= cl->out_offset;
+			}
+			n++;
+		}
+
+		l = writev(cl->fd, iov, n);
+		if (l < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return true;
+			}
+			buxton_debug("writev(): %m\n");
+			return false;
+		}
+
+		cl->out_bytes -= (size_t)l;
+		while (l > 0) {
+			out = &cl->out[cl->out_head];
+			left = out->size - cl->out_offset;
+			if ((size_t)l < left) {
+				cl->out_offset += (size_t)l;
+				break;
+			}
+			l -= (ssize_t)left;
+			output_pop(cl);
+		}
+	}
+
+	/*
+	 * Once it caught up, the client learns it missed notifications, so
+	 * that it can drop whatever it kept on the strength of them
+	 */
+	if (cl->overflowed) {
+		cl->overflowed = false;
+		if (cl->version >= 4) {
+			out_list = buxton_array_new();
+			if (!out_list) {
+				abort();
+			}
+			size = buxton_serialize_message(&notice,
+							BUXTON_CONTROL_OVERFLOW,
+							0, out_list);
+			buxton_array_free(&out_list, NULL);
+			if (size == 0) {
+				abort();
+			}
+			if (!queue_message(self, cl, notice, size, false)) {
+				return false;
+			}
+			if (cl->out_count > 0) {
+				return true;
+			}
+		}
+	}
+
+	/* Queue is empty, wait for requests again */
+	return mod_event_source(self, &cl->source, EPOLLIN | EPOLLPRI);
 }
 
 void handle_smack_label(client_list_item *cl)
@@ -1225,7 +2996,7 @@ void handle_smack_label(client_list_item *cl)
 	cl->smack_label = slabel;
 }
 
-bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
+bool handle_client(BuxtonDaemon *self, client_list_item *cl)
 {
 	ssize_t l;
 	uint16_t peek;
@@ -1261,7 +3032,7 @@ bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 
 	/* Hand off any read data */
 	do {
-		l = read(self->pollfds[i].fd, (cl->data) + cl->offset, cl->size - cl->offset);
+		l = read(cl->fd, (cl->data) + cl->offset, cl->size - cl->offset);
 
 		/*
 		 * Close clients with read errors. If there isn't more
@@ -1305,6 +3076,11 @@ bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
 			goto terminate;
 		}
 
+		/* Leave further requests in the socket until output drains */
+		if (cl->out_count > 0) {
+			goto cleanup;
+		}
+
 		message_limit--;
 		if (message_limit) {
 			cl->size = BUXTON_MESSAGE_HEADER_LENGTH;
@@ -1325,77 +3101,49 @@ cleanup:
 	return more_data;
 
 terminate:
-	terminate_client(self, cl, i);
+	terminate_client(self, cl);
 	return more_data;
 }
 
-void terminate_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
+void terminate_client(BuxtonDaemon *self, client_list_item *cl)
 {
-	BuxtonList *key_list = NULL;
-	BuxtonList *elem, *notify_elem;
-	char *key_name;
-	void *old_key_name = NULL;
-	void *old_fd = NULL;
-	uint64_t fd = (uint64_t)cl->fd;
+	BuxtonNotification *nitem, *next;
 
-	key_list = hashmap_get2(self->client_key_mapping, &fd, &old_fd);
-
-	if (key_list) {
+	if (cl->subscriptions) {
 		buxton_debug("Removing notifications for client before terminating\n");
-		BUXTON_LIST_FOREACH(key_list, elem) {
-			key_name = elem->data;
-			BuxtonList *n_list = NULL;
-
-			n_list = hashmap_get2(self->notify_mapping, key_name, &old_key_name);
-			if (!n_list || !old_key_name) {
-				abort();
-			}
-
-			BuxtonNotification *nitem, *citem = NULL;
-
-			BUXTON_LIST_FOREACH(n_list, notify_elem) {
-				nitem = notify_elem->data;
-				if (nitem->client == cl) {
-					citem = nitem;
-					break;
-				}
-			};
-
-			if (!citem) {
-				abort();
-			}
-
-			/* Remove client from notifications */
-			free_buxton_data(&(citem->old_data));
-
-			BuxtonList *old_n_list = n_list;
-
-			buxton_list_remove(&n_list, citem, true);
-
-			/* If n_list was changed, hashmap should be updated. */
-			if (n_list && n_list != old_n_list) {
-				hashmap_update(self->notify_mapping, key_name, n_list);
-			}
+	}
+	LIST_FOREACH_SAFE(subscription, nitem, next, cl->subscriptions) {
+		remove_subscriber(self, nitem);
+	}
+	hashmap_free(cl->watched);
+	cl->watched = NULL;
 
-			/* If we removed the last item, remove the mapping too */
-			if (!n_list) {
-				(void)hashmap_remove(self->notify_mapping, key_name);
-				free(old_key_name);
-			}
-		};
-		/* Remove key from client hashmap */
-		hashmap_remove(self->client_key_mapping, &fd);
-		free(old_fd);
-		buxton_list_free_all(&key_list);
+	LIST_FOREACH_SAFE(subscription, nitem, next, cl->prefixes) {
+		free_prefix_notification(self, nitem);
 	}
+	cl->prefixes = NULL;
 
-	del_pollfd(self, i);
+	del_event_source(self, &cl->source);
 	close(cl->fd);
+	while (cl->out_count > 0) {
+		output_pop(cl);
+	}
+	free(cl->out);
 	if (cl->smack_label) {
 		free(cl->smack_label->value);
 	}
 	free(cl->smack_label);
 	free(cl->data);
+	buxton_string_table_free(&cl->encode);
+	buxton_string_table_free(&cl->decode);
+	for (uint32_t i = 0; i < cl->n_handles; i++) {
+		free(cl->handles[i].key.group.value);
+		free(cl->handles[i].key.name.value);
+		free(cl->handles[i].key.layer.value);
+		free(cl->handles[i].name);
+	}
+	free(cl->handles);
+	free_stream(cl);
 	buxton_debug("Closed connection from fd %d\n", cl->fd);
 	LIST_REMOVE(client_list_item, item, self->client_list, cl);
 	free(cl);
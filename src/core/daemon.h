@@ -20,50 +20,165 @@
 	#include "config.h"
 #endif
 
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
 #include "buxton.h"
 #include "backend.h"
+#include "buxtonlist.h"
+#include "buxtontrie.h"
 #include "hashmap.h"
 #include "list.h"
 #include "protocol.h"
 #include "serialize.h"
 
+/**
+ * Kind of file descriptor watched by buxtond's event loop
+ */
+typedef enum BuxtonEventType {
+	BUXTON_EVENT_SIGNAL = 0, /**<signalfd delivering termination signals */
+	BUXTON_EVENT_LISTEN, /**<Socket accepting new client connections */
+	BUXTON_EVENT_SMACK, /**<inotify descriptor watching the Smack rules */
+	BUXTON_EVENT_TIMER, /**<timerfd firing when coalesced notifications are due */
+	BUXTON_EVENT_CLIENT /**<Connected client socket */
+} BuxtonEventType;
+
+struct client_list_item;
+struct BuxtonNotification;
+
+/**
+ * What buxtond does with a client whose output queue is full
+ */
+typedef enum BuxtonQueuePolicy {
+	BUXTON_QUEUE_DROP = 0, /**<Drop notifications, disconnect on responses */
+	BUXTON_QUEUE_DISCONNECT /**<Disconnect the client */
+} BuxtonQueuePolicy;
+
+/**
+ * Serialized message waiting to be written to a client
+ */
+typedef struct BuxtonOutput {
+	uint8_t *data; /**<Serialized message */
+	size_t size; /**<Size of the message */
+} BuxtonOutput;
+
+/**
+ * File descriptor registered with the daemon's epoll instance. A
+ * pointer to it is stored in the epoll_event so that dispatching an
+ * event never has to search for its owner.
+ */
+typedef struct BuxtonEventSource {
+	LIST_FIELDS(struct BuxtonEventSource, source); /**<List type */
+	BuxtonEventType type; /**<What the file descriptor is used for */
+	int fd; /**<Watched file descriptor */
+	struct client_list_item *client; /**<Owner of a BUXTON_EVENT_CLIENT source */
+} BuxtonEventSource;
+
+/**
+ * Key a client registered, addressed by its index plus one
+ */
+typedef struct BuxtonKeyHandle {
+	_BuxtonKey key; /**<Owned copy of the registered key */
+	char *name; /**<Key of notify_mapping, "group\nname" */
+} BuxtonKeyHandle;
+
+/**
+ * LIST_NAMES reply still being read from the backend and sent in chunks
+ */
+typedef struct BuxtonNameStream {
+	_BuxtonKey key; /**<Owned layer, group and prefix of the request */
+	BuxtonString cursor; /**<Where the backend scan resumes */
+	BuxtonString held; /**<Name of the cursor moved off a removed key, sent first */
+	bool done; /**<Moving the cursor reached the end of the scan */
+	uint32_t msgid; /**<Message ID of the request and of its chunks */
+} BuxtonNameStream;
+
 /**
  * List for daemon's clients
  */
 typedef struct client_list_item {
 	LIST_FIELDS(struct client_list_item, item); /**<List type */
 	int fd; /**<File descriptor of connected client */
+	BuxtonEventSource source; /**<Event loop registration of the client */
 	struct ucred cred; /**<Credentials of connected client */
 	BuxtonString *smack_label; /**<Smack label of connected client */
 	uint8_t *data; /**<Data buffer for the client */
 	size_t offset; /**<Current position to write to data buffer */
 	size_t size; /**<Size of the data buffer */
+	BuxtonOutput *out; /**<Ring of messages waiting to be written */
+	size_t out_alloc; /**<Number of slots in the ring, a power of two */
+	size_t out_head; /**<Slot of the oldest queued message */
+	size_t out_count; /**<Number of queued messages */
+	size_t out_offset; /**<Bytes of the oldest message already written */
+	size_t out_bytes; /**<Bytes still waiting to be written */
+	uint64_t dropped; /**<Notifications dropped while over the limit */
+	bool overflowed; /**<Notifications were dropped since the last OVERFLOW */
+	uint64_t coalesced; /**<Changes replaced by a newer one before being sent */
+	struct BuxtonNotification *subscriptions; /**<Key notifications the client registered */
+	Hashmap *watched; /**<Newest key notification of each group and name */
+	struct BuxtonNotification *prefixes; /**<Prefix notifications the client registered */
+	bool closing; /**<Connection was shut down and awaits termination */
+	uint32_t version; /**<Protocol version agreed on, 0 before any HELLO */
+	BuxtonStringTable encode; /**<Strings sent to the client by index */
+	BuxtonStringTable decode; /**<Strings the client sends by index */
+	BuxtonKeyHandle *handles; /**<Keys registered by the client */
+	uint32_t n_handles; /**<Number of keys registered */
+	size_t handles_alloc; /**<Bytes allocated for handles */
+	BuxtonNameStream *stream; /**<List waiting for the queue to drain, or NULL */
 } client_list_item;
 
 /**
- * Notification registration
+ * Notification registration. A key notification is linked into the
+ * subscriber list of its key, the subscription list of its client and,
+ * while a change waits out its interval, the daemon's pending list, so
+ * it leaves each of them in constant time, and the watched map of its
+ * client finds it by group and name when the client unregisters. A
+ * prefix notification is kept in the notify_prefixes trie and linked
+ * into the prefix list of its client through the subscription fields.
  */
 typedef struct BuxtonNotification {
+	LIST_FIELDS(struct BuxtonNotification, subscriber); /**<Key's subscribers */
+	LIST_FIELDS(struct BuxtonNotification, subscription); /**<Client's subscriptions */
+	LIST_FIELDS(struct BuxtonNotification, due); /**<Daemon's pending list */
 	client_list_item *client; /**<Client */
-	BuxtonData *old_data; /**<Old value of a particular key*/
+	struct BuxtonWatch *watch; /**<Key value shared with other subscribers */
+	uint64_t version; /**<Version of the key value last sent to the client */
+	uint64_t next; /**<Earliest time in ms the next change may be sent */
+	uint32_t interval; /**<Minimum ms between changes sent, 0 for every change */
 	uint32_t msgid; /**<Message id from the client */
+	bool pending; /**<A change waits in the daemon's pending list */
+	char *prefix; /**<Trie key of a prefix notification */
+	struct BuxtonNotification *dup; /**<Older registration of the key by the client */
 } BuxtonNotification;
 
+/**
+ * Last value of a key with notifications, shared by its subscribers
+ */
+typedef struct BuxtonWatch {
+	char *name; /**<Key of notify_mapping, "group\nname" */
+	_BuxtonKey key; /**<Group and name, key of the clients' watched maps */
+	BuxtonNotification *subscribers; /**<Head of the subscriber list */
+	BuxtonData *value; /**<Last value sent, NULL if the key is unset */
+	uint64_t version; /**<Incremented each time the value changes */
+} BuxtonWatch;
+
 /**
  * Global store of buxtond state
  */
 typedef struct BuxtonDaemon {
-	size_t nfds_alloc;
-	size_t accepting_alloc;
-	nfds_t nfds;
-	bool *accepting;
-	struct pollfd *pollfds;
+	int epoll_fd;
+	size_t nfds;
+	BuxtonEventSource *sources;
 	client_list_item *client_list;
-	Hashmap *notify_mapping;
-	Hashmap *client_key_mapping;
+	size_t queue_limit;
+	BuxtonQueuePolicy queue_policy;
+	Hashmap *notify_mapping; /**<BuxtonWatch of each "group\nname" */
+	BuxtonTrie *notify_prefixes;
+	BuxtonEventSource *timer; /**<timerfd for pending notifications, may be NULL */
+	uint64_t timer_due; /**<Time in ms the timer fires, 0 when disarmed */
+	BuxtonNotification *pending; /**<Head of the subscriptions waiting out their interval */
+	BuxtonData *params; /**<Parameters of the message being handled, reused */
+	size_t params_size; /**<Number of parameters params has room for */
 	BuxtonControl buxton;
 } BuxtonDaemon;
 
@@ -93,16 +208,35 @@ bool buxtond_handle_message(BuxtonDaemon *self,
 			      size_t size)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send the latest value to subscribers whose interval has passed, and
+ * arm the timer for the ones still waiting
+ * @param self Reference to BuxtonDaemon
+ */
+void buxtond_send_pending(BuxtonDaemon *self);
+
 /**
  * Notify clients a value changes in buxtond
+ *
+ * Prefix subscribers with a Smack label are checked against the label
+ * of the key, so they aren't told of an unset passed here once the key
+ * is gone.
  * @param self Refernece to BuxtonDaemon
  * @param client Current client
  * @param key Modified key
- * @param value Modified value
+ * @param value Modified value, NULL if the key was unset
  */
 void buxtond_notify_clients(BuxtonDaemon *self, client_list_item *client,
 			      _BuxtonKey* key, BuxtonData *value);
 
+/**
+ * Notify the subscribers of a whole group that it was removed or its
+ * label changed, with a change naming no key and carrying no value
+ * @param self buxtond instance being run
+ * @param key Key of the group, its name is ignored
+ */
+void buxtond_notify_group(BuxtonDaemon *self, _BuxtonKey *key);
+
 /**
  * Buxton daemon function for setting a value
  * @param self buxtond instance being run
@@ -202,17 +336,30 @@ BuxtonArray *list_names(BuxtonDaemon *self, client_list_item *client,
 			_BuxtonKey *key, int32_t *status)
 	__attribute__((warn_unused_result));
 
+/**
+ * Buxton daemon function for getting every readable key of a group
+ * @param self buxtond instance being run
+ * @param client Used to validate smack access
+ * @param key Key recording the layer and the group
+ * @param status Will be set with the int32_t result of the operation
+ * @returns BuxtonArray of alternating names and values, or NULL
+ */
+BuxtonArray *get_group_values(BuxtonDaemon *self, client_list_item *client,
+			      _BuxtonKey *key, int32_t *status)
+	__attribute__((warn_unused_result));
+
 /**
  * Buxton daemon function for registering notifications on a given key
  * @param self buxtond instance being run
  * @param client Used to validate smack access
  * @param key Key to notify for changes on
  * @param msgid Message ID from the client
+ * @param interval Minimum ms between changes sent, 0 to send every change
  * @param status Will be set with the int32_t result of the operation
  */
 void register_notification(BuxtonDaemon *self, client_list_item *client,
 			   _BuxtonKey *key, uint32_t msgid,
-			   int32_t *status);
+			   uint32_t interval, int32_t *status);
 
 /**
  * Buxton daemon function for unregistering notifications from the given key
@@ -226,6 +373,40 @@ uint32_t unregister_notification(BuxtonDaemon *self, client_list_item *client,
 				 _BuxtonKey *key, int32_t *status)
 	__attribute__((warn_unused_result));
 
+/**
+ * Free a key's last value and any subscribers left, which are not
+ * unlinked from their clients
+ * @param watch The BuxtonWatch to free, may be NULL
+ */
+void free_watch(BuxtonWatch *watch);
+
+/**
+ * Buxton daemon function for registering notifications on every key
+ * of a group whose name starts with a prefix
+ * @param self buxtond instance being run
+ * @param client Used to validate smack access
+ * @param key Key recording the group and the prefix as name, a NULL
+ * name matches the whole group
+ * @param msgid Message ID from the client
+ * @param status Will be set with the int32_t result of the operation
+ */
+void register_prefix_notification(BuxtonDaemon *self, client_list_item *client,
+				  _BuxtonKey *key, uint32_t msgid,
+				  int32_t *status);
+
+/**
+ * Buxton daemon function for unregistering a prefix notification
+ * @param self buxtond instance being run
+ * @param client Client that registered the notification
+ * @param key Key recording the group and the prefix as name
+ * @param status Will be set with the int32_t result of the operation
+ * @return Message ID used to send the notifications to the client
+ */
+uint32_t unregister_prefix_notification(BuxtonDaemon *self,
+					client_list_item *client,
+					_BuxtonKey *key, int32_t *status)
+	__attribute__((warn_unused_result));
+
 /**
  * Verify credentials for the client socket
  * @param cl Client to check the credentials of
@@ -235,22 +416,82 @@ bool identify_client(client_list_item *cl)
 	__attribute__((warn_unused_result));
 
 /**
- * Add a fd to daemon's poll list
+ * Register an event source with the daemon's epoll instance
  * @param self buxtond instance being run
- * @param fd File descriptor to add to the poll list
- * @param events Priority mask for events
- * @param a Accepting status of the fd
- * @return None
+ * @param source Event source with its type and fd initialized
+ * @param events epoll event mask to watch for
+ * @return bool indicating the source was registered
+ */
+bool add_event_source(BuxtonDaemon *self, BuxtonEventSource *source,
+		      uint32_t events)
+	__attribute__((warn_unused_result));
+
+/**
+ * Change the events watched for an event source
+ * @param self buxtond instance being run
+ * @param source Registered event source
+ * @param events New epoll event mask
+ * @return bool indicating the event mask was changed
  */
-void add_pollfd(BuxtonDaemon *self, int fd, short events, bool a);
+bool mod_event_source(BuxtonDaemon *self, BuxtonEventSource *source,
+		      uint32_t events)
+	__attribute__((warn_unused_result));
 
 /**
- * Add a fd to daemon's poll list
+ * Remove an event source from the daemon's epoll instance
  * @param self buxtond instance being run
- * @param i File descriptor to remove from poll list
+ * @param source Event source to stop watching
  * @return None
  */
-void del_pollfd(BuxtonDaemon *self, nfds_t i);
+void del_event_source(BuxtonDaemon *self, BuxtonEventSource *source);
+
+/**
+ * Watch a daemon owned (non client) fd, the source is kept in the
+ * daemon's source list until shutdown
+ * @param self buxtond instance being run
+ * @param fd File descriptor to watch
+ * @param events epoll event mask to watch for
+ * @param type What the file descriptor is used for
+ * @return Newly registered event source or NULL on failure
+ */
+BuxtonEventSource *add_event_fd(BuxtonDaemon *self, int fd, uint32_t events,
+				BuxtonEventType type)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send a message to a client without blocking. Whatever the socket
+ * doesn't take right away is queued and written once the client is
+ * writable again.
+ * @param self buxtond instance being run
+ * @param cl Client to send the message to
+ * @param data Serialized message, ownership is taken in all cases
+ * @param size Size of the message
+ * @param notification Whether the message may be dropped when the
+ * client's queue is full
+ * @return bool false if the client is being disconnected
+ */
+bool queue_message(BuxtonDaemon *self, client_list_item *cl, uint8_t *data,
+		   size_t size, bool notification);
+
+/**
+ * Send more of a client's streamed LIST_NAMES reply, until the reply
+ * ends or the client's output has to be queued
+ * @param self buxtond instance being run
+ * @param cl Client whose reply to continue, may have none
+ * @return bool false if the client is being disconnected
+ */
+bool buxtond_continue_stream(BuxtonDaemon *self, client_list_item *cl)
+	__attribute__((warn_unused_result));
+
+/**
+ * Write as much of a client's output queue as the socket takes
+ * @param self buxtond instance being run
+ * @param cl Client to flush
+ * @return bool false if writing failed and the client should be
+ * terminated
+ */
+bool flush_client(BuxtonDaemon *self, client_list_item *cl)
+	__attribute__((warn_unused_result));
 
 /**
  * Setup a client's smack label
@@ -263,19 +504,17 @@ void handle_smack_label(client_list_item *cl);
  * Handle a client connection
  * @param self buxtond instance being run
  * @param cl The currently activate client
- * @param i The currently active file descriptor
  * @return bool indicating more data to process
  */
-bool handle_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i)
+bool handle_client(BuxtonDaemon *self, client_list_item *cl)
 	__attribute__((warn_unused_result));
 
 /**
  * Terminate client connectoin
  * @param self buxtond instance being run
  * @param cl The client to terminate
- * @param i File descriptor to remove from poll list
  */
-void terminate_client(BuxtonDaemon *self, client_list_item *cl, nfds_t i);
+void terminate_client(BuxtonDaemon *self, client_list_item *cl);
 
 /*
  * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
@@ -21,11 +21,12 @@
 #include <errno.h>
 #include <getopt.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/un.h>
 #include <systemd/sd-daemon.h>
 #include <stdlib.h>
@@ -37,16 +38,19 @@
 
 #include "buxton.h"
 #include "backend.h"
+#include "cache.h"
 #include "daemon.h"
 #include "direct.h"
 #include "list.h"
 #include "log.h"
 #include "smack.h"
+#include "snapshot.h"
 #include "util.h"
 #include "configurator.h"
 #include "buxtonlist.h"
 
 #define SOCKET_TIMEOUT 5
+#define MAX_EVENTS 64
 
 static BuxtonDaemon self;
 
@@ -78,11 +82,12 @@ int main(int argc, char *argv[])
 	bool leftover_messages = false;
 	struct stat st;
 	bool help = false;
-	BuxtonList *map_list = NULL;
+	BuxtonWatch *watch = NULL;
 	Iterator iter;
-	char *notify_key;
-	BuxtonList *key_list = NULL;
-	uint64_t *client_fd;
+	struct epoll_event events[MAX_EVENTS];
+	BuxtonEventSource *source;
+	bool running = true;
+	char *end;
 
 	static struct option opts[] = {
 		{ "config-file", 1, NULL, 'c' },
@@ -133,14 +138,37 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	self.nfds_alloc = 0;
-	self.accepting_alloc = 0;
 	self.nfds = 0;
+	LIST_HEAD_INIT(BuxtonEventSource, self.sources);
+	self.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (self.epoll_fd < 0) {
+		buxton_log("epoll_create1(): %m\n");
+		exit(EXIT_FAILURE);
+	}
+	errno = 0;
+	self.queue_limit = strtoul(buxton_client_queue_limit(), &end, 10);
+	if (errno || *end != '\0') {
+		buxton_log("Invalid client queue limit: %s\n",
+			   buxton_client_queue_limit());
+		exit(EXIT_FAILURE);
+	}
+	if (streq(buxton_client_queue_policy(), "drop")) {
+		self.queue_policy = BUXTON_QUEUE_DROP;
+	} else if (streq(buxton_client_queue_policy(), "disconnect")) {
+		self.queue_policy = BUXTON_QUEUE_DISCONNECT;
+	} else {
+		buxton_log("Invalid client queue policy: %s\n",
+			   buxton_client_queue_policy());
+		exit(EXIT_FAILURE);
+	}
+
 	self.buxton.client.direct = true;
 	self.buxton.client.uid = geteuid();
 	if (!buxton_direct_open(&self.buxton)) {
 		exit(EXIT_FAILURE);
 	}
+	/* Every write goes through this process, so cache layerless gets */
+	self.buxton.cache = buxton_value_cache_new();
 
 	sigemptyset(&mask);
 	ret = sigaddset(&mask, SIGINT);
@@ -166,12 +194,27 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	add_pollfd(&self, sigfd, POLLIN, false);
+	if (!add_event_fd(&self, sigfd, EPOLLIN, BUXTON_EVENT_SIGNAL)) {
+		exit(EXIT_FAILURE);
+	}
 
 	/* For client notifications */
 	self.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
-	/* For keeping track of keys a client is registered to*/
-	self.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
+	/* For notifications on whole groups and name prefixes */
+	self.notify_prefixes = buxton_trie_new();
+	if (!self.notify_prefixes) {
+		abort();
+	}
+	/* For notifications held back by a subscriber's interval */
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		buxton_log("timerfd_create(): %m\n");
+		exit(EXIT_FAILURE);
+	}
+	self.timer = add_event_fd(&self, fd, EPOLLIN, BUXTON_EVENT_TIMER);
+	if (!self.timer) {
+		exit(EXIT_FAILURE);
+	}
 	/* Store a list of connected clients */
 	LIST_HEAD_INIT(client_list_item, self.client_list);
 
@@ -214,39 +257,60 @@ int main(int argc, char *argv[])
 			buxton_log("listen(): %m\n");
 			exit(EXIT_FAILURE);
 		}
-		add_pollfd(&self, fd, POLLIN | POLLPRI, true);
+		if (!add_event_fd(&self, fd, EPOLLIN | EPOLLPRI, BUXTON_EVENT_LISTEN)) {
+			exit(EXIT_FAILURE);
+		}
 	} else {
 		/* systemd socket activation */
 		for (fd = SD_LISTEN_FDS_START + 0; fd < SD_LISTEN_FDS_START + descriptors; fd++) {
 			if (sd_is_fifo(fd, NULL)) {
-				add_pollfd(&self, fd, POLLIN, false);
-				buxton_debug("Added fd %d type FIFO\n", fd);
+				/* Nothing is ever read from FIFOs */
+				buxton_debug("Ignoring fd %d type FIFO\n", fd);
 			} else if (sd_is_socket_unix(fd, SOCK_STREAM, -1, buxton_socket(), 0)) {
-				add_pollfd(&self, fd, POLLIN | POLLPRI, true);
+				if (!add_event_fd(&self, fd, EPOLLIN | EPOLLPRI, BUXTON_EVENT_LISTEN)) {
+					exit(EXIT_FAILURE);
+				}
 				buxton_debug("Added fd %d type UNIX\n", fd);
 			} else if (sd_is_socket(fd, AF_UNSPEC, 0, -1)) {
-				add_pollfd(&self, fd, POLLIN | POLLPRI, true);
+				if (!add_event_fd(&self, fd, EPOLLIN | EPOLLPRI, BUXTON_EVENT_LISTEN)) {
+					exit(EXIT_FAILURE);
+				}
 				buxton_debug("Added fd %d type SOCKET\n", fd);
 			}
 		}
 	}
 
 	if (smackfd >= 0) {
-		/* add Smack rule fd to pollfds */
-		add_pollfd(&self, smackfd, POLLIN | POLLPRI, false);
+		/* watch the Smack rule fd as well */
+		if (!add_event_fd(&self, smackfd, EPOLLIN | EPOLLPRI, BUXTON_EVENT_SMACK)) {
+			exit(EXIT_FAILURE);
+		}
 	}
 
+	/*
+	 * Clients read the values of snapshot layers without asking us.
+	 * Loading them may take a while, so clients can already connect.
+	 */
+	self.buxton.snapshot = buxton_snapshot_new(&self.buxton.config,
+						   buxton_snapshot_path());
+
 	buxton_log("%s: Started\n", argv[0]);
 
 	/* Enter loop to accept clients */
-	for (;;) {
-		ret = poll(self.pollfds, self.nfds, leftover_messages ? 0 : -1);
+	while (running) {
+		int nevents;
 
-		if (ret < 0) {
-			buxton_log("poll(): %m\n");
+		nevents = epoll_wait(self.epoll_fd, events, MAX_EVENTS,
+				     leftover_messages ? 0 : -1);
+
+		if (nevents < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			buxton_log("epoll_wait(): %m\n");
 			break;
 		}
-		if (ret == 0) {
+		if (nevents == 0) {
 			if (!leftover_messages) {
 				continue;
 			}
@@ -254,62 +318,64 @@ int main(int argc, char *argv[])
 
 		leftover_messages = false;
 
-		/* check sigfd if the daemon was signaled */
-		if (self.pollfds[0].revents != 0) {
-			ssize_t sinfo;
-			struct signalfd_siginfo si;
-
-			sinfo = read(self.pollfds[0].fd, &si, sizeof(struct signalfd_siginfo));
-			if (sinfo != sizeof(struct signalfd_siginfo)) {
-				exit(EXIT_FAILURE);
-			}
-
-			if (si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM) {
-				break;
-			}
-		}
-
-		for (nfds_t i = 1; i < self.nfds; i++) {
+		/*
+		 * Every registered fd carries its event source, so the
+		 * cost of a wakeup only depends on the ready fds.
+		 */
+		for (int i = 0; i < nevents; i++) {
 			client_list_item *cl = NULL;
 			char discard[256];
 
-			if (self.pollfds[i].revents == 0) {
-				continue;
-			}
+			source = events[i].data.ptr;
 
-			if (self.pollfds[i].fd == -1) {
-				/* TODO: Remove client from list  */
-				buxton_debug("Removing / Closing client for fd %d\n", self.pollfds[i].fd);
-				del_pollfd(&self, i);
-				continue;
-			}
+			switch (source->type) {
+			case BUXTON_EVENT_SIGNAL: {
+				/* check sigfd if the daemon was signaled */
+				ssize_t sinfo;
+				struct signalfd_siginfo si;
 
-			if (smackfd >= 0) {
-				if (self.pollfds[i].fd == smackfd) {
-					if (!buxton_cache_smack_rules()) {
-						exit(EXIT_FAILURE);
-					}
-					buxton_log("Reloaded Smack access rules\n");
-					/* discard inotify data itself */
-					while (read(smackfd, &discard, 256) == 256);
-					continue;
+				sinfo = read(source->fd, &si, sizeof(struct signalfd_siginfo));
+				if (sinfo != sizeof(struct signalfd_siginfo)) {
+					exit(EXIT_FAILURE);
+				}
+
+				if (si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM) {
+					running = false;
 				}
+				break;
 			}
+			case BUXTON_EVENT_SMACK:
+				if (!buxton_cache_smack_rules()) {
+					exit(EXIT_FAILURE);
+				}
+				buxton_log("Reloaded Smack access rules\n");
+				/* discard inotify data itself */
+				while (read(source->fd, &discard, 256) == 256);
+				break;
+			case BUXTON_EVENT_TIMER: {
+				uint64_t expirations;
 
-			if (self.accepting[i] == true) {
+				if (read(source->fd, &expirations, sizeof(uint64_t)) < 0 &&
+				    errno != EAGAIN) {
+					buxton_log("read(): %m\n");
+				}
+				buxtond_send_pending(&self);
+				break;
+			}
+			case BUXTON_EVENT_LISTEN: {
 				struct timeval tv;
 				int fd;
 				int on = 1;
 
 				addr_len = sizeof(remote);
 
-				if ((fd = accept(self.pollfds[i].fd,
+				if ((fd = accept(source->fd,
 						 (struct sockaddr *)&remote, &addr_len)) == -1) {
 					buxton_log("accept(): %m\n");
 					break;
 				}
 
-				buxton_debug("New client fd %d connected through fd %d\n", fd, self.pollfds[i].fd);
+				buxton_debug("New client fd %d connected through fd %d\n", fd, source->fd);
 
 				if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
 					close(fd);
@@ -325,10 +391,17 @@ int main(int argc, char *argv[])
 
 				cl->fd = fd;
 				cl->cred = (struct ucred) {0, 0, 0};
-				LIST_PREPEND(client_list_item, item, self.client_list, cl);
+				cl->source.type = BUXTON_EVENT_CLIENT;
+				cl->source.fd = fd;
+				cl->source.client = cl;
 
-				/* poll for data on this new client as well */
-				add_pollfd(&self, cl->fd, POLLIN | POLLPRI, false);
+				/* wait for data on this new client as well */
+				if (!add_event_source(&self, &cl->source, EPOLLIN | EPOLLPRI)) {
+					close(fd);
+					free(cl);
+					break;
+				}
+				LIST_PREPEND(client_list_item, item, self.client_list, cl);
 
 				/* Mark our packets as high prio */
 				if (setsockopt(cl->fd, SOL_SOCKET, SO_PRIORITY, &on, sizeof(on)) == -1) {
@@ -342,26 +415,40 @@ int main(int argc, char *argv[])
 					       sizeof(struct timeval)) == -1) {
 					buxton_log("setsockopt(SO_RCVTIMEO): %m\n");
 				}
-
-				/* check if this is optimal or not */
 				break;
 			}
-
-			assert(self.accepting[i] == 0);
-			if (smackfd >= 0) {
-				assert(self.pollfds[i].fd != smackfd);
-			}
-
-			/* handle data on any connection */
-			/* TODO: Replace with hash table lookup */
-			LIST_FOREACH(item, cl, self.client_list)
-				if (self.pollfds[i].fd == cl->fd) {
+			case BUXTON_EVENT_CLIENT:
+				cl = source->client;
+				assert(cl);
+				if (cl->closing) {
+					terminate_client(&self, cl);
 					break;
 				}
+				/*
+				 * Finish queued output and any list being
+				 * streamed before taking new requests, which
+				 * wait for the EPOLLIN that follows
+				 */
+				if (cl->out_count > 0) {
+					if (!flush_client(&self, cl)) {
+						terminate_client(&self, cl);
+						break;
+					}
+					if (cl->out_count == 0 &&
+					    !buxtond_continue_stream(&self, cl)) {
+						terminate_client(&self, cl);
+					}
+					break;
+				}
+				/* handle data on any connection */
+				if (handle_client(&self, cl)) {
+					leftover_messages = true;
+				}
+				break;
+			}
 
-			assert(cl);
-			if (handle_client(&self, cl, i)) {
-				leftover_messages = true;
+			if (!running) {
+				break;
 			}
 		}
 	}
@@ -371,36 +458,33 @@ int main(int argc, char *argv[])
 	if (manual_start) {
 		unlink(buxton_socket());
 	}
-	for (int i = 0; i < self.nfds; i++) {
-		close(self.pollfds[i].fd);
+	for (BuxtonEventSource *i = self.sources; i;) {
+		BuxtonEventSource *j = i->source_next;
+		close(i->fd);
+		free(i);
+		i = j;
 	}
 	for (client_list_item *i = self.client_list; i;) {
 		client_list_item *j = i->item_next;
+		BuxtonNotification *notif, *next;
+		LIST_FOREACH_SAFE(subscription, notif, next, i->prefixes) {
+			free(notif->prefix);
+			free(notif);
+		}
+		hashmap_free(i->watched);
+		close(i->fd);
 		free(i);
 		i = j;
 	}
+	close(self.epoll_fd);
 	/* Clean up notification lists */
-	HASHMAP_FOREACH_KEY(map_list, notify_key, self.notify_mapping, iter) {
-		hashmap_remove(self.notify_mapping, notify_key);
-		BuxtonList *elem;
-		BUXTON_LIST_FOREACH(map_list, elem) {
-			BuxtonNotification *notif = (BuxtonNotification*)elem->data;
-			if (notif->old_data) {
-				free_buxton_data(&(notif->old_data));
-			}
-		}
-		free(notify_key);
-		buxton_list_free_all(&map_list);
-	}
-
-	/* Clean up key lists */
-	HASHMAP_FOREACH_KEY(key_list, client_fd, self.client_key_mapping, iter) {
-		hashmap_remove(self.client_key_mapping, client_fd);
-		buxton_list_free_all(&key_list);
-		free(client_fd);
+	HASHMAP_FOREACH(watch, self.notify_mapping, iter) {
+		hashmap_remove(self.notify_mapping, watch->name);
+		free_watch(watch);
 	}
 	hashmap_free(self.notify_mapping);
-	hashmap_free(self.client_key_mapping);
+	buxton_trie_free(self.notify_prefixes);
+	free(self.params);
 	buxton_direct_close(&self.buxton);
 	return EXIT_SUCCESS;
 }
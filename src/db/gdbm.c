@@ -351,7 +351,7 @@ static bool list_keys(BuxtonLayer *layer,
 
 end:
 	if (!ret && k_list) {
-		for (uint16_t i = 0; i < k_list->len; i++) {
+		for (uint32_t i = 0; i < k_list->len; i++) {
 			current = buxton_array_get(k_list, i);
 			if (!current) {
 				break;
@@ -364,29 +364,57 @@ end:
 	return ret;
 }
 
-static bool list_names(BuxtonLayer *layer,
-		       BuxtonString *group,
-		       BuxtonString *prefix,
-		       BuxtonArray **list)
+/* Returns the name a key contributes to a listing, or NULL */
+static char *match_name(datum key, BuxtonString *group, BuxtonString *prefix,
+			uint32_t *length)
 {
-	GDBM_FILE db;
-	datum key, nextkey;
-	BuxtonArray *k_list = NULL;
-	BuxtonData *data = NULL;
 	char *gname;
-	char *value;
-	char *copy;
+	char *value = NULL;
 	uint32_t glen;
 	uint32_t klen;
-	uint32_t length;
-	bool ret = false;
+
+	gname = (char*)key.dptr;
+	glen = (uint32_t)strlen(gname) + 1;
+	assert(key.dsize >= (size_t)glen);
+	klen = (uint32_t)key.dsize - glen;
+	assert(!klen || klen == (uint32_t)strlen(gname+glen) + 1);
+
+	if (klen) {
+		/* it is a key */
+		if (group && glen == group->length &&
+		    !strcmp(gname, group->value)) {
+			value = gname + glen;
+			*length = klen;
+		}
+	} else if (!group) {
+		/* it is a group */
+		value = gname;
+		*length = glen;
+	}
+
+	if (value && prefix &&
+	    strncmp(value, prefix->value, prefix->length - 1)) {
+		value = NULL;
+	}
+	return value;
+}
+
+static int scan_names(BuxtonLayer *layer, BuxtonString *group,
+		      BuxtonString *prefix, BuxtonString *cursor,
+		      module_name_func func, void *user_data)
+{
+	GDBM_FILE db;
+	datum key, nextkey;
+	BuxtonString name;
 
 	assert(layer);
 	assert(group);
+	assert(cursor);
+	assert(func);
 
 	db = db_for_resource(layer);
 	if (!db) {
-		goto end;
+		return ENOENT;
 	}
 
 	if (!group->length) {
@@ -396,56 +424,125 @@ static bool list_names(BuxtonLayer *layer,
 		prefix = NULL;
 	}
 
-	value = NULL;
+	if (cursor->value) {
+		/* Resume after the last key visited, if it is still there */
+		key.dptr = cursor->value;
+		key.dsize = (int)cursor->length;
+		if (!gdbm_exists(db, key)) {
+			return ESTALE;
+		}
+		key = gdbm_nextkey(db, key);
+		free(cursor->value);
+		cursor->value = NULL;
+		cursor->length = 0;
+	} else {
+		key = gdbm_firstkey(db);
+	}
+
+	while (key.dptr) {
+		name.value = match_name(key, group, prefix, &name.length);
+		if (name.value && !func(&name, user_data)) {
+			/* The cursor keeps the key to resume after */
+			cursor->value = key.dptr;
+			cursor->length = (uint32_t)key.dsize;
+			return 0;
+		}
+
+		/* Visit the next key */
+		nextkey = gdbm_nextkey(db, key);
+		free(key.dptr);
+		key = nextkey;
+	}
+
+	return 0;
+}
+
+static bool collect_name(BuxtonString *name, void *user_data)
+{
+	BuxtonArray *list = user_data;
+	BuxtonData *data;
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+	data->type = BUXTON_TYPE_STRING;
+	if (!buxton_string_copy(name, &data->store.d_string)) {
+		abort();
+	}
+	if (!buxton_array_add(list, data)) {
+		abort();
+	}
+	return true;
+}
+
+static bool list_names(BuxtonLayer *layer,
+		       BuxtonString *group,
+		       BuxtonString *prefix,
+		       BuxtonArray **list)
+{
+	BuxtonArray *k_list;
+	BuxtonString cursor = { NULL, 0 };
+
 	k_list = buxton_array_new();
+	if (!k_list) {
+		abort();
+	}
+	if (scan_names(layer, group, prefix, &cursor, collect_name, k_list)) {
+		buxton_array_free(&k_list, (buxton_free_func)data_free);
+		return false;
+	}
+
+	/* Pass ownership of the array to the caller */
+	*list = k_list;
+	return true;
+}
+
+static int scan_group(BuxtonLayer *layer, BuxtonString *group,
+		      module_group_func func, void *user_data)
+{
+	GDBM_FILE db;
+	datum key, nextkey;
+	datum value;
+	BuxtonData data;
+	BuxtonString label;
+	BuxtonString name;
+	char *gname;
+	uint32_t glen;
+
+	assert(layer);
+	assert(group);
+	assert(func);
+
+	db = db_for_resource(layer);
+	if (!db) {
+		return ENOENT;
+	}
+
+	/* Keys are stored as "group\0name\0", so one pass visits them all */
 	key = gdbm_firstkey(db);
-	/* Iterate through all of the keys */
 	while (key.dptr) {
-
-		/* get main data of the key */
 		gname = (char*)key.dptr;
 		glen = (uint32_t)strlen(gname) + 1;
 		assert(key.dsize >= (size_t)glen);
-		klen = (uint32_t)key.dsize - glen;
-		assert(!klen || klen == (uint32_t)strlen(gname+glen) + 1);
-
-		/* treat the key value if it*/
-		if (klen) {
-			/* it is a key */
-			if (group && glen == group->length
-				&& !strcmp(gname, group->value)) {
-				value = gname + glen;
-				length = klen;
-			}
-		} else {
-			/* it is a group */
-			if (!group) {
-				value = gname;
-				length = glen;
-			}
-		}
 
-		/* treat a potential value */
-		if (value) {
-			/* check the prefix */
-			if (!prefix || !strncmp(value, prefix->value,
-				prefix->length - 1))  {
-				/* add the value */
-				data = malloc0(sizeof(BuxtonData));
-				copy = malloc(length);
-				if (data && copy
-				    && buxton_array_add(k_list, data)) {
-					data->type = BUXTON_TYPE_STRING;
-					data->store.d_string.value = copy;
-					data->store.d_string.length = length;
-					memcpy(copy, value, length);
-				} else {
-					free(data);
-					free(copy);
-					goto end;
+		if ((uint32_t)key.dsize > glen && glen == group->length &&
+		    !strcmp(gname, group->value)) {
+			value = gdbm_fetch(db, key);
+			if (value.dsize >= 0 && value.dptr) {
+				name.value = gname + glen;
+				name.length = (uint32_t)key.dsize - glen;
+				memzero(&data, sizeof(BuxtonData));
+				memzero(&label, sizeof(BuxtonString));
+				buxton_deserialize((uint8_t *)value.dptr, &data,
+						   &label);
+				func(&name, &data, &label, user_data);
+				if (data.type == BUXTON_TYPE_STRING) {
+					free(data.store.d_string.value);
 				}
+				free(label.value);
+				free(value.dptr);
 			}
-			value = NULL;
 		}
 
 		/* Visit the next key */
@@ -454,15 +551,7 @@ static bool list_names(BuxtonLayer *layer,
 		key = nextkey;
 	}
 
-	/* Pass ownership of the array to the caller */
-	*list = k_list;
-	ret = true;
-
-end:
-	if (!ret && k_list) {
-		buxton_array_free(&k_list, (buxton_free_func)data_free);
-	}
-	return ret;
+	return 0;
 }
 
 _bx_export_ void buxton_module_destroy(void)
@@ -491,6 +580,8 @@ _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
 	backend->get_value = &get_value;
 	backend->list_keys = &list_keys;
 	backend->list_names = &list_names;
+	backend->scan_names = &scan_names;
+	backend->get_group = &scan_group;
 	backend->unset_value = &unset_value;
 	backend->create_db = (module_db_init_func) &db_for_resource;
 
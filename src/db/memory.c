@@ -46,12 +46,22 @@ struct valrec {
 	BuxtonString label; /**< Recorded label */
 };
 
+/* DJB's hash function over the bytes of a stored key */
+static unsigned hash_bytes(const char *value, uint32_t sz)
+{
+	unsigned hash = 5381;
+
+	while (sz) {
+		hash = (hash << 5) + hash + (unsigned char)value[--sz];
+	}
+	return hash;
+}
+
 /* creates a keyrec from the key */
 static struct keyrec *make_keyrec(_BuxtonKey *key)
 {
 	uint32_t sz;
 	struct keyrec *result;
-        unsigned hash;
 
 	/* compute requested size */
 	sz = key->group.length;
@@ -78,12 +88,7 @@ static struct keyrec *make_keyrec(_BuxtonKey *key)
 		       key->name.length);
 	}
 
-        /* DJB's hash function */
-        hash = 5381;
-        while (sz) {
-                hash = (hash << 5) + hash + (unsigned char)result->value[--sz];
-	}
-	result->hash = hash;
+	result->hash = hash_bytes(result->value, sz);
 
 	return result;
 }
@@ -403,30 +408,58 @@ static int unset_value(BuxtonLayer *layer,
 	}
 }
 
-static bool list_names(BuxtonLayer *layer,
-		       BuxtonString *group,
-		       BuxtonString *prefix,
-		       BuxtonArray **ret_list)
+/* Returns the name a stored key contributes to a listing, or NULL */
+static char *match_name(struct keyrec *keyrec, BuxtonString *group,
+			BuxtonString *prefix, uint32_t *length)
 {
-	Hashmap *db;
-	BuxtonArray *list = NULL;
-	BuxtonData *data;
-	Iterator iterator;
-	BuxtonArray *array;
 	char *gname;
-	char *value;
-	char *copy;
+	char *value = NULL;
 	uint32_t glen;
 	uint32_t klen;
-	uint32_t length;
-	bool ret = false;
+
+	gname = keyrec->value;
+	glen = (uint32_t)strlen(gname) + 1;
+	assert(keyrec->size >= glen);
+	klen = keyrec->size - glen;
+	assert(!klen || klen == (uint32_t)strlen(gname+glen) + 1);
+
+	if (klen) {
+		/* it is a key */
+		if (group && glen == group->length &&
+		    !strcmp(gname, group->value)) {
+			value = gname + glen;
+			*length = klen;
+		}
+	} else if (!group) {
+		/* it is a group */
+		value = gname;
+		*length = glen;
+	}
+
+	if (value && prefix &&
+	    strncmp(value, prefix->value, prefix->length - 1)) {
+		value = NULL;
+	}
+	return value;
+}
+
+static int scan_names(BuxtonLayer *layer, BuxtonString *group,
+		      BuxtonString *prefix, BuxtonString *cursor,
+		      module_name_func func, void *user_data)
+{
+	Hashmap *db;
+	Iterator iterator = ITERATOR_FIRST;
+	BuxtonString name;
 	struct keyrec *keyrec;
+	struct keyrec at;
 
 	assert(layer);
+	assert(cursor);
+	assert(func);
 
 	db = _db_for_resource(layer);
 	if (!db) {
-		goto end;
+		return ENOENT;
 	}
 
 	if (group && !group->length) {
@@ -436,68 +469,109 @@ static bool list_names(BuxtonLayer *layer,
 		prefix = NULL;
 	}
 
-	value = NULL;
-	list = buxton_array_new();
-
-	/* Iterate through all of the keys */
-	HASHMAP_FOREACH_KEY(array, keyrec, db, iterator) {
-
-		/* get main data of the key */
-		gname = (char*)keyrec->value;
-		glen = (uint32_t)strlen(gname) + 1;
-		assert(keyrec->size >= glen);
-		klen = keyrec->size - glen;
-		assert(!klen || klen == (uint32_t)strlen(gname+glen) + 1);
-
-		/* treat the key value if it*/
-		if (klen) {
-			/* it is a key */
-			if (group && glen == group->length
-				&& !strcmp(gname, group->value)) {
-				value = gname + glen;
-				length = klen;
-			}
-		} else {
-			/* it is a group */
-			if (!group) {
-				value = gname;
-				length = glen;
-			}
+	if (cursor->value) {
+		/* Resume after the last key visited, if it is still there */
+		at.value = cursor->value;
+		at.size = cursor->length;
+		at.hash = hash_bytes(at.value, at.size);
+		if (!hashmap_iterate_skip(db, &at, &iterator)) {
+			return ESTALE;
 		}
-
-		/* treat a potential value */
-		if (value) {
-			/* check the prefix */
-			if (!prefix || !strncmp(value, prefix->value,
-				prefix->length - 1))  {
-				/* add the value */
-				data = malloc0(sizeof(BuxtonData));
-				copy = malloc(length);
-				if (data && copy &&
-				    buxton_array_add(list, data)) {
-					data->type = BUXTON_TYPE_STRING;
-					data->store.d_string.value = copy;
-					data->store.d_string.length = length;
-					memcpy(copy, value, length);
-				} else {
-					free(data);
-					free(copy);
-					goto end;
-				}
+		(void)hashmap_iterate(db, &iterator, NULL);
+		free(cursor->value);
+		cursor->value = NULL;
+		cursor->length = 0;
+	}
+
+	while (hashmap_iterate(db, &iterator, (const void **)&keyrec)) {
+		name.value = match_name(keyrec, group, prefix, &name.length);
+		if (name.value && !func(&name, user_data)) {
+			/* The cursor keeps a copy of the key to resume after */
+			cursor->value = malloc(keyrec->size);
+			if (!cursor->value) {
+				abort();
 			}
-			value = NULL;
+			memcpy(cursor->value, keyrec->value, keyrec->size);
+			cursor->length = keyrec->size;
+			return 0;
 		}
 	}
 
+	return 0;
+}
+
+static bool collect_name(BuxtonString *name, void *user_data)
+{
+	BuxtonArray *list = user_data;
+	BuxtonData *data;
+
+	data = malloc0(sizeof(BuxtonData));
+	if (!data) {
+		abort();
+	}
+	data->type = BUXTON_TYPE_STRING;
+	if (!buxton_string_copy(name, &data->store.d_string)) {
+		abort();
+	}
+	if (!buxton_array_add(list, data)) {
+		abort();
+	}
+	return true;
+}
+
+static bool list_names(BuxtonLayer *layer,
+		       BuxtonString *group,
+		       BuxtonString *prefix,
+		       BuxtonArray **ret_list)
+{
+	BuxtonArray *list;
+	BuxtonString cursor = { NULL, 0 };
+
+	list = buxton_array_new();
+	if (!list) {
+		abort();
+	}
+	if (scan_names(layer, group, prefix, &cursor, collect_name, list)) {
+		buxton_array_free(&list, (buxton_free_func)data_free);
+		return false;
+	}
+
 	/* Pass ownership of the array to the caller */
 	*ret_list = list;
-	ret = true;
+	return true;
+}
 
-end:
-	if (!ret && list) {
-		buxton_array_free(&list, (buxton_free_func)data_free);
+static int scan_group(BuxtonLayer *layer, BuxtonString *group,
+		      module_group_func func, void *user_data)
+{
+	Hashmap *db;
+	Iterator iterator;
+	BuxtonString name;
+	struct keyrec *keyrec;
+	struct valrec *valrec;
+	uint32_t glen;
+
+	assert(layer);
+	assert(group);
+	assert(func);
+
+	db = _db_for_resource(layer);
+	if (!db) {
+		return ENOENT;
 	}
-	return ret;
+
+	HASHMAP_FOREACH_KEY(valrec, keyrec, db, iterator) {
+		glen = (uint32_t)strlen(keyrec->value) + 1;
+		if (keyrec->size == glen || glen != group->length ||
+		    strcmp(keyrec->value, group->value)) {
+			continue;
+		}
+		name.value = keyrec->value + glen;
+		name.length = keyrec->size - glen;
+		func(&name, &valrec->data, &valrec->label, user_data);
+	}
+
+	return 0;
 }
 
 _bx_export_ void buxton_module_destroy(void)
@@ -534,6 +608,8 @@ _bx_export_ bool buxton_module_init(BuxtonBackend *backend)
 	backend->unset_value = &unset_value;
 	backend->list_keys = NULL;
 	backend->list_names = list_names;
+	backend->scan_names = scan_names;
+	backend->get_group = scan_group;
 	backend->create_db = NULL;
 
 	_resources = hashmap_new(string_hash_func, string_compare_func);
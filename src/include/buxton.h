@@ -75,6 +75,18 @@ typedef enum BuxtonControlMessage {
 	BUXTON_CONTROL_CHANGED, /**<A key changed in Buxton */
 	BUXTON_CONTROL_GET_LABEL, /**<Get a label from Buxton */
 	BUXTON_CONTROL_LIST_NAMES, /**<List names within Buxton */
+	BUXTON_CONTROL_BATCH, /**<Run several requests in one message */
+	BUXTON_CONTROL_GET_VALUES, /**<Retrieve several values from Buxton */
+	BUXTON_CONTROL_GET_GROUP, /**<Retrieve all values of a group */
+	BUXTON_CONTROL_NOTIFY_PREFIX, /**<Register for notification on a name prefix */
+	BUXTON_CONTROL_UNNOTIFY_PREFIX, /**<Opt out of notifications on a name prefix */
+	BUXTON_CONTROL_HELLO, /**<Agree on the protocol version */
+	BUXTON_CONTROL_REGISTER_KEY, /**<Get a handle for a key */
+	BUXTON_CONTROL_GET_HANDLE, /**<Retrieve a value by key handle */
+	BUXTON_CONTROL_SET_HANDLE, /**<Set a value by key handle */
+	BUXTON_CONTROL_NOTIFY_HANDLE, /**<Register for notification by key handle */
+	BUXTON_CONTROL_CHUNK, /**<Part of a list, the rest follows */
+	BUXTON_CONTROL_OVERFLOW, /**<Notifications to the client were dropped */
 	BUXTON_CONTROL_MAX
 } BuxtonControlMessage;
 
@@ -93,6 +105,11 @@ typedef struct BuxtonKey *BuxtonKey;
  */
 typedef struct BuxtonResponse *BuxtonResponse;
 
+/**
+ * Represents a list of requests sent to Buxton in one message
+ */
+typedef struct BuxtonBatch *BuxtonBatch;
+
 /**
  * Prototype for callback functions
  *
@@ -123,6 +140,48 @@ _bx_export_ int buxton_open(BuxtonClient *client)
  */
 _bx_export_ void buxton_close(BuxtonClient client);
 
+/**
+ * Keep the values buxton_get_value() returns in the client, answering
+ * later gets of the same keys without asking buxtond. Values are
+ * dropped as buxtond notifies changes to their groups, and least
+ * recently used values are evicted past either bound. Calling this
+ * again changes the bounds.
+ * @param client An open client connection
+ * @param max_values Most values to keep, greater than 0
+ * @param max_bytes Most bytes to keep, greater than 0
+ * @return 0 on success, or EINVAL
+ */
+_bx_export_ int buxton_enable_cache(BuxtonClient client,
+				    size_t max_values,
+				    size_t max_bytes)
+	__attribute__((warn_unused_result));
+
+/**
+ * Count the gets a client's cache answered and those it sent on
+ * @param client An open client connection
+ * @param hits Set to the gets answered from the cache, may be NULL
+ * @param misses Set to the gets sent to buxtond, may be NULL
+ */
+_bx_export_ void buxton_get_cache_stats(BuxtonClient client,
+					uint64_t *hits,
+					uint64_t *misses);
+
+/**
+ * Set how long requests sent from now on wait for buxtond's reply
+ * before their callback is dropped, 3000 ms by default
+ * @note The timeout belongs to the connection, not to a request: every
+ * request sent after the call uses it, including the registrations the
+ * cache sends, while requests already sent keep the timeout they were
+ * sent with. To time one request differently, set the timeout before it
+ * and restore it afterwards.
+ * @param client An open client connection
+ * @param timeout_ms Timeout in milliseconds, greater than 0
+ * @return 0 on success, or EINVAL
+ */
+_bx_export_ int buxton_set_request_timeout(BuxtonClient client,
+					   uint32_t timeout_ms)
+	__attribute__((warn_unused_result));
+
 /**
  * Set a value within Buxton
  * @param client An open client connection
@@ -214,6 +273,24 @@ _bx_export_ int buxton_get_value(BuxtonClient client,
 				 bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Register a key on a client connection, so that later gets, sets and
+ * notifications of it send a handle buxtond assigned instead of its
+ * layer, group and name. The key is matched by layer and type as well.
+ * @param client An open client connection
+ * @param key The key to register, with or without a layer
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_key_register(BuxtonClient client,
+				    BuxtonKey key,
+				    BuxtonCallback callback,
+				    void *data,
+				    bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Retrieve a label from Buxton
  * @param client An open client connection
@@ -270,6 +347,74 @@ _bx_export_ int buxton_list_names(BuxtonClient client,
 					bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * List the keys or the groups within a given layer in Buxton, as
+ * buxton_list_names does, handing the names over as buxtond sends them.
+ * The callback runs once for each chunk of names, with a response of
+ * type BUXTON_CONTROL_CHUNK, then once with the last names and the
+ * status of the whole list, with a response of type
+ * BUXTON_CONTROL_LIST_NAMES. Names of the chunks are only valid if that
+ * status is 0.
+ * @param client An open client connection
+ * @param layer_name The layer of the query
+ * @param group_name The group of the query or NULL
+ * @param prefix_filter A filtering prefix that can be NULL
+ * @param callback A callback function to handle daemon replies
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request, which
+ * returns once the callback ran for the last time
+ * @return An boolean value, indicating success of the operation
+ */
+_bx_export_ int buxton_list_names_stream(BuxtonClient client,
+					 const char *layer_name,
+					 const char *group_name,
+					 const char *prefix_filter,
+					 BuxtonCallback callback,
+					 void *data,
+					 bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Retrieve the values of several keys within Buxton in one request
+ *
+ * The callback is run once, with a response of type
+ * BUXTON_CONTROL_GET_VALUES holding a status and a value for each key,
+ * in the order the keys were passed.
+ * @param client An open client connection
+ * @param keys Array of keys to retrieve
+ * @param count Number of keys in the array
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_get_values(BuxtonClient client,
+				  BuxtonKey *keys,
+				  size_t count,
+				  BuxtonCallback callback,
+				  void *data,
+				  bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Retrieve the names and values of every key in a group
+ *
+ * The callback is run once, with a response of type
+ * BUXTON_CONTROL_GET_GROUP holding the keys the client may read.
+ * @param client An open client connection
+ * @param key A group key, with a layer and without a name
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_get_group(BuxtonClient client,
+				 BuxtonKey key,
+				 BuxtonCallback callback,
+				 void *data,
+				 bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Register for notifications on the given key in all layers
  * @param client An open client connection
@@ -286,6 +431,26 @@ _bx_export_ int buxton_register_notification(BuxtonClient client,
 					     bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Register for notifications on the given key in all layers, receiving
+ * at most one per interval. Changes made within an interval are
+ * coalesced into a single notification carrying the latest value.
+ * @param client An open client connection
+ * @param key The key to register interest with
+ * @param interval Minimum milliseconds between notifications, 0 for all
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_register_coalesced_notification(BuxtonClient client,
+						       BuxtonKey key,
+						       uint32_t interval,
+						       BuxtonCallback callback,
+						       void *data,
+						       bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Unregister from notifications on the given key in all layers
  * @param client An open client connection
@@ -302,6 +467,45 @@ _bx_export_ int buxton_unregister_notification(BuxtonClient client,
 					       bool sync)
 	__attribute__((warn_unused_result));
 
+/**
+ * Register for notifications on every key of a group whose name
+ * starts with a prefix, in all layers
+ *
+ * Each change runs the callback with a response of type
+ * BUXTON_CONTROL_CHANGED whose key is the key that changed. For a
+ * whole group, removing it or setting a label in it runs the callback
+ * with a key that has no name.
+ * @param client An open client connection
+ * @param key A key whose name is the prefix, or a group key without a
+ * name to be notified of every key in the group
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_register_prefix_notification(BuxtonClient client,
+						    BuxtonKey key,
+						    BuxtonCallback callback,
+						    void *data,
+						    bool sync)
+	__attribute__((warn_unused_result));
+
+/**
+ * Unregister from notifications on a prefix in all layers
+ * @param client An open client connection
+ * @param key The key the prefix notification was registered with
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_unregister_prefix_notification(BuxtonClient client,
+						      BuxtonKey key,
+						      BuxtonCallback callback,
+						      void *data,
+						      bool sync)
+	__attribute__((warn_unused_result));
+
 /**
  * Unset a value by key in the given BuxtonLayer
  * @param client An open client connection
@@ -327,6 +531,28 @@ _bx_export_ int buxton_unset_value(BuxtonClient client,
 _bx_export_ ssize_t buxton_client_handle_response(BuxtonClient client)
 	__attribute__((warn_unused_result));
 
+/**
+ * Get a file descriptor to integrate a client in an event loop
+ * @note Readable whenever buxton_drain_completions() has callbacks to
+ * run, as replies arrived or callbacks were left queued
+ * @param client An open client connection
+ * @return the file descriptor, owned by the client, or -1 on error
+ */
+_bx_export_ int buxton_completion_fd(BuxtonClient client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Queue the callbacks of the messages on the socket, then run the
+ * oldest queued callbacks
+ * @note Will not block. Callbacks run with no libbuxton lock held, and
+ * those past max stay queued for the next call
+ * @param client An open client connection
+ * @param max Most callbacks to run
+ * @return Number of callbacks run or -1 if there was an error
+ */
+_bx_export_ ssize_t buxton_drain_completions(BuxtonClient client, size_t max)
+	__attribute__((warn_unused_result));
+
 /**
  * Create a key for item lookup in buxton
  * @param group Pointer to a character string representing a group
@@ -427,6 +653,7 @@ _bx_export_ BuxtonDataType buxton_response_value_type(BuxtonResponse response)
 /**
  * Get the count of value for a buxton response of get list of keys
  * Applicable if buxton_response_type(response) == BUXTON_CONTROL_LIST_NAMES
+ * or BUXTON_CONTROL_CHUNK
  * @param response a BuxtonResponse
  * @return the count of items or zero if not applicable
  */
@@ -436,6 +663,7 @@ _bx_export_ uint32_t buxton_response_list_names_count(BuxtonResponse response)
 /**
  * Get the count of value for a buxton response of get list of keys
  * Applicable if buxton_response_type(response) == BUXTON_CONTROL_LIST_NAMES
+ * or BUXTON_CONTROL_CHUNK
  * The returned value MUST be deleted using free.
  * @param response a BuxtonResponse
  * @param index the index of the queried item
@@ -444,6 +672,189 @@ _bx_export_ uint32_t buxton_response_list_names_count(BuxtonResponse response)
 _bx_export_ char *buxton_response_list_names_item(BuxtonResponse response, uint32_t index)
 	__attribute__((warn_unused_result));
 
+/**
+ * Get the count of keys in a buxton response to a multi-key get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_VALUES
+ * @param response a BuxtonResponse
+ * @return the count of keys or zero if not applicable
+ */
+_bx_export_ uint32_t buxton_response_values_count(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the status for one key of a buxton response to a multi-key get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_VALUES
+ * @param response a BuxtonResponse
+ * @param index the index of the queried key
+ * @return 0 if the value was retrieved, non-zero on failure or bad index
+ */
+_bx_export_ int32_t buxton_response_values_status(BuxtonResponse response,
+						  uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the value for one key of a buxton response to a multi-key get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_VALUES
+ * The returned value MUST be deleted using free.
+ * @param response a BuxtonResponse
+ * @param index the index of the queried key
+ * @return pointer to the value or NULL if not applicable, failed or bad index
+ */
+_bx_export_ void *buxton_response_values_item(BuxtonResponse response,
+					      uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the type of the value for one key of a buxton response to a multi-key get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_VALUES
+ * @param response a BuxtonResponse
+ * @param index the index of the queried key
+ * @return The type of the value or -1 if not applicable, failed or bad index
+ */
+_bx_export_ BuxtonDataType buxton_response_values_item_type(BuxtonResponse response,
+							    uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the count of keys in a buxton response to a group get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_GROUP
+ * @param response a BuxtonResponse
+ * @return the count of keys or zero if not applicable
+ */
+_bx_export_ uint32_t buxton_response_group_count(BuxtonResponse response)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the name of one key of a buxton response to a group get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_GROUP
+ * The returned name MUST be deleted using free.
+ * @param response a BuxtonResponse
+ * @param index the index of the key
+ * @return a copy of the name or NULL if not applicable or bad index
+ */
+_bx_export_ char *buxton_response_group_item_name(BuxtonResponse response,
+						  uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the value of one key of a buxton response to a group get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_GROUP
+ * The returned value MUST be deleted using free.
+ * @param response a BuxtonResponse
+ * @param index the index of the key
+ * @return pointer to the value or NULL if not applicable or bad index
+ */
+_bx_export_ void *buxton_response_group_item_value(BuxtonResponse response,
+						   uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Get the type of the value of one key of a buxton response to a group get
+ * Applicable if buxton_response_type(response) == BUXTON_CONTROL_GET_GROUP
+ * @param response a BuxtonResponse
+ * @param index the index of the key
+ * @return The type of the value or -1 if not applicable or bad index
+ */
+_bx_export_ BuxtonDataType buxton_response_group_item_type(BuxtonResponse response,
+							   uint32_t index)
+	__attribute__((warn_unused_result));
+
+/**
+ * Create an empty batch of requests
+ * The returned batch MUST be deleted using buxton_batch_free.
+ * @return An empty BuxtonBatch or NULL on failure
+ */
+_bx_export_ BuxtonBatch buxton_batch_new(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a batch and any requests still queued in it
+ * @param batch The BuxtonBatch to free
+ */
+_bx_export_ void buxton_batch_free(BuxtonBatch batch);
+
+/**
+ * Queue a get value request in a batch
+ * @param batch The BuxtonBatch to add the request to
+ * @param key The key to retrieve
+ * @param callback A callback function to handle the request's reply
+ * @param data User data to be used with callback function
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_get_value(BuxtonBatch batch,
+				       BuxtonKey key,
+				       BuxtonCallback callback,
+				       void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Queue a set value request in a batch
+ * The value is copied, so it may be released once this call returns.
+ * @param batch The BuxtonBatch to add the request to
+ * @param key The key to set
+ * @param value A pointer to a supported data type
+ * @param callback A callback function to handle the request's reply
+ * @param data User data to be used with callback function
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_set_value(BuxtonBatch batch,
+				       BuxtonKey key,
+				       const void *value,
+				       BuxtonCallback callback,
+				       void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Queue an unset value request in a batch
+ * @param batch The BuxtonBatch to add the request to
+ * @param key The key to unset
+ * @param callback A callback function to handle the request's reply
+ * @param data User data to be used with callback function
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_unset_value(BuxtonBatch batch,
+					 BuxtonKey key,
+					 BuxtonCallback callback,
+					 void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Queue a get label request in a batch
+ * @param batch The BuxtonBatch to add the request to
+ * @param key The group or key to retrieve the label of
+ * @param callback A callback function to handle the request's reply
+ * @param data User data to be used with callback function
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_get_label(BuxtonBatch batch,
+				       BuxtonKey key,
+				       BuxtonCallback callback,
+				       void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send every request queued in a batch to Buxton in a single message
+ *
+ * Requests run in the order they were added and each one's callback
+ * gets the same response it would get if sent on its own. After
+ * those, the batch callback gets a response of type
+ * BUXTON_CONTROL_BATCH whose status is 0 only if every request
+ * succeeded. The queued requests are handed over, so the batch is
+ * empty again once this call returns.
+ * @param client An open client connection
+ * @param batch The BuxtonBatch to send
+ * @param callback A callback function run after all request callbacks
+ * @param data User data to be used with callback function
+ * @param sync Indicator for running a synchronous request
+ * @return An int value, indicating success of the operation
+ */
+_bx_export_ int buxton_batch_submit(BuxtonClient client,
+				    BuxtonBatch batch,
+				    BuxtonCallback callback,
+				    void *data,
+				    bool sync)
+	__attribute__((warn_unused_result));
+
 /*
  * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
  *
@@ -142,3 +142,15 @@ _bx_export_ bool sbuxton_get_bool(char *key);
  * @param layer A layer name that is a string (char *)
  */
 _bx_export_ void sbuxton_remove_group(char *group_name, char *layer);
+/**
+ * Keeps the values got in a cache, dropped as buxtond notifies changes to them
+ * Applies to the current connection and to the ones opened afterwards
+ * @param max_values Most values to hold
+ * @param max_bytes Most bytes to hold
+ */
+_bx_export_ void sbuxton_enable_cache(size_t max_values, size_t max_bytes);
+/**
+ * Closes the connection kept open across calls, and frees its keys
+ * The next call opens a new connection
+ */
+_bx_export_ void sbuxton_close(void);
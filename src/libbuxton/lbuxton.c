@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -31,17 +32,23 @@
 #include <stdint.h>
 
 #include "buxton.h"
+#include "buxtonbatch.h"
 #include "buxtonclient.h"
 #include "buxtonkey.h"
 #include "buxtonresponse.h"
 #include "buxtonstring.h"
+#include "clientcache.h"
+#include "completion.h"
 #include "configurator.h"
 #include "hashmap.h"
 #include "log.h"
 #include "protocol.h"
+#include "snapshot.h"
 #include "util.h"
 
+static pthread_mutex_t key_guard = PTHREAD_MUTEX_INITIALIZER;
 static Hashmap *key_hash = NULL;
+static unsigned int open_clients = 0;
 
 int buxton_set_conf_file(const char *path)
 {
@@ -66,7 +73,7 @@ int buxton_open(BuxtonClient *client)
 {
 	_BuxtonClient **c = (_BuxtonClient **)client;
 	_BuxtonClient *cl = NULL;
-	int bx_socket, r;
+	int bx_socket, r, saved_errno;
 	struct sockaddr_un remote;
 	size_t sock_name_len;
 
@@ -95,13 +102,14 @@ int buxton_open(BuxtonClient *client)
 		return -1;
 	}
 
-	if (!setup_callbacks()) {
+	cl = malloc0(sizeof(_BuxtonClient));
+	if (!cl) {
 		close(bx_socket);
 		return -1;
 	}
 
-	cl = malloc0(sizeof(_BuxtonClient));
-	if (!cl) {
+	if (!setup_callbacks(cl)) {
+		free(cl);
 		close(bx_socket);
 		return -1;
 	}
@@ -109,24 +117,76 @@ int buxton_open(BuxtonClient *client)
 	cl->fd = bx_socket;
 	*c = cl;
 
+	/*
+	 * Without an answer, keep to protocol version 1. Reading the reply
+	 * leaves EAGAIN behind, which callers must not see on success.
+	 */
+	saved_errno = errno;
+	if (!buxton_wire_hello(cl) || buxton_wire_get_response(cl) <= 0) {
+		buxton_debug("No reply to HELLO, using protocol version 1\n");
+	}
+	errno = saved_errno;
+
+	pthread_mutex_lock(&key_guard);
+	open_clients++;
+	pthread_mutex_unlock(&key_guard);
+
 	return bx_socket;
 }
 
-void buxton_close(BuxtonClient client)
+static void free_client(_BuxtonClient *c)
 {
-	_BuxtonClient *c;
-	BuxtonKey key = NULL;
-	Iterator i;
+	cleanup_callbacks(c);
+	buxton_client_cache_free(c->cache);
+	buxton_completion_queue_free(c->completions);
+	if (c->snapshot) {
+		buxton_snapshot_view_close(c->snapshot);
+		free(c->snapshot);
+	}
+	close(c->fd);
+	c->direct = 0;
+	c->fd = -1;
+	free(c);
+}
 
-	/* Free all remaining allocated keys */
-	HASHMAP_FOREACH_KEY(key, key, key_hash, i) {
-		hashmap_remove_value(key_hash, key, key);
-		buxton_key_free(key);
+/* Free the client if one of the callbacks just run closed it */
+static void release(_BuxtonClient *c)
+{
+	if (buxton_wire_release(c)) {
+		free_client(c);
 	}
+}
+
+/* Wait for a reply to a sync request, whose callback may close the client */
+static int wait_response(_BuxtonClient *c)
+{
+	int ret;
+
+	buxton_wire_hold(c);
+	ret = buxton_wire_get_response(c);
+	release(c);
+
+	return ret;
+}
 
-	hashmap_free(key_hash);
+void buxton_close(BuxtonClient client)
+{
+	_BuxtonClient *c;
+	_BuxtonKey *key;
 
-	key_hash = NULL;
+	/* Keys aren't tied to a client, free those left once none is open */
+	pthread_mutex_lock(&key_guard);
+	if (client && open_clients > 0) {
+		open_clients--;
+	}
+	if (open_clients == 0 && key_hash) {
+		while ((key = hashmap_steal_first(key_hash))) {
+			key_free(key);
+		}
+		hashmap_free(key_hash);
+		key_hash = NULL;
+	}
+	pthread_mutex_unlock(&key_guard);
 
 	if (!client) {
 		return;
@@ -134,11 +194,164 @@ void buxton_close(BuxtonClient client)
 
 	c = (_BuxtonClient *)client;
 
-	cleanup_callbacks();
-	close(c->fd);
-	c->direct = 0;
-	c->fd = -1;
-	free(c);
+	/* Closed by a callback, freed once the callbacks are done */
+	if (!buxton_wire_close(c)) {
+		return;
+	}
+	free_client(c);
+}
+
+int buxton_enable_cache(BuxtonClient client, size_t max_values,
+			size_t max_bytes)
+{
+	_BuxtonClient *c = (_BuxtonClient *)client;
+
+	if (!c || max_values == 0 || max_bytes == 0) {
+		return EINVAL;
+	}
+
+	if (c->cache) {
+		buxton_client_cache_resize(c->cache, max_values, max_bytes);
+	} else {
+		c->cache = buxton_client_cache_new(max_values, max_bytes);
+	}
+
+	return 0;
+}
+
+void buxton_get_cache_stats(BuxtonClient client, uint64_t *hits,
+			    uint64_t *misses)
+{
+	_BuxtonClient *c = (_BuxtonClient *)client;
+	uint64_t h = 0, m = 0;
+
+	if (c && c->cache) {
+		pthread_mutex_lock(&c->cache->lock);
+		h = c->cache->hits;
+		m = c->cache->misses;
+		pthread_mutex_unlock(&c->cache->lock);
+	}
+	if (hits) {
+		*hits = h;
+	}
+	if (misses) {
+		*misses = m;
+	}
+}
+
+int buxton_set_request_timeout(BuxtonClient client, uint32_t timeout_ms)
+{
+	if (!client || timeout_ms == 0) {
+		return EINVAL;
+	}
+
+	set_callback_timeout((_BuxtonClient *)client, timeout_ms);
+
+	return 0;
+}
+
+/*
+ * Run the callback of a get answered without buxtond. Once the client
+ * queues its callbacks, it is queued behind the older ones, which run
+ * first if the get is sync.
+ */
+static void answer_get(_BuxtonClient *client, _BuxtonKey *key,
+		       BuxtonData *value, BuxtonCallback callback, void *data,
+		       bool sync)
+{
+	BuxtonData list[2];
+
+	list[0].type = BUXTON_TYPE_INT32;
+	list[0].store.d_int32 = 0;
+	list[1] = *value;
+	if (client->completions) {
+		buxton_completion_post(client->completions, callback, data, 2,
+				       list, BUXTON_CONTROL_GET, key);
+		if (sync) {
+			(void)buxton_wire_run_completions(client, SIZE_MAX);
+		}
+	} else {
+		run_callback(callback, data, 2, list, BUXTON_CONTROL_GET, key);
+	}
+	if (value->type == BUXTON_TYPE_STRING) {
+		free(value->store.d_string.value);
+	}
+}
+
+/*
+ * Answer a get from the values kept by the client. On a miss for a
+ * group not yet watched, registers for changes to the whole group, so
+ * that the value got next can be kept, and sets registered.
+ */
+static bool get_cached_value(_BuxtonClient *client, _BuxtonKey *key,
+			     BuxtonCallback callback, void *data, bool sync,
+			     bool *registered)
+{
+	BuxtonData value;
+	ssize_t r;
+	bool watch;
+
+	/* Changes buxtond already sent must be seen before a hit */
+	if (client->completions) {
+		r = buxton_wire_queue_responses(client, client->completions);
+	} else {
+		r = buxton_wire_handle_response(client);
+	}
+	if (r < 0) {
+		return false;
+	}
+
+	if (!buxton_client_cache_get(client->cache, key, &value, &watch)) {
+		if (watch && buxton_wire_watch_group(client, &key->group)) {
+			*registered = true;
+		}
+		return false;
+	}
+
+	answer_get(client, key, &value, callback, data, sync);
+
+	return true;
+}
+
+/*
+ * Answer a get for a key of a given layer from the snapshot buxtond
+ * publishes, without a round trip. Whatever it cannot answer, such as
+ * keys not every client may read, is asked of buxtond as before.
+ */
+static bool get_snapshot_value(_BuxtonClient *client, _BuxtonKey *key,
+			       BuxtonCallback callback, void *data, bool sync)
+{
+	BuxtonData value;
+	int ret;
+
+	lock_mutex(client);
+	if (!client->snapshot) {
+		client->snapshot = malloc0(sizeof(BuxtonSnapshotView));
+		if (!client->snapshot) {
+			unlock_mutex(client);
+			return false;
+		}
+		client->snapshot->fd = -1;
+	}
+	if (!client->snapshot->map &&
+	    !buxton_snapshot_view_open(client->snapshot, buxton_snapshot_path())) {
+		unlock_mutex(client);
+		return false;
+	}
+
+	ret = buxton_snapshot_lookup(client->snapshot, key, &value);
+	if (ret == ESTALE) {
+		/* buxtond stopped updating this file, look again next time */
+		buxton_snapshot_view_close(client->snapshot);
+	}
+	unlock_mutex(client);
+	if (ret) {
+		return false;
+	}
+
+	answer_get(client, key, &value, callback, data, sync);
+
+	return true;
 }
 
 int buxton_get_value(BuxtonClient client,
@@ -146,6 +359,63 @@ int buxton_get_value(BuxtonClient client,
 		     BuxtonCallback callback,
 		     void *data,
 		     bool sync)
+{
+	bool r;
+	bool registered = false;
+	int ret = 0;
+	int replies = 0;
+	_BuxtonClient *c = (_BuxtonClient *)client;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!k || !(k->group.value) || !(k->name.value) ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
+	}
+
+	/* Gets answered here run their callback before returning */
+	buxton_wire_hold(c);
+	if (c->cache && get_cached_value(c, k, callback, data, sync,
+					   &registered)) {
+		goto end;
+	}
+
+	/* Layerless gets may resolve to user layers, which are not published */
+	if (k->layer.value && get_snapshot_value(c, k, callback, data, sync)) {
+		goto end;
+	}
+
+	if (c->cache) {
+		r = buxton_wire_get_cached_value(c, k, callback, data);
+	} else {
+		r = buxton_wire_get_value(c, k, callback, data);
+	}
+	if (!r) {
+		ret = -1;
+		goto end;
+	}
+
+	/* The reply to the cache's registration comes first */
+	while (sync && replies < (registered ? 2 : 1) &&
+	       !buxton_wire_closed(c)) {
+		ret = buxton_wire_get_response(client);
+		if (ret <= 0) {
+			ret = -1;
+			goto end;
+		}
+		replies += ret;
+		ret = 0;
+	}
+
+end:
+	release(c);
+	return ret;
+}
+
+int buxton_key_register(BuxtonClient client,
+			BuxtonKey key,
+			BuxtonCallback callback,
+			void *data,
+			bool sync)
 {
 	bool r;
 	int ret = 0;
@@ -156,13 +426,91 @@ int buxton_get_value(BuxtonClient client,
 		return EINVAL;
 	}
 
-	r = buxton_wire_get_value((_BuxtonClient *)client, k, callback, data);
+	r = buxton_wire_register_key((_BuxtonClient *)client, k, callback,
+				     data);
 	if (!r) {
 		return -1;
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_get_values(BuxtonClient client,
+		      BuxtonKey *keys,
+		      size_t count,
+		      BuxtonCallback callback,
+		      void *data,
+		      bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k;
+
+	if (!keys || count == 0) {
+		return EINVAL;
+	}
+
+	if (count > BUXTON_GET_VALUES_MAX_KEYS) {
+		return E2BIG;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		k = (_BuxtonKey *)keys[i];
+		if (!k || !(k->group.value) || !(k->name.value) ||
+		    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+			return EINVAL;
+		}
+	}
+
+	r = buxton_wire_get_values((_BuxtonClient *)client, (_BuxtonKey **)keys,
+				   count, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = wait_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_get_group(BuxtonClient client,
+		     BuxtonKey key,
+		     BuxtonCallback callback,
+		     void *data,
+		     bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	/* We require the key name to be NULL, since it is not used for groups */
+	if (!k || !k->group.value || k->name.value || !k->layer.value) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_get_group((_BuxtonClient *)client, k, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -178,6 +526,17 @@ int buxton_register_notification(BuxtonClient client,
 				 BuxtonCallback callback,
 				 void *data,
 				 bool sync)
+{
+	return buxton_register_coalesced_notification(client, key, 0, callback,
+						      data, sync);
+}
+
+int buxton_register_coalesced_notification(BuxtonClient client,
+					   BuxtonKey key,
+					   uint32_t interval,
+					   BuxtonCallback callback,
+					   void *data,
+					   bool sync)
 {
 	bool r;
 	int ret = 0;
@@ -189,13 +548,13 @@ int buxton_register_notification(BuxtonClient client,
 	}
 
 	r = buxton_wire_register_notification((_BuxtonClient *)client, k,
-					      callback, data);
+					      interval, callback, data);
 	if (!r) {
 		return -1;
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -228,7 +587,71 @@ int buxton_unregister_notification(BuxtonClient client,
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_register_prefix_notification(BuxtonClient client,
+					BuxtonKey key,
+					BuxtonCallback callback,
+					void *data,
+					bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!k || !k->group.value) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_register_prefix_notification((_BuxtonClient *)client,
+						     k, callback, data, NULL);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = wait_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_unregister_prefix_notification(BuxtonClient client,
+					  BuxtonKey key,
+					  BuxtonCallback callback,
+					  void *data,
+					  bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!k || !k->group.value) {
+		return EINVAL;
+	}
+
+	r = buxton_wire_unregister_prefix_notification((_BuxtonClient *)client,
+						       k, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -256,6 +679,7 @@ int buxton_set_value(BuxtonClient client,
 		return EINVAL;
 	}
 
+	buxton_client_cache_invalidate(((_BuxtonClient *)client)->cache, k);
 	r = buxton_wire_set_value((_BuxtonClient *)client, k, value, callback,
 				  data);
 	if (!r) {
@@ -263,7 +687,7 @@ int buxton_set_value(BuxtonClient client,
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -293,6 +717,7 @@ int buxton_set_label(BuxtonClient client,
 	/* discarding const until BuxtonString updated */
 	v = buxton_string_pack((char*)value);
 
+	buxton_client_cache_invalidate(((_BuxtonClient *)client)->cache, k);
 	r = buxton_wire_set_label((_BuxtonClient *)client, k, &v, callback,
 				  data);
 	if (!r) {
@@ -300,7 +725,7 @@ int buxton_set_label(BuxtonClient client,
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -332,7 +757,7 @@ int buxton_get_label(BuxtonClient client,
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -364,7 +789,7 @@ int buxton_create_group(BuxtonClient client,
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -390,13 +815,14 @@ int buxton_remove_group(BuxtonClient client,
 		return EINVAL;
 	}
 
+	buxton_client_cache_invalidate(((_BuxtonClient *)client)->cache, k);
 	r = buxton_wire_remove_group((_BuxtonClient *)client, k, callback, data);
 	if (!r) {
 		return -1;
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -430,7 +856,7 @@ int buxton_client_list_keys(BuxtonClient client,
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -438,83 +864,294 @@ int buxton_client_list_keys(BuxtonClient client,
 		}
 	}
 
-	return ret;
+	return ret;
+}
+
+/* A streamed list is only done once its final status is handled */
+static int request_list_names(BuxtonClient client, const char *layer_name,
+			      const char *group_name, const char *prefix_filter,
+			      bool stream, BuxtonCallback callback, void *data,
+			      bool sync)
+{
+	bool r;
+	int ret = 0;
+	BuxtonString l;
+	BuxtonString g;
+	BuxtonString p;
+	uint32_t msgid;
+
+	if (!layer_name) {
+		return EINVAL;
+	}
+
+	/* discarding const until BuxtonString is updated */
+	l = buxton_string_pack((char*)layer_name);
+
+	if (group_name) {
+		g = buxton_string_pack((char*)group_name); /* discarding const is okay */
+	} else {
+		g.value = NULL;
+		g.length = 0;
+	}
+
+	if (prefix_filter) {
+		p = buxton_string_pack((char*)prefix_filter); /* discarding const is okay */
+	} else {
+		p.value = NULL;
+		p.length = 0;
+	}
+
+	r = buxton_wire_list_names((_BuxtonClient *)client, &l, &g, &p, stream,
+				   callback, data, &msgid);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		buxton_wire_hold(client);
+		do {
+			ret = buxton_wire_get_response(client);
+		} while (ret > 0 && !buxton_wire_closed(client) &&
+			 buxton_wire_waiting(client, msgid));
+		release(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+int buxton_list_names(BuxtonClient client,
+			    const char *layer_name,
+			    const char *group_name,
+			    const char *prefix_filter,
+			    BuxtonCallback callback,
+			    void *data,
+			    bool sync)
+{
+	return request_list_names(client, layer_name, group_name,
+				  prefix_filter, false, callback, data, sync);
+}
+
+int buxton_list_names_stream(BuxtonClient client,
+			     const char *layer_name,
+			     const char *group_name,
+			     const char *prefix_filter,
+			     BuxtonCallback callback,
+			     void *data,
+			     bool sync)
+{
+	return request_list_names(client, layer_name, group_name,
+				  prefix_filter, true, callback, data, sync);
+}
+
+int buxton_unset_value(BuxtonClient client,
+		       BuxtonKey key,
+		       BuxtonCallback callback,
+		       void *data,
+		       bool sync)
+{
+	bool r;
+	int ret = 0;
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!k || !k->group.value || !k->name.value || !k->layer.value ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
+	}
+
+	buxton_client_cache_invalidate(((_BuxtonClient *)client)->cache, k);
+	r = buxton_wire_unset_value((_BuxtonClient *)client, k, callback, data);
+	if (!r) {
+		return -1;
+	}
+
+	if (sync) {
+		ret = wait_response(client);
+		if (ret <= 0) {
+			ret = -1;
+		} else {
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+BuxtonBatch buxton_batch_new(void)
+{
+	_BuxtonBatch *batch;
+
+	batch = malloc0(sizeof(_BuxtonBatch));
+	if (!batch) {
+		return NULL;
+	}
+
+	batch->ops = buxton_array_new();
+	if (!batch->ops) {
+		free(batch);
+		return NULL;
+	}
+
+	return (BuxtonBatch)batch;
+}
+
+void buxton_batch_free(BuxtonBatch batch)
+{
+	_BuxtonBatch *b = (_BuxtonBatch *)batch;
+
+	if (!b) {
+		return;
+	}
+
+	buxton_array_free(&b->ops, batch_op_free);
+	free(b);
+}
+
+static int batch_add(_BuxtonBatch *batch, BuxtonControlMessage type,
+		     _BuxtonKey *key, const void *value,
+		     BuxtonCallback callback, void *data)
+{
+	BuxtonBatchOp *op;
+	BuxtonData v;
+
+	if (batch->ops->len >= BUXTON_BATCH_MAX_OPS) {
+		return E2BIG;
+	}
+
+	op = malloc0(sizeof(BuxtonBatchOp));
+	if (!op) {
+		return -1;
+	}
+
+	op->key = malloc0(sizeof(_BuxtonKey));
+	if (!op->key) {
+		goto fail;
+	}
+	if (!buxton_key_copy(key, op->key)) {
+		free(op->key);
+		op->key = NULL;
+		goto fail;
+	}
+
+	if (value) {
+		buxton_value_to_data(key->type, value, &v);
+		op->value = malloc0(sizeof(BuxtonData));
+		if (!op->value) {
+			goto fail;
+		}
+		if (!buxton_data_copy(&v, op->value)) {
+			goto fail;
+		}
+	}
+
+	op->type = type;
+	op->callback = callback;
+	op->data = data;
+
+	if (!buxton_array_add(batch->ops, op)) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	batch_op_free(op);
+	return -1;
+}
+
+int buxton_batch_get_value(BuxtonBatch batch,
+			   BuxtonKey key,
+			   BuxtonCallback callback,
+			   void *data)
+{
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!batch || !k || !(k->group.value) || !(k->name.value) ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
+	}
+
+	return batch_add((_BuxtonBatch *)batch, BUXTON_CONTROL_GET, k, NULL,
+			 callback, data);
 }
 
-int buxton_list_names(BuxtonClient client,
-			    const char *layer_name,
-			    const char *group_name,
-			    const char *prefix_filter,
-			    BuxtonCallback callback,
-			    void *data,
-			    bool sync)
+int buxton_batch_set_value(BuxtonBatch batch,
+			   BuxtonKey key,
+			   const void *value,
+			   BuxtonCallback callback,
+			   void *data)
 {
-	bool r;
-	int ret = 0;
-	BuxtonString l;
-	BuxtonString g;
-	BuxtonString p;
+	_BuxtonKey *k = (_BuxtonKey *)key;
 
-	if (!layer_name) {
+	if (!batch || !k || !k->group.value || !k->name.value ||
+	    !k->layer.value || k->type <= BUXTON_TYPE_MIN ||
+	    k->type >= BUXTON_TYPE_MAX || k->type == BUXTON_TYPE_UNSET ||
+	    !value) {
 		return EINVAL;
 	}
 
-	/* discarding const until BuxtonString is updated */
-	l = buxton_string_pack((char*)layer_name);
+	return batch_add((_BuxtonBatch *)batch, BUXTON_CONTROL_SET, k, value,
+			 callback, data);
+}
 
-	if (group_name) {
-		g = buxton_string_pack((char*)group_name); /* discarding const is okay */
-	} else {
-		g.value = NULL;
-		g.length = 0;
-	}
+int buxton_batch_unset_value(BuxtonBatch batch,
+			     BuxtonKey key,
+			     BuxtonCallback callback,
+			     void *data)
+{
+	_BuxtonKey *k = (_BuxtonKey *)key;
 
-	if (prefix_filter) {
-		p = buxton_string_pack((char*)prefix_filter); /* discarding const is okay */
-	} else {
-		p.value = NULL;
-		p.length = 0;
+	if (!batch || !k || !k->group.value || !k->name.value ||
+	    !k->layer.value || k->type <= BUXTON_TYPE_MIN ||
+	    k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
 	}
 
-	r = buxton_wire_list_names((_BuxtonClient *)client, &l, &g, &p, callback, data);
-	if (!r) {
-		return -1;
-	}
+	return batch_add((_BuxtonBatch *)batch, BUXTON_CONTROL_UNSET, k, NULL,
+			 callback, data);
+}
 
-	if (sync) {
-		ret = buxton_wire_get_response(client);
-		if (ret <= 0) {
-			ret = -1;
-		} else {
-			ret = 0;
-		}
+int buxton_batch_get_label(BuxtonBatch batch,
+			   BuxtonKey key,
+			   BuxtonCallback callback,
+			   void *data)
+{
+	_BuxtonKey *k = (_BuxtonKey *)key;
+
+	if (!batch || !k || !k->group.value || !k->layer.value ||
+	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+		return EINVAL;
 	}
 
-	return ret;
+	return batch_add((_BuxtonBatch *)batch, BUXTON_CONTROL_GET_LABEL, k,
+			 NULL, callback, data);
 }
 
-int buxton_unset_value(BuxtonClient client,
-		       BuxtonKey key,
-		       BuxtonCallback callback,
-		       void *data,
-		       bool sync)
+int buxton_batch_submit(BuxtonClient client,
+			BuxtonBatch batch,
+			BuxtonCallback callback,
+			void *data,
+			bool sync)
 {
 	bool r;
 	int ret = 0;
-	_BuxtonKey *k = (_BuxtonKey *)key;
+	_BuxtonBatch *b = (_BuxtonBatch *)batch;
 
-	if (!k || !k->group.value || !k->name.value || !k->layer.value ||
-	    k->type <= BUXTON_TYPE_MIN || k->type >= BUXTON_TYPE_MAX) {
+	if (!b || !b->ops->len) {
 		return EINVAL;
 	}
 
-	r = buxton_wire_unset_value((_BuxtonClient *)client, k, callback, data);
+	r = buxton_wire_batch((_BuxtonClient *)client, b, callback, data);
 	if (!r) {
 		return -1;
 	}
 
 	if (sync) {
-		ret = buxton_wire_get_response(client);
+		ret = wait_response(client);
 		if (ret <= 0) {
 			ret = -1;
 		} else {
@@ -544,14 +1181,6 @@ BuxtonKey buxton_key_create(const char *group, const char *name,
 		goto fail;
 	}
 
-	if (!key_hash) {
-		/* Create on hashmap on first call to key_create */
-		key_hash = hashmap_new(trivial_hash_func, trivial_compare_func);
-		if (!key_hash) {
-			return NULL;
-		}
-	}
-
 	g = strdup(group);
 	if (!g) {
 		goto fail;
@@ -595,7 +1224,18 @@ BuxtonKey buxton_key_create(const char *group, const char *name,
 	key->type = type;
 
 	/* Add new keys to internal hash for cleanup on close */
+	pthread_mutex_lock(&key_guard);
+	if (!key_hash) {
+		/* Create on hashmap on first call to key_create */
+		key_hash = hashmap_new(trivial_hash_func, trivial_compare_func);
+		if (!key_hash) {
+			pthread_mutex_unlock(&key_guard);
+			free(key);
+			goto fail;
+		}
+	}
 	hashmap_put(key_hash, key, key);
+	pthread_mutex_unlock(&key_guard);
 
 	return (BuxtonKey)key;
 
@@ -658,7 +1298,9 @@ void buxton_key_free(BuxtonKey key)
 		return;
 	}
 
+	pthread_mutex_lock(&key_guard);
 	hashmap_remove_value(key_hash, key, key);
+	pthread_mutex_unlock(&key_guard);
 
 	free(k->group.value);
 	free(k->name.value);
@@ -668,7 +1310,65 @@ void buxton_key_free(BuxtonKey key)
 
 ssize_t buxton_client_handle_response(BuxtonClient client)
 {
-	return buxton_wire_handle_response((_BuxtonClient *)client);
+	_BuxtonClient *c = (_BuxtonClient *)client;
+	ssize_t ret;
+
+	buxton_wire_hold(c);
+	ret = buxton_wire_handle_response(c);
+	release(c);
+
+	return ret;
+}
+
+/* Created on first use, callbacks of earlier replies ran inline */
+static BuxtonCompletionQueue *completion_queue(_BuxtonClient *client)
+{
+	if (!client->completions) {
+		client->completions = buxton_completion_queue_new(client->fd);
+	}
+
+	return client->completions;
+}
+
+int buxton_completion_fd(BuxtonClient client)
+{
+	BuxtonCompletionQueue *queue;
+
+	if (!client) {
+		return -1;
+	}
+
+	queue = completion_queue((_BuxtonClient *)client);
+	if (!queue) {
+		return -1;
+	}
+
+	return queue->poll_fd;
+}
+
+ssize_t buxton_drain_completions(BuxtonClient client, size_t max)
+{
+	BuxtonCompletionQueue *queue;
+	size_t ran;
+
+	if (!client) {
+		return -1;
+	}
+
+	queue = completion_queue((_BuxtonClient *)client);
+	if (!queue) {
+		return -1;
+	}
+
+	if (buxton_wire_queue_responses((_BuxtonClient *)client, queue) < 0) {
+		return -1;
+	}
+
+	buxton_wire_hold(client);
+	ran = buxton_wire_run_completions(client, max);
+	release(client);
+
+	return (ssize_t)ran;
 }
 
 BuxtonControlMessage buxton_response_type(BuxtonResponse response)
@@ -713,7 +1413,9 @@ BuxtonKey buxton_response_key(BuxtonResponse response)
 		return NULL;
 	}
 
-	if (buxton_response_type(response) == BUXTON_CONTROL_LIST_NAMES) {
+	if (buxton_response_type(response) == BUXTON_CONTROL_LIST_NAMES ||
+	    buxton_response_type(response) == BUXTON_CONTROL_BATCH ||
+	    buxton_response_type(response) == BUXTON_CONTROL_GET_VALUES) {
 		return NULL;
 	}
 
@@ -730,31 +1432,9 @@ BuxtonKey buxton_response_key(BuxtonResponse response)
 	return (BuxtonKey)key;
 }
 
-void *buxton_response_value(BuxtonResponse response)
+static void *data_to_value(BuxtonData *d)
 {
 	void *p = NULL;
-	BuxtonData *d = NULL;
-	_BuxtonResponse *r = (_BuxtonResponse *)response;
-	BuxtonControlMessage type;
-
-	if (!response) {
-		return NULL;
-	}
-
-	type = buxton_response_type(response);
-	if (type == BUXTON_CONTROL_GET || type == BUXTON_CONTROL_GET_LABEL) {
-		d = buxton_array_get(r->data, 1);
-	} else if (type == BUXTON_CONTROL_CHANGED) {
-		if (r->data->len) {
-			d = buxton_array_get(r->data, 0);
-		}
-	} else {
-		goto out;
-	}
-
-	if (!d) {
-		goto out;
-	}
 
 	switch (d->type) {
 	case BUXTON_TYPE_STRING:
@@ -816,6 +1496,34 @@ out:
 	return p;
 }
 
+void *buxton_response_value(BuxtonResponse response)
+{
+	BuxtonData *d = NULL;
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+	BuxtonControlMessage type;
+
+	if (!response) {
+		return NULL;
+	}
+
+	type = buxton_response_type(response);
+	if (type == BUXTON_CONTROL_GET || type == BUXTON_CONTROL_GET_LABEL) {
+		d = buxton_array_get(r->data, 1);
+	} else if (type == BUXTON_CONTROL_CHANGED) {
+		if (r->data->len) {
+			d = buxton_array_get(r->data, 0);
+		}
+	} else {
+		return NULL;
+	}
+
+	if (!d) {
+		return NULL;
+	}
+
+	return data_to_value(d);
+}
+
 BuxtonDataType buxton_response_value_type(BuxtonResponse response)
 {
 	BuxtonData *d = NULL;
@@ -854,7 +1562,7 @@ uint32_t buxton_response_list_names_count(BuxtonResponse response)
 	}
 
 	type = buxton_response_type(response);
-	if (type != BUXTON_CONTROL_LIST_NAMES) {
+	if (type != BUXTON_CONTROL_LIST_NAMES && type != BUXTON_CONTROL_CHUNK) {
 		return 0;
 	}
 	return r->data->len ? ((uint32_t)r->data->len - 1) : 0;
@@ -871,13 +1579,13 @@ char *buxton_response_list_names_item(BuxtonResponse response, uint32_t index)
 	}
 
 	type = buxton_response_type(response);
-	if (type != BUXTON_CONTROL_LIST_NAMES) {
+	if (type != BUXTON_CONTROL_LIST_NAMES && type != BUXTON_CONTROL_CHUNK) {
 		return NULL;
 	}
 	if (index + 1 >= r->data->len) {
 		return NULL;
 	}
-	d = buxton_array_get(r->data, (uint16_t)(index + 1));
+	d = buxton_array_get(r->data, index + 1);
 	if (d == NULL) {
 		return NULL;
 	}
@@ -887,6 +1595,138 @@ char *buxton_response_list_names_item(BuxtonResponse response, uint32_t index)
 	return strdup(d->store.d_string.value);
 }
 
+uint32_t buxton_response_values_count(BuxtonResponse response)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+
+	if (!response) {
+		return 0;
+	}
+
+	if (buxton_response_type(response) != BUXTON_CONTROL_GET_VALUES) {
+		return 0;
+	}
+	return r->data->len ? ((uint32_t)r->data->len - 1) / 2 : 0;
+}
+
+/*
+ * GET_VALUES responses hold the overall status followed by a status
+ * and a value slot for every key, see handle_callback_response
+ */
+static BuxtonData *values_item(BuxtonResponse response, uint32_t index,
+			       uint32_t offset)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+
+	if (index >= buxton_response_values_count(response)) {
+		return NULL;
+	}
+
+	return buxton_array_get(r->data, 1 + 2 * index + offset);
+}
+
+int32_t buxton_response_values_status(BuxtonResponse response, uint32_t index)
+{
+	BuxtonData *d;
+
+	d = values_item(response, index, 0);
+	if (!d || d->type != BUXTON_TYPE_INT32) {
+		return -1;
+	}
+
+	return d->store.d_int32;
+}
+
+void *buxton_response_values_item(BuxtonResponse response, uint32_t index)
+{
+	BuxtonData *d;
+
+	d = values_item(response, index, 1);
+	if (!d || d->type == BUXTON_TYPE_UNSET) {
+		return NULL;
+	}
+
+	return data_to_value(d);
+}
+
+BuxtonDataType buxton_response_values_item_type(BuxtonResponse response,
+						uint32_t index)
+{
+	BuxtonData *d;
+
+	d = values_item(response, index, 1);
+	if (!d || d->type == BUXTON_TYPE_UNSET) {
+		return -1;
+	}
+
+	return d->type;
+}
+uint32_t buxton_response_group_count(BuxtonResponse response)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+
+	if (!response) {
+		return 0;
+	}
+
+	if (buxton_response_type(response) != BUXTON_CONTROL_GET_GROUP) {
+		return 0;
+	}
+	return r->data->len ? ((uint32_t)r->data->len - 1) / 2 : 0;
+}
+
+/*
+ * GET_GROUP responses hold the status followed by a name and a value
+ * for every key
+ */
+static BuxtonData *group_item(BuxtonResponse response, uint32_t index,
+			      uint32_t offset)
+{
+	_BuxtonResponse *r = (_BuxtonResponse *)response;
+
+	if (index >= buxton_response_group_count(response)) {
+		return NULL;
+	}
+
+	return buxton_array_get(r->data, 1 + 2 * index + offset);
+}
+
+char *buxton_response_group_item_name(BuxtonResponse response, uint32_t index)
+{
+	BuxtonData *d;
+
+	d = group_item(response, index, 0);
+	if (!d || d->type != BUXTON_TYPE_STRING) {
+		return NULL;
+	}
+
+	return strdup(d->store.d_string.value);
+}
+
+void *buxton_response_group_item_value(BuxtonResponse response, uint32_t index)
+{
+	BuxtonData *d;
+
+	d = group_item(response, index, 1);
+	if (!d) {
+		return NULL;
+	}
+
+	return data_to_value(d);
+}
+
+BuxtonDataType buxton_response_group_item_type(BuxtonResponse response,
+					       uint32_t index)
+{
+	BuxtonData *d;
+
+	d = group_item(response, index, 1);
+	if (!d) {
+		return -1;
+	}
+
+	return d->type;
+}
 
 /*
  * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
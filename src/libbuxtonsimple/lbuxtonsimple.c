@@ -45,7 +45,7 @@ void sbuxton_set_group(char *group, char *layer)
 	/* In case a string is longer than MAX_LG_LEN, set the last byte to null */
 	_layer[MAX_LG_LEN -1] = '\0';
 	_group[MAX_LG_LEN -1] = '\0';
-	BuxtonKey g = buxton_key_create(_group, NULL, _layer, BUXTON_TYPE_STRING);
+	BuxtonKey g = _client_key(_group, NULL, _layer, BUXTON_TYPE_STRING);
 	buxton_debug("buxton key group = %s\n", buxton_key_get_group(g));
 	if (buxton_create_group(client, g, _cg_cb, &status, true)
 		|| !status) {
@@ -56,7 +56,6 @@ void sbuxton_set_group(char *group, char *layer)
 	buxton_key_get_layer(g));
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 /* Set and get int32_t value for buxton key with type BUXTON_TYPE_INT32 */
@@ -67,8 +66,8 @@ void sbuxton_set_int32(char *key, int32_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key  */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT32);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_INT32);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT32;
@@ -77,6 +76,7 @@ void sbuxton_set_int32(char *key, int32_t value)
 	/* call buxton_set_value for type BUXTON_TYPE_INT32 */
 	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
 		buxton_debug("Set int32_t call failed.\n");
+		_client_disconnect();
 		return;
 	}
 	if (!ret.status) {
@@ -84,7 +84,6 @@ void sbuxton_set_int32(char *key, int32_t value)
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 int32_t sbuxton_get_int32(char *key)
@@ -94,8 +93,8 @@ int32_t sbuxton_get_int32(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT32);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_INT32);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT32;
@@ -103,13 +102,13 @@ int32_t sbuxton_get_int32(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get int32_t call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.i32val;
 }
 
@@ -121,8 +120,8 @@ void sbuxton_set_string(char *key, char *value )
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_STRING);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_STRING);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_STRING;
@@ -131,13 +130,13 @@ void sbuxton_set_string(char *key, char *value )
 	/* set value */
 	if (buxton_set_value(client, _key, value, _bs_cb, &ret, true)) {
 		buxton_debug("Set string call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 char* sbuxton_get_string(char *key)
@@ -147,8 +146,8 @@ char* sbuxton_get_string(char *key)
 		errno = ENOTCONN;
 		return NULL;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_STRING);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_STRING);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_STRING;
@@ -156,13 +155,13 @@ char* sbuxton_get_string(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get string call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.sval;
 }
 
@@ -174,8 +173,8 @@ void sbuxton_set_uint32(char *key, uint32_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT32);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_UINT32);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT32;
@@ -183,13 +182,13 @@ void sbuxton_set_uint32(char *key, uint32_t value)
 	saved_errno = errno;
 	if (buxton_set_value(client,_key, &value, _bs_cb, &ret, true)) {
 		buxton_debug("Set uint32_t call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 uint32_t sbuxton_get_uint32(char *key)
@@ -199,8 +198,8 @@ uint32_t sbuxton_get_uint32(char *key)
 		errno = ENOTCONN;
 		return 0;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT32);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_UINT32);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT32;
@@ -208,13 +207,13 @@ uint32_t sbuxton_get_uint32(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get uint32_t call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.ui32val;
 }
 
@@ -226,8 +225,8 @@ void sbuxton_set_int64(char *key, int64_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT64);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_INT64);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT64;
@@ -235,13 +234,13 @@ void sbuxton_set_int64(char *key, int64_t value)
 	saved_errno = errno;
 	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
 		buxton_debug("Set int64_t call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 int64_t sbuxton_get_int64(char *key)
@@ -251,8 +250,8 @@ int64_t sbuxton_get_int64(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_INT64);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_INT64);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_INT64;
@@ -260,13 +259,13 @@ int64_t sbuxton_get_int64(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get int64_t call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.i64val;
 }
 
@@ -278,8 +277,8 @@ void sbuxton_set_uint64(char *key, uint64_t value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT64);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_UINT64);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT64;
@@ -287,13 +286,13 @@ void sbuxton_set_uint64(char *key, uint64_t value)
 	saved_errno = errno;
 	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
 		buxton_debug("Set uint64_t call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 uint64_t sbuxton_get_uint64(char *key)
@@ -303,8 +302,8 @@ uint64_t sbuxton_get_uint64(char *key)
 		errno = ENOTCONN;
 		return 0;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_UINT64);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_UINT64);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_UINT64;
@@ -312,13 +311,13 @@ uint64_t sbuxton_get_uint64(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get uint64_t call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.ui64val;
 }
 
@@ -330,8 +329,8 @@ void sbuxton_set_float(char *key, float value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_FLOAT);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_FLOAT);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_FLOAT;
@@ -339,13 +338,13 @@ void sbuxton_set_float(char *key, float value)
 	saved_errno = errno;
 	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
 		buxton_debug("Set float call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 float sbuxton_get_float(char *key)
@@ -355,8 +354,8 @@ float sbuxton_get_float(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_FLOAT);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_FLOAT);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_FLOAT;
@@ -364,13 +363,13 @@ float sbuxton_get_float(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get float call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.fval;
 }
 
@@ -382,8 +381,8 @@ void sbuxton_set_double(char *key, double value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_DOUBLE);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_DOUBLE);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_DOUBLE;
@@ -391,13 +390,13 @@ void sbuxton_set_double(char *key, double value)
 	saved_errno = errno;
 	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
 		buxton_debug("Set double call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 double sbuxton_get_double(char *key)
@@ -407,8 +406,8 @@ double sbuxton_get_double(char *key)
 		errno = ENOTCONN;
 		return -1;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_DOUBLE);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_DOUBLE);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_DOUBLE;
@@ -416,13 +415,13 @@ double sbuxton_get_double(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get double call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.dval;
 }
 
@@ -434,8 +433,8 @@ void sbuxton_set_bool(char *key, bool value)
 		errno = ENOTCONN;
 		return;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_BOOLEAN);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_BOOLEAN);
 	/* return value and status */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_BOOLEAN;
@@ -443,13 +442,13 @@ void sbuxton_set_bool(char *key, bool value)
 	saved_errno = errno;
 	if (buxton_set_value(client, _key, &value, _bs_cb, &ret, true)) {
 		buxton_debug("Set bool call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 }
 
 bool sbuxton_get_bool(char *key)
@@ -459,8 +458,8 @@ bool sbuxton_get_bool(char *key)
 		errno = ENOTCONN;
 		return false;
 	}
-	/* create key */
-	BuxtonKey _key = buxton_key_create(_group, key, _layer, BUXTON_TYPE_BOOLEAN);
+	/* reuse key */
+	BuxtonKey _key = _client_key(_group, key, _layer, BUXTON_TYPE_BOOLEAN);
 	/* return value */
 	vstatus ret;
 	ret.type = BUXTON_TYPE_BOOLEAN;
@@ -468,13 +467,13 @@ bool sbuxton_get_bool(char *key)
 	/* get value */
 	if (buxton_get_value(client, _key, _bg_cb, &ret, true)) {
 		buxton_debug("Get bool call failed.\n");
+		_client_disconnect();
 	}
 	if (!ret.status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
-	_client_disconnect();
 	return ret.val.bval;
 }
 
@@ -487,16 +486,38 @@ void sbuxton_remove_group(char *group_name, char *layer)
 		return;
 	}
 	saved_errno = errno;
-	BuxtonKey group = _buxton_group_create(group_name, layer);
+	BuxtonKey group = _client_key(group_name, NULL, layer, BUXTON_TYPE_STRING);
 	int status;
 	if (buxton_remove_group(client, group, _rg_cb, &status, true)) {
 		buxton_debug("Remove group call failed.\n");
+		_client_disconnect();
 	}
 	if (!status) {
 		errno = EACCES;
 	} else {
 		errno = saved_errno;
 	}
+}
+
+/* Keep got values, dropped as buxtond notifies changes to them */
+void sbuxton_enable_cache(size_t max_values, size_t max_bytes)
+{
+	int r;
+
+	if (!max_values || !max_bytes) {
+		errno = EINVAL;
+		return;
+	}
+	r = _client_cache(max_values, max_bytes);
+	if (r) {
+		buxton_debug("Enable cache call failed.\n");
+		errno = r;
+	}
+}
+
+/* Close the connection kept across calls */
+void sbuxton_close(void)
+{
 	_client_disconnect();
 }
 
@@ -13,10 +13,16 @@
 	#include "config.h"
 #endif
 
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "buxton.h"
 #include "buxtonkey.h"
@@ -27,7 +33,28 @@
 #include "smack.h"
 #include "util.h"
 
-static Hashmap *_smackrules = NULL;
+/**
+ * Access granted by a loaded rule, keyed by the subject and object
+ * label IDs
+ */
+typedef struct SmackRule {
+	uint64_t pair; /**<Subject ID in the high half, object ID in the low */
+	BuxtonKeyAccessType access; /**<Access granted */
+} SmackRule;
+
+/**
+ * Open addressed table of the loaded rules, allocated in one block
+ */
+typedef struct SmackRuleSet {
+	size_t mask; /**<Number of slots minus one, a power of two */
+	size_t count; /**<Number of rules held */
+	SmackRule slots[]; /**<Rules, a pair of 0 marks a free slot */
+} SmackRuleSet;
+
+/* Label to ID, only for labels the loaded rules name */
+static Hashmap *_smacklabels = NULL;
+static uint32_t _smacklabel_count = 0;
+static SmackRuleSet *_smackrules = NULL;
 /* set to true unless Smack support is not detected by the daemon */
 static bool have_smack = true;
 
@@ -39,118 +66,366 @@ bool buxton_smack_enabled(void)
 	return have_smack;
 }
 
-bool buxton_cache_smack_rules(void)
+/* IDs are small and sequential, so spread them over the slots */
+static size_t rule_hash(uint64_t pair)
 {
-	smack_check();
+	return (size_t)((pair * 0x9E3779B97F4A7C15ULL) >> 32);
+}
 
-	FILE *load_file = NULL;
-	char *rule_pair = NULL;
-	int ret = true;
-	bool have_rules = false;
-	struct stat buf;
+static SmackRule *find_rule(SmackRuleSet *set, uint64_t pair)
+{
+	size_t n;
+
+	for (n = rule_hash(pair) & set->mask; set->slots[n].pair;
+	     n = (n + 1) & set->mask) {
+		if (set->slots[n].pair == pair) {
+			break;
+		}
+	}
 
-	if (_smackrules) {
-		hashmap_free(_smackrules);
+	return &set->slots[n];
+}
+
+/* Returns the ID of a label, or 0 if no loaded rule names it */
+static uint32_t find_label(const char *label)
+{
+	if (!_smacklabels || !label) {
+		return 0;
 	}
 
-	_smackrules = hashmap_new(string_hash_func, string_compare_func);
+	return (uint32_t)PTR_TO_UINT(hashmap_get(_smacklabels, label));
+}
+
+static uint32_t intern_label(const char *label)
+{
+	char *l;
+	uint32_t id;
+	int r;
+
+	id = find_label(label);
+	if (id) {
+		return id;
+	}
 
-	if (!_smackrules) {
+	l = strdup(label);
+	if (!l) {
+		abort();
+	}
+	id = ++_smacklabel_count;
+	r = hashmap_put(_smacklabels, l, UINT_TO_PTR(id));
+	if (r != 1) {
 		abort();
 	}
 
-	//FIXME: should check for a proper mount point instead
-	if ((stat(SMACK_MOUNT_DIR, &buf) == -1) || !S_ISDIR(buf.st_mode)) {
-		buxton_log("Smack filesystem not detected; disabling Smack checks\n");
-		have_smack = false;
-		goto end;
+	return id;
+}
+
+/*
+ * Copy the next whitespace separated token into buf, returning false
+ * if there is none or it is too long to be a label
+ */
+static bool next_token(const char **p, const char *end, char *buf)
+{
+	const char *start;
+	size_t len;
+
+	while (*p < end && isspace((unsigned char)**p)) {
+		(*p)++;
+	}
+	start = *p;
+	while (*p < end && !isspace((unsigned char)**p)) {
+		(*p)++;
 	}
 
-	load_file = fopen(buxton_smack_load_file(), "r");
+	len = (size_t)(*p - start);
+	if (len == 0 || len > SMACK_LABEL_LEN) {
+		return false;
+	}
+	memcpy(buf, start, len);
+	buf[len] = '\0';
 
-	if (!load_file) {
-		switch (errno) {
-		case ENOENT:
-			buxton_log("Smackfs load2 file not found; disabling Smack checks\n");
-			have_smack = false;
-			goto end;
-		default:
-			buxton_log("fopen(): %m\n");
-			ret = false;
-			goto end;
+	return true;
+}
+
+/*
+ * Parse rules in load2 format, "subject object access" on each line,
+ * into a new rule set. Only labels seen for the first time allocate.
+ */
+static SmackRuleSet *parse_rules(const char *buf, size_t len)
+{
+	SmackRuleSet *set;
+	const char *p = buf;
+	const char *end = buf + len;
+	size_t lines = 0;
+	size_t slots = 16;
+
+	for (size_t i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			lines++;
 		}
 	}
+	/* Keep the table at most half full, a last line may lack '\n' */
+	while (slots < (lines + 1) * 2) {
+		slots *= 2;
+	}
 
-	do {
-		int r;
-		int chars;
-		BuxtonKeyAccessType *accesstype;
+	set = malloc0(sizeof(SmackRuleSet) + slots * sizeof(SmackRule));
+	if (!set) {
+		abort();
+	}
+	set->mask = slots - 1;
 
-		char subject[SMACK_LABEL_LEN+1] = { 0, };
-		char object[SMACK_LABEL_LEN+1] = { 0, };
-		char access[ACC_LEN] = { 0, };
+	if (!_smacklabels) {
+		_smacklabels = hashmap_new(string_hash_func, string_compare_func);
+		if (!_smacklabels) {
+			abort();
+		}
+	}
 
-		/* read contents from load2 */
-		chars = fscanf(load_file, "%s %s %s\n", subject, object, access);
+	for (;;) {
+		char subject[SMACK_LABEL_LEN+1];
+		char object[SMACK_LABEL_LEN+1];
+		char access[SMACK_LABEL_LEN+1];
+		SmackRule *rule;
+		uint64_t pair;
 
-		if (ferror(load_file)) {
-			buxton_log("fscanf(): %m\n");
-			ret = false;
-			goto end;
+		while (p < end && isspace((unsigned char)*p)) {
+			p++;
+		}
+		if (p == end) {
+			break;
 		}
 
-		if (!have_rules && chars == EOF && feof(load_file)) {
-			buxton_debug("No loaded Smack rules found\n");
-			goto end;
+		if (!next_token(&p, end, subject) ||
+		    !next_token(&p, end, object) ||
+		    !next_token(&p, end, access)) {
+			buxton_log("Corrupt load file detected\n");
+			free(set);
+			return NULL;
 		}
 
-		if (chars != 3) {
+		/* One rule per line, which is what the table was sized for */
+		if (set->count > lines) {
 			buxton_log("Corrupt load file detected\n");
-			ret = false;
-			goto end;
+			free(set);
+			return NULL;
 		}
 
-		have_rules = true;
+		pair = (uint64_t)intern_label(subject) << 32;
+		pair |= intern_label(object);
 
-		r = asprintf(&rule_pair, "%s %s", subject, object);
-		if (r == -1) {
-			abort();
+		/* A later rule for the same pair replaces the earlier one */
+		rule = find_rule(set, pair);
+		if (!rule->pair) {
+			rule->pair = pair;
+			set->count++;
 		}
+		rule->access = ACCESS_NONE;
 
-		accesstype = malloc0(sizeof(BuxtonKeyAccessType));
-		if (!accesstype) {
-			abort();
+		if (strchr(access, 'r')) {
+			rule->access |= ACCESS_READ;
+		}
+
+		if (strchr(access, 'w')) {
+			rule->access |= ACCESS_WRITE;
 		}
+	}
 
-		*accesstype = ACCESS_NONE;
+	return set;
+}
 
-		if (strchr(access, 'r')) {
-			*accesstype |= ACCESS_READ;
+/*
+ * Drop the labels no rule of set names, so the table doesn't keep every
+ * label of every rule set ever loaded. Labels both sets name keep their
+ * ID, a dropped label loaded again gets a new one.
+ */
+static void prune_labels(SmackRuleSet *set)
+{
+	Iterator iterator;
+	bool *used;
+	char *label;
+	void *id;
+
+	used = calloc((size_t)_smacklabel_count + 1, sizeof(bool));
+	if (!used) {
+		abort();
+	}
+	for (size_t n = 0; n <= set->mask; n++) {
+		if (set->slots[n].pair) {
+			used[set->slots[n].pair >> 32] = true;
+			used[(uint32_t)set->slots[n].pair] = true;
 		}
+	}
 
-		if (strchr(access, 'w')) {
-			*accesstype |= ACCESS_WRITE;
+	/* Removing the current entry leaves the iterator valid */
+	HASHMAP_FOREACH_KEY(id, label, _smacklabels, iterator) {
+		if (!used[PTR_TO_UINT(id)]) {
+			hashmap_remove(_smacklabels, label);
+			free(label);
+		}
+	}
+	free(used);
+}
+
+/* Read a whole file, which smackfs only allows with read() */
+static char *read_file(int fd, size_t *len)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	ssize_t r;
+
+	*len = 0;
+	do {
+		if (*len == size) {
+			size = size ? size * 2 : 65536;
+			buf = realloc(buf, size);
+			if (!buf) {
+				abort();
+			}
+		}
+		r = read(fd, buf + *len, size - *len);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			buxton_log("read(): %m\n");
+			free(buf);
+			return NULL;
+		}
+		*len += (size_t)r;
+	} while (r > 0);
+
+	return buf;
+}
+
+/*
+ * Load the rules in the file at path and swap them in, keeping the
+ * previous rules if the file can't be read or parsed
+ */
+static bool load_rules(int fd, const char *path)
+{
+	SmackRuleSet *set;
+	struct timespec start, end;
+	struct stat st;
+	char *buf = NULL;
+	void *map = MAP_FAILED;
+	size_t len = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (fstat(fd, &st) == -1) {
+		buxton_log("fstat(): %m\n");
+		return false;
+	}
+
+	/* Regular files are mapped, pseudo files like smackfs are read */
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		len = (size_t)st.st_size;
+		map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (map == MAP_FAILED) {
+		buf = read_file(fd, &len);
+		if (!buf) {
+			return false;
 		}
+	}
+
+	set = parse_rules(map != MAP_FAILED ? map : buf, len);
+
+	if (map != MAP_FAILED) {
+		munmap(map, len);
+	}
+	free(buf);
+
+	if (!set) {
+		return false;
+	}
+
+	free(_smackrules);
+	_smackrules = set;
+	prune_labels(set);
 
-		hashmap_put(_smackrules, rule_pair, accesstype);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	buxton_log("Loaded %zu Smack rules from %s in %.3fms\n", set->count,
+		   path, (double)(end.tv_sec - start.tv_sec) * 1000.0 +
+		   (double)(end.tv_nsec - start.tv_nsec) / 1000000.0);
 
-	} while (!feof(load_file));
+	return true;
+}
+
+bool buxton_cache_smack_rules(void)
+{
+	smack_check();
+
+	int fd = -1;
+	int ret = true;
+	struct stat buf;
+
+	//FIXME: should check for a proper mount point instead
+	if ((stat(SMACK_MOUNT_DIR, &buf) == -1) || !S_ISDIR(buf.st_mode)) {
+		buxton_log("Smack filesystem not detected; disabling Smack checks\n");
+		have_smack = false;
+		goto end;
+	}
+
+	fd = open(buxton_smack_load_file(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		switch (errno) {
+		case ENOENT:
+			buxton_log("Smackfs load2 file not found; disabling Smack checks\n");
+			have_smack = false;
+			goto end;
+		default:
+			buxton_log("open(): %m\n");
+			ret = false;
+			goto end;
+		}
+	}
+
+	ret = load_rules(fd, buxton_smack_load_file());
 
 end:
-	if (load_file) {
-		fclose(load_file);
+	if (fd >= 0) {
+		close(fd);
 	}
 
 	return ret;
 }
 
+bool buxton_smack_load_rules(const char *path)
+{
+	int fd;
+	bool ret;
+
+	assert(path);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		buxton_log("open(): %m\n");
+		return false;
+	}
+
+	have_smack = true;
+	ret = load_rules(fd, path);
+	close(fd);
+
+	return ret;
+}
+
+size_t buxton_smack_label_count(void)
+{
+	return hashmap_size(_smacklabels);
+}
+
 bool buxton_check_smack_access(BuxtonString *subject, BuxtonString *object, BuxtonKeyAccessType request)
 {
 	smack_check();
 
-	_cleanup_free_ char *key = NULL;
-	int r;
-	BuxtonKeyAccessType *access;
+	SmackRule *rule;
+	uint64_t pair;
+	uint64_t subject_id;
+	uint32_t object_id;
 
 	assert(subject);
 	assert(object);
@@ -186,37 +461,36 @@ bool buxton_check_smack_access(BuxtonString *subject, BuxtonString *object, Buxt
 		}
 	}
 
-	/* finally, check the loaded rules */
-	r = asprintf(&key, "%s %s", subject->value, object->value);
-	if (r == -1) {
-		abort();
+	/*
+	 * finally, check the loaded rules. A label no rule names has no
+	 * ID, and clients may well use such labels. In this situation,
+	 * access is simply denied, because there are no further rules to
+	 * consider.
+	 */
+	subject_id = find_label(subject->value);
+	object_id = find_label(object->value);
+	if (!subject_id || !object_id) {
+		buxton_debug("No rule for labels '%s' '%s'\n", subject->value,
+			     object->value);
+		return false;
 	}
 
-	buxton_debug("Key: %s\n", key);
-
-	access = hashmap_get(_smackrules, key);
-	if (!access) {
-		/* A null value is not an error, since clients may try to
-		 * read/write keys with labels that are not in the loaded
-		 * rule set. In this situation, access is simply denied,
-		 * because there are no further rules to consider.
-		 */
-		buxton_debug("Value of key '%s' is NULL\n", key);
+	pair = (subject_id << 32) | object_id;
+	rule = find_rule(_smackrules, pair);
+	if (!rule->pair) {
+		buxton_debug("No rule for labels '%s' '%s'\n", subject->value,
+			     object->value);
 		return false;
 	}
 
-	/* After debugging, change this code to: */
-	/* return ((*access) & request); */
-	if (access) {
-		buxton_debug("Value: %x\n", *access);
-	}
+	buxton_debug("Value: %x\n", rule->access);
 
-	if (request == ACCESS_READ && (*access) & request) {
+	if (request == ACCESS_READ && rule->access & request) {
 		buxton_debug("Read access granted!\n");
 		return true;
 	}
 
-	if (request == ACCESS_WRITE && ((*access) & ACCESS_READ && (*access) & ACCESS_WRITE)) {
+	if (request == ACCESS_WRITE && (rule->access & ACCESS_READ && rule->access & ACCESS_WRITE)) {
 		buxton_debug("Write access granted!\n");
 		return true;
 	}
@@ -62,6 +62,22 @@ bool buxton_smack_enabled(void)
 bool buxton_cache_smack_rules(void)
 	__attribute__((warn_unused_result));
 
+/**
+ * Load Smack rules from a file in load2 format and enable Smack checks
+ * @param path The file to load the rules from
+ * @return true if the rules were loaded, false otherwise
+ * @note Used to exercise the access checks where smackfs isn't mounted
+ */
+bool buxton_smack_load_rules(const char *path)
+	__attribute__((warn_unused_result));
+
+/**
+ * Count the labels named by the loaded Smack rules
+ * @return the number of labels held for the access checks
+ * @note Used to check labels of replaced rules are released
+ */
+size_t buxton_smack_label_count(void);
+
 /**
  * Check whether the smack access matches the buxton client access
  * @param subject Smack subject label
@@ -35,10 +35,29 @@
  */
 static BuxtonLayer *buxton_layer_new(ConfigLayer *conf_layer);
 
+/*
+ * A value in a system layer beats one in a user layer, then the higher
+ * priority wins. Names break ties so the order doesn't depend on hashing.
+ */
+static int compare_layers(const void *a, const void *b)
+{
+	const BuxtonLayer *la = *(BuxtonLayer * const *)a;
+	const BuxtonLayer *lb = *(BuxtonLayer * const *)b;
+
+	if (la->type != lb->type) {
+		return la->type == LAYER_SYSTEM ? -1 : 1;
+	}
+	if (la->priority != lb->priority) {
+		return la->priority > lb->priority ? -1 : 1;
+	}
+	return strcmp(la->name.value, lb->name.value);
+}
+
 /* Load layer configurations from disk */
 void buxton_init_layers(BuxtonConfig *config)
 {
 	Hashmap *layers = NULL;
+	BuxtonLayer **order = NULL;
 	int nlayers = 0;
 	ConfigLayer *config_layers = NULL;
 	int r;
@@ -49,6 +68,13 @@ void buxton_init_layers(BuxtonConfig *config)
 		abort();
 	}
 
+	if (nlayers > 0) {
+		order = malloc0(sizeof(BuxtonLayer *) * (size_t)nlayers);
+		if (!order) {
+			abort();
+		}
+	}
+
 	for (int n = 0; n < nlayers; n++) {
 		BuxtonLayer *layer;
 
@@ -61,9 +87,16 @@ void buxton_init_layers(BuxtonConfig *config)
 		if (r != 1) {
 			abort();
 		}
+		order[n] = layer;
+	}
+
+	if (nlayers > 0) {
+		qsort(order, (size_t)nlayers, sizeof(BuxtonLayer *), compare_layers);
 	}
 
 	config->layers = layers;
+	config->layer_order = order;
+	config->layer_count = nlayers > 0 ? (size_t)nlayers : 0;
 	free(config_layers);
 }
 
@@ -117,6 +150,14 @@ static BuxtonLayer *buxton_layer_new(ConfigLayer *conf_layer)
 	}
 
 	out->readonly = is_read_only(conf_layer);
+	if (conf_layer->snapshot) {
+		if (out->type == LAYER_SYSTEM) {
+			out->snapshot = true;
+		} else {
+			buxton_log("Layer %s is not a System layer, not publishing a snapshot\n",
+				   conf_layer->name);
+		}
+	}
 	out->priority = conf_layer->priority;
 	return out;
 fail:
@@ -252,6 +293,8 @@ void destroy_backend(BuxtonBackend *backend)
 	backend->get_value = NULL;
 	backend->list_keys = NULL;
 	backend->list_names = NULL;
+	backend->scan_names = NULL;
+	backend->get_group = NULL;
 	backend->unset_value = NULL;
 	backend->destroy();
 	dlclose(backend->module);
@@ -62,6 +62,7 @@ typedef struct BuxtonLayer {
 	int priority; /**<Priority of this layer */
 	char *description; /**<Description of this layer */
 	bool readonly; /**<Layer is readonly or not */
+	bool snapshot; /**<Readable values are published in the snapshot file */
 } BuxtonLayer;
 
 /**
@@ -94,6 +95,53 @@ typedef bool (*module_list_func) (BuxtonLayer *layer, BuxtonArray **data);
 typedef bool (*module_list_names_func) (BuxtonLayer *layer, BuxtonString *group,
 				  BuxtonString *prefix, BuxtonArray **data);
 
+/**
+ * Backend name scan callback, run once for each name listed
+ * @param name The name, only valid during the call
+ * @param user_data Data passed to the scan function
+ * @return false to stop the scan after this name
+ */
+typedef bool (*module_name_func) (BuxtonString *name, void *user_data);
+
+/**
+ * Backend key/group scan function, which lists names a few at a time
+ * @param layer The layer to query
+ * @param group The group to query or NULL
+ * @param prefix The prefix for filtering or NULL
+ * @param cursor Where to resume, with a NULL value to start a new scan.
+ * When func stops the scan, it is set to the position of the last name
+ * passed, which the caller owns; it is left NULL once the scan is done.
+ * @param func Function run for each name
+ * @param user_data Data passed to func
+ * @return a int value, 0 on success, ESTALE if the cursor's key is gone
+ * or another errno value
+ */
+typedef int (*module_scan_names_func) (BuxtonLayer *layer, BuxtonString *group,
+				       BuxtonString *prefix,
+				       BuxtonString *cursor,
+				       module_name_func func, void *user_data);
+
+/**
+ * Backend group scan callback, run once for each key of the group
+ * @param name The key's name
+ * @param data The key's value, only valid during the call
+ * @param label The key's label, only valid during the call
+ * @param user_data Data passed to the scan function
+ */
+typedef void (*module_group_func) (BuxtonString *name, BuxtonData *data,
+				   BuxtonString *label, void *user_data);
+
+/**
+ * Backend group scan function
+ * @param layer The layer to query
+ * @param group The group to scan
+ * @param func Function run for each key in the group
+ * @param user_data Data passed to func
+ * @return a int value, 0 on success or an errno value
+ */
+typedef int (*module_get_group_func) (BuxtonLayer *layer, BuxtonString *group,
+				      module_group_func func, void *user_data);
+
 /**
  * Backend database creation function
  * @param layer The layer matching the db to create
@@ -118,6 +166,8 @@ typedef struct BuxtonBackend {
 	module_value_func get_value; /**<Get value function */
 	module_list_func list_keys; /**<List keys function */
 	module_list_names_func list_names; /**<List names function */
+	module_scan_names_func scan_names; /**<Incremental list names function */
+	module_get_group_func get_group; /**<Group scan function */
 	module_value_func unset_value; /**<Unset value function */
 	module_db_init_func create_db; /**<DB file creation function */
 } BuxtonBackend;
@@ -128,6 +178,8 @@ typedef struct BuxtonBackend {
 typedef struct BuxtonConfig {
 	Hashmap *databases; /**<Database mapping */
 	Hashmap *layers; /**<Global layer configuration */
+	BuxtonLayer **layer_order; /**<Layers in lookup order, winner first */
+	size_t layer_count; /**<Number of layers in layer_order */
 	Hashmap *backends; /**<Backend mapping */
 } BuxtonConfig;
 
@@ -137,6 +189,8 @@ typedef struct BuxtonConfig {
 typedef struct BuxtonControl {
 	_BuxtonClient client; /**<Valid client connection */
 	BuxtonConfig config; /**<Valid configuration (unused) */
+	struct BuxtonValueCache *cache; /**<Resolved layerless values, or NULL */
+	struct BuxtonSnapshot *snapshot; /**<Values published to clients, or NULL */
 } BuxtonControl;
 
 /**
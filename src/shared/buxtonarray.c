@@ -27,7 +27,7 @@ BuxtonArray *buxton_array_new(void)
 bool buxton_array_add(BuxtonArray *array,
 		      void *data)
 {
-	uint16_t new_len;
+	uint32_t new_len;
 	size_t curr, new_size;
 
 	if (!array || !data) {
@@ -40,7 +40,7 @@ bool buxton_array_add(BuxtonArray *array,
 		}
 	}
 
-	new_len = (uint16_t)(array->len + 1);
+	new_len = array->len + 1;
 	if (!new_len) {
 		return false;
 	}
@@ -59,7 +59,7 @@ bool buxton_array_add(BuxtonArray *array,
 	return true;
 }
 
-void *buxton_array_get(BuxtonArray *array, uint16_t index)
+void *buxton_array_get(BuxtonArray *array, uint32_t index)
 {
 	if (!array) {
 		return NULL;
@@ -0,0 +1,58 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include "buxton.h"
+#include "buxtonarray.h"
+#include "buxtondata.h"
+#include "buxtonkey.h"
+
+/**
+ * Maximum number of requests in a single batch, chosen so the
+ * serialized request always fits BUXTON_MESSAGE_MAX_PARAMS
+ */
+#define BUXTON_BATCH_MAX_OPS 512
+
+/**
+ * A single request queued in a batch
+ */
+typedef struct BuxtonBatchOp {
+	BuxtonControlMessage type; /**<Type of the request */
+	_BuxtonKey *key; /**<Copy of the key used for the request */
+	BuxtonData *value; /**<Copy of the value for set requests */
+	BuxtonCallback callback; /**<Callback for this request's reply */
+	void *data; /**<User data passed to the callback */
+} BuxtonBatchOp;
+
+/**
+ * Represents a list of requests sent to buxtond in one message
+ */
+typedef struct BuxtonBatch {
+	BuxtonArray *ops; /**<Array of BuxtonBatchOp in submission order */
+} _BuxtonBatch;
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
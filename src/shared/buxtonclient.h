@@ -30,6 +30,10 @@ typedef struct BuxtonClient {
 	bool direct; /**<Only used for direction connections */
 	pid_t pid; /**<Process ID, used within libbuxton */
 	uid_t uid; /**<User ID of currently using user */
+	struct BuxtonSnapshotView *snapshot; /**<Mapped snapshot file, or NULL */
+	struct BuxtonClientCache *cache; /**<Values got before, or NULL */
+	struct BuxtonCompletionQueue *completions; /**<Callbacks left to drain, or NULL */
+	struct BuxtonCallbacks *callbacks; /**<Pending replies and notifications */
 } _BuxtonClient;
 
 /*
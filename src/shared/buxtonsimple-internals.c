@@ -13,24 +13,65 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "buxton.h"
+#include "buxtonkey.h"
 #include "buxtonsimple-internals.h"
+#include "hashmap.h"
 #include "log.h"
+#include "util.h"
+
+/* Most keys kept before the interned keys are flushed */
+#define MAX_INTERNED_KEYS 1024
 
 BuxtonClient client = NULL;
+/* Process that opened client, a forked child must not share it */
+static pid_t client_pid = 0;
+/* Keys of the open connection, freed when it is closed */
+static Hashmap *interned_keys = NULL;
+/* Bounds of the client cache, 0 while it is disabled */
+static size_t cache_values = 0;
+static size_t cache_bytes = 0;
+
+static void flush_keys(void)
+{
+	BuxtonKey key;
+
+	if (!interned_keys) {
+		return;
+	}
+	while ((key = hashmap_steal_first(interned_keys))) {
+		buxton_key_free(key);
+	}
+}
 
 /* Make sure client connection is open */
 int _client_connection(void)
 {
+	int r;
+
+	/* A forked child drops the connection it inherited */
+	if (client && client_pid != getpid()) {
+		buxton_debug("Connection inherited, reconnecting.\n");
+		_client_disconnect();
+	}
 	/* Check if client connection is open */
 	if (!client) {
 		/* Open connection if needed */
 		if ((buxton_open(&client)) <0 ) {
 			buxton_debug("Couldn't connect.\n");
+			client = NULL;
 			return 0;
 		}
+		client_pid = getpid();
 		buxton_debug("Connection successful.\n");
+		if (cache_values) {
+			r = buxton_enable_cache(client, cache_values, cache_bytes);
+			if (r) {
+				buxton_debug("Couldn't enable cache: %d\n", r);
+			}
+		}
 	}
 	return 1;
 }
@@ -40,11 +81,73 @@ void _client_disconnect(void)
 {
 	/* Only attempt to close the client if it != NULL */
 	if (client) {
+		/* Keys go first, closing the last client frees them */
+		flush_keys();
 		/* Close the connection */
 		buxton_close(client);
 		buxton_debug("Connection closed\n");
 		client = NULL;
+		client_pid = 0;
+	}
+}
+
+BuxtonKey _client_key(char *group, char *name, char *layer,
+		      BuxtonDataType type)
+{
+	_BuxtonKey lookup;
+	BuxtonKey key;
+
+	if (!group) {
+		return NULL;
+	}
+
+	memzero(&lookup, sizeof(_BuxtonKey));
+	lookup.group = buxton_string_pack(group);
+	if (name) {
+		lookup.name = buxton_string_pack(name);
 	}
+	if (layer) {
+		lookup.layer = buxton_string_pack(layer);
+	}
+	lookup.type = type;
+
+	if (!interned_keys) {
+		interned_keys = hashmap_new(key_hash_func, key_compare_func);
+		if (!interned_keys) {
+			abort();
+		}
+	}
+
+	key = hashmap_get(interned_keys, &lookup);
+	if (key) {
+		return key;
+	}
+
+	if (hashmap_size(interned_keys) >= MAX_INTERNED_KEYS) {
+		flush_keys();
+	}
+	key = buxton_key_create(group, name, layer, type);
+	if (!key) {
+		return NULL;
+	}
+	if (hashmap_put(interned_keys, key, key) < 0) {
+		abort();
+	}
+
+	return key;
+}
+
+int _client_cache(size_t max_values, size_t max_bytes)
+{
+	cache_values = max_values;
+	cache_bytes = max_bytes;
+
+	/* Otherwise it is enabled once the connection opens */
+	if (client && client_pid == getpid()) {
+		return buxton_enable_cache(client, max_values, max_bytes);
+	}
+
+	return 0;
 }
 
 /* Create group callback */
@@ -88,15 +88,38 @@ extern BuxtonClient client;
 
 /**
  * Checks for client connection and opens it if client connection is not open
+ * The connection stays open across calls, a forked child opens its own
  * @return Returns 1 on success and 0 on failure
  */
 int _client_connection(void);
 
 /**
  * Checks for client connections and closes it if client connection is open
+ * The keys returned by _client_key are freed with it
  */
 void _client_disconnect(void);
 
+/**
+ * Returns the key for a group, name, layer and type, creating it on first use
+ * Must only be called while the client connection is open
+ * @param group A group name that is a string (char *)
+ * @param name A key name that is a string (char *), or NULL for the group
+ * @param layer A layer name that is a string (char *)
+ * @param type The BuxtonDataType of the key
+ * @return A BuxtonKey owned by the connection, or NULL on failure
+ */
+BuxtonKey _client_key(char *group, char *name, char *layer,
+		      BuxtonDataType type);
+
+/**
+ * Keeps got values in a cache on the client connection
+ * Applies to the open connection and to connections opened afterwards
+ * @param max_values Most values to hold
+ * @param max_bytes Most bytes to hold
+ * @return 0 on success, an errno value otherwise
+ */
+int _client_cache(size_t max_values, size_t max_bytes);
+
 /**
  * Create group callback
  * @param response BuxtonResponse
@@ -0,0 +1,210 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "buxtontrie.h"
+
+static BuxtonTrie *find_child(BuxtonTrie *node, char c)
+{
+	BuxtonTrie *child;
+
+	for (child = node->child; child; child = child->sibling) {
+		if (child->c == c) {
+			return child;
+		}
+	}
+
+	return NULL;
+}
+
+BuxtonTrie *buxton_trie_new(void)
+{
+	return calloc(1, sizeof(BuxtonTrie));
+}
+
+void buxton_trie_free(BuxtonTrie *trie)
+{
+	BuxtonTrie *next;
+
+	for (; trie; trie = next) {
+		next = trie->sibling;
+		buxton_trie_free(trie->child);
+		buxton_list_free(&trie->items);
+		free(trie);
+	}
+}
+
+bool buxton_trie_add(BuxtonTrie *trie, const char *key, void *item)
+{
+	BuxtonTrie *node = trie;
+	BuxtonTrie *child;
+
+	assert(trie);
+	assert(key);
+
+	for (; *key; key++) {
+		child = find_child(node, *key);
+		if (!child) {
+			child = calloc(1, sizeof(BuxtonTrie));
+			if (!child) {
+				return false;
+			}
+			child->c = *key;
+			child->sibling = node->child;
+			node->child = child;
+		}
+		node = child;
+	}
+
+	if (!buxton_list_prepend(&node->items, item)) {
+		return false;
+	}
+	trie->count++;
+
+	return true;
+}
+
+/* Returns true if the item was removed, *empty tells if node can go */
+static bool remove_item(BuxtonTrie *node, const char *key, void *item,
+			bool *empty)
+{
+	BuxtonTrie *child, **link;
+	bool child_empty = false;
+
+	if (!*key) {
+		if (!buxton_list_remove(&node->items, item, false)) {
+			return false;
+		}
+	} else {
+		for (link = &node->child; *link; link = &(*link)->sibling) {
+			if ((*link)->c == *key) {
+				break;
+			}
+		}
+		child = *link;
+		if (!child || !remove_item(child, key + 1, item, &child_empty)) {
+			return false;
+		}
+		if (child_empty) {
+			*link = child->sibling;
+			free(child);
+		}
+	}
+
+	*empty = !node->items && !node->child;
+	return true;
+}
+
+bool buxton_trie_remove(BuxtonTrie *trie, const char *key, void *item)
+{
+	bool empty;
+
+	assert(trie);
+	assert(key);
+
+	/* The root is owned by the caller, so it stays even when empty */
+	if (!remove_item(trie, key, item, &empty)) {
+		return false;
+	}
+	trie->count--;
+
+	return true;
+}
+
+BuxtonList *buxton_trie_get(BuxtonTrie *trie, const char *key)
+{
+	BuxtonTrie *node = trie;
+
+	assert(trie);
+	assert(key);
+
+	for (; node && *key; key++) {
+		node = find_child(node, *key);
+	}
+
+	return node ? node->items : NULL;
+}
+
+size_t buxton_trie_foreach_prefix(BuxtonTrie *trie, const char *key,
+				  buxton_trie_func func, void *user_data)
+{
+	BuxtonTrie *node = trie;
+	BuxtonList *elem;
+	size_t count = 0;
+
+	assert(trie);
+	assert(key);
+	assert(func);
+
+	while (node) {
+		BUXTON_LIST_FOREACH(node->items, elem) {
+			func(elem->data, user_data);
+			count++;
+		}
+		if (!*key) {
+			break;
+		}
+		node = find_child(node, *key++);
+	}
+
+	return count;
+}
+
+size_t buxton_trie_count(BuxtonTrie *trie)
+{
+	assert(trie);
+
+	return trie->count;
+}
+
+bool buxton_trie_match_prefix(BuxtonTrie *trie, const char *key)
+{
+	BuxtonTrie *node = trie;
+
+	assert(trie);
+	assert(key);
+
+	if (!trie->count) {
+		return false;
+	}
+
+	while (node) {
+		if (node->items) {
+			return true;
+		}
+		if (!*key) {
+			break;
+		}
+		node = find_child(node, *key++);
+	}
+
+	return false;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
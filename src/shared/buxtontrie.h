@@ -0,0 +1,120 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#pragma once
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "buxtonlist.h"
+
+/**
+ * A character trie holding a list of items at each node
+ */
+typedef struct BuxtonTrie {
+	struct BuxtonTrie *child; /**<First node one character deeper */
+	struct BuxtonTrie *sibling; /**<Next node at the same depth */
+	BuxtonList *items; /**<Items added for the key ending here */
+	char c; /**<Character leading to this node */
+	size_t count; /**<Items held under every key, kept on the root only */
+} BuxtonTrie;
+
+/**
+ * Function run for each item found in the trie
+ */
+typedef void (*buxton_trie_func) (void *item, void *user_data);
+
+/**
+ * Create an empty trie
+ * @return a new trie or NULL if out of memory
+ */
+BuxtonTrie *buxton_trie_new(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a trie, the items it holds are left to the caller
+ * @param trie The trie to free, may be NULL
+ */
+void buxton_trie_free(BuxtonTrie *trie);
+
+/**
+ * Add an item under a key
+ * @param trie The trie to update
+ * @param key The key to add the item under, may be empty
+ * @param item The item to add
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_trie_add(BuxtonTrie *trie, const char *key, void *item)
+	__attribute__((warn_unused_result));
+
+/**
+ * Remove an item from a key, dropping nodes left without items
+ * @param trie The trie to update
+ * @param key The key the item was added under
+ * @param item The item to remove
+ * @return a boolean value, indicating the item was found
+ */
+bool buxton_trie_remove(BuxtonTrie *trie, const char *key, void *item);
+
+/**
+ * Get the items added under exactly a key
+ * @param trie The trie to search
+ * @param key The key the items were added under
+ * @return the list of items, owned by the trie, or NULL if there are none
+ */
+BuxtonList *buxton_trie_get(BuxtonTrie *trie, const char *key);
+
+/**
+ * Run a function for the items of every key that is a prefix of the
+ * given key, including the key itself. The function must not change
+ * the trie.
+ * @param trie The trie to search
+ * @param key The key to match prefixes of
+ * @param func Function to run for each item
+ * @param user_data Passed to func
+ * @return the number of items visited
+ */
+size_t buxton_trie_foreach_prefix(BuxtonTrie *trie, const char *key,
+				  buxton_trie_func func, void *user_data);
+
+/**
+ * Count the items held by a trie
+ * @param trie The trie to count the items of
+ * @return the number of items held under every key
+ */
+size_t buxton_trie_count(BuxtonTrie *trie);
+
+/**
+ * Check whether any key that is a prefix of the given key, including
+ * the key itself, holds items
+ * @param trie The trie to search
+ * @param key The key to match prefixes of
+ * @return true if items were added under a matching key
+ */
+bool buxton_trie_match_prefix(BuxtonTrie *trie, const char *key);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
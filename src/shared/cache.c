@@ -0,0 +1,442 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "log.h"
+#include "util.h"
+
+static void free_entries(BuxtonCacheEntry *entry)
+{
+	BuxtonCacheEntry *next;
+
+	for (; entry; entry = next) {
+		next = entry->next;
+		if (entry->data.type == BUXTON_TYPE_STRING) {
+			free(entry->data.store.d_string.value);
+		}
+		free(entry->label.value);
+		free(entry->group_label.value);
+		free(entry);
+	}
+}
+
+/* What an entry counts against the byte budget of the cache */
+static size_t entry_size(BuxtonCacheEntry *entry)
+{
+	size_t size = sizeof(BuxtonCacheEntry);
+
+	if (entry->data.type == BUXTON_TYPE_STRING) {
+		size += entry->data.store.d_string.length;
+	}
+
+	return size + entry->label.length + entry->group_label.length;
+}
+
+/* Free entries of the cache, no longer counting them */
+static void drop_entries(BuxtonValueCache *cache, BuxtonCacheEntry *entry)
+{
+	for (BuxtonCacheEntry *e = entry; e; e = e->next) {
+		cache->count--;
+		cache->bytes -= entry_size(e);
+	}
+	free_entries(entry);
+}
+
+/* Free a map of names to entries */
+static void free_names(BuxtonValueCache *cache, Hashmap *names)
+{
+	BuxtonCacheEntry *entry;
+	char *name;
+
+	while ((name = hashmap_first_key(names))) {
+		entry = hashmap_remove(names, name);
+		drop_entries(cache, entry);
+		free(name);
+	}
+	hashmap_free(names);
+}
+
+static void free_group_entries(Hashmap *groups)
+{
+	BuxtonGroupEntry *entry, *next;
+	char *group;
+
+	while ((group = hashmap_first_key(groups))) {
+		entry = hashmap_remove(groups, group);
+		for (; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+		free(group);
+	}
+	hashmap_free(groups);
+}
+
+/* Labels are only referenced by group entries, so they go together */
+static void clear_layers(BuxtonValueCache *cache)
+{
+	Hashmap *groups;
+	char *label;
+
+	while ((groups = hashmap_steal_first(cache->layers))) {
+		free_group_entries(groups);
+	}
+	while ((label = hashmap_first_key(cache->labels))) {
+		(void)hashmap_remove(cache->labels, label);
+		free(label);
+	}
+	cache->group_count = 0;
+}
+
+static void clear_groups(BuxtonValueCache *cache)
+{
+	Hashmap *names;
+	char *group;
+
+	while ((group = hashmap_first_key(cache->groups))) {
+		names = hashmap_remove(cache->groups, group);
+		free_names(cache, names);
+		free(group);
+	}
+}
+
+BuxtonValueCache *buxton_value_cache_new(void)
+{
+	BuxtonValueCache *cache;
+
+	cache = malloc0(sizeof(BuxtonValueCache));
+	if (!cache) {
+		abort();
+	}
+
+	cache->groups = hashmap_new(string_hash_func, string_compare_func);
+	cache->layers = hashmap_new(trivial_hash_func, trivial_compare_func);
+	cache->labels = hashmap_new(string_hash_func, string_compare_func);
+	if (!cache->groups || !cache->layers || !cache->labels) {
+		abort();
+	}
+
+	return cache;
+}
+
+void buxton_value_cache_free(BuxtonValueCache *cache)
+{
+	if (!cache) {
+		return;
+	}
+
+	buxton_debug("Value cache: %llu hits, %llu misses\n",
+		     (unsigned long long)cache->hits,
+		     (unsigned long long)cache->misses);
+	clear_groups(cache);
+	hashmap_free(cache->groups);
+	clear_layers(cache);
+	hashmap_free(cache->layers);
+	hashmap_free(cache->labels);
+	free(cache);
+}
+
+BuxtonCacheEntry *buxton_value_cache_get(BuxtonValueCache *cache,
+					 _BuxtonKey *key, uid_t uid)
+{
+	BuxtonCacheEntry *entry;
+	Hashmap *names;
+
+	assert(cache);
+	assert(key);
+
+	if (!key->group.value || !key->name.value) {
+		return NULL;
+	}
+
+	names = hashmap_get(cache->groups, key->group.value);
+	if (!names) {
+		return NULL;
+	}
+
+	for (entry = hashmap_get(names, key->name.value); entry;
+	     entry = entry->next) {
+		if (entry->uid == uid) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+void buxton_value_cache_put(BuxtonValueCache *cache, _BuxtonKey *key,
+			    BuxtonCacheEntry *entry)
+{
+	BuxtonCacheEntry *head;
+	Hashmap *names;
+	char *group;
+	char *name;
+	size_t size;
+
+	assert(cache);
+	assert(key);
+	assert(key->group.value);
+	assert(key->name.value);
+	assert(entry);
+
+	/* Keys come and go, so rather than tracking use, start over */
+	size = entry_size(entry);
+	if (cache->count >= BUXTON_VALUE_CACHE_MAX ||
+	    cache->bytes + size > BUXTON_VALUE_CACHE_BYTES) {
+		clear_groups(cache);
+	}
+
+	names = hashmap_get(cache->groups, key->group.value);
+	if (!names) {
+		names = hashmap_new(string_hash_func, string_compare_func);
+		group = strdup(key->group.value);
+		if (!names || !group) {
+			abort();
+		}
+		if (hashmap_put(cache->groups, group, names) != 1) {
+			abort();
+		}
+	}
+
+	head = hashmap_get(names, key->name.value);
+	if (head) {
+		entry->next = head;
+		if (hashmap_update(names, key->name.value, entry) < 0) {
+			abort();
+		}
+	} else {
+		entry->next = NULL;
+		name = strdup(key->name.value);
+		if (!name) {
+			abort();
+		}
+		if (hashmap_put(names, name, entry) != 1) {
+			abort();
+		}
+	}
+	cache->count++;
+	cache->bytes += size;
+}
+
+void buxton_value_cache_invalidate(BuxtonValueCache *cache, _BuxtonKey *key)
+{
+	BuxtonCacheEntry *entry;
+	Hashmap *names;
+	char *group;
+	char *name;
+
+	if (!cache) {
+		return;
+	}
+
+	assert(key);
+
+	if (!key->group.value) {
+		return;
+	}
+
+	if (!key->name.value) {
+		names = hashmap_remove2(cache->groups, key->group.value,
+					(void **)&group);
+		if (names) {
+			free_names(cache, names);
+			free(group);
+		}
+		return;
+	}
+
+	names = hashmap_get(cache->groups, key->group.value);
+	if (!names) {
+		return;
+	}
+
+	entry = hashmap_remove2(names, key->name.value, (void **)&name);
+	if (!entry) {
+		return;
+	}
+	free(name);
+	drop_entries(cache, entry);
+}
+
+BuxtonGroupEntry *buxton_group_cache_get(BuxtonValueCache *cache,
+					 BuxtonLayer *layer,
+					 const char *group, uid_t uid)
+{
+	BuxtonGroupEntry *entry;
+	Hashmap *groups;
+
+	assert(cache);
+	assert(layer);
+	assert(group);
+
+	/* System layers are shared by every user */
+	if (layer->type != LAYER_USER) {
+		uid = 0;
+	}
+
+	groups = hashmap_get(cache->layers, layer);
+	if (!groups) {
+		return NULL;
+	}
+
+	for (entry = hashmap_get(groups, group); entry; entry = entry->next) {
+		if (entry->uid == uid) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* Group entries share one copy of a label, counting its users */
+static char *intern_label(BuxtonValueCache *cache, BuxtonString *label)
+{
+	uintptr_t refs;
+	char *l = NULL;
+
+	refs = (uintptr_t)hashmap_get2(cache->labels, label->value,
+				       (void **)&l);
+	if (refs) {
+		if (hashmap_update(cache->labels, l, (void *)(refs + 1)) < 0) {
+			abort();
+		}
+		return l;
+	}
+
+	l = strdup(label->value);
+	if (!l) {
+		abort();
+	}
+	if (hashmap_put(cache->labels, l, (void *)(uintptr_t)1) != 1) {
+		abort();
+	}
+
+	return l;
+}
+
+/* The label goes once no group entry is left on it */
+static void release_label(BuxtonValueCache *cache, char *label)
+{
+	uintptr_t refs;
+
+	if (!label) {
+		return;
+	}
+
+	refs = (uintptr_t)hashmap_get(cache->labels, label);
+	assert(refs > 0);
+	if (refs > 1) {
+		if (hashmap_update(cache->labels, label,
+				   (void *)(refs - 1)) < 0) {
+			abort();
+		}
+		return;
+	}
+	(void)hashmap_remove(cache->labels, label);
+	free(label);
+}
+
+BuxtonGroupEntry *buxton_group_cache_put(BuxtonValueCache *cache,
+					 BuxtonLayer *layer,
+					 const char *group, uid_t uid,
+					 bool exists, BuxtonString *label)
+{
+	BuxtonGroupEntry *entry;
+	Hashmap *groups;
+	char *old_label;
+	char *name;
+
+	if (!cache) {
+		return NULL;
+	}
+
+	assert(layer);
+	assert(group);
+
+	if (layer->type != LAYER_USER) {
+		uid = 0;
+	}
+
+	entry = buxton_group_cache_get(cache, layer, group, uid);
+	if (!entry) {
+		if (cache->group_count >= BUXTON_GROUP_CACHE_MAX) {
+			clear_layers(cache);
+		}
+
+		groups = hashmap_get(cache->layers, layer);
+		if (!groups) {
+			groups = hashmap_new(string_hash_func,
+					     string_compare_func);
+			if (!groups) {
+				abort();
+			}
+			if (hashmap_put(cache->layers, layer, groups) != 1) {
+				abort();
+			}
+		}
+
+		entry = malloc0(sizeof(BuxtonGroupEntry));
+		if (!entry) {
+			abort();
+		}
+		entry->uid = uid;
+		entry->next = hashmap_get(groups, group);
+		if (entry->next) {
+			if (hashmap_update(groups, group, entry) < 0) {
+				abort();
+			}
+		} else {
+			name = strdup(group);
+			if (!name) {
+				abort();
+			}
+			if (hashmap_put(groups, name, entry) != 1) {
+				abort();
+			}
+		}
+		cache->group_count++;
+	}
+
+	/* Interned before the old label is released, in case they match */
+	old_label = entry->label.value;
+	entry->exists = exists;
+	if (exists && label && label->value) {
+		entry->label.value = intern_label(cache, label);
+		entry->label.length = label->length;
+	} else {
+		entry->label.value = NULL;
+		entry->label.length = 0;
+	}
+	release_label(cache, old_label);
+
+	return entry;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,164 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file cache.h Internal header
+ * This file is used internally by buxton to cache resolved values
+ * and group metadata
+ * \internal
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "backend.h"
+#include "buxton.h"
+#include "hashmap.h"
+
+/**
+ * Most entries held before the cache is emptied
+ */
+#define BUXTON_VALUE_CACHE_MAX 8192
+
+/**
+ * Most bytes of entries, values and labels held before the cache is
+ * emptied
+ */
+#define BUXTON_VALUE_CACHE_BYTES (4 * 1024 * 1024)
+
+/**
+ * Most groups known before the group tables are emptied
+ */
+#define BUXTON_GROUP_CACHE_MAX 4096
+
+/**
+ * The value a layerless get resolved to for one user
+ */
+typedef struct BuxtonCacheEntry {
+	uid_t uid; /**<User the value was resolved for */
+	BuxtonLayer *layer; /**<Layer holding the winning value */
+	BuxtonData data; /**<Winning value */
+	BuxtonString label; /**<Label of the winning value */
+	BuxtonString group_label; /**<Label of the group in that layer */
+	struct BuxtonCacheEntry *next; /**<Entry for another user */
+} BuxtonCacheEntry;
+
+/**
+ * Whether a group exists in one layer for one user, and its label
+ */
+typedef struct BuxtonGroupEntry {
+	uid_t uid; /**<User for user layers, 0 for system layers */
+	bool exists; /**<Group exists in the layer */
+	BuxtonString label; /**<Interned label of the group if it exists */
+	struct BuxtonGroupEntry *next; /**<Entry for another user */
+} BuxtonGroupEntry;
+
+/**
+ * Resolved values of layerless gets, keyed by group and then name,
+ * and the groups of each layer
+ */
+typedef struct BuxtonValueCache {
+	Hashmap *groups; /**<Group name to a Hashmap of name to entries */
+	size_t count; /**<Number of entries held */
+	size_t bytes; /**<Bytes of the entries held, with their values and labels */
+	Hashmap *layers; /**<Layer to a Hashmap of group name to entries */
+	Hashmap *labels; /**<Interned group label to the number of entries on it */
+	size_t group_count; /**<Number of group entries held */
+	uint64_t hits; /**<Gets answered from the cache */
+	uint64_t misses; /**<Gets that had to search the layers */
+} BuxtonValueCache;
+
+/**
+ * Create an empty value cache
+ * @return a new cache, which must be freed with buxton_value_cache_free
+ */
+BuxtonValueCache *buxton_value_cache_new(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a value cache and all its entries
+ * @param cache The cache to free, may be NULL
+ */
+void buxton_value_cache_free(BuxtonValueCache *cache);
+
+/**
+ * Look up the value a key resolved to
+ * @param cache The cache to query
+ * @param key The key, only its group and name are used
+ * @param uid The user the key is resolved for
+ * @return the entry or NULL if the key isn't cached
+ */
+BuxtonCacheEntry *buxton_value_cache_get(BuxtonValueCache *cache,
+					 _BuxtonKey *key, uid_t uid)
+	__attribute__((warn_unused_result));
+
+/**
+ * Record the value a key resolved to
+ * @param cache The cache to update
+ * @param key The key, only its group and name are used
+ * @param entry The entry to add, the cache takes ownership of it
+ */
+void buxton_value_cache_put(BuxtonValueCache *cache, _BuxtonKey *key,
+			    BuxtonCacheEntry *entry);
+
+/**
+ * Drop cached values after a change
+ * @param cache The cache to update, may be NULL
+ * @param key The changed key, or the changed group if it has no name
+ */
+void buxton_value_cache_invalidate(BuxtonValueCache *cache, _BuxtonKey *key);
+
+/**
+ * Look up what is known of a group in a layer
+ * @param cache The cache to query
+ * @param layer The layer holding the group
+ * @param group The name of the group
+ * @param uid The user the layer is opened for
+ * @return the entry or NULL if the group hasn't been looked up
+ */
+BuxtonGroupEntry *buxton_group_cache_get(BuxtonValueCache *cache,
+					 BuxtonLayer *layer,
+					 const char *group, uid_t uid)
+	__attribute__((warn_unused_result));
+
+/**
+ * Record whether a group exists in a layer and its label
+ * @param cache The cache to update, may be NULL
+ * @param layer The layer holding the group
+ * @param group The name of the group
+ * @param uid The user the layer is opened for
+ * @param exists Whether the group exists
+ * @param label The label of the group, ignored if it doesn't exist
+ * @return the entry, owned by the cache, or NULL if cache is NULL
+ */
+BuxtonGroupEntry *buxton_group_cache_put(BuxtonValueCache *cache,
+					 BuxtonLayer *layer,
+					 const char *group, uid_t uid,
+					 bool exists, BuxtonString *label);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,409 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clientcache.h"
+#include "log.h"
+#include "util.h"
+
+static void free_value(BuxtonCachedValue *value)
+{
+	if (value->data.type == BUXTON_TYPE_STRING) {
+		free(value->data.store.d_string.value);
+	}
+	free(value->layer);
+	free(value);
+}
+
+static void lru_unlink(BuxtonClientCache *cache, BuxtonCachedValue *value)
+{
+	if (cache->lru_tail == value) {
+		cache->lru_tail = value->lru_prev;
+	}
+	LIST_REMOVE(BuxtonCachedValue, lru, cache->lru, value);
+}
+
+static void lru_push(BuxtonClientCache *cache, BuxtonCachedValue *value)
+{
+	LIST_PREPEND(BuxtonCachedValue, lru, cache->lru, value);
+	if (!cache->lru_tail) {
+		cache->lru_tail = value;
+	}
+}
+
+/* Forget a value that is already out of its group's names */
+static void forget_value(BuxtonClientCache *cache, BuxtonCachedValue *value)
+{
+	lru_unlink(cache, value);
+	cache->count--;
+	cache->bytes -= value->size;
+	free_value(value);
+}
+
+static void drop_name(BuxtonClientCache *cache, BuxtonCachedGroup *group,
+		      const char *name)
+{
+	BuxtonCachedValue *value, *next;
+	char *key = NULL;
+
+	value = hashmap_remove2(group->names, name, (void **)&key);
+	for (; value; value = next) {
+		next = value->next;
+		forget_value(cache, value);
+	}
+	free(key);
+}
+
+static void drop_names(BuxtonClientCache *cache, BuxtonCachedGroup *group)
+{
+	char *name;
+
+	while ((name = hashmap_first_key(group->names))) {
+		drop_name(cache, group, name);
+	}
+}
+
+static void drop_value(BuxtonClientCache *cache, BuxtonCachedValue *value)
+{
+	BuxtonCachedGroup *group = value->group;
+	BuxtonCachedValue *head, *prev;
+
+	head = hashmap_get(group->names, value->name);
+	assert(head);
+
+	if (head == value) {
+		if (!value->next) {
+			drop_name(cache, group, value->name);
+			return;
+		}
+		if (hashmap_update(group->names, value->name, value->next) < 0) {
+			abort();
+		}
+	} else {
+		for (prev = head; prev->next != value; prev = prev->next) {
+			assert(prev->next);
+		}
+		prev->next = value->next;
+	}
+	forget_value(cache, value);
+}
+
+static void evict(BuxtonClientCache *cache)
+{
+	while (cache->lru_tail && (cache->count > cache->max_count ||
+				   cache->bytes > cache->max_bytes)) {
+		drop_value(cache, cache->lru_tail);
+	}
+}
+
+static BuxtonCachedValue *find_value(BuxtonCachedGroup *group, _BuxtonKey *key)
+{
+	BuxtonCachedValue *value;
+
+	for (value = hashmap_get(group->names, key->name.value); value;
+	     value = value->next) {
+		if (!value->layer && !key->layer.value) {
+			return value;
+		}
+		if (value->layer && key->layer.value &&
+		    streq(value->layer, key->layer.value)) {
+			return value;
+		}
+	}
+
+	return NULL;
+}
+
+BuxtonClientCache *buxton_client_cache_new(size_t max_count, size_t max_bytes)
+{
+	BuxtonClientCache *cache;
+
+	cache = malloc0(sizeof(BuxtonClientCache));
+	if (!cache) {
+		abort();
+	}
+
+	cache->groups = hashmap_new(string_hash_func, string_compare_func);
+	if (!cache->groups) {
+		abort();
+	}
+	if (pthread_mutex_init(&cache->lock, NULL)) {
+		abort();
+	}
+	LIST_HEAD_INIT(BuxtonCachedValue, cache->lru);
+	cache->max_count = max_count;
+	cache->max_bytes = max_bytes;
+
+	return cache;
+}
+
+void buxton_client_cache_free(BuxtonClientCache *cache)
+{
+	BuxtonCachedGroup *group;
+
+	if (!cache) {
+		return;
+	}
+
+	buxton_debug("Client cache: %llu hits, %llu misses\n",
+		     (unsigned long long)cache->hits,
+		     (unsigned long long)cache->misses);
+	while ((group = hashmap_steal_first(cache->groups))) {
+		drop_names(cache, group);
+		hashmap_free(group->names);
+		free(group->name);
+		free(group);
+	}
+	hashmap_free(cache->groups);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+void buxton_client_cache_resize(BuxtonClientCache *cache, size_t max_count,
+				size_t max_bytes)
+{
+	assert(cache);
+
+	pthread_mutex_lock(&cache->lock);
+	cache->max_count = max_count;
+	cache->max_bytes = max_bytes;
+	evict(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+bool buxton_client_cache_get(BuxtonClientCache *cache, _BuxtonKey *key,
+			     BuxtonData *data, bool *watch)
+{
+	BuxtonCachedGroup *group;
+	BuxtonCachedValue *value = NULL;
+
+	assert(cache);
+	assert(key);
+	assert(data);
+	assert(watch);
+
+	pthread_mutex_lock(&cache->lock);
+	group = hashmap_get(cache->groups, key->group.value);
+	*watch = !group;
+	if (group && group->state == BUXTON_WATCH_ACTIVE) {
+		value = find_value(group, key);
+	}
+	if (!value || value->data.type != key->type) {
+		cache->misses++;
+		pthread_mutex_unlock(&cache->lock);
+		return false;
+	}
+
+	if (!buxton_data_copy(&value->data, data)) {
+		abort();
+	}
+	lru_unlink(cache, value);
+	lru_push(cache, value);
+	cache->hits++;
+	pthread_mutex_unlock(&cache->lock);
+
+	return true;
+}
+
+void buxton_client_cache_watch(BuxtonClientCache *cache, BuxtonString *group,
+			       uint32_t msgid)
+{
+	BuxtonCachedGroup *g;
+
+	assert(cache);
+	assert(group);
+
+	pthread_mutex_lock(&cache->lock);
+	if (hashmap_get(cache->groups, group->value)) {
+		pthread_mutex_unlock(&cache->lock);
+		return;
+	}
+
+	g = malloc0(sizeof(BuxtonCachedGroup));
+	if (!g) {
+		abort();
+	}
+	g->name = strdup(group->value);
+	g->names = hashmap_new(string_hash_func, string_compare_func);
+	if (!g->name || !g->names) {
+		abort();
+	}
+	g->state = BUXTON_WATCH_PENDING;
+	g->msgid = msgid;
+	if (hashmap_put(cache->groups, g->name, g) != 1) {
+		abort();
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void buxton_client_cache_watch_failed(BuxtonClientCache *cache,
+				      BuxtonString *group)
+{
+	BuxtonCachedGroup *g;
+
+	assert(cache);
+	assert(group);
+
+	pthread_mutex_lock(&cache->lock);
+	g = hashmap_get(cache->groups, group->value);
+	if (g) {
+		g->state = BUXTON_WATCH_FAILED;
+		drop_names(cache, g);
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void buxton_client_cache_put(BuxtonClientCache *cache, uint32_t msgid,
+			     _BuxtonKey *key, BuxtonData *data)
+{
+	BuxtonCachedGroup *group;
+	BuxtonCachedValue *value, *head;
+	char *name;
+
+	if (!cache) {
+		return;
+	}
+
+	assert(key);
+	assert(data);
+
+	if (!key->group.value || !key->name.value || data->type != key->type) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	group = hashmap_get(cache->groups, key->group.value);
+	if (!group || group->state == BUXTON_WATCH_FAILED) {
+		goto unlock;
+	}
+	/*
+	 * Replies come in the order requests were sent, so by the reply to
+	 * a get sent after the registration, a refusal would have been seen
+	 */
+	if (group->state == BUXTON_WATCH_PENDING) {
+		if ((int32_t)(msgid - group->msgid) <= 0) {
+			goto unlock;
+		}
+		group->state = BUXTON_WATCH_ACTIVE;
+	}
+
+	value = find_value(group, key);
+	if (value) {
+		drop_value(cache, value);
+	}
+
+	value = malloc0(sizeof(BuxtonCachedValue));
+	if (!value) {
+		abort();
+	}
+	if (!buxton_data_copy(data, &value->data)) {
+		abort();
+	}
+	value->size = sizeof(BuxtonCachedValue);
+	if (data->type == BUXTON_TYPE_STRING) {
+		value->size += data->store.d_string.length;
+	}
+	if (key->layer.value) {
+		value->layer = strdup(key->layer.value);
+		if (!value->layer) {
+			abort();
+		}
+		value->size += key->layer.length;
+	}
+	value->group = group;
+
+	head = hashmap_get(group->names, key->name.value);
+	if (head) {
+		value->name = head->name;
+		value->next = head;
+		if (hashmap_update(group->names, value->name, value) < 0) {
+			abort();
+		}
+	} else {
+		name = strdup(key->name.value);
+		if (!name) {
+			abort();
+		}
+		value->name = name;
+		if (hashmap_put(group->names, name, value) != 1) {
+			abort();
+		}
+	}
+
+	lru_push(cache, value);
+	cache->count++;
+	cache->bytes += value->size;
+	evict(cache);
+
+unlock:
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void buxton_client_cache_invalidate(BuxtonClientCache *cache, _BuxtonKey *key)
+{
+	BuxtonCachedGroup *group;
+
+	if (!cache) {
+		return;
+	}
+
+	assert(key);
+
+	if (!key->group.value) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	group = hashmap_get(cache->groups, key->group.value);
+	if (group) {
+		if (key->name.value) {
+			if (hashmap_get(group->names, key->name.value)) {
+				drop_name(cache, group, key->name.value);
+			}
+		} else {
+			drop_names(cache, group);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void buxton_client_cache_flush(BuxtonClientCache *cache)
+{
+	if (!cache) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	while (cache->lru_tail) {
+		drop_value(cache, cache->lru_tail);
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
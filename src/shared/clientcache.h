@@ -0,0 +1,173 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file clientcache.h Internal header
+ * This file is used internally by libbuxton to keep the values a client
+ * got, dropping them as buxtond notifies changes
+ * \internal
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buxton.h"
+#include "buxtondata.h"
+#include "buxtonkey.h"
+#include "hashmap.h"
+#include "list.h"
+
+/**
+ * Whether changes to a group reach the cache
+ */
+typedef enum BuxtonWatchState {
+	BUXTON_WATCH_PENDING, /**<Registration sent, no reply seen yet */
+	BUXTON_WATCH_ACTIVE, /**<buxtond notifies changes to the group */
+	BUXTON_WATCH_FAILED /**<Registration refused or timed out, group isn't cached */
+} BuxtonWatchState;
+
+struct BuxtonCachedGroup;
+
+/**
+ * A value got for a key, from one layer or layerless
+ */
+typedef struct BuxtonCachedValue {
+	struct BuxtonCachedGroup *group; /**<Group of the key */
+	char *name; /**<Name of the key, owned by the group's names */
+	char *layer; /**<Layer of the get, or NULL if layerless */
+	BuxtonData data; /**<The value */
+	size_t size; /**<Bytes accounted for this value */
+	struct BuxtonCachedValue *next; /**<Value of the name in another layer */
+	LIST_FIELDS(struct BuxtonCachedValue, lru); /**<Least recently used last */
+} BuxtonCachedValue;
+
+/**
+ * The cached values of a group and the state of its registration
+ */
+typedef struct BuxtonCachedGroup {
+	char *name; /**<Name of the group, owned by the cache's groups */
+	BuxtonWatchState state; /**<State of the group's registration */
+	uint32_t msgid; /**<Message ID of the registration */
+	Hashmap *names; /**<Key name to values */
+} BuxtonCachedGroup;
+
+/**
+ * Values a client got, bounded by count and bytes
+ */
+typedef struct BuxtonClientCache {
+	pthread_mutex_t lock; /**<Guards the cache, never held in callbacks */
+	Hashmap *groups; /**<Group name to BuxtonCachedGroup */
+	LIST_HEAD(BuxtonCachedValue, lru); /**<Most recently used first */
+	BuxtonCachedValue *lru_tail; /**<Next value to evict */
+	size_t count; /**<Number of values held */
+	size_t bytes; /**<Bytes accounted for the values held */
+	size_t max_count; /**<Most values held */
+	size_t max_bytes; /**<Most bytes held */
+	uint64_t hits; /**<Gets answered from the cache */
+	uint64_t misses; /**<Gets sent to buxtond */
+} BuxtonClientCache;
+
+/**
+ * Create an empty client cache
+ * @param max_count Most values to hold
+ * @param max_bytes Most bytes to hold
+ * @return a new cache, which must be freed with buxton_client_cache_free
+ */
+BuxtonClientCache *buxton_client_cache_new(size_t max_count, size_t max_bytes)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a client cache and all its values
+ * @param cache The cache to free, may be NULL
+ */
+void buxton_client_cache_free(BuxtonClientCache *cache);
+
+/**
+ * Change the bounds of a cache, evicting values over them
+ * @param cache The cache to update
+ * @param max_count Most values to hold
+ * @param max_bytes Most bytes to hold
+ */
+void buxton_client_cache_resize(BuxtonClientCache *cache, size_t max_count,
+				size_t max_bytes);
+
+/**
+ * Look up the value of a key, counting a hit or a miss
+ * @param cache The cache to query
+ * @param key The key, with its layer or none and its type
+ * @param data Set to a copy of the value on a hit, strings must be freed
+ * @param watch Set to true if the key's group has no registration yet
+ * @return true on a hit
+ */
+bool buxton_client_cache_get(BuxtonClientCache *cache, _BuxtonKey *key,
+			     BuxtonData *data, bool *watch)
+	__attribute__((warn_unused_result));
+
+/**
+ * Record that changes to a group were registered for
+ * @param cache The cache to update
+ * @param group Name of the group
+ * @param msgid Message ID of the registration
+ */
+void buxton_client_cache_watch(BuxtonClientCache *cache, BuxtonString *group,
+			       uint32_t msgid);
+
+/**
+ * Record that buxtond refused the registration of a group, or never
+ * replied to it
+ * @param cache The cache to update
+ * @param group Name of the group
+ */
+void buxton_client_cache_watch_failed(BuxtonClientCache *cache,
+				      BuxtonString *group);
+
+/**
+ * Keep the value a get returned, if changes to its group are notified
+ * @param cache The cache to update, may be NULL
+ * @param msgid Message ID of the get
+ * @param key The key, with its layer or none and its type
+ * @param data The value
+ */
+void buxton_client_cache_put(BuxtonClientCache *cache, uint32_t msgid,
+			     _BuxtonKey *key, BuxtonData *data);
+
+/**
+ * Drop the values of a key in every layer
+ * @param cache The cache to update, may be NULL
+ * @param key The changed key, or the changed group if it has no name
+ */
+void buxton_client_cache_invalidate(BuxtonClientCache *cache, _BuxtonKey *key);
+
+/**
+ * Drop every value, after buxtond dropped notifications that may have
+ * changed them. Registrations are kept, as buxtond still has them.
+ * @param cache The cache to update, may be NULL
+ */
+void buxton_client_cache_flush(BuxtonClientCache *cache);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
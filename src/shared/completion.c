@@ -0,0 +1,208 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "completion.h"
+#include "log.h"
+#include "protocol.h"
+#include "util.h"
+
+static void free_completion(BuxtonCompletion *completion)
+{
+	for (size_t i = 0; i < completion->count; i++) {
+		if (completion->list[i].type == BUXTON_TYPE_STRING) {
+			free(completion->list[i].store.d_string.value);
+		}
+	}
+	free(completion->list);
+	free(completion->key.group.value);
+	free(completion->key.name.value);
+	free(completion->key.layer.value);
+	free(completion);
+}
+
+static bool watch_fd(int poll_fd, int fd)
+{
+	struct epoll_event event;
+
+	memzero(&event, sizeof(struct epoll_event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+
+	return epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+BuxtonCompletionQueue *buxton_completion_queue_new(int fd)
+{
+	BuxtonCompletionQueue *queue;
+
+	queue = malloc0(sizeof(BuxtonCompletionQueue));
+	if (!queue) {
+		abort();
+	}
+
+	LIST_HEAD_INIT(BuxtonCompletion, queue->head);
+	queue->poll_fd = -1;
+	queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (queue->event_fd == -1) {
+		buxton_log("eventfd(): %m\n");
+		goto fail;
+	}
+
+	queue->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (queue->poll_fd == -1) {
+		buxton_log("epoll_create1(): %m\n");
+		goto fail;
+	}
+
+	if (!watch_fd(queue->poll_fd, fd) ||
+	    !watch_fd(queue->poll_fd, queue->event_fd)) {
+		buxton_log("epoll_ctl(): %m\n");
+		goto fail;
+	}
+
+	return queue;
+
+fail:
+	buxton_completion_queue_free(queue);
+	return NULL;
+}
+
+void buxton_completion_queue_free(BuxtonCompletionQueue *queue)
+{
+	BuxtonCompletion *completion;
+
+	if (!queue) {
+		return;
+	}
+
+	while ((completion = queue->head)) {
+		LIST_REMOVE(BuxtonCompletion, item, queue->head, completion);
+		free_completion(completion);
+	}
+	if (queue->poll_fd != -1) {
+		close(queue->poll_fd);
+	}
+	if (queue->event_fd != -1) {
+		close(queue->event_fd);
+	}
+	free(queue);
+}
+
+void buxton_completion_post(BuxtonCompletionQueue *queue,
+			    BuxtonCallback callback, void *data, size_t count,
+			    BuxtonData *list, BuxtonControlMessage type,
+			    _BuxtonKey *key)
+{
+	BuxtonCompletion *completion;
+
+	assert(queue);
+
+	if (!callback) {
+		return;
+	}
+
+	completion = malloc0(sizeof(BuxtonCompletion));
+	if (!completion) {
+		abort();
+	}
+	if (count) {
+		completion->list = malloc(sizeof(BuxtonData) * count);
+		if (!completion->list) {
+			abort();
+		}
+	}
+
+	/* Values that are not strings, including unset ones, copy as is */
+	for (size_t i = 0; i < count; i++) {
+		completion->list[i] = list[i];
+		if (list[i].type == BUXTON_TYPE_STRING &&
+		    !buxton_string_copy(&list[i].store.d_string,
+					&completion->list[i].store.d_string)) {
+			abort();
+		}
+	}
+	completion->count = count;
+	if (key) {
+		if (!buxton_key_copy(key, &completion->key)) {
+			abort();
+		}
+		completion->has_key = true;
+	}
+	completion->callback = callback;
+	completion->data = data;
+	completion->type = type;
+
+	if (queue->tail) {
+		LIST_INSERT_AFTER(BuxtonCompletion, item, queue->head,
+				  queue->tail, completion);
+	} else {
+		LIST_PREPEND(BuxtonCompletion, item, queue->head, completion);
+		if (eventfd_write(queue->event_fd, 1) < 0) {
+			buxton_log("eventfd_write(): %m\n");
+		}
+	}
+	queue->tail = completion;
+	queue->count++;
+}
+
+size_t buxton_completion_run(BuxtonCompletionQueue *queue, size_t max)
+{
+	BuxtonCompletion *completion;
+	eventfd_t value;
+	size_t ran = 0;
+
+	assert(queue);
+
+	/* Unlink first, a callback may drain the client again */
+	while (ran < max && (completion = queue->head)) {
+		LIST_REMOVE(BuxtonCompletion, item, queue->head, completion);
+		if (queue->tail == completion) {
+			queue->tail = NULL;
+		}
+		queue->count--;
+		if (!queue->count) {
+			(void)eventfd_read(queue->event_fd, &value);
+		}
+
+		run_callback(completion->callback, completion->data,
+			     completion->count, completion->list,
+			     completion->type,
+			     completion->has_key ? &completion->key : NULL);
+		free_completion(completion);
+		ran++;
+	}
+
+	return ran;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,108 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file completion.h Internal header
+ * This file is used internally by libbuxton to queue the callbacks of
+ * a client's replies and notifications, so they run when the client
+ * drains them rather than while replies are read
+ * \internal
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buxton.h"
+#include "buxtondata.h"
+#include "buxtonkey.h"
+#include "list.h"
+
+/**
+ * A callback waiting to run, with its own copy of the response
+ */
+typedef struct BuxtonCompletion {
+	BuxtonCallback callback; /**<Callback to run */
+	void *data; /**<User data of the callback */
+	BuxtonControlMessage type; /**<Type of the response */
+	BuxtonData *list; /**<Values of the response */
+	size_t count; /**<Number of values */
+	_BuxtonKey key; /**<Key of the response */
+	bool has_key; /**<Whether the response has a key */
+	LIST_FIELDS(struct BuxtonCompletion, item); /**<Oldest first */
+} BuxtonCompletion;
+
+/**
+ * The completions of a client. Only the thread draining the client
+ * touches the queue, so it needs no lock.
+ */
+typedef struct BuxtonCompletionQueue {
+	LIST_HEAD(BuxtonCompletion, head); /**<Next completion to run */
+	BuxtonCompletion *tail; /**<Last completion queued */
+	size_t count; /**<Number of completions queued */
+	int event_fd; /**<Readable while completions are queued */
+	int poll_fd; /**<Readable when the client has work to drain */
+} BuxtonCompletionQueue;
+
+/**
+ * Create an empty completion queue for a client
+ * @param fd The client's socket
+ * @return a new queue, or NULL if its file descriptors could not be
+ * created
+ */
+BuxtonCompletionQueue *buxton_completion_queue_new(int fd)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free a completion queue, dropping the completions left in it
+ * @param queue The queue to free, may be NULL
+ */
+void buxton_completion_queue_free(BuxtonCompletionQueue *queue);
+
+/**
+ * Queue a callback with a copy of its response
+ * @param queue The queue to post to
+ * @param callback Callback to run, nothing is queued if NULL
+ * @param data User data of the callback
+ * @param count Number of values in the response
+ * @param list Values of the response
+ * @param type Type of the response
+ * @param key Key of the response, or NULL
+ */
+void buxton_completion_post(BuxtonCompletionQueue *queue,
+			    BuxtonCallback callback, void *data, size_t count,
+			    BuxtonData *list, BuxtonControlMessage type,
+			    _BuxtonKey *key);
+
+/**
+ * Run the oldest completions, in the order they were queued
+ * @param queue The queue to drain
+ * @param max Most completions to run
+ * @return the number of completions run
+ */
+size_t buxton_completion_run(BuxtonCompletionQueue *queue, size_t max);
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -29,6 +29,21 @@
  */
 #define CONFIG_SECTION "Configuration"
 
+/**
+ * Default number of bytes buxtond queues for a client that isn't reading
+ */
+#define _CLIENT_QUEUE_LIMIT "262144"
+
+/**
+ * Default handling of clients over the queue limit
+ */
+#define _CLIENT_QUEUE_POLICY "drop"
+
+/**
+ * Default path of the snapshot file, next to the socket
+ */
+#define _SNAPSHOT_PATH _BUXTON_SOCKET ".snapshot"
+
 #ifndef HAVE_SECURE_GETENV
 #  ifdef HAVE___SECURE_GETENV
 #    define secure_getenv __secure_getenv
@@ -62,7 +77,10 @@ static const char *KS[CONFIG_MAX] = {
 	"BUXTON_MODULE_DIR",
 	"BUXTON_DB_PATH",
 	"BUXTON_SMACK_LOAD_FILE",
-	"BUXTON_BUXTON_SOCKET"
+	"BUXTON_BUXTON_SOCKET",
+	"BUXTON_CLIENT_QUEUE_LIMIT",
+	"BUXTON_CLIENT_QUEUE_POLICY",
+	"BUXTON_SNAPSHOT_PATH"
 };
 
 /**
@@ -75,7 +93,10 @@ static const char *config_keys[CONFIG_MAX] = {
 	"ModuleDirectory",
 	"DatabasePath",
 	"SmackLoadFile",
-	"SocketPath"
+	"SocketPath",
+	"ClientQueueLimit",
+	"ClientQueuePolicy",
+	"SnapshotPath"
 };
 
 static const char *COMPILE_DEFAULT[CONFIG_MAX] = {
@@ -84,7 +105,10 @@ static const char *COMPILE_DEFAULT[CONFIG_MAX] = {
 	_MODULE_DIRECTORY,
 	_DB_PATH,
 	_SMACK_LOAD_FILE,
-	_BUXTON_SOCKET
+	_BUXTON_SOCKET,
+	_CLIENT_QUEUE_LIMIT,
+	_CLIENT_QUEUE_POLICY,
+	_SNAPSHOT_PATH
 };
 
 /**
@@ -166,6 +190,24 @@ static inline int get_ini_int(char *section, char *name, bool required,
 	return iniparser_getint(conf.ini, buf, def);
 }
 
+/**
+ * analagous method to get_ini_string()
+ *
+ * @param section the section of the ini file
+ * @param name the name of the key
+ * @param def default value for the setting
+ *
+ * @return the value
+ */
+static inline bool get_ini_bool(char *section, char *name, bool def)
+{
+	char buf[PATH_MAX];
+
+	assert(conf.ini);
+	snprintf(buf, sizeof(buf), "%s:%s", section, name);
+	return iniparser_getboolean(conf.ini, buf, def) == 1;
+}
+
 /**
  * @internal
  * Initialize conf
@@ -282,6 +324,24 @@ const char* buxton_socket(void)
 	return (const char*)conf.keys[CONFIG_BUXTON_SOCKET];
 }
 
+const char* buxton_client_queue_limit(void)
+{
+	initialize();
+	return (const char*)conf.keys[CONFIG_CLIENT_QUEUE_LIMIT];
+}
+
+const char* buxton_client_queue_policy(void)
+{
+	initialize();
+	return (const char*)conf.keys[CONFIG_CLIENT_QUEUE_POLICY];
+}
+
+const char* buxton_snapshot_path(void)
+{
+	initialize();
+	return (const char*)conf.keys[CONFIG_SNAPSHOT_PATH];
+}
+
 int buxton_key_get_layers(ConfigLayer **layers)
 {
 	ConfigLayer *_layers;
@@ -320,6 +380,8 @@ int buxton_key_get_layers(ConfigLayer **layers)
 			true, 0);
 		_layers[j].access = get_ini_string(section_name, "Access",
 			false, "read-write");
+		_layers[j].snapshot = get_ini_bool(section_name, "Snapshot",
+			false);
 		j++;
 	}
 	*layers = _layers;
@@ -20,6 +20,8 @@
 	#include "config.h"
 #endif
 
+#include <stdbool.h>
+
 typedef enum ConfigKey {
 	CONFIG_MIN = 0,
 	CONFIG_CONF_FILE,
@@ -27,6 +29,9 @@ typedef enum ConfigKey {
 	CONFIG_DB_PATH,
 	CONFIG_SMACK_LOAD_FILE,
 	CONFIG_BUXTON_SOCKET,
+	CONFIG_CLIENT_QUEUE_LIMIT,
+	CONFIG_CLIENT_QUEUE_POLICY,
+	CONFIG_SNAPSHOT_PATH,
 	CONFIG_MAX
 } ConfigKey;
 
@@ -42,6 +47,7 @@ typedef struct ConfigLayer {
 	char *description;
 	char *access;
 	int priority;
+	bool snapshot;
 } ConfigLayer;
 
 /**
@@ -105,6 +111,39 @@ const char *buxton_smack_load_file(void)
 const char *buxton_socket(void)
 	__attribute__((warn_unused_result));
 
+/**
+ * @internal
+ * @brief Get the per-client output queue limit of buxtond.
+ *
+ *
+ * @return the limit in bytes as a string. Do not free this pointer.
+ * It belongs to configurator.
+ */
+const char *buxton_client_queue_limit(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * @internal
+ * @brief Get what buxtond does with clients over their queue limit.
+ *
+ *
+ * @return "drop" or "disconnect". Do not free this pointer.
+ * It belongs to configurator.
+ */
+const char *buxton_client_queue_policy(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * @internal
+ * @brief Get the path of the snapshot file buxtond publishes values in.
+ *
+ *
+ * @return the path of the snapshot file. Do not free this pointer.
+ * It belongs to configurator.
+ */
+const char *buxton_snapshot_path(void)
+	__attribute__((warn_unused_result));
+
 /**
  * @internal
  * @brief Get an array of ConfigLayers from the conf file
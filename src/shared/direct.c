@@ -17,13 +17,31 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "cache.h"
+#include "configurator.h"
 #include "direct.h"
 #include "log.h"
+#include "serialize.h"
 #include "smack.h"
+#include "snapshot.h"
 #include "util.h"
 
 #define BUXTON_ROOT_CHECK_ENV "BUXTON_ROOT_CHECK"
 
+/**
+ * Outcome of a group lookup and read check in one layer, kept while
+ * several keys are read on behalf of the same client
+ */
+typedef struct GroupCheck {
+	BuxtonLayer *layer;
+	int ret;
+	struct GroupCheck *next;
+} GroupCheck;
+
+static int get_value_for_layer(BuxtonControl *control, _BuxtonKey *key,
+			       BuxtonData *data, BuxtonString *data_label,
+			       BuxtonString *client_label, Hashmap *groups);
+
 bool buxton_direct_open(BuxtonControl *control)
 {
 
@@ -31,6 +49,8 @@ bool buxton_direct_open(BuxtonControl *control)
 
 	memzero(&(control->config), sizeof(BuxtonConfig));
 	buxton_init_layers(&(control->config));
+	control->cache = NULL;
+	control->snapshot = NULL;
 
 	control->client.direct = true;
 	control->client.pid = getpid();
@@ -38,77 +58,333 @@ bool buxton_direct_open(BuxtonControl *control)
 	return true;
 }
 
-int32_t buxton_direct_get_value(BuxtonControl *control, _BuxtonKey *key,
+/*
+ * buxtond neither sees nor republishes direct writes, so layers it
+ * publishes are left to it while it runs. Its own writes go through
+ * control->snapshot.
+ */
+static bool may_write_layer(BuxtonControl *control, BuxtonLayer *layer)
+{
+	if (control->snapshot || !layer->snapshot) {
+		return true;
+	}
+	if (buxton_snapshot_published(buxton_snapshot_path())) {
+		buxton_log("Layer %s is published by buxtond, write it through buxtond\n",
+			   layer->name.value);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Find the group of a key in one layer. The daemon remembers every
+ * group it has looked up, so *label then points into its group table;
+ * otherwise the label is read from the backend into *tmp, which the
+ * caller must free.
+ */
+static int find_group(BuxtonControl *control, _BuxtonKey *key,
+		      BuxtonLayer *layer, BuxtonString *label, char **tmp)
+{
+	BuxtonGroupEntry *entry;
+	BuxtonBackend *backend;
+	BuxtonData g;
+	_BuxtonKey group;
+	int ret;
+
+	if (!key->group.value) {
+		return EINVAL;
+	}
+
+	if (control->cache) {
+		entry = buxton_group_cache_get(control->cache, layer,
+					       key->group.value,
+					       control->client.uid);
+		if (entry) {
+			if (!entry->exists) {
+				return ENOENT;
+			}
+			*label = entry->label;
+			return 0;
+		}
+	}
+
+	memzero(&g, sizeof(BuxtonData));
+	memzero(&group, sizeof(_BuxtonKey));
+	memzero(label, sizeof(BuxtonString));
+	group.group = key->group;
+	group.layer = layer->name;
+	group.type = BUXTON_TYPE_STRING;
+
+	backend = backend_for_layer(&control->config, layer);
+	assert(backend);
+
+	layer->uid = control->client.uid;
+	ret = backend->get_value(layer, &group, &g, label);
+	if (ret) {
+		if (ret == ENOENT) {
+			buxton_group_cache_put(control->cache, layer,
+					       key->group.value,
+					       control->client.uid, false,
+					       NULL);
+		}
+		return ret;
+	}
+	free(g.store.d_string.value);
+
+	entry = buxton_group_cache_put(control->cache, layer, key->group.value,
+				       control->client.uid, true, label);
+	if (entry) {
+		free(label->value);
+		*label = entry->label;
+	} else {
+		*tmp = label->value;
+	}
+
+	return 0;
+}
+
+static int32_t resolve_value(BuxtonControl *control, _BuxtonKey *key,
 			     BuxtonData *data, BuxtonString *data_label,
-			     BuxtonString *client_label)
+			     BuxtonString *client_label, Hashmap *groups,
+			     BuxtonLayer **winner)
 {
-	/* Handle direct manipulation */
-	BuxtonLayer *l;
 	BuxtonConfig *config;
-	BuxtonString layer = (BuxtonString){ NULL, 0 };
-	Iterator i;
-	BuxtonData d;
-	int priority = 0;
+	BuxtonLayer *l;
+	int32_t ret;
+
+	config = &control->config;
+
+	/* Layers are sorted so that the first one holding the key wins */
+	for (size_t n = 0; n < config->layer_count; n++) {
+		l = config->layer_order[n];
+		key->layer = l->name;
+		ret = (int32_t)get_value_for_layer(control, key, data,
+						   data_label, client_label,
+						   groups);
+		if (!ret) {
+			key->layer = (BuxtonString){ NULL, 0 };
+			if (winner) {
+				*winner = l;
+			}
+			return 0;
+		}
+	}
+	key->layer = (BuxtonString){ NULL, 0 };
+
+	return ENOENT;
+}
+
+/*
+ * Resolve a key for every client at once: without a client label or a
+ * type, the winner is the highest layer holding the key at all. A
+ * client that may read that value of that type would have resolved to
+ * it too, anyone else falls back to a full search.
+ */
+static BuxtonCacheEntry *cache_value(BuxtonControl *control, _BuxtonKey *key,
+				     int32_t *status)
+{
+	BuxtonCacheEntry *entry;
+	BuxtonDataType type = key->type;
+	BuxtonString group_label;
+	_cleanup_free_ char *tmp = NULL;
+	int32_t ret;
+
+	entry = malloc0(sizeof(BuxtonCacheEntry));
+	if (!entry) {
+		abort();
+	}
+
+	key->type = BUXTON_TYPE_UNSET;
+	ret = resolve_value(control, key, &entry->data, &entry->label, NULL,
+			    NULL, &entry->layer);
+	key->type = type;
+	if (ret) {
+		free(entry);
+		*status = ret;
+		return NULL;
+	}
+
+	if (find_group(control, key, entry->layer, &group_label, &tmp)) {
+		if (entry->data.type == BUXTON_TYPE_STRING) {
+			free(entry->data.store.d_string.value);
+		}
+		free(entry->label.value);
+		free(entry);
+		*status = -1;
+		return NULL;
+	}
+	if (!buxton_string_copy(&group_label, &entry->group_label)) {
+		abort();
+	}
+
+	entry->uid = control->client.uid;
+	buxton_value_cache_put(control->cache, key, entry);
+
+	return entry;
+}
+
+/*
+ * Returns 0 if the value was served from the cache, -1 if the client
+ * needs a full search, or an errno value if no layer holds the key
+ */
+static int32_t get_cached_value(BuxtonControl *control, _BuxtonKey *key,
+				BuxtonData *data, BuxtonString *data_label,
+				BuxtonString *client_label)
+{
+	BuxtonCacheEntry *entry;
+	int32_t ret = -1;
+
+	entry = buxton_value_cache_get(control->cache, key, control->client.uid);
+	if (entry) {
+		control->cache->hits++;
+	} else {
+		control->cache->misses++;
+		entry = cache_value(control, key, &ret);
+		if (!entry) {
+			return ret;
+		}
+	}
+
+	if (key->type != BUXTON_TYPE_UNSET && key->type != entry->data.type) {
+		return -1;
+	}
+	if (client_label &&
+	    !buxton_check_smack_access(client_label, &entry->group_label,
+				       ACCESS_READ)) {
+		return -1;
+	}
+	if (entry->label.value && client_label && client_label->value &&
+	    !buxton_check_smack_access(client_label, &entry->label,
+				       ACCESS_READ)) {
+		return -1;
+	}
+
+	if (!buxton_data_copy(&entry->data, data)) {
+		abort();
+	}
+	if (!buxton_string_copy(&entry->label, data_label)) {
+		abort();
+	}
+
+	return 0;
+}
+
+static int32_t get_value(BuxtonControl *control, _BuxtonKey *key,
+			 BuxtonData *data, BuxtonString *data_label,
+			 BuxtonString *client_label, Hashmap *groups)
+{
+	/* Handle direct manipulation */
 	int32_t ret;
-	BuxtonLayerType layer_origin = -1;
 
 	assert(control);
 	assert(key);
 
 	if (key->layer.value) {
-		ret = (int32_t)buxton_direct_get_value_for_layer(control, key, data,
-						      data_label,
-						      client_label);
-		return ret;
+		return (int32_t)get_value_for_layer(control, key, data,
+						    data_label, client_label,
+						    groups);
 	}
 
-	config = &control->config;
+	if (control->cache && key->name.value) {
+		ret = get_cached_value(control, key, data, data_label,
+				       client_label);
+		if (ret != -1) {
+			return ret;
+		}
+	}
 
-	HASHMAP_FOREACH(l, config->layers, i) {
-		key->layer.value = l->name.value;
-		key->layer.length = l->name.length;
-		ret = (int32_t)buxton_direct_get_value_for_layer(control,
-						      key,
-						      &d,
-						      data_label,
-						      client_label);
-		if (!ret) {
-			free(data_label->value);
-			data_label->value = NULL;
-			data_label->length = 0;
-			if (d.type == BUXTON_TYPE_STRING) {
-				free(d.store.d_string.value);
-			}
+	return resolve_value(control, key, data, data_label, client_label,
+			     groups, NULL);
+}
 
-			if ((l->type == LAYER_SYSTEM && (layer_origin != LAYER_SYSTEM ||
-							 priority <= l->priority)) ||
-			    (l->type == LAYER_USER && layer_origin != LAYER_SYSTEM &&
-			     priority <= l->priority)) {
-				if (l->type == LAYER_SYSTEM) {
-					layer_origin = LAYER_SYSTEM;
-				} else {
-					layer_origin = LAYER_USER;
-				}
-				priority = l->priority;
-				layer.value = l->name.value;
-				layer.length = l->name.length;
+int32_t buxton_direct_get_value(BuxtonControl *control, _BuxtonKey *key,
+			     BuxtonData *data, BuxtonString *data_label,
+			     BuxtonString *client_label)
+{
+	return get_value(control, key, data, data_label, client_label, NULL);
+}
+
+void buxton_direct_get_values(BuxtonControl *control, _BuxtonKey *keys,
+			      size_t count, BuxtonData *data, int32_t *status,
+			      BuxtonString *client_label)
+{
+	BuxtonString data_label;
+	GroupCheck *check, *next;
+	Hashmap *groups;
+	Iterator i;
+
+	assert(control);
+	assert(keys);
+	assert(data);
+	assert(status);
+
+	groups = hashmap_new(string_hash_func, string_compare_func);
+	if (!groups) {
+		abort();
+	}
+
+	for (size_t k = 0; k < count; k++) {
+		memzero(&data_label, sizeof(BuxtonString));
+		status[k] = get_value(control, &keys[k], &data[k], &data_label,
+				      client_label, groups);
+		free(data_label.value);
+	}
+
+	HASHMAP_FOREACH(check, groups, i) {
+		for (; check; check = next) {
+			next = check->next;
+			free(check);
+		}
+	}
+	hashmap_free(groups);
+}
+
+/*
+ * Groups must be created first, so a key lookup fails if its group
+ * doesn't exist or the client can't read it. When several keys are
+ * read together the outcome is remembered for each group and layer.
+ */
+static int check_group(BuxtonControl *control, _BuxtonKey *key,
+		       BuxtonLayer *layer, BuxtonString *client_label,
+		       Hashmap *groups)
+{
+	GroupCheck *head = NULL;
+	GroupCheck *check;
+	BuxtonString group_label;
+	_cleanup_free_ char *tmp = NULL;
+	int ret;
+
+	if (groups) {
+		head = hashmap_get(groups, key->group.value);
+		for (check = head; check; check = check->next) {
+			if (check->layer == layer) {
+				return check->ret;
 			}
 		}
 	}
-	if (layer.value) {
-		key->layer.value = layer.value;
-		key->layer.length = layer.length;
-		ret = (int32_t)buxton_direct_get_value_for_layer(control,
-						      key,
-						      data,
-						      data_label,
-						      client_label);
-		key->layer.value = NULL;
-		key->layer.length = 0;
 
-		return ret;
+	ret = find_group(control, key, layer, &group_label, &tmp);
+	if (ret) {
+		buxton_debug("Group %s missing for get value\n", key->group.value);
+	} else if (client_label &&
+		   !buxton_check_smack_access(client_label, &group_label, ACCESS_READ)) {
+		ret = EPERM;
 	}
-	return ENOENT;
+
+	if (groups) {
+		check = malloc0(sizeof(GroupCheck));
+		if (!check) {
+			abort();
+		}
+		check->layer = layer;
+		check->ret = ret;
+		check->next = head;
+		if (hashmap_replace(groups, key->group.value, check) < 0) {
+			abort();
+		}
+	}
+
+	return ret;
 }
 
 int buxton_direct_get_value_for_layer(BuxtonControl *control,
@@ -116,14 +392,19 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 				       BuxtonData *data,
 				       BuxtonString *data_label,
 				       BuxtonString *client_label)
+{
+	return get_value_for_layer(control, key, data, data_label,
+				   client_label, NULL);
+}
+
+static int get_value_for_layer(BuxtonControl *control, _BuxtonKey *key,
+			       BuxtonData *data, BuxtonString *data_label,
+			       BuxtonString *client_label, Hashmap *groups)
 {
 	/* Handle direct manipulation */
 	BuxtonBackend *backend = NULL;
 	BuxtonLayer *layer = NULL;
 	BuxtonConfig *config;
-	BuxtonData g;
-	_BuxtonKey group;
-	BuxtonString group_label;
 	int ret;
 
 	assert(control);
@@ -133,10 +414,6 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 	buxton_debug("get_value '%s:%s' for layer '%s' start\n",
 		     key->group.value, key->name.value, key->layer.value);
 
-	memzero(&g, sizeof(BuxtonData));
-	memzero(&group, sizeof(_BuxtonKey));
-	memzero(&group_label, sizeof(BuxtonString));
-
 	if (!key->layer.value) {
 		ret = EINVAL;
 		goto fail;
@@ -152,22 +429,10 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 
 	layer->uid = control->client.uid;
 
-	/* Groups must be created first, so bail if this key's group doesn't exist */
+	/* The group checks are only needed for key lookups, or we recurse endlessly */
 	if (key->name.value) {
-		if (!buxton_copy_key_group(key, &group)) {
-			abort();
-		}
-		ret = buxton_direct_get_value_for_layer(control, &group, &g, &group_label, NULL);
+		ret = check_group(control, key, layer, client_label, groups);
 		if (ret) {
-			buxton_debug("Group %s for name %s missing for get value\n", key->group.value, key->name.value);
-			goto fail;
-		}
-	}
-
-	/* The group checks are only needed for key lookups, or we recurse endlessly */
-	if (key->name.value && client_label) {
-		if (!buxton_check_smack_access(client_label, &group_label, ACCESS_READ)) {
-			ret = EPERM;
 			goto fail;
 		}
 	}
@@ -180,17 +445,16 @@ int buxton_direct_get_value_for_layer(BuxtonControl *control,
 			/* Client lacks permission to read the value */
 			free(data_label->value);
 			data_label->value = NULL;
+			if (data->type == BUXTON_TYPE_STRING) {
+				free(data->store.d_string.value);
+				data->store.d_string.value = NULL;
+			}
 			ret = EPERM;
 			goto fail;
 		}
 	}
 
 fail:
-	free(g.store.d_string.value);
-	free(group.group.value);
-	free(group.name.value);
-	free(group.layer.value);
-	free(group_label.value);
 	buxton_debug("get_value '%s:%s' for layer '%s' end\n",
 		     key->group.value, key->name.value, key->layer.value);
 	return ret;
@@ -207,11 +471,10 @@ bool buxton_direct_set_value(BuxtonControl *control,
 	BuxtonConfig *config;
 	BuxtonString default_label = buxton_string_pack("_");
 	BuxtonString *l;
+	BuxtonString group_label;
 	_cleanup_buxton_data_ BuxtonData *d = NULL;
-	_cleanup_buxton_data_ BuxtonData *g = NULL;
-	_cleanup_buxton_key_ _BuxtonKey *group = NULL;
 	_cleanup_buxton_string_ BuxtonString *data_label = NULL;
-	_cleanup_buxton_string_ BuxtonString *group_label = NULL;
+	_cleanup_free_ char *tmp = NULL;
 	bool r = false;
 	int ret;
 
@@ -221,19 +484,6 @@ bool buxton_direct_set_value(BuxtonControl *control,
 
 	buxton_debug("set_value start\n");
 
-	group = malloc0(sizeof(_BuxtonKey));
-	if (!group) {
-		abort();
-	}
-	g = malloc0(sizeof(BuxtonData));
-	if (!g) {
-		abort();
-	}
-	group_label = malloc0(sizeof(BuxtonString));
-	if (!group_label) {
-		abort();
-	}
-
 	d = malloc0(sizeof(BuxtonData));
 	if (!d) {
 		abort();
@@ -243,12 +493,14 @@ bool buxton_direct_set_value(BuxtonControl *control,
 		abort();
 	}
 
-	/* Groups must be created first, so bail if this key's group doesn't exist */
-	if (!buxton_copy_key_group(key, group)) {
-		abort();
+	config = &control->config;
+	if (!key->layer.value ||
+	    (layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
+		goto fail;
 	}
 
-	ret = buxton_direct_get_value_for_layer(control, group, g, group_label, NULL);
+	/* Groups must be created first, so bail if this key's group doesn't exist */
+	ret = find_group(control, key, layer, &group_label, &tmp);
 	if (ret) {
 		buxton_debug("Error(%d): %s\n", ret, strerror(ret));
 		buxton_debug("Group %s for name %s missing for set value\n", key->group.value, key->name.value);
@@ -257,7 +509,7 @@ bool buxton_direct_set_value(BuxtonControl *control,
 
 	/* Access checks are not needed for direct clients, where label is NULL */
 	if (label) {
-		if (!buxton_check_smack_access(label, group_label, ACCESS_WRITE)) {
+		if (!buxton_check_smack_access(label, &group_label, ACCESS_WRITE)) {
 			goto fail;
 		}
 
@@ -290,15 +542,13 @@ bool buxton_direct_set_value(BuxtonControl *control,
 		}
 	}
 
-	config = &control->config;
-	if ((layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
-		goto fail;
-	}
-
 	if (layer->readonly) {
 		buxton_debug("Read-only layer!\n");
 		goto fail;
 	}
+	if (!may_write_layer(control, layer)) {
+		goto fail;
+	}
 
 	backend = backend_for_layer(config, layer);
 	assert(backend);
@@ -308,6 +558,9 @@ bool buxton_direct_set_value(BuxtonControl *control,
 	if (ret) {
 		buxton_debug("set value failed: %s\n", strerror(ret));
 	} else {
+		buxton_value_cache_invalidate(control->cache, key);
+		buxton_snapshot_update(control->snapshot, layer, key, data, l,
+				       &group_label);
 		r = true;
 	}
 
@@ -340,6 +593,9 @@ bool buxton_direct_set_label(BuxtonControl *control,
 		buxton_debug("Read-only layer!\n");
 		goto fail;
 	}
+	if (!may_write_layer(control, layer)) {
+		goto fail;
+	}
 
 	if (layer->type == LAYER_SYSTEM) {
 		char *root_check = getenv(BUXTON_ROOT_CHECK_ENV);
@@ -363,6 +619,15 @@ bool buxton_direct_set_label(BuxtonControl *control,
 	if (ret) {
 		buxton_debug("set label failed: %s\n", strerror(ret));
 	} else {
+		if (!key->name.value) {
+			buxton_group_cache_put(control->cache, layer,
+					       key->group.value,
+					       control->client.uid, true,
+					       label);
+		}
+		buxton_value_cache_invalidate(control->cache, key);
+		buxton_snapshot_reload_group(control->snapshot, config, layer,
+					     &key->group);
 		r = true;
 	}
 
@@ -378,10 +643,10 @@ bool buxton_direct_create_group(BuxtonControl *control,
 	BuxtonLayer *layer;
 	BuxtonConfig *config;
 	BuxtonString s, l;
+	BuxtonString glabel;
 	_cleanup_buxton_data_ BuxtonData *data = NULL;
-	_cleanup_buxton_data_ BuxtonData *group = NULL;
 	_cleanup_buxton_string_ BuxtonString *dlabel = NULL;
-	_cleanup_buxton_string_ BuxtonString *glabel = NULL;
+	_cleanup_free_ char *tmp = NULL;
 	bool r = false;
 	int ret;
 
@@ -392,18 +657,10 @@ bool buxton_direct_create_group(BuxtonControl *control,
 	if (!data) {
 		abort();
 	}
-	group = malloc0(sizeof(BuxtonData));
-	if (!group) {
-		abort();
-	}
 	dlabel = malloc0(sizeof(BuxtonString));
 	if (!dlabel) {
 		abort();
 	}
-	glabel = malloc0(sizeof(BuxtonString));
-	if (!glabel) {
-		abort();
-	}
 
 	config = &control->config;
 
@@ -415,6 +672,9 @@ bool buxton_direct_create_group(BuxtonControl *control,
 		buxton_debug("Read-only layer!\n");
 		goto fail;
 	}
+	if (!may_write_layer(control, layer)) {
+		goto fail;
+	}
 
 	if (layer->type == LAYER_SYSTEM) {
 		char *root_check = getenv(BUXTON_ROOT_CHECK_ENV);
@@ -427,7 +687,7 @@ bool buxton_direct_create_group(BuxtonControl *control,
 		}
 	}
 
-	if (buxton_direct_get_value_for_layer(control, key, group, glabel, NULL) != ENOENT) {
+	if (find_group(control, key, layer, &glabel, &tmp) != ENOENT) {
 		buxton_debug("Group '%s' already exists\n", key->group.value);
 		goto fail;
 	}
@@ -459,6 +719,9 @@ bool buxton_direct_create_group(BuxtonControl *control,
 	if (ret) {
 		buxton_debug("create group failed: %s\n", strerror(ret));
 	} else {
+		buxton_group_cache_put(control->cache, layer, key->group.value,
+				       control->client.uid, true, dlabel);
+		buxton_value_cache_invalidate(control->cache, key);
 		r = true;
 	}
 
@@ -473,23 +736,14 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
 	BuxtonConfig *config;
-	_cleanup_buxton_data_ BuxtonData *group = NULL;
-	_cleanup_buxton_string_ BuxtonString *glabel = NULL;
+	BuxtonString glabel;
+	_cleanup_free_ char *tmp = NULL;
 	bool r = false;
 	int ret;
 
 	assert(control);
 	assert(key);
 
-	group = malloc0(sizeof(BuxtonData));
-	if (!group) {
-		abort();
-	}
-	glabel = malloc0(sizeof(BuxtonString));
-	if (!glabel) {
-		abort();
-	}
-
 	config = &control->config;
 
 	if ((layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
@@ -500,6 +754,9 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 		buxton_debug("Read-ony layer!\n");
 		goto fail;
 	}
+	if (!may_write_layer(control, layer)) {
+		goto fail;
+	}
 
 	if (layer->type == LAYER_SYSTEM) {
 		char *root_check = getenv(BUXTON_ROOT_CHECK_ENV);
@@ -512,13 +769,13 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 		}
 	}
 
-	if (buxton_direct_get_value_for_layer(control, key, group, glabel, NULL)) {
+	if (find_group(control, key, layer, &glabel, &tmp)) {
 		buxton_debug("Group '%s' doesn't exist\n", key->group.value);
 		goto fail;
 	}
 
 	if (layer->type == LAYER_USER) {
-		if (client_label && !buxton_check_smack_access(client_label, glabel, ACCESS_WRITE)) {
+		if (client_label && !buxton_check_smack_access(client_label, &glabel, ACCESS_WRITE)) {
 			goto fail;
 		}
 	}
@@ -532,6 +789,11 @@ bool buxton_direct_remove_group(BuxtonControl *control,
 	if (ret) {
 		buxton_debug("remove group failed: %s\n", strerror(ret));
 	} else {
+		buxton_group_cache_put(control->cache, layer, key->group.value,
+				       control->client.uid, false, NULL);
+		buxton_value_cache_invalidate(control->cache, key);
+		buxton_snapshot_reload_group(control->snapshot, config, layer,
+					     &key->group);
 		r = true;
 	}
 
@@ -562,6 +824,108 @@ bool buxton_direct_list_keys(BuxtonControl *control,
 	return backend->list_keys(layer, list);
 }
 
+/**
+ * State shared with add_group_entry while a group is scanned
+ */
+typedef struct GroupScan {
+	BuxtonArray *list;
+	BuxtonString *client_label;
+	bool overflow;
+} GroupScan;
+
+static void add_group_entry(BuxtonString *name, BuxtonData *data,
+			    BuxtonString *label, void *user_data)
+{
+	GroupScan *scan = (GroupScan *)user_data;
+	BuxtonData *n;
+	BuxtonData *v;
+
+	if (scan->client_label &&
+	    !buxton_check_smack_access(scan->client_label, label, ACCESS_READ)) {
+		return;
+	}
+
+	/* Leave room for the status in the response */
+	if (scan->list->len + 2 >= BUXTON_MESSAGE_MAX_PARAMS) {
+		scan->overflow = true;
+		return;
+	}
+
+	n = malloc0(sizeof(BuxtonData));
+	v = malloc0(sizeof(BuxtonData));
+	if (!n || !v) {
+		abort();
+	}
+	n->type = BUXTON_TYPE_STRING;
+	if (!buxton_string_copy(name, &n->store.d_string)) {
+		abort();
+	}
+	if (!buxton_data_copy(data, v)) {
+		abort();
+	}
+	if (!buxton_array_add(scan->list, n) ||
+	    !buxton_array_add(scan->list, v)) {
+		abort();
+	}
+}
+
+int32_t buxton_direct_get_group(BuxtonControl *control,
+				_BuxtonKey *key,
+				BuxtonString *client_label,
+				BuxtonArray **list)
+{
+	BuxtonBackend *backend;
+	BuxtonLayer *layer;
+	BuxtonConfig *config;
+	GroupScan scan;
+	int ret;
+
+	assert(control);
+	assert(key);
+	assert(list);
+
+	if (!key->layer.value || !key->group.value) {
+		return EINVAL;
+	}
+
+	config = &control->config;
+	if ((layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
+		return EINVAL;
+	}
+	backend = backend_for_layer(config, layer);
+	assert(backend);
+
+	if (!backend->get_group) {
+		return ENOTSUP;
+	}
+
+	layer->uid = control->client.uid;
+
+	ret = check_group(control, key, layer, client_label, NULL);
+	if (ret) {
+		return ret;
+	}
+
+	scan.list = buxton_array_new();
+	if (!scan.list) {
+		abort();
+	}
+	scan.client_label = client_label;
+	scan.overflow = false;
+
+	ret = backend->get_group(layer, &key->group, add_group_entry, &scan);
+	if (!ret && scan.overflow) {
+		ret = E2BIG;
+	}
+	if (ret) {
+		buxton_array_free(&scan.list, (buxton_free_func)data_free);
+		return ret;
+	}
+
+	*list = scan.list;
+	return 0;
+}
+
 bool buxton_direct_list_names(BuxtonControl *control,
 			     BuxtonString *layer_name,
 			     BuxtonString *group,
@@ -587,6 +951,38 @@ bool buxton_direct_list_names(BuxtonControl *control,
 	return backend->list_names(layer, group, prefix, list);
 }
 
+int buxton_direct_scan_names(BuxtonControl *control,
+			     BuxtonString *layer_name,
+			     BuxtonString *group,
+			     BuxtonString *prefix,
+			     BuxtonString *cursor,
+			     module_name_func func,
+			     void *user_data)
+{
+	BuxtonBackend *backend = NULL;
+	BuxtonLayer *layer;
+	BuxtonConfig *config;
+
+	assert(control);
+	assert(layer_name && layer_name->value);
+	assert(cursor);
+	assert(func);
+
+	config = &control->config;
+	if ((layer = hashmap_get(config->layers, layer_name->value)) == NULL) {
+		return ENOENT;
+	}
+	backend = backend_for_layer(config, layer);
+	assert(backend);
+	if (!backend->scan_names) {
+		return ENOTSUP;
+	}
+
+	layer->uid = control->client.uid;
+	return backend->scan_names(layer, group, prefix, cursor, func,
+				   user_data);
+}
+
 bool buxton_direct_unset_value(BuxtonControl *control,
 			       _BuxtonKey *key,
 			       BuxtonString *label)
@@ -594,30 +990,16 @@ bool buxton_direct_unset_value(BuxtonControl *control,
 	BuxtonBackend *backend;
 	BuxtonLayer *layer;
 	BuxtonConfig *config;
+	BuxtonString group_label;
 	_cleanup_buxton_string_ BuxtonString *data_label = NULL;
-	_cleanup_buxton_string_ BuxtonString *group_label = NULL;
 	_cleanup_buxton_data_ BuxtonData *d = NULL;
-	_cleanup_buxton_data_ BuxtonData *g = NULL;
-	_cleanup_buxton_key_ _BuxtonKey *group = NULL;
+	_cleanup_free_ char *tmp = NULL;
 	int ret;
 	bool r = false;
 
 	assert(control);
 	assert(key);
 
-	group = malloc0(sizeof(_BuxtonKey));
-	if (!group) {
-		abort();
-	}
-	g = malloc0(sizeof(BuxtonData));
-	if (!g) {
-		abort();
-	}
-	group_label = malloc0(sizeof(BuxtonString));
-	if (!group_label) {
-		abort();
-	}
-
 	d = malloc0(sizeof(BuxtonData));
 	if (!d) {
 		abort();
@@ -627,18 +1009,20 @@ bool buxton_direct_unset_value(BuxtonControl *control,
 		abort();
 	}
 
-	if (!buxton_copy_key_group(key, group)) {
-		abort();
+	config = &control->config;
+	if (!key->layer.value ||
+	    (layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
+		return false;
 	}
 
-	if (buxton_direct_get_value_for_layer(control, group, g, group_label, NULL)) {
+	if (find_group(control, key, layer, &group_label, &tmp)) {
 		buxton_debug("Group %s for name %s missing for unset value\n", key->group.value, key->name.value);
 		goto fail;
 	}
 
 	/* Access checks are not needed for direct clients, where label is NULL */
 	if (label) {
-		if (!buxton_check_smack_access(label, group_label, ACCESS_WRITE)) {
+		if (!buxton_check_smack_access(label, &group_label, ACCESS_WRITE)) {
 			goto fail;
 		}
 		if (!buxton_direct_get_value_for_layer(control, key, d, data_label, NULL)) {
@@ -651,15 +1035,13 @@ bool buxton_direct_unset_value(BuxtonControl *control,
 		}
 	}
 
-	config = &control->config;
-	if ((layer = hashmap_get(config->layers, key->layer.value)) == NULL) {
-		return false;
-	}
-
 	if (layer->readonly) {
 		buxton_debug("Read-only layer!\n");
 		return false;
 	}
+	if (!may_write_layer(control, layer)) {
+		return false;
+	}
 	backend = backend_for_layer(config, layer);
 	assert(backend);
 
@@ -668,6 +1050,9 @@ bool buxton_direct_unset_value(BuxtonControl *control,
 	if (ret) {
 		buxton_debug("Unset value failed: %s\n", strerror(ret));
 	} else {
+		buxton_value_cache_invalidate(control->cache, key);
+		buxton_snapshot_update(control->snapshot, layer, key, NULL, NULL,
+				       NULL);
 		r = true;
 	}
 
@@ -731,11 +1116,19 @@ void buxton_direct_close(BuxtonControl *control)
 		free(layer);
 	}
 	hashmap_free(control->config.layers);
+	free(control->config.layer_order);
+
+	buxton_value_cache_free(control->cache);
+	buxton_snapshot_free(control->snapshot);
 
 	control->client.direct = false;
 	control->config.backends = NULL;
 	control->config.databases = NULL;
 	control->config.layers = NULL;
+	control->config.layer_order = NULL;
+	control->config.layer_count = 0;
+	control->cache = NULL;
+	control->snapshot = NULL;
 }
 
 /*
@@ -115,6 +115,26 @@ int32_t buxton_direct_get_value(BuxtonControl *control,
 			     BuxtonString *client_label)
 	__attribute__((warn_unused_result));
 
+/**
+ * Retrieve several values from Buxton
+ *
+ * Each group is looked up and checked against the client's Smack
+ * label once per layer, however many of the keys belong to it.
+ * @param control An initialized control structure
+ * @param keys Array of count keys to retrieve
+ * @param count Number of keys
+ * @param data Array of count empty BuxtonData, where data is stored
+ * @param status Array of count int32_t, where the result for each key
+ *        is stored as buxton_direct_get_value would return it
+ * @param client_label The Smack label of the client
+ */
+void buxton_direct_get_values(BuxtonControl *control,
+			      _BuxtonKey *keys,
+			      size_t count,
+			      BuxtonData *data,
+			      int32_t *status,
+			      BuxtonString *client_label);
+
 /**
  * Retrieve a value from Buxton by layer
  * @param control An initialized control structure
@@ -143,6 +163,22 @@ bool buxton_direct_list_keys(BuxtonControl *control,
 			     BuxtonArray **list)
 	__attribute__((warn_unused_result));
 
+/**
+ * Retrieve every key of a group in a given layer with a single scan
+ * of the backend. Keys the client can't read are left out.
+ * @param control An initialized control structure
+ * @param key Key holding the layer and group to query
+ * @param client_label The Smack label of the client
+ * @param list Pointer to store a BuxtonArray of alternating names and
+ *        values in, which the caller must free along with its items
+ * @return 0 on success, an errno value otherwise
+ */
+int32_t buxton_direct_get_group(BuxtonControl *control,
+				_BuxtonKey *key,
+				BuxtonString *client_label,
+				BuxtonArray **list)
+	__attribute__((warn_unused_result));
+
 /**
  * Retrieve a list of keys or groups in a given layer
  * filtered by prefix. The prefix is in the name field of the key.
@@ -160,6 +196,27 @@ bool buxton_direct_list_names(BuxtonControl *control,
 			     BuxtonArray **list)
 	__attribute__((warn_unused_result));
 
+/**
+ * List keys or groups in a given layer a few at a time, see
+ * module_scan_names_func for how the cursor resumes a scan
+ * @param control An initialized control structure
+ * @param layer_name Layer to query
+ * @param group Group to query can be NULL or empty
+ * @param prefix Filtering prefix of names
+ * @param cursor Where to resume, with a NULL value to start a new scan
+ * @param func Function run for each name, returning false to stop
+ * @param user_data Data passed to func
+ * @return 0 on success, an errno value otherwise
+ */
+int buxton_direct_scan_names(BuxtonControl *control,
+			     BuxtonString *layer_name,
+			     BuxtonString *group,
+			     BuxtonString *prefix,
+			     BuxtonString *cursor,
+			     module_name_func func,
+			     void *user_data)
+	__attribute__((warn_unused_result));
+
 /**
  * Unset a value by key in the given BuxtonLayer
  * @param control An initialized control structure
@@ -18,106 +18,178 @@
 #include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <time.h>
 
+#include "buxtonbatch.h"
 #include "buxtonclient.h"
 #include "buxtonkey.h"
 #include "buxtonresponse.h"
 #include "buxtonstring.h"
+#include "clientcache.h"
+#include "completion.h"
 #include "hashmap.h"
 #include "log.h"
 #include "protocol.h"
 #include "util.h"
 
-#define TIMEOUT 3
-
-static pthread_mutex_t callback_guard = PTHREAD_MUTEX_INITIALIZER;
-static Hashmap *callbacks = NULL;
-static Hashmap *notify_callbacks = NULL;
-static volatile uint32_t _msgid = 0;
+/* Default ms a request waits for its reply */
+#define TIMEOUT 3000
 
 struct notify_value {
+	BuxtonClientCache *cache;
 	void *data;
 	BuxtonCallback cb;
-	struct timeval tv;
+	uint32_t msgid;
+	uint64_t deadline;
+	size_t heap_index;
 	BuxtonControlMessage type;
 	_BuxtonKey *key;
+	BuxtonArray *ops;
+	BuxtonData *parts;
+	size_t n_parts;
+	size_t parts_alloc;
+	bool stream;
 };
 
-static uint32_t get_msgid(void)
+static uint32_t get_msgid(_BuxtonClient *client)
 {
-	return __sync_fetch_and_add(&_msgid, 1);
+	return __sync_fetch_and_add(&client->callbacks->msgid, 1);
 }
 
-bool setup_callbacks(void)
+static void free_callback(struct notify_value *nv)
 {
-	bool r = false;
-	int s;
+	key_free(nv->key);
+	buxton_array_free(&nv->ops, batch_op_free);
+	for (size_t i = 0; i < nv->n_parts; i++) {
+		free(nv->parts[i].store.d_string.value);
+	}
+	free(nv->parts);
+	free(nv);
+}
 
-	s = pthread_mutex_lock(&callback_guard);
-	if (s) {
-		return false;
+void batch_op_free(void *p)
+{
+	BuxtonBatchOp *op = p;
+
+	if (!op) {
+		return;
 	}
 
-	if (callbacks && notify_callbacks) {
-		goto unlock;
+	key_free(op->key);
+	data_free(op->value);
+	free(op);
+}
+
+void buxton_value_to_data(BuxtonDataType type, const void *value,
+			  BuxtonData *data)
+{
+	data->type = type;
+	switch (type) {
+	case BUXTON_TYPE_STRING:
+		/* cast until BuxtonString is updated */
+		data->store.d_string.value = (char *)value;
+		data->store.d_string.length = (uint32_t)strlen((char *)value) + 1;
+		break;
+	case BUXTON_TYPE_INT32:
+		data->store.d_int32 = *(const int32_t *)value;
+		break;
+	case BUXTON_TYPE_INT64:
+		data->store.d_int64 = *(const int64_t *)value;
+		break;
+	case BUXTON_TYPE_UINT32:
+		data->store.d_uint32 = *(const uint32_t *)value;
+		break;
+	case BUXTON_TYPE_UINT64:
+		data->store.d_uint64 = *(const uint64_t *)value;
+		break;
+	case BUXTON_TYPE_FLOAT:
+		data->store.d_float = *(const float *)value;
+		break;
+	case BUXTON_TYPE_DOUBLE:
+		memcpy(&data->store.d_double, value, sizeof(double));
+		break;
+	case BUXTON_TYPE_BOOLEAN:
+		data->store.d_boolean = *(const bool *)value;
+		break;
+	default:
+		break;
 	}
+}
 
-	callbacks = hashmap_new(trivial_hash_func, trivial_compare_func);
-	if (!callbacks) {
-		goto unlock;
+bool setup_callbacks(_BuxtonClient *client)
+{
+	BuxtonCallbacks *cbs;
+
+	cbs = malloc0(sizeof(BuxtonCallbacks));
+	if (!cbs) {
+		return false;
 	}
 
-	notify_callbacks = hashmap_new(trivial_hash_func, trivial_compare_func);
-	if (!notify_callbacks) {
-		hashmap_free(callbacks);
-		goto unlock;
+	cbs->callbacks = hashmap_new(trivial_hash_func, trivial_compare_func);
+	if (!cbs->callbacks) {
+		goto fail;
 	}
 
-	r = true;
+	cbs->notify_callbacks = hashmap_new(trivial_hash_func,
+					    trivial_compare_func);
+	if (!cbs->notify_callbacks) {
+		goto fail;
+	}
 
-unlock:
-	s = pthread_mutex_unlock(&callback_guard);
-	if (s) {
-		return false;
+	if (pthread_mutex_init(&cbs->guard, NULL)) {
+		goto fail;
+	}
+	if (pthread_mutex_init(&cbs->send_lock, NULL)) {
+		pthread_mutex_destroy(&cbs->guard);
+		goto fail;
 	}
+	cbs->timeout = TIMEOUT;
 
-	return r;
+	client->callbacks = cbs;
+
+	return true;
+
+fail:
+	hashmap_free(cbs->callbacks);
+	hashmap_free(cbs->notify_callbacks);
+	free(cbs);
+	return false;
 }
 
-void cleanup_callbacks(void)
+void cleanup_callbacks(_BuxtonClient *client)
 {
+	BuxtonCallbacks *cbs = client->callbacks;
 	struct notify_value *nvi;
-	Iterator it;
-#if UINTPTR_MAX == 0xffffffffffffffff
-	uint64_t hkey;
-#else
-	uint32_t hkey;
-#endif
+	_BuxtonKey *k;
+
+	if (!cbs) {
+		return;
+	}
 
-	(void)pthread_mutex_lock(&callback_guard);
+	while ((nvi = hashmap_steal_first(cbs->callbacks))) {
+		free_callback(nvi);
+	}
+	hashmap_free(cbs->callbacks);
 
-	if (callbacks) {
-		HASHMAP_FOREACH_KEY(nvi, hkey, callbacks, it) {
-			(void)hashmap_remove(callbacks, (void *)hkey);
-			key_free(nvi->key);
-			free(nvi);
-		}
-		hashmap_free(callbacks);
+	while ((nvi = hashmap_steal_first(cbs->notify_callbacks))) {
+		free_callback(nvi);
 	}
-	callbacks = NULL;
+	hashmap_free(cbs->notify_callbacks);
 
-	if (notify_callbacks) {
-		HASHMAP_FOREACH_KEY(nvi, hkey, notify_callbacks, it) {
-			(void)hashmap_remove(notify_callbacks, (void *)hkey);
-			key_free(nvi->key);
-			free(nvi);
+	if (cbs->handles) {
+		while ((k = hashmap_steal_first_key(cbs->handles))) {
+			key_free(k);
 		}
-		hashmap_free(notify_callbacks);
+		hashmap_free(cbs->handles);
 	}
-	notify_callbacks = NULL;
 
-	(void)pthread_mutex_unlock(&callback_guard);
+	free(cbs->heap);
+	buxton_string_table_free(&cbs->encode);
+	buxton_string_table_free(&cbs->decode);
+	pthread_mutex_destroy(&cbs->send_lock);
+	pthread_mutex_destroy(&cbs->guard);
+	free(cbs);
+	client->callbacks = NULL;
 }
 
 void run_callback(BuxtonCallback callback, void *data, size_t count,
@@ -149,36 +221,196 @@ out:
 	buxton_array_free(&array, NULL);
 }
 
-void reap_callbacks(void)
+static uint64_t now_ms(void)
 {
-	struct notify_value *nvi;
-	struct timeval tv;
-	Iterator it;
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		abort();
+	}
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * Requests waiting for a reply are kept in a binary min-heap on their
+ * deadline, each knowing its slot so a reply can take it out directly.
+ */
+static void heap_set(BuxtonCallbacks *cbs, size_t i, struct notify_value *nv)
+{
+	cbs->heap[i] = nv;
+	nv->heap_index = i;
+}
+
+static void heap_up(BuxtonCallbacks *cbs, size_t i)
+{
+	struct notify_value *nv = cbs->heap[i];
+	size_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (cbs->heap[parent]->deadline <= nv->deadline) {
+			break;
+		}
+		heap_set(cbs, i, cbs->heap[parent]);
+		i = parent;
+	}
+	heap_set(cbs, i, nv);
+}
+
+static void heap_down(BuxtonCallbacks *cbs, size_t i)
+{
+	struct notify_value *nv = cbs->heap[i];
+	size_t child;
+
+	while ((child = 2 * i + 1) < cbs->heap_len) {
+		if (child + 1 < cbs->heap_len &&
+		    cbs->heap[child + 1]->deadline < cbs->heap[child]->deadline) {
+			child++;
+		}
+		if (nv->deadline <= cbs->heap[child]->deadline) {
+			break;
+		}
+		heap_set(cbs, i, cbs->heap[child]);
+		i = child;
+	}
+	heap_set(cbs, i, nv);
+}
+
+static void heap_push(BuxtonCallbacks *cbs, struct notify_value *nv)
+{
+	struct notify_value **heap;
+
+	if (cbs->heap_len == cbs->heap_size) {
+		cbs->heap_size = cbs->heap_size ? cbs->heap_size * 2 : 16;
+		heap = realloc(cbs->heap,
+			       sizeof(struct notify_value *) * cbs->heap_size);
+		if (!heap) {
+			abort();
+		}
+		cbs->heap = heap;
+	}
+	heap_set(cbs, cbs->heap_len++, nv);
+	heap_up(cbs, nv->heap_index);
+}
+
+static void heap_remove(BuxtonCallbacks *cbs, struct notify_value *nv)
+{
+	struct notify_value *last;
+	size_t i = nv->heap_index;
+
+	assert(i < cbs->heap_len && cbs->heap[i] == nv);
+
+	last = cbs->heap[--cbs->heap_len];
+	if (last == nv) {
+		return;
+	}
+	heap_set(cbs, i, last);
+	heap_down(cbs, i);
+	heap_up(cbs, last->heap_index);
+}
+
+void set_callback_timeout(_BuxtonClient *client, uint32_t timeout)
+{
+	(void)pthread_mutex_lock(&client->callbacks->guard);
+	client->callbacks->timeout = timeout;
+	(void)pthread_mutex_unlock(&client->callbacks->guard);
+}
+
+void reap_callbacks(_BuxtonClient *client)
+{
+	BuxtonCallbacks *cbs = client->callbacks;
+	struct notify_value *nv;
+	uint64_t now;
+
+	if (!cbs->heap_len) {
+		return;
+	}
+
+	/* remove timed out callbacks, soonest deadline first */
+	now = now_ms();
+	while (cbs->heap_len && cbs->heap[0]->deadline <= now) {
+		nv = cbs->heap[0];
+		heap_remove(cbs, nv);
 #if UINTPTR_MAX == 0xffffffffffffffff
-	uint64_t hkey;
+		(void)hashmap_remove(cbs->callbacks, (void *)((uint64_t)nv->msgid));
 #else
-	uint32_t hkey;
+		(void)hashmap_remove(cbs->callbacks, (void *)nv->msgid);
 #endif
+		/* Without a reply the group would stay pending for good */
+		if (nv->cache) {
+			buxton_client_cache_watch_failed(nv->cache,
+							 &nv->key->group);
+		}
+		free_callback(nv);
+	}
+}
 
-	(void)gettimeofday(&tv, NULL);
+static bool add_callback(_BuxtonClient *client, struct notify_value *nv,
+			 uint32_t msgid)
+{
+	BuxtonCallbacks *cbs = client->callbacks;
+	int s;
 
-	/* remove timed out callbacks */
-	HASHMAP_FOREACH_KEY(nvi, hkey, callbacks, it) {
-		if (tv.tv_sec - nvi->tv.tv_sec > TIMEOUT) {
-			(void)hashmap_remove(callbacks, (void *)hkey);
-			key_free(nvi->key);
-			free(nvi);
-		}
+	s = pthread_mutex_lock(&cbs->guard);
+	if (s) {
+		return false;
+	}
+
+	reap_callbacks(client);
+
+	nv->msgid = msgid;
+	nv->deadline = now_ms() + cbs->timeout;
+#if UINTPTR_MAX == 0xffffffffffffffff
+	s = hashmap_put(cbs->callbacks, (void *)((uint64_t)msgid), nv);
+#else
+	s = hashmap_put(cbs->callbacks, (void *)msgid, nv);
+#endif
+	if (s > 0) {
+		heap_push(cbs, nv);
 	}
+	(void)pthread_mutex_unlock(&cbs->guard);
+
+	if (s < 1) {
+		buxton_debug("Error adding callback for msgid: %llu\n", msgid);
+		return false;
+	}
+
+	return true;
 }
 
-bool send_message(_BuxtonClient *client, uint8_t *send, size_t send_len,
-		  BuxtonCallback callback, void *data, uint32_t msgid,
-		  BuxtonControlMessage type, _BuxtonKey *key)
+/*
+ * Messages are built in version 1, and encoded again in the agreed
+ * version as they are written so buxtond's table sees strings in order
+ */
+static bool write_message(_BuxtonClient *client, uint8_t *send,
+			  size_t send_len)
+{
+	BuxtonCallbacks *cbs = client->callbacks;
+	_cleanup_free_ uint8_t *v2 = NULL;
+	size_t v2_len;
+	bool r;
+
+	if (cbs->version < 2) {
+		return _write(client->fd, send, send_len);
+	}
+
+	pthread_mutex_lock(&cbs->send_lock);
+	v2_len = buxton_transcode_message_v2(send, send_len, &cbs->encode, &v2);
+	r = v2_len && _write(client->fd, v2, v2_len);
+	pthread_mutex_unlock(&cbs->send_lock);
+
+	return r;
+}
+
+/* A get's reply is also kept in the cache it was sent for, if any */
+static bool send_cached_message(_BuxtonClient *client, uint8_t *send,
+				size_t send_len, BuxtonCallback callback,
+				void *data, uint32_t msgid,
+				BuxtonControlMessage type, _BuxtonKey *key,
+				BuxtonClientCache *cache, bool stream)
 {
 	struct notify_value *nv;
 	_BuxtonKey *k = NULL;
-	int s;
 	bool r = false;
 
 	nv = malloc0(sizeof(struct notify_value));
@@ -196,33 +428,19 @@ bool send_message(_BuxtonClient *client, uint8_t *send, size_t send_len,
 		}
 	}
 
-	(void)gettimeofday(&nv->tv, NULL);
+	nv->cache = cache;
+	nv->stream = stream;
 	nv->cb = callback;
 	nv->data = data;
 	nv->type = type;
 	nv->key = k;
 
-	s = pthread_mutex_lock(&callback_guard);
-	if (s) {
-		goto fail;
-	}
-
-	reap_callbacks();
-
-#if UINTPTR_MAX == 0xffffffffffffffff
-	s = hashmap_put(callbacks, (void *)((uint64_t)msgid), nv);
-#else
-	s = hashmap_put(callbacks, (void *)msgid, nv);
-#endif
-	(void)pthread_mutex_unlock(&callback_guard);
-
-	if (s < 1) {
-		buxton_debug("Error adding callback for msgid: %llu\n", msgid);
+	if (!add_callback(client, nv, msgid)) {
 		goto fail;
 	}
 
 	/* Now write it off */
-	if (!_write(client->fd, send, send_len)) {
+	if (!write_message(client, send, send_len)) {
 		buxton_debug("Write failed for msgid: %llu\n", msgid);
 		r = false;
 	} else {
@@ -237,20 +455,275 @@ fail:
 	return false;
 }
 
-void lock_mutex(void)
+bool send_message(_BuxtonClient *client, uint8_t *send, size_t send_len,
+		  BuxtonCallback callback, void *data, uint32_t msgid,
+		  BuxtonControlMessage type, _BuxtonKey *key)
 {
-	buxton_debug("Value of mutex %d", callback_guard.__data.__lock);
-	pthread_mutex_lock(&callback_guard);
+	return send_cached_message(client, send, send_len, callback, data,
+				   msgid, type, key, NULL, false);
 }
 
-void unlock_mutex(void)
+void lock_mutex(_BuxtonClient *client)
 {
-	pthread_mutex_unlock(&callback_guard);
+	buxton_debug("Value of mutex %d", client->callbacks->guard.__data.__lock);
+	pthread_mutex_lock(&client->callbacks->guard);
 }
 
-void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
+void unlock_mutex(_BuxtonClient *client)
+{
+	pthread_mutex_unlock(&client->callbacks->guard);
+}
+
+/* Run a callback now, or queue it for the client to drain */
+static void deliver(BuxtonCompletionQueue *queue, BuxtonCallback callback,
+		    void *data, size_t count, BuxtonData *list,
+		    BuxtonControlMessage type, _BuxtonKey *key)
+{
+	if (queue) {
+		buxton_completion_post(queue, callback, data, count, list,
+				       type, key);
+	} else {
+		run_callback(callback, data, count, list, type, key);
+	}
+}
+
+static void run_batch_callbacks(BuxtonCompletionQueue *queue,
+				struct notify_value *nv, BuxtonData *list,
+				size_t count)
+{
+	BuxtonBatchOp *op;
+	BuxtonData status;
+	size_t pos = 1;
+	size_t n;
+
+	/* a batch the daemon refused only carries the overall status */
+	status = list[0];
+
+	for (uint32_t i = 0; i < nv->ops->len; i++) {
+		op = buxton_array_get(nv->ops, i);
+		if (pos >= count || list[pos].type != BUXTON_TYPE_UINT32 ||
+		    list[pos].store.d_uint32 > count - pos - 1) {
+			status.store.d_int32 = -1;
+			deliver(queue, op->callback, op->data, 1, &status,
+				op->type, op->key);
+			pos = count;
+			continue;
+		}
+		n = list[pos].store.d_uint32;
+		deliver(queue, op->callback, op->data, n, &list[pos + 1],
+			op->type, op->key);
+		pos += n + 1;
+	}
+
+	deliver(queue, nv->cb, nv->data, 1, &status, BUXTON_CONTROL_BATCH,
+		NULL);
+}
+
+/*
+ * Failed keys carry no value on the wire, give every key a status and
+ * a value slot so responses can be indexed directly.
+ */
+static void run_get_values_callback(BuxtonCompletionQueue *queue,
+				    struct notify_value *nv, BuxtonData *list,
+				    size_t count)
+{
+	_cleanup_free_ BuxtonData *values = NULL;
+	size_t n = 1;
+	size_t pos = 1;
+
+	values = malloc0(sizeof(BuxtonData) * count * 2);
+	if (!values) {
+		return;
+	}
+
+	values[0] = list[0];
+	while (pos < count) {
+		values[n] = list[pos++];
+		if (values[n].type == BUXTON_TYPE_INT32 &&
+		    values[n].store.d_int32 == 0 && pos < count) {
+			values[n + 1] = list[pos++];
+		} else {
+			values[n + 1].type = BUXTON_TYPE_UNSET;
+		}
+		n += 2;
+	}
+
+	deliver(queue, nv->cb, nv->data, n, values, BUXTON_CONTROL_GET_VALUES,
+		NULL);
+}
+
+/*
+ * A change to a key under a prefix carries the key's group and name
+ * ahead of the value, the callback gets them as the response key.
+ */
+static void run_prefix_callback(_BuxtonClient *client,
+				BuxtonCompletionQueue *queue,
+				struct notify_value *nv, BuxtonData *list,
+				size_t count)
+{
+	_BuxtonKey key;
+
+	if (count < 2 || list[0].type != BUXTON_TYPE_STRING ||
+	    list[1].type != BUXTON_TYPE_STRING) {
+		return;
+	}
+
+	memzero(&key, sizeof(_BuxtonKey));
+	key.group = list[0].store.d_string;
+	key.name = list[1].store.d_string;
+	key.type = count > 2 ? list[2].type : BUXTON_TYPE_UNSET;
+	/* No name means the whole group was removed or relabelled */
+	if (!key.name.value || !*key.name.value) {
+		key.name = (BuxtonString){ NULL, 0 };
+	}
+
+	/* The cache must see a change before any later get is answered */
+	if (nv->cache) {
+		buxton_client_cache_invalidate(nv->cache, &key);
+		return;
+	}
+
+	if (queue) {
+		buxton_completion_post(queue, (BuxtonCallback)(nv->cb), nv->data,
+				       count - 2, &list[2],
+				       BUXTON_CONTROL_CHANGED, &key);
+		return;
+	}
+
+	unlock_mutex(client);
+	run_callback((BuxtonCallback)(nv->cb), nv->data, count - 2, &list[2],
+		     BUXTON_CONTROL_CHANGED, &key);
+	lock_mutex(client);
+}
+
+/* Called with the guard held, a key registered twice keeps its first handle */
+static void add_handle(BuxtonCallbacks *cbs, _BuxtonKey *key, uint32_t handle)
+{
+	_BuxtonKey *k;
+
+	if (!cbs->handles) {
+		cbs->handles = hashmap_new(key_hash_func, key_compare_func);
+		if (!cbs->handles) {
+			abort();
+		}
+	}
+	if (hashmap_get(cbs->handles, key)) {
+		return;
+	}
+
+	k = malloc0(sizeof(_BuxtonKey));
+	if (!k) {
+		abort();
+	}
+	if (!buxton_key_copy(key, k)) {
+		abort();
+	}
+	if (hashmap_put(cbs->handles, k, (void *)(uintptr_t)handle) != 1) {
+		abort();
+	}
+}
+
+/* Handle of a registered key, or 0 */
+static uint32_t key_handle(_BuxtonClient *client, _BuxtonKey *key)
+{
+	BuxtonCallbacks *cbs = client->callbacks;
+	uint32_t handle = 0;
+
+	pthread_mutex_lock(&cbs->guard);
+	if (cbs->handles) {
+		handle = (uint32_t)(uintptr_t)hashmap_get(cbs->handles, key);
+	}
+	pthread_mutex_unlock(&cbs->guard);
+
+	return handle;
+}
+
+/* Names of a chunk are copied, they point into the read buffer */
+static void add_parts(struct notify_value *nv, BuxtonData *list, size_t count)
+{
+	if (!greedy_realloc((void **)&nv->parts, &nv->parts_alloc,
+			    sizeof(BuxtonData) * (nv->n_parts + count))) {
+		abort();
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (list[i].type != BUXTON_TYPE_STRING) {
+			continue;
+		}
+		nv->parts[nv->n_parts].type = BUXTON_TYPE_STRING;
+		if (!buxton_string_copy(&list[i].store.d_string,
+					&nv->parts[nv->n_parts].store.d_string)) {
+			abort();
+		}
+		nv->n_parts++;
+	}
+}
+
+/*
+ * A streamed list is waited for as long as chunks keep coming. Unless
+ * the caller asked for the chunks, their names are kept until the
+ * final status and given to the callback as a single list.
+ */
+static void handle_chunk(_BuxtonClient *client, BuxtonCompletionQueue *queue,
+			 uint32_t msgid, BuxtonData *list, size_t count)
+{
+	BuxtonCallbacks *cbs = client->callbacks;
+	struct notify_value *nv;
+
+#if UINTPTR_MAX == 0xffffffffffffffff
+	nv = hashmap_get(cbs->callbacks, (void *)((uint64_t)msgid));
+#else
+	nv = hashmap_get(cbs->callbacks, (void *)msgid);
+#endif
+	if (!nv || nv->type != BUXTON_CONTROL_LIST_NAMES) {
+		return;
+	}
+	heap_remove(cbs, nv);
+	nv->deadline = now_ms() + cbs->timeout;
+	heap_push(cbs, nv);
+
+	if (nv->stream) {
+		deliver(queue, (BuxtonCallback)(nv->cb), nv->data, count, list,
+			BUXTON_CONTROL_CHUNK, nv->key);
+		return;
+	}
+	add_parts(nv, &list[1], count - 1);
+}
+
+static void run_list_names_callback(BuxtonCompletionQueue *queue,
+				    struct notify_value *nv, BuxtonData *list,
+				    size_t count)
+{
+	_cleanup_free_ BuxtonData *names = NULL;
+
+	/* The names of a failed list are dropped */
+	if (list[0].store.d_int32 != 0) {
+		deliver(queue, (BuxtonCallback)(nv->cb), nv->data, 1, list,
+			BUXTON_CONTROL_LIST_NAMES, nv->key);
+		return;
+	}
+	add_parts(nv, &list[1], count - 1);
+
+	names = malloc(sizeof(BuxtonData) * (nv->n_parts + 1));
+	if (!names) {
+		abort();
+	}
+	names[0] = list[0];
+	if (nv->n_parts) {
+		memcpy(&names[1], nv->parts, sizeof(BuxtonData) * nv->n_parts);
+	}
+
+	deliver(queue, (BuxtonCallback)(nv->cb), nv->data, nv->n_parts + 1,
+		names, BUXTON_CONTROL_LIST_NAMES, nv->key);
+}
+
+/* Callbacks are queued instead of run when the queue isn't NULL */
+static void dispatch_response(_BuxtonClient *client,
+			      BuxtonCompletionQueue *queue,
+			      BuxtonControlMessage msg, uint32_t msgid,
 			      BuxtonData *list, size_t count)
 {
+	Hashmap *callbacks = client->callbacks->callbacks;
+	Hashmap *notify_callbacks = client->callbacks->notify_callbacks;
 	struct notify_value *nv;
 
 	/* use notification callbacks for notification messages */
@@ -264,14 +737,37 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 			return;
 		}
 
+		if (nv->type == BUXTON_CONTROL_NOTIFY_PREFIX) {
+			run_prefix_callback(client, queue, nv, list, count);
+			return;
+		}
+
+		if (queue) {
+			buxton_completion_post(queue, (BuxtonCallback)(nv->cb),
+					       nv->data, count, list,
+					       BUXTON_CONTROL_CHANGED, nv->key);
+			return;
+		}
+
 		/*
 		* unlocking mutex to be able to call other client api's
 		* in notification callbacks
 		*/
-		(void)pthread_mutex_unlock(&callback_guard);
+		unlock_mutex(client);
 		run_callback((BuxtonCallback)(nv->cb), nv->data, count, list,
 			     BUXTON_CONTROL_CHANGED, nv->key);
-		(void)pthread_mutex_lock(&callback_guard);
+		lock_mutex(client);
+		return;
+	}
+
+	if (msg == BUXTON_CONTROL_CHUNK) {
+		handle_chunk(client, queue, msgid, list, count);
+		return;
+	}
+
+	/* Changes may have been missed, nothing kept can be trusted */
+	if (msg == BUXTON_CONTROL_OVERFLOW) {
+		buxton_client_cache_flush(client->cache);
 		return;
 	}
 
@@ -283,8 +779,28 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 	if (!nv) {
 		return;
 	}
+	heap_remove(client->callbacks, nv);
 
-	if (nv->type == BUXTON_CONTROL_NOTIFY) {
+	if (nv->type == BUXTON_CONTROL_BATCH) {
+		run_batch_callbacks(queue, nv, list, count);
+		free_callback(nv);
+		return;
+	} else if (nv->type == BUXTON_CONTROL_GET_VALUES) {
+		run_get_values_callback(queue, nv, list, count);
+		free_callback(nv);
+		return;
+	} else if (nv->type == BUXTON_CONTROL_LIST_NAMES && nv->n_parts) {
+		run_list_names_callback(queue, nv, list, count);
+		free_callback(nv);
+		return;
+	} else if (nv->type == BUXTON_CONTROL_GET) {
+		if (count == 2 && list[0].type == BUXTON_TYPE_INT32 &&
+		    list[0].store.d_int32 == 0) {
+			buxton_client_cache_put(nv->cache, msgid, nv->key,
+						&list[1]);
+		}
+	} else if (nv->type == BUXTON_CONTROL_NOTIFY ||
+		   nv->type == BUXTON_CONTROL_NOTIFY_PREFIX) {
 		if (list[0].type == BUXTON_TYPE_INT32 &&
 		    list[0].store.d_int32 == 0) {
 #if UINTPTR_MAX == 0xffffffffffffffff
@@ -296,6 +812,12 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 				return;
 			}
 		}
+		if (nv->cache) {
+			buxton_client_cache_watch_failed(nv->cache,
+							 &nv->key->group);
+			free_callback(nv);
+			return;
+		}
 	} else if (nv->type == BUXTON_CONTROL_UNNOTIFY) {
 		if (list[0].type == BUXTON_TYPE_INT32 &&
 		    list[0].store.d_int32 == 0) {
@@ -306,48 +828,97 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 					     (void *)list[2].store.d_uint32);
 #endif
 
+			return;
+		}
+	} else if (nv->type == BUXTON_CONTROL_HELLO) {
+		if (count == 2 && list[0].type == BUXTON_TYPE_INT32 &&
+		    list[0].store.d_int32 == 0 &&
+		    list[1].type == BUXTON_TYPE_UINT32 &&
+		    list[1].store.d_uint32 <= BUXTON_PROTOCOL_VERSION) {
+			client->callbacks->version = list[1].store.d_uint32;
+		}
+	} else if (nv->type == BUXTON_CONTROL_REGISTER_KEY) {
+		if (count == 2 && list[0].type == BUXTON_TYPE_INT32 &&
+		    list[0].store.d_int32 == 0 &&
+		    list[1].type == BUXTON_TYPE_UINT32 &&
+		    list[1].store.d_uint32 != 0) {
+			add_handle(client->callbacks, nv->key,
+				   list[1].store.d_uint32);
+		}
+	} else if (nv->type == BUXTON_CONTROL_UNNOTIFY_PREFIX) {
+		if (count == 2 && list[0].type == BUXTON_TYPE_INT32 &&
+		    list[0].store.d_int32 == 0 &&
+		    list[1].type == BUXTON_TYPE_UINT32) {
+			struct notify_value *old;
+
+#if UINTPTR_MAX == 0xffffffffffffffff
+			old = hashmap_remove(notify_callbacks,
+					     (void *)((uint64_t)list[1].store.d_uint32));
+#else
+			old = hashmap_remove(notify_callbacks,
+					     (void *)list[1].store.d_uint32);
+#endif
+			if (old) {
+				free_callback(old);
+			}
+			free_callback(nv);
 			return;
 		}
 	}
 
 	/* callback should be run on notfiy or unnotify failure */
 	/* and on any other server message we are waiting for */
-	run_callback((BuxtonCallback)(nv->cb), nv->data, count, list, nv->type,
-		     nv->key);
+	deliver(queue, (BuxtonCallback)(nv->cb), nv->data, count, list,
+		nv->type, nv->key);
 
-	key_free(nv->key);
-	free(nv);
+	free_callback(nv);
 }
 
-ssize_t buxton_wire_handle_response(_BuxtonClient *client)
+void handle_callback_response(_BuxtonClient *client,
+			      BuxtonControlMessage msg, uint32_t msgid,
+			      BuxtonData *list, size_t count)
+{
+	dispatch_response(client, NULL, msg, msgid, list, count);
+}
+
+/*
+ * Queued callbacks don't run while replies are read, so a single lock
+ * covers every message read for a queue.
+ */
+static ssize_t read_responses(_BuxtonClient *client,
+			      BuxtonCompletionQueue *queue)
 {
 	ssize_t l;
 	_cleanup_free_ uint8_t *response = NULL;
-	BuxtonData *r_list = NULL;
+	_cleanup_free_ BuxtonData *r_list = NULL;
+	size_t r_size = 0;
 	BuxtonControlMessage r_msg = BUXTON_CONTROL_MIN;
 	ssize_t count = 0;
 	size_t offset = 0;
 	size_t size = BUXTON_MESSAGE_HEADER_LENGTH;
+	size_t capacity = BUXTON_MESSAGE_HEADER_LENGTH;
 	uint32_t r_msgid;
 	int s;
 	ssize_t handled = 0;
 
-	s = pthread_mutex_lock(&callback_guard);
+	s = pthread_mutex_lock(&client->callbacks->guard);
 	if (s) {
 		return 0;
 	}
-	reap_callbacks();
-	(void)pthread_mutex_unlock(&callback_guard);
+	reap_callbacks(client);
+	if (!queue) {
+		unlock_mutex(client);
+	}
 
 	response = malloc0(BUXTON_MESSAGE_HEADER_LENGTH);
 	if (!response) {
-		return 0;
+		goto out;
 	}
 
 	do {
 		l = read(client->fd, response + offset, size - offset);
 		if (l <= 0) {
-			return handled;
+			goto out;
 		}
 		offset += (size_t)l;
 		if (offset < BUXTON_MESSAGE_HEADER_LENGTH) {
@@ -356,77 +927,321 @@ ssize_t buxton_wire_handle_response(_BuxtonClient *client)
 		if (size == BUXTON_MESSAGE_HEADER_LENGTH) {
 			size = buxton_get_message_size(response, offset);
 			if (size == 0 || size > BUXTON_MESSAGE_MAX_LENGTH) {
-				return -1;
+				handled = -1;
+				goto out;
 			}
 		}
-		if (size != BUXTON_MESSAGE_HEADER_LENGTH) {
+		/* The buffer is kept for the next message, grown as needed */
+		if (size > capacity) {
 			response = realloc(response, size);
 			if (!response) {
-				return -1;
+				handled = -1;
+				goto out;
 			}
+			capacity = size;
 		}
 		if (size != offset) {
 			continue;
 		}
 
-		count = buxton_deserialize_message(response, &r_msg, size, &r_msgid, &r_list);
+		/* Strings of r_list point into response until the next read */
+		/* buxtond only gives strings an index once HELLO is agreed */
+		count = buxton_deserialize_message_view(response, &r_msg, size,
+							&r_msgid, &r_list,
+							&r_size,
+							&client->callbacks->decode);
 		if (count < 0) {
 			goto next;
 		}
 
-		if (!(r_msg == BUXTON_CONTROL_STATUS && r_list && r_list[0].type == BUXTON_TYPE_INT32)
-		    && !(r_msg == BUXTON_CONTROL_CHANGED)) {
+		if (!((r_msg == BUXTON_CONTROL_STATUS ||
+		       r_msg == BUXTON_CONTROL_CHUNK) &&
+		      count > 0 && r_list[0].type == BUXTON_TYPE_INT32)
+		    && !(r_msg == BUXTON_CONTROL_CHANGED) &&
+		    !(r_msg == BUXTON_CONTROL_OVERFLOW)) {
 			handled++;
 			buxton_log("Critical error: Invalid response\n");
 			goto next;
 		}
 
-		s = pthread_mutex_lock(&callback_guard);
-		if (s) {
-			goto next;
+		if (!queue) {
+			s = pthread_mutex_lock(&client->callbacks->guard);
+			if (s) {
+				goto next;
+			}
 		}
 
-		handle_callback_response(r_msg, r_msgid, r_list, (size_t)count);
+		dispatch_response(client, queue, r_msg, r_msgid,
+				  count ? r_list : NULL, (size_t)count);
 
-		(void)pthread_mutex_unlock(&callback_guard);
+		if (!queue) {
+			unlock_mutex(client);
+		}
 		handled++;
 
-	next:
-		if (r_list) {
-			for (int i = 0; i < count; i++) {
-				if (r_list[i].type == BUXTON_TYPE_STRING) {
-					free(r_list[i].store.d_string.value);
-				}
-			}
-			free(r_list);
+		/* A callback closed the client, the rest is never read */
+		if (buxton_wire_closed(client)) {
+			goto out;
 		}
 
+	next:
 		/* reset for next possible message */
 		size = BUXTON_MESSAGE_HEADER_LENGTH;
 		offset = 0;
 	} while (true);
+
+out:
+	if (queue) {
+		unlock_mutex(client);
+	}
+	return handled;
+}
+
+ssize_t buxton_wire_handle_response(_BuxtonClient *client)
+{
+	return read_responses(client, NULL);
 }
 
+ssize_t buxton_wire_queue_responses(_BuxtonClient *client,
+				    BuxtonCompletionQueue *queue)
+{
+	assert(queue);
+
+	return read_responses(client, queue);
+}
+
+/*
+ * Once a client queues its callbacks, a sync wait queues the reply too
+ * and runs the queue, so older callbacks still run first
+ */
 int buxton_wire_get_response(_BuxtonClient *client)
 {
 	struct pollfd pfd[1];
 	int r;
 	ssize_t processed;
 
-	pfd[0].fd = client->fd;
-	pfd[0].events = POLLIN;
-	pfd[0].revents = 0;
-	r = poll(pfd, 1, 5000);
+	pfd[0].fd = client->fd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	r = poll(pfd, 1, 5000);
+
+	if (r == 0) {
+		return -ETIME;
+	} else if (r < 0) {
+		return -errno;
+	}
+
+	if (client->completions) {
+		processed = read_responses(client, client->completions);
+		(void)buxton_wire_run_completions(client, SIZE_MAX);
+	} else {
+		processed = buxton_wire_handle_response(client);
+	}
+
+	return (int)processed;
+}
+
+size_t buxton_wire_run_completions(_BuxtonClient *client, size_t max)
+{
+	size_t ran = 0;
+
+	assert(client->completions);
+
+	while (ran < max && !buxton_wire_closed(client) &&
+	       buxton_completion_run(client->completions, 1)) {
+		ran++;
+	}
+
+	return ran;
+}
+
+/*
+ * Callbacks run with the client still in use up the stack, so closing
+ * it from one only marks it. The last caller to let go frees it.
+ */
+void buxton_wire_hold(_BuxtonClient *client)
+{
+	(void)__atomic_add_fetch(&client->callbacks->holds, 1,
+				 __ATOMIC_SEQ_CST);
+}
+
+bool buxton_wire_release(_BuxtonClient *client)
+{
+	return __atomic_sub_fetch(&client->callbacks->holds, 1,
+				  __ATOMIC_SEQ_CST) == BUXTON_CLIENT_CLOSED;
+}
+
+bool buxton_wire_close(_BuxtonClient *client)
+{
+	if (!client->callbacks) {
+		return true;
+	}
+	return __atomic_fetch_or(&client->callbacks->holds,
+				 BUXTON_CLIENT_CLOSED, __ATOMIC_SEQ_CST) == 0;
+}
+
+bool buxton_wire_closed(_BuxtonClient *client)
+{
+	return (__atomic_load_n(&client->callbacks->holds, __ATOMIC_SEQ_CST) &
+		BUXTON_CLIENT_CLOSED) != 0;
+}
+
+bool buxton_wire_waiting(_BuxtonClient *client, uint32_t msgid)
+{
+	bool waiting;
+
+	pthread_mutex_lock(&client->callbacks->guard);
+#if UINTPTR_MAX == 0xffffffffffffffff
+	waiting = hashmap_get(client->callbacks->callbacks,
+			      (void *)((uint64_t)msgid)) != NULL;
+#else
+	waiting = hashmap_get(client->callbacks->callbacks,
+			      (void *)msgid) != NULL;
+#endif
+	pthread_mutex_unlock(&client->callbacks->guard);
+
+	return waiting;
+}
+
+bool buxton_wire_hello(_BuxtonClient *client)
+{
+	_cleanup_free_ uint8_t *send = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_version;
+	bool ret = false;
+	uint32_t msgid;
+
+	assert(client);
+
+	msgid = get_msgid(client);
+	d_version.type = BUXTON_TYPE_UINT32;
+	d_version.store.d_uint32 = BUXTON_PROTOCOL_VERSION;
+
+	list = buxton_array_new();
+	if (!buxton_array_add(list, &d_version)) {
+		buxton_log("Failed to add version to hello array\n");
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_HELLO, msgid,
+					    list);
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (!send_message(client, send, send_len, NULL, NULL, msgid,
+			  BUXTON_CONTROL_HELLO, NULL)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
+bool buxton_wire_register_key(_BuxtonClient *client, _BuxtonKey *key,
+			      BuxtonCallback callback, void *data)
+{
+	_cleanup_free_ uint8_t *send = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_layer;
+	BuxtonData d_group;
+	BuxtonData d_name;
+	BuxtonData d_type;
+	bool ret = false;
+	uint32_t msgid;
+
+	assert(client);
+	assert(key);
+
+	msgid = get_msgid(client);
+	buxton_string_to_data(&key->group, &d_group);
+	buxton_string_to_data(&key->name, &d_name);
+	d_type.type = BUXTON_TYPE_UINT32;
+	d_type.store.d_uint32 = key->type;
+
+	list = buxton_array_new();
+	if (key->layer.value) {
+		buxton_string_to_data(&key->layer, &d_layer);
+		if (!buxton_array_add(list, &d_layer)) {
+			buxton_log("Failed to add layer to register_key array\n");
+			goto end;
+		}
+	}
+	if (!buxton_array_add(list, &d_group) ||
+	    !buxton_array_add(list, &d_name) ||
+	    !buxton_array_add(list, &d_type)) {
+		buxton_log("Failed to add key to register_key array\n");
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_REGISTER_KEY,
+					    msgid, list);
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (!send_message(client, send, send_len, callback, data, msgid,
+			  BUXTON_CONTROL_REGISTER_KEY, key)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
+/*
+ * Send a request by the handle of its key. The reply is handled as the
+ * reply to the request of type, so callbacks and the cache see no
+ * difference.
+ */
+static bool send_by_handle(_BuxtonClient *client, BuxtonControlMessage msg,
+			   uint32_t handle, BuxtonData *param,
+			   BuxtonCallback callback, void *data, uint32_t msgid,
+			   BuxtonControlMessage type, _BuxtonKey *key,
+			   BuxtonClientCache *cache)
+{
+	_cleanup_free_ uint8_t *send = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_handle;
+	bool ret = false;
+
+	d_handle.type = BUXTON_TYPE_UINT32;
+	d_handle.store.d_uint32 = handle;
+
+	list = buxton_array_new();
+	if (!buxton_array_add(list, &d_handle)) {
+		buxton_log("Failed to add handle to array\n");
+		goto end;
+	}
+	if (param && !buxton_array_add(list, param)) {
+		buxton_log("Failed to add parameter to handle array\n");
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, msg, msgid, list);
+	if (send_len == 0) {
+		goto end;
+	}
 
-	if (r == 0) {
-		return -ETIME;
-	} else if (r < 0) {
-		return -errno;
+	if (!send_cached_message(client, send, send_len, callback, data, msgid,
+				 type, key, cache, false)) {
+		goto end;
 	}
 
-	processed = buxton_wire_handle_response(client);
+	ret = true;
 
-	return (int)processed;
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
 }
 
 bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
@@ -441,42 +1256,20 @@ bool buxton_wire_set_value(_BuxtonClient *client, _BuxtonKey *key,
 	BuxtonData d_group;
 	BuxtonData d_name;
 	BuxtonData d_value;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
+	uint32_t handle;
+
+	buxton_value_to_data(key->type, value, &d_value);
+	handle = key_handle(client, key);
+	if (handle) {
+		return send_by_handle(client, BUXTON_CONTROL_SET_HANDLE, handle,
+				      &d_value, callback, data, msgid,
+				      BUXTON_CONTROL_SET, key, NULL);
+	}
 
 	buxton_string_to_data(&key->layer, &d_layer);
 	buxton_string_to_data(&key->group, &d_group);
 	buxton_string_to_data(&key->name, &d_name);
-	d_value.type = key->type;
-	switch (key->type) {
-	case BUXTON_TYPE_STRING:
-		/* cast until BuxtonString is updated */
-		d_value.store.d_string.value = (char *)value;
-		d_value.store.d_string.length = (uint32_t)strlen((char *)value) + 1;
-		break;
-	case BUXTON_TYPE_INT32:
-		d_value.store.d_int32 = *(const int32_t *)value;
-		break;
-	case BUXTON_TYPE_INT64:
-		d_value.store.d_int64 = *(const int64_t *)value;
-		break;
-	case BUXTON_TYPE_UINT32:
-		d_value.store.d_uint32 = *(const uint32_t *)value;
-		break;
-	case BUXTON_TYPE_UINT64:
-		d_value.store.d_uint64 = *(const uint64_t *)value;
-		break;
-	case BUXTON_TYPE_FLOAT:
-		d_value.store.d_float = *(const float *)value;
-		break;
-	case BUXTON_TYPE_DOUBLE:
-		memcpy(&d_value.store.d_double, value, sizeof(double));
-		break;
-	case BUXTON_TYPE_BOOLEAN:
-		d_value.store.d_boolean = *(const bool *)value;
-		break;
-	default:
-		break;
-	}
 
 	list = buxton_array_new();
 	if (!buxton_array_add(list, &d_layer)) {
@@ -531,7 +1324,7 @@ bool buxton_wire_set_label(_BuxtonClient *client,
 	BuxtonData d_group;
 	BuxtonData d_name;
 	BuxtonData d_value;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(&key->layer, &d_layer);
 	buxton_string_to_data(&key->group, &d_group);
@@ -588,7 +1381,7 @@ bool buxton_wire_create_group(_BuxtonClient *client, _BuxtonKey *key,
 	BuxtonArray *list = NULL;
 	BuxtonData d_layer;
 	BuxtonData d_group;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(&key->layer, &d_layer);
 	buxton_string_to_data(&key->group, &d_group);
@@ -621,6 +1414,51 @@ end:
 	return ret;
 }
 
+bool buxton_wire_get_group(_BuxtonClient *client, _BuxtonKey *key,
+			   BuxtonCallback callback, void *data)
+{
+	assert(client);
+	assert(key);
+
+	_cleanup_free_ uint8_t *send = NULL;
+	bool ret = false;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_layer;
+	BuxtonData d_group;
+	uint32_t msgid = get_msgid(client);
+
+	buxton_string_to_data(&key->layer, &d_layer);
+	buxton_string_to_data(&key->group, &d_group);
+
+	list = buxton_array_new();
+	if (!buxton_array_add(list, &d_layer)) {
+		buxton_log("Failed to add layer to get_group array\n");
+		goto end;
+	}
+	if (!buxton_array_add(list, &d_group)) {
+		buxton_log("Failed to add group to get_group array\n");
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_GET_GROUP, msgid, list);
+
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (!send_message(client, send, send_len, callback, data, msgid,
+			  BUXTON_CONTROL_GET_GROUP, key)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
 bool buxton_wire_remove_group(_BuxtonClient *client, _BuxtonKey *key,
 			      BuxtonCallback callback, void *data)
 {
@@ -633,7 +1471,7 @@ bool buxton_wire_remove_group(_BuxtonClient *client, _BuxtonKey *key,
 	BuxtonArray *list = NULL;
 	BuxtonData d_layer;
 	BuxtonData d_group;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(&key->layer, &d_layer);
 	buxton_string_to_data(&key->group, &d_group);
@@ -666,8 +1504,9 @@ end:
 	return ret;
 }
 
-bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
-			   BuxtonCallback callback, void *data)
+static bool send_get_value(_BuxtonClient *client, _BuxtonKey *key,
+			   BuxtonCallback callback, void *data,
+			   BuxtonClientCache *cache)
 {
 	bool ret = false;
 	size_t send_len = 0;
@@ -677,7 +1516,15 @@ bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
 	BuxtonData d_group;
 	BuxtonData d_name;
 	BuxtonData d_type;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
+	uint32_t handle;
+
+	handle = key_handle(client, key);
+	if (handle) {
+		return send_by_handle(client, BUXTON_CONTROL_GET_HANDLE, handle,
+				      NULL, callback, data, msgid,
+				      BUXTON_CONTROL_GET, key, cache);
+	}
 
 	buxton_string_to_data(&key->group, &d_group);
 	buxton_string_to_data(&key->name, &d_name);
@@ -711,8 +1558,77 @@ bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
 		goto end;
 	}
 
+	if (!send_cached_message(client, send, send_len, callback, data, msgid,
+				 BUXTON_CONTROL_GET, key, cache, false)) {
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
+bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
+			   BuxtonCallback callback, void *data)
+{
+	return send_get_value(client, key, callback, data, NULL);
+}
+
+bool buxton_wire_get_cached_value(_BuxtonClient *client, _BuxtonKey *key,
+				  BuxtonCallback callback, void *data)
+{
+	assert(client->cache);
+
+	return send_get_value(client, key, callback, data, client->cache);
+}
+
+bool buxton_wire_get_values(_BuxtonClient *client, _BuxtonKey **keys,
+			    size_t count, BuxtonCallback callback, void *data)
+{
+	assert(client);
+	assert(keys);
+
+	_cleanup_free_ uint8_t *send = NULL;
+	_cleanup_free_ BuxtonData *params = NULL;
+	bool ret = false;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData *d;
+	uint32_t msgid = get_msgid(client);
+
+	/* layer, group, name and type for every key */
+	params = malloc0(sizeof(BuxtonData) * 4 * count);
+	if (!params) {
+		return false;
+	}
+
+	list = buxton_array_new();
+	for (size_t i = 0; i < count; i++) {
+		d = &params[4 * i];
+		buxton_string_to_data(&keys[i]->layer, &d[0]);
+		buxton_string_to_data(&keys[i]->group, &d[1]);
+		buxton_string_to_data(&keys[i]->name, &d[2]);
+		d[3].type = BUXTON_TYPE_UINT32;
+		d[3].store.d_uint32 = keys[i]->type;
+		for (int j = 0; j < 4; j++) {
+			if (!buxton_array_add(list, &d[j])) {
+				buxton_log("Failed to add key to get_values array\n");
+				goto end;
+			}
+		}
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_GET_VALUES,
+					    msgid, list);
+
+	if (send_len == 0 || send_len > BUXTON_MESSAGE_MAX_LENGTH) {
+		goto end;
+	}
+
 	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_GET, key)) {
+			  BUXTON_CONTROL_GET_VALUES, NULL)) {
 		goto end;
 	}
 
@@ -736,7 +1652,7 @@ bool buxton_wire_get_label(_BuxtonClient *client, _BuxtonKey *key,
 	BuxtonData d_layer;
 	BuxtonData d_group;
 	BuxtonData d_name;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(&key->layer, &d_layer);
 	buxton_string_to_data(&key->group, &d_group);
@@ -792,7 +1708,7 @@ bool buxton_wire_unset_value(_BuxtonClient *client,
 	BuxtonData d_layer;
 	BuxtonData d_type;
 	bool ret = false;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(&key->group, &d_group);
 	buxton_string_to_data(&key->name, &d_name);
@@ -850,7 +1766,7 @@ bool buxton_wire_list_keys(_BuxtonClient *client,
 	BuxtonArray *list = NULL;
 	BuxtonData d_layer;
 	bool ret = false;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(layer, &d_layer);
 
@@ -884,8 +1800,10 @@ bool buxton_wire_list_names(_BuxtonClient *client,
 			   BuxtonString *layer,
 			   BuxtonString *group,
 			   BuxtonString *prefix,
+			   bool stream,
 			   BuxtonCallback callback,
-			   void *data)
+			   void *data,
+			   uint32_t *msgid_out)
 {
 	assert(client);
 	assert(layer);
@@ -897,7 +1815,7 @@ bool buxton_wire_list_names(_BuxtonClient *client,
 	BuxtonData d_group;
 	BuxtonData d_prefix;
 	bool ret = false;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(layer, &d_layer);
 	buxton_string_to_data(group, &d_group);
@@ -924,11 +1842,15 @@ bool buxton_wire_list_names(_BuxtonClient *client,
 		goto end;
 	}
 
-	if (!send_message(client, send, send_len, callback, data, msgid,
-			  BUXTON_CONTROL_LIST_NAMES, NULL)) {
+	if (!send_cached_message(client, send, send_len, callback, data, msgid,
+				 BUXTON_CONTROL_LIST_NAMES, NULL, NULL,
+				 stream)) {
 		goto end;
 	}
 
+	if (msgid_out) {
+		*msgid_out = msgid;
+	}
 	ret = true;
 
 end:
@@ -939,6 +1861,7 @@ end:
 
 bool buxton_wire_register_notification(_BuxtonClient *client,
 				       _BuxtonKey *key,
+				       uint32_t interval,
 				       BuxtonCallback callback,
 				       void *data)
 {
@@ -951,8 +1874,20 @@ bool buxton_wire_register_notification(_BuxtonClient *client,
 	BuxtonData d_group;
 	BuxtonData d_name;
 	BuxtonData d_type;
+	BuxtonData d_interval;
 	bool ret = false;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
+	uint32_t handle;
+
+	d_interval.type = BUXTON_TYPE_UINT32;
+	d_interval.store.d_uint32 = interval;
+	handle = key_handle(client, key);
+	if (handle) {
+		return send_by_handle(client, BUXTON_CONTROL_NOTIFY_HANDLE,
+				      handle, interval ? &d_interval : NULL,
+				      callback, data, msgid,
+				      BUXTON_CONTROL_NOTIFY, key, NULL);
+	}
 
 	buxton_string_to_data(&key->group, &d_group);
 	buxton_string_to_data(&key->name, &d_name);
@@ -972,6 +1907,13 @@ bool buxton_wire_register_notification(_BuxtonClient *client,
 		buxton_log("Failed to add type to set_value array\n");
 		goto end;
 	}
+	/* Older daemons only know the three parameter form */
+	if (interval) {
+		if (!buxton_array_add(list, &d_interval)) {
+			buxton_log("Failed to add interval to notify array\n");
+			goto end;
+		}
+	}
 
 	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_NOTIFY, msgid,
 					    list);
@@ -1007,7 +1949,7 @@ bool buxton_wire_unregister_notification(_BuxtonClient *client,
 	BuxtonData d_name;
 	BuxtonData d_type;
 	bool ret = false;
-	uint32_t msgid = get_msgid();
+	uint32_t msgid = get_msgid(client);
 
 	buxton_string_to_data(&key->group, &d_group);
 	buxton_string_to_data(&key->name, &d_name);
@@ -1047,6 +1989,220 @@ end:
 	return ret;
 }
 
+/*
+ * A NULL name is sent as an empty prefix, matching the whole group. A
+ * registration for a cache is recorded before it is sent, so that its
+ * reply always finds the group.
+ */
+static bool send_prefix_notification(_BuxtonClient *client, _BuxtonKey *key,
+				     BuxtonCallback callback, void *data,
+				     BuxtonClientCache *cache,
+				     BuxtonControlMessage msg, uint32_t *sent)
+{
+	assert(client);
+	assert(key);
+
+	_cleanup_free_ uint8_t *send = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	BuxtonData d_group;
+	BuxtonData d_name;
+	bool ret = false;
+	uint32_t msgid = get_msgid(client);
+
+	buxton_string_to_data(&key->group, &d_group);
+	buxton_string_to_data(&key->name, &d_name);
+
+	list = buxton_array_new();
+	if (!buxton_array_add(list, &d_group)) {
+		buxton_log("Failed to add group to notify prefix array\n");
+		goto end;
+	}
+	if (!buxton_array_add(list, &d_name)) {
+		buxton_log("Failed to add prefix to notify prefix array\n");
+		goto end;
+	}
+
+	send_len = buxton_serialize_message(&send, msg, msgid, list);
+
+	if (send_len == 0) {
+		goto end;
+	}
+
+	if (cache) {
+		buxton_client_cache_watch(cache, &key->group, msgid);
+	}
+	if (!send_cached_message(client, send, send_len, callback, data,
+				 msgid, msg, key, cache, false)) {
+		if (cache) {
+			buxton_client_cache_watch_failed(cache, &key->group);
+		}
+		goto end;
+	}
+
+	if (sent) {
+		*sent = msgid;
+	}
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
+bool buxton_wire_register_prefix_notification(_BuxtonClient *client,
+					      _BuxtonKey *key,
+					      BuxtonCallback callback,
+					      void *data, uint32_t *msgid)
+{
+	return send_prefix_notification(client, key, callback, data, NULL,
+					BUXTON_CONTROL_NOTIFY_PREFIX, msgid);
+}
+
+bool buxton_wire_watch_group(_BuxtonClient *client, BuxtonString *group)
+{
+	_BuxtonKey key;
+
+	assert(client->cache);
+
+	memzero(&key, sizeof(_BuxtonKey));
+	key.group = *group;
+	key.type = BUXTON_TYPE_STRING;
+
+	return send_prefix_notification(client, &key, NULL, NULL,
+					client->cache,
+					BUXTON_CONTROL_NOTIFY_PREFIX, NULL);
+}
+
+bool buxton_wire_unregister_prefix_notification(_BuxtonClient *client,
+						_BuxtonKey *key,
+						BuxtonCallback callback,
+						void *data)
+{
+	return send_prefix_notification(client, key, callback, data, NULL,
+					BUXTON_CONTROL_UNNOTIFY_PREFIX, NULL);
+}
+
+/*
+ * Each request in a batch is framed by its control code and parameter
+ * count, followed by the parameters the standalone message carries.
+ */
+static bool add_batch_params(BuxtonArray *list, BuxtonData *slots,
+			     BuxtonBatchOp *op)
+{
+	_BuxtonKey *key = op->key;
+	BuxtonData *params = &slots[2];
+	uint32_t count = 0;
+
+	if (key->layer.value) {
+		buxton_string_to_data(&key->layer, &params[count++]);
+	}
+	buxton_string_to_data(&key->group, &params[count++]);
+	if (key->name.value) {
+		buxton_string_to_data(&key->name, &params[count++]);
+	}
+
+	switch (op->type) {
+	case BUXTON_CONTROL_SET:
+		params[count++] = *op->value;
+		break;
+	case BUXTON_CONTROL_GET:
+	case BUXTON_CONTROL_UNSET:
+		params[count].type = BUXTON_TYPE_UINT32;
+		params[count++].store.d_uint32 = key->type;
+		break;
+	case BUXTON_CONTROL_GET_LABEL:
+		break;
+	default:
+		return false;
+	}
+
+	slots[0].type = BUXTON_TYPE_UINT32;
+	slots[0].store.d_uint32 = (uint32_t)op->type;
+	slots[1].type = BUXTON_TYPE_UINT32;
+	slots[1].store.d_uint32 = count;
+
+	for (uint32_t i = 0; i < count + 2; i++) {
+		if (!buxton_array_add(list, &slots[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool buxton_wire_batch(_BuxtonClient *client, _BuxtonBatch *batch,
+		       BuxtonCallback callback, void *data)
+{
+	assert(client);
+	assert(batch);
+	assert(batch->ops);
+
+	_cleanup_free_ uint8_t *send = NULL;
+	_cleanup_free_ BuxtonData *slots = NULL;
+	struct notify_value *nv = NULL;
+	size_t send_len = 0;
+	BuxtonArray *list = NULL;
+	bool ret = false;
+	uint32_t msgid = get_msgid(client);
+
+	/* two framing parameters plus at most four request parameters */
+	slots = malloc0(sizeof(BuxtonData) * 6 * batch->ops->len);
+	if (!slots) {
+		return false;
+	}
+
+	list = buxton_array_new();
+	if (!list) {
+		return false;
+	}
+	for (uint32_t i = 0; i < batch->ops->len; i++) {
+		if (!add_batch_params(list, &slots[6 * i],
+				      buxton_array_get(batch->ops, i))) {
+			buxton_log("Failed to add request to batch array\n");
+			goto end;
+		}
+	}
+
+	send_len = buxton_serialize_message(&send, BUXTON_CONTROL_BATCH, msgid,
+					    list);
+
+	if (send_len == 0 || send_len > BUXTON_MESSAGE_MAX_LENGTH) {
+		goto end;
+	}
+
+	nv = malloc0(sizeof(struct notify_value));
+	if (!nv) {
+		goto end;
+	}
+	nv->cb = callback;
+	nv->data = data;
+	nv->type = BUXTON_CONTROL_BATCH;
+	nv->ops = batch->ops;
+
+	if (!add_callback(client, nv, msgid)) {
+		free(nv);
+		goto end;
+	}
+
+	/* The callback owns the requests now */
+	batch->ops = buxton_array_new();
+	if (!batch->ops) {
+		abort();
+	}
+
+	if (!write_message(client, send, send_len)) {
+		buxton_debug("Write failed for msgid: %llu\n", msgid);
+		goto end;
+	}
+
+	ret = true;
+
+end:
+	buxton_array_free(&list, NULL);
+	return ret;
+}
+
 void include_protocol(void)
 {
 	;
@@ -20,24 +20,82 @@
 	#include "config.h"
 #endif
 
+#include <pthread.h>
+
 #include "buxton.h"
+#include "buxtonbatch.h"
 #include "buxtonclient.h"
 #include "buxtonkey.h"
+#include "completion.h"
 #include "list.h"
 #include "serialize.h"
 #include "hashmap.h"
 
+struct notify_value;
+
+/**
+ * Requests waiting for a reply and notifications registered on a
+ * client connection
+ */
+typedef struct BuxtonCallbacks {
+	pthread_mutex_t guard; /**<Guards the tables of this connection */
+	Hashmap *callbacks; /**<Message ID to request waiting for a reply */
+	Hashmap *notify_callbacks; /**<Message ID to registered notification */
+	uint32_t msgid; /**<Next message ID of this connection */
+	struct notify_value **heap; /**<Requests waiting, soonest deadline first */
+	size_t heap_len; /**<Number of requests in the heap */
+	size_t heap_size; /**<Slots allocated for the heap */
+	uint32_t timeout; /**<ms a request sent now waits for its reply */
+	pthread_mutex_t send_lock; /**<Keeps messages in encoding order */
+	uint32_t version; /**<Protocol version agreed on, 0 before HELLO */
+	BuxtonStringTable encode; /**<Strings sent to buxtond by index */
+	BuxtonStringTable decode; /**<Strings buxtond sends by index */
+	Hashmap *handles; /**<Registered _BuxtonKey to its handle, under guard */
+	uint32_t holds; /**<Callers running callbacks, and BUXTON_CLIENT_CLOSED */
+} BuxtonCallbacks;
+
+/**
+ * Set in BuxtonCallbacks.holds once the client was closed while held
+ */
+#define BUXTON_CLIENT_CLOSED 0x80000000U
+
 /**
- * Initialize callback hashamps
+ * Initialize the callback hashmaps of a client connection
+ * @param client Client connection, its previous callbacks are ignored
  * @return a boolean value, indicating success of the operation
  */
-bool setup_callbacks(void)
+bool setup_callbacks(_BuxtonClient *client)
 	__attribute__((warn_unused_result));
 
 /**
- * free callback hashmaps
+ * free the callback hashmaps of a client connection
+ * @param client Client connection
+ */
+void cleanup_callbacks(_BuxtonClient *client);
+
+/**
+ * Set how long requests sent from now on wait for their reply, those
+ * already sent keep their deadline
+ * @param client Client connection
+ * @param timeout Timeout in ms
+ */
+void set_callback_timeout(_BuxtonClient *client, uint32_t timeout);
+
+/**
+ * Free a request queued in a batch
+ * @param p The BuxtonBatchOp to free
  */
-void cleanup_callbacks(void);
+void batch_op_free(void *p);
+
+/**
+ * Wrap a value passed in through the public API in a BuxtonData
+ * @note Strings are not copied, data points at value
+ * @param type Type of the value
+ * @param value Pointer to the value
+ * @param data BuxtonData to fill in
+ */
+void buxton_value_to_data(BuxtonDataType type, const void *value,
+			  BuxtonData *data);
 
 /**
  * Execute callback function on list using user data
@@ -53,9 +111,10 @@ void run_callback(BuxtonCallback callback, void *data, size_t count,
 		  _BuxtonKey *key);
 
 /**
- * cleanup expired messages (must hold callback_guard lock)
+ * cleanup expired messages (must hold the client's callback lock)
+ * @param client Client connection
  */
-void reap_callbacks(void);
+void reap_callbacks(_BuxtonClient *client);
 
 /**
  * Write message to buxtond
@@ -74,13 +133,16 @@ bool send_message(_BuxtonClient *client, uint8_t *send, size_t send_len,
 	__attribute__((warn_unused_result));
 
 /**
- * Check for callbacks for daemon's response
+ * Check for callbacks for daemon's response (must hold the client's
+ * callback lock)
+ * @param client Client connection the response came on
  * @param msg Buxton message type
  * @param msgid Key for message lookup
  * @param list array of BuxtonData
  * @param count number of elements in list
  */
-void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
+void handle_callback_response(_BuxtonClient *client,
+			      BuxtonControlMessage msg, uint32_t msgid,
 			      BuxtonData *list, size_t count);
 
 /**
@@ -92,6 +154,17 @@ void handle_callback_response(BuxtonControlMessage msg, uint32_t msgid,
 ssize_t buxton_wire_handle_response(_BuxtonClient *client)
 	__attribute__((warn_unused_result));
 
+/**
+ * Parse the responses buxtond sent, queueing their callbacks instead
+ * of running them
+ * @param client A BuxtonClient
+ * @param queue The client's completion queue
+ * @return number of received messages processed, or -1 on a bad message
+ */
+ssize_t buxton_wire_queue_responses(_BuxtonClient *client,
+				    BuxtonCompletionQueue *queue)
+	__attribute__((warn_unused_result));
+
 /**
  * Wait for a response from buxtond and then call handle response
  * @param client Client connection
@@ -99,6 +172,79 @@ ssize_t buxton_wire_handle_response(_BuxtonClient *client)
  */
 int buxton_wire_get_response(_BuxtonClient *client);
 
+/**
+ * Run the client's queued callbacks, stopping early if one closes it
+ * @param client Client connection, which has a completion queue
+ * @param max Most callbacks to run
+ * @return the number of callbacks run
+ */
+size_t buxton_wire_run_completions(_BuxtonClient *client, size_t max);
+
+/**
+ * Keep a client from being freed while its callbacks run, since one of
+ * them may close it
+ * @param client Client connection
+ */
+void buxton_wire_hold(_BuxtonClient *client);
+
+/**
+ * Stop keeping a client
+ * @param client Client connection
+ * @return true if it was closed while held and must now be freed
+ */
+bool buxton_wire_release(_BuxtonClient *client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Mark a client closed, no more of its replies are read
+ * @param client Client connection
+ * @return true if nothing holds it, so it can be freed now
+ */
+bool buxton_wire_close(_BuxtonClient *client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Check whether a client was closed by one of its callbacks
+ * @param client Client connection
+ * @return true if it was closed
+ */
+bool buxton_wire_closed(_BuxtonClient *client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Check whether a request still waits for its reply, or for the rest
+ * of it
+ * @param client Client connection
+ * @param msgid Message ID of the request
+ * @return true until the request's callback has run for the last time
+ */
+bool buxton_wire_waiting(_BuxtonClient *client, uint32_t msgid)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send a HELLO message over the wire protocol, offering the highest
+ * protocol version spoken. Messages are sent in the agreed version once
+ * the reply is handled.
+ * @param client Client connection
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_hello(_BuxtonClient *client)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send a REGISTER_KEY message over the wire protocol. Once buxtond
+ * replies with a handle, gets, sets and notifications of the key are
+ * sent by handle.
+ * @param client Client connection
+ * @param key _BuxtonKey pointer, with its layer or none and its type
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_register_key(_BuxtonClient *client, _BuxtonKey *key,
+			      BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
 /**
  * Send a SET message over the wire protocol, return the response
  * @param client Client connection
@@ -131,6 +277,29 @@ bool buxton_wire_set_label(_BuxtonClient *client, _BuxtonKey *key,
 			   void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Maximum number of keys a connection may register
+ */
+#define BUXTON_MAX_KEY_HANDLES 4096
+
+/**
+ * Maximum number of keys in a single GET_VALUES message
+ */
+#define BUXTON_GET_VALUES_MAX_KEYS (BUXTON_MESSAGE_MAX_PARAMS / 4)
+
+/**
+ * Send a GET_VALUES message over the wire protocol, return the data
+ * @param client Client connection
+ * @param keys Array of _BuxtonKey pointers
+ * @param count Number of keys, at most BUXTON_GET_VALUES_MAX_KEYS
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_get_values(_BuxtonClient *client, _BuxtonKey **keys,
+			    size_t count, BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
 /**
  * Send a GET_LABEL message over the wire protocol, return the response
  *
@@ -146,6 +315,18 @@ bool buxton_wire_get_label(_BuxtonClient *client, _BuxtonKey *key,
 			   BuxtonCallback callback, void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a GET_GROUP message over the wire protocol, return the data
+ * @param client Client connection
+ * @param key Key with group and layer members initialized
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_get_group(_BuxtonClient *client, _BuxtonKey *key,
+			   BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
 /**
  * Send a CREATE_GROUP message over the wire protocol, return the response
  *
@@ -188,6 +369,19 @@ bool buxton_wire_get_value(_BuxtonClient *client, _BuxtonKey *key,
 			   BuxtonCallback callback, void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a GET message over the wire protocol, keeping the value in the
+ * client's cache once buxtond notifies changes to the key's group
+ * @param client Client connection, with a cache
+ * @param key _BuxtonKey pointer
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_get_cached_value(_BuxtonClient *client, _BuxtonKey *key,
+				  BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
 /**
  * Send an UNSET message over the wire protocol, return the response
  * @param client Client connection
@@ -206,12 +400,14 @@ bool buxton_wire_unset_value(_BuxtonClient *client,
  * Send a NOTIFY message over the protocol, register for events
  * @param client Client connection
  * @param key _BuxtonKey pointer
+ * @param interval Minimum ms between notifications, 0 for every change
  * @param callback A callback function to handle daemon reply
  * @param data User data to be used with callback function
  * @return a boolean value, indicating success of the operation
  */
 bool buxton_wire_register_notification(_BuxtonClient *client,
 				       _BuxtonKey *key,
+				       uint32_t interval,
 				       BuxtonCallback callback,
 				       void *data)
 	__attribute__((warn_unused_result));
@@ -231,21 +427,27 @@ bool buxton_wire_list_keys(_BuxtonClient *client,
 	__attribute__((warn_unused_result));
 
 /**
- * Send a LIST message over the protocol, retrieve key/group list
+ * Send a LIST message over the protocol, retrieve key/group list.
+ * buxtond may send the list in chunks, see buxton_list_names_stream.
  * @param client Client connection
  * @param layer Layer name
  * @param group Group name
  * @param prefix Filtering prefix
+ * @param stream Whether the callback runs for each chunk, rather than
+ * once with every name
  * @param callback A callback function to handle daemon reply
  * @param data User data to be used with callback function
+ * @param msgid Set to the message ID of the request, may be NULL
  * @return a boolean value, indicating success of the operation
  */
 bool buxton_wire_list_names(_BuxtonClient *client,
 			   BuxtonString *layer,
 			   BuxtonString *group,
 			   BuxtonString *prefix,
+			   bool stream,
 			   BuxtonCallback callback,
-			   void *data)
+			   void *data,
+			   uint32_t *msgid)
 	__attribute__((warn_unused_result));
 
 /**
@@ -262,13 +464,69 @@ bool buxton_wire_unregister_notification(_BuxtonClient *client,
 					 void *data)
 	__attribute__((warn_unused_result));
 
+/**
+ * Send a NOTIFY_PREFIX message over the protocol, register for
+ * notifications on every key of a group starting with a prefix
+ * @param client Client connection
+ * @param key Key with the group and the prefix as name, or no name
+ * for the whole group
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @param msgid Set to the message ID of the registration, may be NULL
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_register_prefix_notification(_BuxtonClient *client,
+					      _BuxtonKey *key,
+					      BuxtonCallback callback,
+					      void *data, uint32_t *msgid)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send a NOTIFY_PREFIX message for a whole group on behalf of the
+ * client's cache. * Changes invalidate the cache and a refusal stops it from keeping the
+ * group, both as soon as they are read rather than from a callback.
+ * @param client Client connection, with a cache
+ * @param group Name of the group
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_watch_group(_BuxtonClient *client, BuxtonString *group)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send an UNNOTIFY_PREFIX message over the protocol, no longer
+ * receive notifications for a prefix
+ * @param client Client connection
+ * @param key Key with the group and the prefix as name, or no name
+ * for the whole group
+ * @param callback A callback function to handle daemon reply
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_unregister_prefix_notification(_BuxtonClient *client,
+						_BuxtonKey *key,
+						BuxtonCallback callback,
+						void *data)
+	__attribute__((warn_unused_result));
+
+/**
+ * Send a BATCH message over the protocol, run every queued request
+ * @param client Client connection
+ * @param batch Batch of requests, emptied once they are sent
+ * @param callback A callback function run after all request callbacks
+ * @param data User data to be used with callback function
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_wire_batch(_BuxtonClient *client, _BuxtonBatch *batch,
+		       BuxtonCallback callback, void *data)
+	__attribute__((warn_unused_result));
+
 void include_protocol(void);
 
 /**
  * These functions are internal and are used in the test cases only for handle_client_check
  */
-void lock_mutex(void);
-void unlock_mutex(void);
+void lock_mutex(_BuxtonClient *client);
+void unlock_mutex(_BuxtonClient *client);
 
 
 /*
@@ -189,7 +189,7 @@ void buxton_deserialize(uint8_t *source, BuxtonData *target,
 size_t buxton_serialize_message(uint8_t **dest, BuxtonControlMessage message,
 				uint32_t msgid, BuxtonArray *list)
 {
-	uint16_t i = 0;
+	uint32_t i = 0;
 	uint8_t *data = NULL;
 	size_t ret = 0;
 	size_t offset = 0;
@@ -358,75 +358,406 @@ end:
 	return ret;
 }
 
-ssize_t buxton_deserialize_message(uint8_t *data,
-				  BuxtonControlMessage *r_message,
-				  size_t size, uint32_t *r_msgid,
-				  BuxtonData **list)
+/*
+ * Version 2 parameters start with a tag byte: the type in the low bits
+ * and, for strings, how the string is sent in the high bits. Lengths and
+ * counts are LEB128 varints, other values have the width of their type.
+ */
+#define V2_TYPE_MASK 0x0f
+#define V2_STRING_LITERAL 0x00
+#define V2_STRING_DEFINE 0x10
+#define V2_STRING_REF 0x20
+#define V2_STRING_MASK 0xf0
+
+/* Most bytes of a varint holding 32 bits */
+#define VARINT_MAX_SIZE 5
+
+static size_t put_varint(uint8_t *data, uint32_t value)
+{
+	size_t i = 0;
+
+	while (value >= 0x80) {
+		data[i++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	data[i++] = (uint8_t)value;
+
+	return i;
+}
+
+static bool get_varint(uint8_t *data, size_t size, size_t *offset,
+		       uint32_t *value)
 {
+	uint32_t v = 0;
+	unsigned int shift = 0;
+	uint8_t byte;
+
+	do {
+		if (*offset >= size || shift >= 7 * VARINT_MAX_SIZE) {
+			return false;
+		}
+		byte = data[(*offset)++];
+		if (shift == 28 && byte > 0x0f) {
+			return false;
+		}
+		v |= (uint32_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	*value = v;
+	return true;
+}
+
+static size_t value_width(BuxtonDataType type)
+{
+	switch (type) {
+	case BUXTON_TYPE_INT32:
+		return sizeof(int32_t);
+	case BUXTON_TYPE_UINT32:
+		return sizeof(uint32_t);
+	case BUXTON_TYPE_INT64:
+		return sizeof(int64_t);
+	case BUXTON_TYPE_UINT64:
+		return sizeof(uint64_t);
+	case BUXTON_TYPE_FLOAT:
+		return sizeof(float);
+	case BUXTON_TYPE_DOUBLE:
+		return sizeof(double);
+	case BUXTON_TYPE_BOOLEAN:
+		return sizeof(bool);
+	default:
+		return 0;
+	}
+}
+
+/* Whether a string may be given an index, it must survive strcmp */
+static bool string_internable(BuxtonString *string)
+{
+	return string->length > 1 &&
+		string->length <= BUXTON_STRING_TABLE_MAX_LENGTH &&
+		strnlen(string->value, string->length) == string->length - 1;
+}
+
+/*
+ * Number of leading parameters of a request holding its layer and
+ * group names. Only those are given an index: a connection sends them
+ * over and over, while names and values would fill the table for good.
+ */
+static size_t key_params(uint32_t message, size_t count)
+{
+	switch (message) {
+	case BUXTON_CONTROL_SET:
+	case BUXTON_CONTROL_SET_LABEL:
+	case BUXTON_CONTROL_CREATE_GROUP:
+	case BUXTON_CONTROL_REMOVE_GROUP:
+	case BUXTON_CONTROL_UNSET:
+	case BUXTON_CONTROL_GET_LABEL:
+	case BUXTON_CONTROL_LIST_NAMES:
+	case BUXTON_CONTROL_GET_GROUP:
+		return count < 2 ? count : 2;
+	case BUXTON_CONTROL_GET:
+	case BUXTON_CONTROL_REGISTER_KEY:
+		/* Layerless gets start with the group */
+		if (count == 4) {
+			return 2;
+		}
+		return count < 1 ? count : 1;
+	case BUXTON_CONTROL_NOTIFY:
+	case BUXTON_CONTROL_UNNOTIFY:
+	case BUXTON_CONTROL_NOTIFY_PREFIX:
+	case BUXTON_CONTROL_UNNOTIFY_PREFIX:
+		return count < 1 ? count : 1;
+	default:
+		return 0;
+	}
+}
+
+static void string_table_add(BuxtonStringTable *table, BuxtonString *string,
+			     bool encode)
+{
+	BuxtonString *entry;
+
+	if (!table->strings) {
+		table->strings = malloc(sizeof(BuxtonString) *
+					BUXTON_STRING_TABLE_SIZE);
+		if (!table->strings) {
+			abort();
+		}
+	}
+	entry = &table->strings[table->count];
+	if (!buxton_string_copy(string, entry)) {
+		abort();
+	}
+	table->count++;
+
+	if (!encode) {
+		return;
+	}
+	if (!table->index) {
+		table->index = hashmap_new(string_hash_func,
+					   string_compare_func);
+		if (!table->index) {
+			abort();
+		}
+	}
+	if (hashmap_put(table->index, entry->value,
+			(void *)(uintptr_t)table->count) != 1) {
+		abort();
+	}
+}
+
+void buxton_string_table_free(BuxtonStringTable *table)
+{
+	assert(table);
+
+	/* The index hashes its keys when freed, they go after it */
+	hashmap_free(table->index);
+	for (uint32_t i = 0; i < table->count; i++) {
+		free(table->strings[i].value);
+	}
+	free(table->strings);
+	memzero(table, sizeof(BuxtonStringTable));
+}
+
+void buxton_string_table_truncate(BuxtonStringTable *table, uint32_t count)
+{
+	assert(table);
+
+	while (table->count > count) {
+		table->count--;
+		(void)hashmap_remove(table->index,
+				     table->strings[table->count].value);
+		free(table->strings[table->count].value);
+	}
+}
+
+static size_t serialize_v2(uint8_t **dest, BuxtonControlMessage message,
+			   uint32_t msgid, BuxtonData *list, size_t count,
+			   BuxtonStringTable *table)
+{
+	uint8_t *data;
 	size_t offset = 0;
-	ssize_t ret = -1;
-	size_t min_length = BUXTON_MESSAGE_HEADER_LENGTH;
-	uint16_t control, message;
-	size_t n_params, c_param, c_length;
-	BuxtonDataType c_type = 0;
-	BuxtonData *k_list = NULL;
-	BuxtonData c_data;
-	uint32_t msgid;
+	size_t size;
+	uint16_t control, msg;
+	uint32_t length;
+	uintptr_t index;
+	BuxtonString *string;
+	size_t request = 0;
+	size_t keys_from = 0;
+	size_t keys_to;
+	bool key;
+
+	if (count > BUXTON_MESSAGE_MAX_PARAMS) {
+		errno = EINVAL;
+		return 0;
+	}
+	if (message >= BUXTON_CONTROL_MAX || message < BUXTON_CONTROL_SET) {
+		errno = EINVAL;
+		return 0;
+	}
 
-	assert(data);
-	assert(r_message);
+	/*
+	 * Check every parameter before writing any, the table must not
+	 * gain strings for a message that is never sent
+	 */
+	size = BUXTON_MSGID_OFFSET + sizeof(uint32_t) + VARINT_MAX_SIZE;
+	for (size_t i = 0; i < count; i++) {
+		if (list[i].type == BUXTON_TYPE_STRING) {
+			size += 1 + VARINT_MAX_SIZE +
+				list[i].store.d_string.length;
+		} else if (value_width(list[i].type)) {
+			size += 1 + value_width(list[i].type);
+		} else {
+			errno = EINVAL;
+			buxton_log("Invalid parameter type %lu\n", list[i].type);
+			return 0;
+		}
+	}
+
+	data = malloc(size);
+	if (!data) {
+		abort();
+	}
+
+	control = BUXTON_CONTROL_CODE_V2;
+	memcpy(data, &control, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+
+	msg = (uint16_t)message;
+	memcpy(data+offset, &msg, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+
+	/* Save room for final size */
+	offset += sizeof(uint32_t);
+
+	memcpy(data+offset, &msgid, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+
+	offset += put_varint(data+offset, (uint32_t)count);
+
+	keys_to = key_params(message, count);
+	for (size_t i = 0; i < count; i++) {
+		/* Batched requests are framed by their control code and count */
+		if (message == BUXTON_CONTROL_BATCH && i == request &&
+		    i + 1 < count && list[i].type == BUXTON_TYPE_UINT32 &&
+		    list[i + 1].type == BUXTON_TYPE_UINT32) {
+			keys_from = i + 2;
+			keys_to = keys_from +
+				key_params(list[i].store.d_uint32,
+					   list[i + 1].store.d_uint32);
+			request = keys_from + list[i + 1].store.d_uint32;
+		}
+
+		if (list[i].type != BUXTON_TYPE_STRING) {
+			data[offset++] = (uint8_t)list[i].type;
+			memcpy(data+offset, &list[i].store,
+			       value_width(list[i].type));
+			offset += value_width(list[i].type);
+			continue;
+		}
+
+		string = &list[i].store.d_string;
+		index = 0;
+		if (table && string_internable(string)) {
+			index = (uintptr_t)hashmap_get(table->index,
+						       string->value);
+		}
+		if (index) {
+			data[offset++] = BUXTON_TYPE_STRING | V2_STRING_REF;
+			offset += put_varint(data+offset, (uint32_t)(index - 1));
+			continue;
+		}
+
+		/* Strings already given an index are used anywhere */
+		if (message == BUXTON_CONTROL_GET_VALUES) {
+			key = i % 4 < 2;
+		} else {
+			key = i >= keys_from && i < keys_to;
+		}
+		if (table && key && table->count < BUXTON_STRING_TABLE_SIZE &&
+		    string_internable(string)) {
+			data[offset++] = BUXTON_TYPE_STRING | V2_STRING_DEFINE;
+			string_table_add(table, string, true);
+		} else {
+			data[offset++] = BUXTON_TYPE_STRING | V2_STRING_LITERAL;
+		}
+		length = string->length;
+		offset += put_varint(data+offset, length);
+		if (length) {
+			memcpy(data+offset, string->value, length);
+			offset += length;
+		}
+	}
+
+	memcpy(data+BUXTON_LENGTH_OFFSET, &offset, sizeof(uint32_t));
+	*dest = data;
+
+	return offset;
+}
+
+size_t buxton_serialize_message_v2(uint8_t **dest,
+				   BuxtonControlMessage message,
+				   uint32_t msgid, BuxtonArray *list,
+				   BuxtonStringTable *table)
+{
+	_cleanup_free_ BuxtonData *params = NULL;
+	BuxtonData *param;
+
+	assert(dest);
 	assert(list);
 
-	buxton_debug("Deserializing message...\n");
-	buxton_debug("size=%lu\n", size);
+	if (list->len) {
+		params = malloc(sizeof(BuxtonData) * list->len);
+		if (!params) {
+			abort();
+		}
+	}
+	for (uint32_t i = 0; i < list->len; i++) {
+		param = buxton_array_get(list, i);
+		if (!param) {
+			errno = EINVAL;
+			return 0;
+		}
+		params[i] = *param;
+	}
 
-	if (size < min_length) {
+	return serialize_v2(dest, message, msgid, params, list->len, table);
+}
+
+/* Check the header of a message, leaving offset at its first parameter */
+static bool deserialize_header(uint8_t *data, size_t size,
+			       BuxtonControlMessage *r_message,
+			       uint32_t *r_msgid, size_t *n_params,
+			       size_t *offset, bool *v2)
+{
+	uint16_t control, message;
+	uint32_t count;
+
+	if (size < BUXTON_MESSAGE_HEADER_LENGTH) {
 		errno = EINVAL;
-		goto end;
+		return false;
 	}
 
 	/* Copy the control code */
 	control = *(uint16_t*)data;
-	offset += sizeof(uint16_t);
+	*offset = sizeof(uint16_t);
 
 	/* Check this is a valid buxton message */
-	if (control != BUXTON_CONTROL_CODE) {
+	if (control != BUXTON_CONTROL_CODE && control != BUXTON_CONTROL_CODE_V2) {
 		errno = EINVAL;
-		goto end;
+		return false;
 	}
+	*v2 = control == BUXTON_CONTROL_CODE_V2;
 
 	/* Obtain the control message */
-	message = *(BuxtonControlMessage*)(data+offset);
-	offset += sizeof(uint16_t);
+	message = *(BuxtonControlMessage*)(data + *offset);
+	*offset += sizeof(uint16_t);
 
 	/* Ensure control message is in valid range */
 	if (message <= BUXTON_CONTROL_MIN || message >= BUXTON_CONTROL_MAX) {
 		errno = EINVAL;
-		goto end;
+		return false;
 	}
 
 	/* Skip size since our caller got this already */
-	offset += sizeof(uint32_t);
+	*offset += sizeof(uint32_t);
 
 	/* Obtain the message id */
-	msgid = *(uint32_t*)(data+offset);
-	offset += sizeof(uint32_t);
+	*r_msgid = *(uint32_t*)(data + *offset);
+	*offset += sizeof(uint32_t);
 
 	/* Obtain number of parameters */
-	n_params = *(uint32_t*)(data+offset);
-	offset += sizeof(uint32_t);
-	buxton_debug("total params: %d\n", n_params);
+	if (*v2) {
+		if (!get_varint(data, size, offset, &count)) {
+			errno = EINVAL;
+			return false;
+		}
+		*n_params = count;
+	} else {
+		*n_params = *(uint32_t*)(data + *offset);
+		*offset += sizeof(uint32_t);
+	}
+	buxton_debug("total params: %d\n", *n_params);
 
-	if (n_params > BUXTON_MESSAGE_MAX_PARAMS) {
+	if (*n_params > BUXTON_MESSAGE_MAX_PARAMS) {
 		errno = EINVAL;
-		goto end;
+		return false;
 	}
 
-	k_list = malloc0(sizeof(BuxtonData)*n_params);
-	if (n_params && !k_list) {
-		errno = ENOMEM;
-		goto end;
-	}
+	*r_message = message;
+	return true;
+}
+
+/*
+ * Unpack the parameters of a message into k_list. Strings are copied,
+ * or point into data when view is set.
+ */
+static bool deserialize_params(uint8_t *data, size_t size, size_t offset,
+			       size_t n_params, BuxtonData *k_list, bool view)
+{
+	size_t c_param, c_length;
+	BuxtonDataType c_type = 0;
+	BuxtonData c_data;
 
 	memzero(&c_data, sizeof(BuxtonData));
 
@@ -436,7 +767,7 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 		/* Don't read past the end of the buffer */
 		if (offset + sizeof(uint16_t) + sizeof(uint32_t) > size) {
 			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 
 		/* Now unpack type */
@@ -445,14 +776,14 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 
 		if (c_type >= BUXTON_TYPE_MAX || c_type <= BUXTON_TYPE_MIN) {
 			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 
 		/* Retrieve the length of the value */
 		c_length = *(uint32_t*)(data+offset);
 		if (c_length == 0 && c_type != BUXTON_TYPE_STRING) {
 			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 		offset += sizeof(uint32_t);
 		buxton_debug("value length: %lu\n", c_length);
@@ -460,25 +791,28 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 		/* Don't try to read past the end of our buffer */
 		if (offset + c_length > size) {
 			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 
 		switch (c_type) {
 		case BUXTON_TYPE_STRING:
 			if (c_length) {
-				c_data.store.d_string.value = malloc(c_length);
-				if (!c_data.store.d_string.value) {
-					errno = ENOMEM;
-					goto end;
-				}
-				memcpy(c_data.store.d_string.value, data+offset, c_length);
-				c_data.store.d_string.length = (uint32_t)c_length;
-				if (c_data.store.d_string.value[c_length-1] != 0x00) {
+				if (data[offset + c_length - 1] != 0x00) {
 					errno = EINVAL;
 					buxton_debug("buxton_deserialize_message(): Garbage message\n");
-					free(c_data.store.d_string.value);
-					goto end;
+					goto fail;
 				}
+				if (view) {
+					c_data.store.d_string.value = (char *)(data + offset);
+				} else {
+					c_data.store.d_string.value = malloc(c_length);
+					if (!c_data.store.d_string.value) {
+						errno = ENOMEM;
+						goto fail;
+					}
+					memcpy(c_data.store.d_string.value, data+offset, c_length);
+				}
+				c_data.store.d_string.length = (uint32_t)c_length;
 			} else {
 				c_data.store.d_string.value = NULL;
 				c_data.store.d_string.length = 0;
@@ -507,13 +841,153 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 			break;
 		default:
 			errno = EINVAL;
-			goto end;
+			goto fail;
 		}
 		c_data.type = c_type;
 		k_list[c_param] = c_data;
 		memzero(&c_data, sizeof(BuxtonData));
 		offset += c_length;
 	}
+
+	return true;
+
+fail:
+	/* Free the strings copied before the failure */
+	for (size_t i = 0; !view && i < c_param; i++) {
+		if (k_list[i].type == BUXTON_TYPE_STRING) {
+			free(k_list[i].store.d_string.value);
+		}
+	}
+	return false;
+}
+
+/*
+ * Unpack the parameters of a version 2 message into k_list, as
+ * deserialize_params does. Strings given an index point into the table
+ * when view is set; without a table, giving one is an error.
+ */
+static bool deserialize_params_v2(uint8_t *data, size_t size, size_t offset,
+				  size_t n_params, BuxtonData *k_list,
+				  bool view, BuxtonStringTable *table)
+{
+	size_t c_param, width;
+	uint8_t tag;
+	uint32_t length, index;
+	BuxtonDataType c_type;
+	BuxtonString string;
+
+	for (c_param = 0; c_param < n_params; c_param++) {
+		if (offset >= size) {
+			goto fail;
+		}
+		tag = data[offset++];
+		c_type = tag & V2_TYPE_MASK;
+
+		if (c_type != BUXTON_TYPE_STRING) {
+			width = value_width(c_type);
+			if (!width || tag & V2_STRING_MASK ||
+			    offset + width > size) {
+				goto fail;
+			}
+			k_list[c_param].type = c_type;
+			memcpy(&k_list[c_param].store, data+offset, width);
+			offset += width;
+			continue;
+		}
+
+		switch (tag & V2_STRING_MASK) {
+		case V2_STRING_REF:
+			if (!table || !get_varint(data, size, &offset, &index) ||
+			    index >= table->count) {
+				goto fail;
+			}
+			string = table->strings[index];
+			break;
+		case V2_STRING_LITERAL:
+		case V2_STRING_DEFINE:
+			if (!get_varint(data, size, &offset, &length) ||
+			    length > size - offset) {
+				goto fail;
+			}
+			string.value = length ? (char *)(data + offset) : NULL;
+			string.length = length;
+			if (length && data[offset + length - 1] != 0x00) {
+				buxton_debug("buxton_deserialize_message(): Garbage message\n");
+				goto fail;
+			}
+			offset += length;
+			if ((tag & V2_STRING_MASK) == V2_STRING_LITERAL) {
+				break;
+			}
+			if (!table || table->count >= BUXTON_STRING_TABLE_SIZE ||
+			    !string_internable(&string)) {
+				goto fail;
+			}
+			string_table_add(table, &string, false);
+			string = table->strings[table->count - 1];
+			break;
+		default:
+			goto fail;
+		}
+
+		k_list[c_param].type = BUXTON_TYPE_STRING;
+		k_list[c_param].store.d_string = string;
+		if (!view && string.value &&
+		    !buxton_string_copy(&string,
+					&k_list[c_param].store.d_string)) {
+			abort();
+		}
+	}
+
+	return true;
+
+fail:
+	errno = EINVAL;
+	for (size_t i = 0; !view && i < c_param; i++) {
+		if (k_list[i].type == BUXTON_TYPE_STRING) {
+			free(k_list[i].store.d_string.value);
+		}
+	}
+	return false;
+}
+
+ssize_t buxton_deserialize_message(uint8_t *data,
+				  BuxtonControlMessage *r_message,
+				  size_t size, uint32_t *r_msgid,
+				  BuxtonData **list)
+{
+	size_t offset = 0;
+	ssize_t ret = -1;
+	size_t n_params;
+	BuxtonControlMessage message;
+	BuxtonData *k_list = NULL;
+	uint32_t msgid;
+	bool v2;
+
+	assert(data);
+	assert(r_message);
+	assert(list);
+
+	buxton_debug("Deserializing message...\n");
+	buxton_debug("size=%lu\n", size);
+
+	if (!deserialize_header(data, size, &message, &msgid, &n_params,
+				&offset, &v2)) {
+		goto end;
+	}
+
+	k_list = malloc0(sizeof(BuxtonData)*n_params);
+	if (n_params && !k_list) {
+		errno = ENOMEM;
+		goto end;
+	}
+
+	if (v2 ? !deserialize_params_v2(data, size, offset, n_params, k_list,
+					false, NULL) :
+	    !deserialize_params(data, size, offset, n_params, k_list, false)) {
+		goto end;
+	}
+
 	*r_message = message;
 	*r_msgid = msgid;
 	if (n_params == 0) {
@@ -533,6 +1007,88 @@ end:
 	return ret;
 }
 
+ssize_t buxton_deserialize_message_view(uint8_t *data,
+				       BuxtonControlMessage *r_message,
+				       size_t size, uint32_t *r_msgid,
+				       BuxtonData **list, size_t *list_size,
+				       BuxtonStringTable *table)
+{
+	size_t offset = 0;
+	size_t n_params;
+	BuxtonControlMessage message;
+	BuxtonData *k_list;
+	uint32_t msgid;
+	bool v2;
+
+	assert(data);
+	assert(r_message);
+	assert(list);
+	assert(list_size);
+
+	if (!deserialize_header(data, size, &message, &msgid, &n_params,
+				&offset, &v2)) {
+		return -1;
+	}
+
+	/* The list only grows, so a connection settles at no allocation */
+	if (n_params > *list_size) {
+		k_list = realloc(*list, sizeof(BuxtonData) * n_params);
+		if (!k_list) {
+			errno = ENOMEM;
+			return -1;
+		}
+		*list = k_list;
+		*list_size = n_params;
+	}
+
+	if (v2 ? !deserialize_params_v2(data, size, offset, n_params, *list,
+					true, table) :
+	    !deserialize_params(data, size, offset, n_params, *list, true)) {
+		return -1;
+	}
+
+	*r_message = message;
+	*r_msgid = msgid;
+
+	return (ssize_t)n_params;
+}
+
+size_t buxton_transcode_message_v2(uint8_t *data, size_t size,
+				   BuxtonStringTable *table, uint8_t **dest)
+{
+	BuxtonData small[16];
+	_cleanup_free_ BuxtonData *large = NULL;
+	BuxtonData *params = small;
+	BuxtonControlMessage message;
+	size_t offset = 0;
+	size_t n_params;
+	uint32_t msgid;
+	bool v2;
+
+	assert(data);
+	assert(dest);
+
+	if (!deserialize_header(data, size, &message, &msgid, &n_params,
+				&offset, &v2) || v2) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (n_params > sizeof(small) / sizeof(BuxtonData)) {
+		large = malloc(sizeof(BuxtonData) * n_params);
+		if (!large) {
+			abort();
+		}
+		params = large;
+	}
+
+	if (!deserialize_params(data, size, offset, n_params, params, true)) {
+		return 0;
+	}
+
+	return serialize_v2(dest, message, msgid, params, n_params, table);
+}
+
 size_t buxton_get_message_size(uint8_t *data, size_t size)
 {
 	size_t r_size;
@@ -552,6 +1108,23 @@ size_t buxton_get_message_size(uint8_t *data, size_t size)
 	return r_size;
 }
 
+uint8_t *buxton_copy_message(uint8_t *data, size_t size, uint32_t msgid)
+{
+	uint8_t *copy;
+
+	assert(data);
+	assert(size >= BUXTON_MSGID_OFFSET + sizeof(uint32_t));
+
+	copy = malloc(size);
+	if (!copy) {
+		abort();
+	}
+	memcpy(copy, data, size);
+	memcpy(copy + BUXTON_MSGID_OFFSET, &msgid, sizeof(uint32_t));
+
+	return copy;
+}
+
 void include_serialize(void)
 {
 	;
@@ -24,17 +24,60 @@
 
 #include "buxton.h"
 #include "buxtonarray.h"
+#include "buxtonstring.h"
+#include "hashmap.h"
 
 /**
  * Magic for Buxton messages
  */
 #define BUXTON_CONTROL_CODE 0x672
 
+/**
+ * Magic for Buxton messages in the compact encoding of protocol version 2
+ */
+#define BUXTON_CONTROL_CODE_V2 0x673
+
+/**
+ * Highest protocol version spoken, agreed on with BUXTON_CONTROL_HELLO.
+ * Version 2 brought the compact encoding, version 3 the LIST_NAMES
+ * replies streamed in BUXTON_CONTROL_CHUNK messages, version 4 the
+ * BUXTON_CONTROL_OVERFLOW message sent after notifications were dropped.
+ */
+#define BUXTON_PROTOCOL_VERSION 4
+
+/**
+ * Most strings a connection gives an index to in each direction
+ */
+#define BUXTON_STRING_TABLE_SIZE 256
+
+/**
+ * Longest string, with its terminator, given an index
+ */
+#define BUXTON_STRING_TABLE_MAX_LENGTH 64
+
+/**
+ * Strings sent once in full and then by index on a version 2 connection.
+ * Each side keeps one table for what it sends and one for what it
+ * receives, filled in message order, so they always agree. Only the
+ * layer and group names of requests are added, a string already in the
+ * table is sent by index wherever it appears.
+ */
+typedef struct BuxtonStringTable {
+	Hashmap *index; /**<String to its index + 1, only used to encode */
+	BuxtonString *strings; /**<Strings by index */
+	uint32_t count; /**<Number of strings given an index */
+} BuxtonStringTable;
+
 /**
  * Location of size in serialized message data
  */
 #define BUXTON_LENGTH_OFFSET sizeof(uint32_t)
 
+/**
+ * Location of the message ID in serialized message data
+ */
+#define BUXTON_MSGID_OFFSET (BUXTON_LENGTH_OFFSET + sizeof(uint32_t))
+
 /**
  * Minimum size of serialized BuxtonData
  * 2 is the minimum number of characters in a valid SMACK label
@@ -93,8 +136,52 @@ size_t buxton_serialize_message(uint8_t **dest,
 				BuxtonArray *list)
 	__attribute__((warn_unused_result));
 
+/**
+ * Serialize a message in the compact encoding of protocol version 2
+ * @param dest Pointer to store serialized message in
+ * @param message The type of message to be serialized
+ * @param msgid The message ID to be serialized
+ * @param list An array of BuxtonData's to be serialized
+ * @param table Strings given an index on the connection, updated with the
+ * ones this message gives one, or NULL to send every string in full
+ * @return a size_t, 0 indicates failure otherwise size of dest
+ */
+size_t buxton_serialize_message_v2(uint8_t **dest,
+				   BuxtonControlMessage message,
+				   uint32_t msgid, BuxtonArray *list,
+				   BuxtonStringTable *table)
+	__attribute__((warn_unused_result));
+
+/**
+ * Encode a serialized version 1 message again in version 2
+ * @param data The version 1 message
+ * @param size The size of the version 1 message
+ * @param table Strings given an index on the connection, as for
+ * buxton_serialize_message_v2
+ * @param dest Pointer to store the version 2 message in
+ * @return a size_t, 0 indicates failure otherwise size of dest
+ */
+size_t buxton_transcode_message_v2(uint8_t *data, size_t size,
+				   BuxtonStringTable *table, uint8_t **dest)
+	__attribute__((warn_unused_result));
+
+/**
+ * Free the strings of a table, leaving it empty
+ * @param table The table to empty
+ */
+void buxton_string_table_free(BuxtonStringTable *table);
+
+/**
+ * Forget the strings given an index after the first count, as if the
+ * messages that gave them were never sent
+ * @param table The table to shrink
+ * @param count Number of strings to keep
+ */
+void buxton_string_table_truncate(BuxtonStringTable *table, uint32_t count);
+
 /**
  * Deserialize the given data into an array of BuxtonData structs
+ * Version 2 messages are accepted if they give no string an index
  * @param data The source data to be deserialized
  * @param r_message An empty pointer that will be set to the message type
  * @param size The size of the data being deserialized
@@ -108,6 +195,28 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 				  BuxtonData **list)
 	__attribute__((warn_unused_result));
 
+/**
+ * Deserialize the given data like buxton_deserialize_message, without
+ * copying its strings, which point into data instead
+ * @param data The source data to be deserialized, which must outlive the list
+ * @param r_message An empty pointer that will be set to the message type
+ * @param size The size of the data being deserialized
+ * @param r_msgid The message ID being deserialized
+ * @param list A list reused across messages, grown as needed and freed with
+ * free()
+ * @param list_size The number of BuxtonData structs list has room for
+ * @param table Strings the sender gave an index, whose strings are pointed
+ * to as well, or NULL if the connection speaks version 1
+ * @return the number of values set in the list, or -1 if deserialization
+ * failed
+ */
+ssize_t buxton_deserialize_message_view(uint8_t *data,
+				       BuxtonControlMessage *r_message,
+				       size_t size, uint32_t *r_msgid,
+				       BuxtonData **list, size_t *list_size,
+				       BuxtonStringTable *table)
+	__attribute__((warn_unused_result));
+
 /**
  * Get size of a buxton message data stream
  * @param data The source data stream
@@ -117,6 +226,17 @@ ssize_t buxton_deserialize_message(uint8_t *data,
 size_t buxton_get_message_size(uint8_t *data, size_t size)
 	__attribute__((warn_unused_result));
 
+/**
+ * Copy a serialized message under another message ID, which is all
+ * that differs between copies of a message sent to several clients
+ * @param data The serialized message
+ * @param size The size of the serialized message
+ * @param msgid The message ID of the copy
+ * @return a newly allocated copy of the message
+ */
+uint8_t *buxton_copy_message(uint8_t *data, size_t size, uint32_t msgid)
+	__attribute__((warn_unused_result));
+
 void include_serialize(void);
 
 /*
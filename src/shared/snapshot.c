@@ -0,0 +1,983 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "smack.h"
+#include "snapshot.h"
+#include "util.h"
+
+/* Smallest snapshot file, enough for a few hundred short values */
+#define SNAPSHOT_MIN_SIZE 16384
+
+/* Rewrites a reader sits out before asking buxtond instead */
+#define SNAPSHOT_TRIES 16
+
+/* FNV-1a, which readers and buxtond must agree on */
+static uint32_t hash_bytes(uint32_t hash, const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)s[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static uint32_t key_hash(const char *key, size_t len)
+{
+	return hash_bytes(2166136261U, key, len);
+}
+
+/*
+ * Only values every client may read are published: the key and its
+ * group must both carry the floor label, unless Smack is disabled
+ */
+static bool is_public(BuxtonString *label)
+{
+	if (!buxton_smack_enabled()) {
+		return true;
+	}
+	return label && label->value && streq(label->value, "_");
+}
+
+static void free_names(Hashmap *names)
+{
+	BuxtonData *data;
+	Iterator iterator;
+	char *name;
+
+	HASHMAP_FOREACH_KEY(data, name, names, iterator) {
+		hashmap_remove(names, name);
+		data_free(data);
+		free(name);
+	}
+	hashmap_free(names);
+}
+
+static char *group_key(BuxtonLayer *layer, const char *group)
+{
+	char *key;
+
+	if (asprintf(&key, "%s\n%s", layer->name.value, group) == -1) {
+		abort();
+	}
+	return key;
+}
+
+static void drop_group(BuxtonSnapshot *snapshot, BuxtonLayer *layer,
+		       const char *group)
+{
+	_cleanup_free_ char *key = NULL;
+	Hashmap *names;
+	char *old_key;
+
+	key = group_key(layer, group);
+	names = hashmap_get2(snapshot->groups, key, (void **)&old_key);
+	if (!names) {
+		return;
+	}
+
+	hashmap_remove(snapshot->groups, key);
+	snapshot->count -= hashmap_size(names);
+	free_names(names);
+	free(old_key);
+}
+
+static void put_value(BuxtonSnapshot *snapshot, BuxtonLayer *layer,
+		      const char *group, BuxtonString *name, BuxtonData *data)
+{
+	_cleanup_free_ char *key = NULL;
+	BuxtonData *value;
+	Hashmap *names;
+	char *copy;
+
+	key = group_key(layer, group);
+	names = hashmap_get(snapshot->groups, key);
+	if (!names) {
+		names = hashmap_new(string_hash_func, string_compare_func);
+		if (!names) {
+			abort();
+		}
+		if (hashmap_put(snapshot->groups, key, names) != 1) {
+			abort();
+		}
+		key = NULL;
+	}
+
+	value = hashmap_get(names, name->value);
+	if (value) {
+		if (value->type == BUXTON_TYPE_STRING) {
+			free(value->store.d_string.value);
+		}
+	} else {
+		value = malloc0(sizeof(BuxtonData));
+		copy = strdup(name->value);
+		if (!value || !copy) {
+			abort();
+		}
+		if (hashmap_put(names, copy, value) != 1) {
+			abort();
+		}
+		snapshot->count++;
+	}
+
+	if (!buxton_data_copy(data, value)) {
+		abort();
+	}
+}
+
+static void drop_value(BuxtonSnapshot *snapshot, BuxtonLayer *layer,
+		       const char *group, const char *name)
+{
+	_cleanup_free_ char *key = NULL;
+	BuxtonData *value;
+	Hashmap *names;
+	char *old_name;
+
+	key = group_key(layer, group);
+	names = hashmap_get(snapshot->groups, key);
+	if (!names) {
+		return;
+	}
+
+	value = hashmap_get2(names, name, (void **)&old_name);
+	if (!value) {
+		return;
+	}
+	hashmap_remove(names, name);
+	data_free(value);
+	free(old_name);
+	snapshot->count--;
+}
+
+typedef struct GroupScan {
+	BuxtonSnapshot *snapshot;
+	BuxtonLayer *layer;
+	const char *group;
+} GroupScan;
+
+static void add_scanned_value(BuxtonString *name, BuxtonData *data,
+			      BuxtonString *label, void *user_data)
+{
+	GroupScan *scan = user_data;
+
+	if (is_public(label)) {
+		put_value(scan->snapshot, scan->layer, scan->group, name, data);
+	}
+}
+
+static void load_group(BuxtonSnapshot *snapshot, BuxtonConfig *config,
+		       BuxtonLayer *layer, BuxtonString *group)
+{
+	BuxtonBackend *backend;
+	BuxtonData data;
+	BuxtonString label = { NULL, 0 };
+	_BuxtonKey key;
+	GroupScan scan;
+	int ret;
+
+	backend = backend_for_layer(config, layer);
+	assert(backend);
+
+	memzero(&data, sizeof(BuxtonData));
+	memzero(&key, sizeof(_BuxtonKey));
+	key.layer = layer->name;
+	key.group = *group;
+	key.type = BUXTON_TYPE_STRING;
+
+	/* Groups are stored as a value without a name, holding the label */
+	ret = backend->get_value(layer, &key, &data, &label);
+	if (ret) {
+		return;
+	}
+	if (data.type == BUXTON_TYPE_STRING) {
+		free(data.store.d_string.value);
+	}
+	if (!is_public(&label)) {
+		free(label.value);
+		return;
+	}
+	free(label.value);
+
+	scan.snapshot = snapshot;
+	scan.layer = layer;
+	scan.group = group->value;
+	ret = backend->get_group(layer, group, add_scanned_value, &scan);
+	if (ret) {
+		buxton_debug("Unable to read group %s of layer %s: %s\n",
+			     group->value, layer->name.value, strerror(ret));
+	}
+}
+
+static void load_layer(BuxtonSnapshot *snapshot, BuxtonConfig *config,
+		       BuxtonLayer *layer)
+{
+	BuxtonBackend *backend;
+	BuxtonArray *groups = NULL;
+	BuxtonString empty = { NULL, 0 };
+	BuxtonData *group;
+
+	backend = backend_for_layer(config, layer);
+	assert(backend);
+
+	/* An empty group lists the groups of the layer */
+	if (!backend->list_names(layer, &empty, NULL, &groups)) {
+		buxton_log("Unable to list groups of layer %s for the snapshot\n",
+			   layer->name.value);
+		return;
+	}
+
+	for (uint32_t i = 0; i < groups->len; i++) {
+		group = buxton_array_get(groups, i);
+		load_group(snapshot, config, layer, &group->store.d_string);
+	}
+	buxton_array_free(&groups, (buxton_free_func)data_free);
+}
+
+static bool grow(BuxtonSnapshot *snapshot, size_t size)
+{
+	size_t len = snapshot->map_len * 2;
+	uint8_t *map;
+
+	if (len < size) {
+		len = size;
+	}
+	len = (len + SNAPSHOT_MIN_SIZE - 1) & ~(size_t)(SNAPSHOT_MIN_SIZE - 1);
+
+	if (ftruncate(snapshot->fd, (off_t)len) == -1) {
+		buxton_log("Unable to grow snapshot file: %m\n");
+		return false;
+	}
+	map = mremap(snapshot->map, snapshot->map_len, len, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED) {
+		buxton_log("Unable to map grown snapshot file: %m\n");
+		return false;
+	}
+
+	snapshot->map = map;
+	snapshot->map_len = len;
+	return true;
+}
+
+static uint32_t begin_write(BuxtonSnapshotHeader *header)
+{
+	uint32_t seq = (header->seq + 1) | 1;
+
+	__atomic_store_n(&header->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return seq;
+}
+
+static void end_write(BuxtonSnapshotHeader *header, uint32_t seq)
+{
+	__atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Bytes an entry takes in the file, group being "layer\ngroup" */
+static size_t entry_size(const char *group, const char *name,
+			 BuxtonData *data)
+{
+	return ALIGN8(sizeof(BuxtonSnapshotEntry) + strlen(group) + 1 +
+		      strlen(name) + 1 + (data->type == BUXTON_TYPE_STRING ?
+					  data->store.d_string.length :
+					  sizeof(data->store)));
+}
+
+static void write_entry(BuxtonSnapshotEntry *entry, const char *group,
+			const char *name, BuxtonData *data)
+{
+	size_t group_len = strlen(group) + 1;
+	size_t name_len = strlen(name) + 1;
+	uint8_t *bytes = (uint8_t *)(entry + 1);
+
+	/* "layer\ngroup" becomes "layer\0group\0" */
+	memcpy(bytes, group, group_len);
+	*(char *)memchr(bytes, '\n', group_len) = '\0';
+	memcpy(bytes + group_len, name, name_len);
+	entry->key_len = (uint32_t)(group_len + name_len);
+	entry->hash = key_hash((char *)bytes, entry->key_len);
+	entry->type = data->type;
+
+	bytes += entry->key_len;
+	if (data->type == BUXTON_TYPE_STRING) {
+		entry->value_len = data->store.d_string.length;
+		memcpy(bytes, data->store.d_string.value, entry->value_len);
+	} else {
+		entry->value_len = (uint32_t)sizeof(data->store);
+		memcpy(bytes, &data->store, sizeof(data->store));
+	}
+}
+
+static void write_entries(BuxtonSnapshot *snapshot, uint32_t buckets)
+{
+	uint32_t *table = (uint32_t *)(snapshot->map +
+				       sizeof(BuxtonSnapshotHeader));
+	size_t offset = sizeof(BuxtonSnapshotHeader) + ALIGN8(buckets *
+							      sizeof(uint32_t));
+	Iterator group_iterator, name_iterator;
+	BuxtonSnapshotEntry *entry;
+	Hashmap *names;
+	BuxtonData *data;
+	const char *name;
+	const char *group;
+	uint32_t idx;
+
+	memzero(table, buckets * sizeof(uint32_t));
+
+	HASHMAP_FOREACH_KEY(names, group, snapshot->groups, group_iterator) {
+		HASHMAP_FOREACH_KEY(data, name, names, name_iterator) {
+			entry = (BuxtonSnapshotEntry *)(snapshot->map + offset);
+			write_entry(entry, group, name, data);
+
+			idx = entry->hash & (buckets - 1);
+			while (table[idx]) {
+				idx = (idx + 1) & (buckets - 1);
+			}
+			table[idx] = (uint32_t)offset;
+
+			offset += entry_size(group, name, data);
+		}
+	}
+}
+
+/*
+ * Write every held value out to the file. If they do not fit the file
+ * is marked closed, so readers ask buxtond rather than see stale values.
+ */
+static void publish(BuxtonSnapshot *snapshot)
+{
+	BuxtonSnapshotHeader *header;
+	Iterator group_iterator, name_iterator;
+	Hashmap *names;
+	BuxtonData *data;
+	const char *group;
+	const char *name;
+	uint32_t buckets = 16;
+	uint32_t seq;
+	size_t size;
+
+	while (buckets < snapshot->count * 2 && buckets < (1U << 30)) {
+		buckets <<= 1;
+	}
+
+	size = sizeof(BuxtonSnapshotHeader) + ALIGN8(buckets * sizeof(uint32_t));
+	HASHMAP_FOREACH_KEY(names, group, snapshot->groups, group_iterator) {
+		HASHMAP_FOREACH_KEY(data, name, names, name_iterator) {
+			size += entry_size(group, name, data);
+		}
+	}
+
+	header = (BuxtonSnapshotHeader *)snapshot->map;
+	if (size > UINT32_MAX ||
+	    (size > snapshot->map_len && !grow(snapshot, size))) {
+		header = (BuxtonSnapshotHeader *)snapshot->map;
+		seq = begin_write(header);
+		header->closed = 1;
+		end_write(header, seq);
+		return;
+	}
+	header = (BuxtonSnapshotHeader *)snapshot->map;
+
+	seq = begin_write(header);
+	header->magic = BUXTON_SNAPSHOT_MAGIC;
+	header->version = BUXTON_SNAPSHOT_VERSION;
+	header->closed = 0;
+	header->size = (uint32_t)size;
+	header->buckets = buckets;
+	header->count = (uint32_t)snapshot->count;
+	header->pid = (uint32_t)getpid();
+	write_entries(snapshot, buckets);
+	end_write(header, seq);
+	snapshot->dead = 0;
+}
+
+/*
+ * Close the gap left in a probe sequence by moving back the entries
+ * after it that may sit there, so readers need no tombstones
+ */
+static void remove_slot(BuxtonSnapshot *snapshot, uint32_t *table,
+			uint32_t buckets, uint32_t hole)
+{
+	BuxtonSnapshotEntry *entry;
+	uint32_t mask = buckets - 1;
+	uint32_t idx = hole;
+	uint32_t home;
+
+	table[hole] = 0;
+	for (;;) {
+		idx = (idx + 1) & mask;
+		if (!table[idx]) {
+			return;
+		}
+		entry = (BuxtonSnapshotEntry *)(snapshot->map + table[idx]);
+		home = entry->hash & mask;
+		if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+			table[hole] = table[idx];
+			table[idx] = 0;
+			hole = idx;
+		}
+	}
+}
+
+/*
+ * Write a single changed key to the file: its slot is repointed,
+ * cleared, or filled, and a value that no longer fits its entry is
+ * appended after the others. Returns false when the whole file must be
+ * written again instead, because it was closed, the table is getting
+ * full or the space left behind by old entries outgrew the live ones.
+ */
+static bool publish_key(BuxtonSnapshot *snapshot, BuxtonLayer *layer,
+			const char *group, const char *name, BuxtonData *data)
+{
+	_cleanup_free_ char *key = NULL;
+	BuxtonSnapshotHeader *header;
+	BuxtonSnapshotEntry *entry = NULL;
+	uint32_t *table;
+	uint32_t buckets, hash, idx, seq;
+	size_t layer_len, group_len, name_len;
+	size_t old_size = 0, new_size = 0;
+	size_t offset;
+	uint8_t *bytes;
+	bool append;
+
+	header = (BuxtonSnapshotHeader *)snapshot->map;
+	if (header->closed || snapshot->dead > header->size / 2) {
+		return false;
+	}
+
+	layer_len = strlen(layer->name.value) + 1;
+	group_len = strlen(group) + 1;
+	name_len = strlen(name) + 1;
+	hash = hash_bytes(2166136261U, layer->name.value, layer_len);
+	hash = hash_bytes(hash, group, group_len);
+	hash = hash_bytes(hash, name, name_len);
+
+	buckets = header->buckets;
+	table = (uint32_t *)(snapshot->map + sizeof(BuxtonSnapshotHeader));
+	for (idx = hash & (buckets - 1); table[idx];
+	     idx = (idx + 1) & (buckets - 1)) {
+		entry = (BuxtonSnapshotEntry *)(snapshot->map + table[idx]);
+		bytes = (uint8_t *)(entry + 1);
+		if (entry->hash == hash &&
+		    entry->key_len == layer_len + group_len + name_len &&
+		    !memcmp(bytes, layer->name.value, layer_len) &&
+		    !memcmp(bytes + layer_len, group, group_len) &&
+		    !memcmp(bytes + layer_len + group_len, name, name_len)) {
+			break;
+		}
+		entry = NULL;
+	}
+
+	key = group_key(layer, group);
+	if (entry) {
+		old_size = ALIGN8(sizeof(BuxtonSnapshotEntry) +
+				  entry->key_len + entry->value_len);
+	} else if (!data) {
+		return true;
+	} else if ((header->count + 1) * 2 > buckets) {
+		return false;
+	}
+	if (data) {
+		new_size = entry_size(key, name, data);
+	}
+	append = new_size > old_size;
+	offset = append ? header->size : table[idx];
+	if (append) {
+		if (offset + new_size > UINT32_MAX) {
+			return false;
+		}
+		if (offset + new_size > snapshot->map_len &&
+		    !grow(snapshot, offset + new_size)) {
+			return false;
+		}
+		header = (BuxtonSnapshotHeader *)snapshot->map;
+		table = (uint32_t *)(snapshot->map +
+				     sizeof(BuxtonSnapshotHeader));
+	}
+
+	seq = begin_write(header);
+	if (!data) {
+		remove_slot(snapshot, table, buckets, idx);
+		header->count--;
+	} else {
+		write_entry((BuxtonSnapshotEntry *)(snapshot->map + offset),
+			    key, name, data);
+		if (append) {
+			header->size = (uint32_t)(offset + new_size);
+			table[idx] = (uint32_t)offset;
+		}
+		if (!entry) {
+			header->count++;
+		}
+	}
+	end_write(header, seq);
+
+	snapshot->dead += append ? old_size : old_size - new_size;
+	return true;
+}
+
+BuxtonSnapshot *buxton_snapshot_new(BuxtonConfig *config, const char *path)
+{
+	BuxtonSnapshotHeader *header;
+	BuxtonSnapshot *snapshot;
+	struct stat st;
+	uint32_t seq;
+	size_t len;
+	bool wanted = false;
+
+	assert(config);
+	assert(path);
+
+	for (size_t i = 0; i < config->layer_count; i++) {
+		if (config->layer_order[i]->snapshot) {
+			wanted = true;
+		}
+	}
+	if (!wanted) {
+		return NULL;
+	}
+
+	snapshot = malloc0(sizeof(BuxtonSnapshot));
+	if (!snapshot) {
+		abort();
+	}
+	snapshot->fd = -1;
+	snapshot->path = strdup(path);
+	snapshot->groups = hashmap_new(string_hash_func, string_compare_func);
+	if (!snapshot->path || !snapshot->groups) {
+		abort();
+	}
+
+	/*
+	 * An existing file is rewritten in place rather than replaced, so
+	 * clients still mapping it after buxtond was restarted see the
+	 * new values
+	 */
+	snapshot->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (snapshot->fd == -1) {
+		buxton_log("Unable to open snapshot file %s: %m\n", path);
+		goto fail;
+	}
+	if (fchmod(snapshot->fd, 0644) == -1 || fstat(snapshot->fd, &st) == -1) {
+		buxton_log("Unable to set up snapshot file %s: %m\n", path);
+		goto fail;
+	}
+
+	len = (size_t)st.st_size;
+	if (len < SNAPSHOT_MIN_SIZE) {
+		len = SNAPSHOT_MIN_SIZE;
+		if (ftruncate(snapshot->fd, (off_t)len) == -1) {
+			buxton_log("Unable to size snapshot file %s: %m\n", path);
+			goto fail;
+		}
+	}
+	snapshot->map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			     snapshot->fd, 0);
+	if (snapshot->map == MAP_FAILED) {
+		snapshot->map = NULL;
+		buxton_log("Unable to map snapshot file %s: %m\n", path);
+		goto fail;
+	}
+	snapshot->map_len = len;
+
+	/* Readers stop trusting values left by a buxtond that crashed */
+	header = (BuxtonSnapshotHeader *)snapshot->map;
+	if (header->magic == BUXTON_SNAPSHOT_MAGIC && !header->closed) {
+		seq = begin_write(header);
+		header->closed = 1;
+		end_write(header, seq);
+	}
+
+	for (size_t i = 0; i < config->layer_count; i++) {
+		if (config->layer_order[i]->snapshot) {
+			load_layer(snapshot, config, config->layer_order[i]);
+		}
+	}
+	publish(snapshot);
+
+	return snapshot;
+
+fail:
+	buxton_snapshot_free(snapshot);
+	return NULL;
+}
+
+void buxton_snapshot_free(BuxtonSnapshot *snapshot)
+{
+	BuxtonSnapshotHeader *header;
+	Iterator iterator;
+	Hashmap *names;
+	char *key;
+	uint32_t seq;
+
+	if (!snapshot) {
+		return;
+	}
+
+	if (snapshot->map) {
+		header = (BuxtonSnapshotHeader *)snapshot->map;
+		seq = begin_write(header);
+		header->closed = 1;
+		end_write(header, seq);
+		munmap(snapshot->map, snapshot->map_len);
+	}
+	if (snapshot->fd != -1) {
+		close(snapshot->fd);
+	}
+
+	HASHMAP_FOREACH_KEY(names, key, snapshot->groups, iterator) {
+		hashmap_remove(snapshot->groups, key);
+		free_names(names);
+		free(key);
+	}
+	hashmap_free(snapshot->groups);
+	free(snapshot->path);
+	free(snapshot);
+}
+
+void buxton_snapshot_update(BuxtonSnapshot *snapshot, BuxtonLayer *layer,
+			    _BuxtonKey *key, BuxtonData *data,
+			    BuxtonString *label, BuxtonString *group_label)
+{
+	if (!snapshot || !layer->snapshot) {
+		return;
+	}
+
+	assert(key->group.value);
+	assert(key->name.value);
+
+	if (data && is_public(label) && is_public(group_label)) {
+		put_value(snapshot, layer, key->group.value, &key->name, data);
+	} else {
+		drop_value(snapshot, layer, key->group.value, key->name.value);
+		data = NULL;
+	}
+	if (!publish_key(snapshot, layer, key->group.value, key->name.value,
+			 data)) {
+		publish(snapshot);
+	}
+}
+
+void buxton_snapshot_reload_group(BuxtonSnapshot *snapshot,
+				  BuxtonConfig *config, BuxtonLayer *layer,
+				  BuxtonString *group)
+{
+	if (!snapshot || !layer->snapshot) {
+		return;
+	}
+
+	drop_group(snapshot, layer, group->value);
+	load_group(snapshot, config, layer, group);
+	publish(snapshot);
+}
+
+/* A buxtond that died without closing the file publishes nothing */
+static bool publisher_alive(uint32_t pid)
+{
+	return pid && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+/* Read without a syscall where the vDSO provides it */
+static uint64_t coarse_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == -1) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+bool buxton_snapshot_published(const char *path)
+{
+	BuxtonSnapshotHeader header;
+	ssize_t r;
+	int fd;
+
+	assert(path);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return false;
+	}
+	r = pread(fd, &header, sizeof(BuxtonSnapshotHeader), 0);
+	close(fd);
+	if (r != (ssize_t)sizeof(BuxtonSnapshotHeader) ||
+	    header.magic != BUXTON_SNAPSHOT_MAGIC ||
+	    header.version != BUXTON_SNAPSHOT_VERSION || header.closed) {
+		return false;
+	}
+
+	return publisher_alive(header.pid);
+}
+
+bool buxton_snapshot_view_open(BuxtonSnapshotView *view, const char *path)
+{
+	struct stat st;
+
+	assert(view);
+	assert(path);
+
+	view->map = NULL;
+	view->map_len = 0;
+	view->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (view->fd == -1) {
+		return false;
+	}
+
+	if (fstat(view->fd, &st) == -1 ||
+	    (size_t)st.st_size < sizeof(BuxtonSnapshotHeader)) {
+		goto fail;
+	}
+	view->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+			 view->fd, 0);
+	if (view->map == MAP_FAILED) {
+		view->map = NULL;
+		goto fail;
+	}
+	view->map_len = (size_t)st.st_size;
+
+	if (!publisher_alive(((BuxtonSnapshotHeader *)view->map)->pid)) {
+		goto fail;
+	}
+	view->checked = coarse_ms();
+
+	return true;
+
+fail:
+	buxton_snapshot_view_close(view);
+	return false;
+}
+
+void buxton_snapshot_view_close(BuxtonSnapshotView *view)
+{
+	assert(view);
+
+	if (view->map) {
+		munmap(view->map, view->map_len);
+	}
+	if (view->fd != -1) {
+		close(view->fd);
+	}
+	view->map = NULL;
+	view->map_len = 0;
+	view->fd = -1;
+}
+
+/* Map the whole file again once buxtond grew it past our mapping */
+static bool remap(BuxtonSnapshotView *view, size_t size)
+{
+	struct stat st;
+	uint8_t *map;
+
+	if (fstat(view->fd, &st) == -1 || (size_t)st.st_size < size) {
+		return false;
+	}
+	map = mremap(view->map, view->map_len, (size_t)st.st_size,
+		     MREMAP_MAYMOVE);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+
+	view->map = map;
+	view->map_len = (size_t)st.st_size;
+	return true;
+}
+
+static bool key_matches(const uint8_t *bytes, _BuxtonKey *key)
+{
+	BuxtonString *parts[] = { &key->layer, &key->group, &key->name };
+
+	for (size_t i = 0; i < 3; i++) {
+		if (memcmp(bytes, parts[i]->value, parts[i]->length)) {
+			return false;
+		}
+		bytes += parts[i]->length;
+	}
+	return true;
+}
+
+/*
+ * Find a key in a copy of the header that looked consistent. Nothing
+ * read from the file is trusted, since buxtond may be rewriting it.
+ */
+static int find_entry(BuxtonSnapshotView *view, uint32_t size,
+		      uint32_t buckets, uint32_t hash, uint32_t key_len,
+		      _BuxtonKey *key, BuxtonData *data)
+{
+	const uint32_t *table;
+	const BuxtonSnapshotEntry *entry;
+	const uint8_t *bytes;
+	uint32_t offset, idx;
+	size_t table_end;
+
+	if (!buckets || (buckets & (buckets - 1))) {
+		return ESTALE;
+	}
+	table_end = sizeof(BuxtonSnapshotHeader) + (size_t)buckets *
+		sizeof(uint32_t);
+	if (table_end > size) {
+		return ESTALE;
+	}
+	table = (const uint32_t *)(view->map + sizeof(BuxtonSnapshotHeader));
+
+	idx = hash & (buckets - 1);
+	for (uint32_t i = 0; i < buckets; i++, idx = (idx + 1) & (buckets - 1)) {
+		offset = table[idx];
+		if (!offset) {
+			return ENOENT;
+		}
+		if (offset % 8 || offset < table_end ||
+		    (size_t)offset + sizeof(BuxtonSnapshotEntry) > size) {
+			return ESTALE;
+		}
+
+		entry = (const BuxtonSnapshotEntry *)(view->map + offset);
+		if (entry->hash != hash || entry->key_len != key_len) {
+			continue;
+		}
+		bytes = (const uint8_t *)(entry + 1);
+		if ((size_t)offset + sizeof(BuxtonSnapshotEntry) + key_len > size ||
+		    !key_matches(bytes, key)) {
+			continue;
+		}
+
+		/* Found; a different type is for buxtond to refuse */
+		if (entry->type != key->type) {
+			return ENOENT;
+		}
+		bytes += key_len;
+		if ((size_t)offset + sizeof(BuxtonSnapshotEntry) + key_len +
+		    entry->value_len > size) {
+			return ESTALE;
+		}
+
+		data->type = key->type;
+		if (key->type == BUXTON_TYPE_STRING) {
+			if (!entry->value_len) {
+				return ESTALE;
+			}
+			data->store.d_string.value = malloc(entry->value_len);
+			if (!data->store.d_string.value) {
+				abort();
+			}
+			memcpy(data->store.d_string.value, bytes,
+			       entry->value_len);
+			data->store.d_string.value[entry->value_len - 1] = '\0';
+			data->store.d_string.length = entry->value_len;
+		} else {
+			if (entry->value_len != sizeof(data->store)) {
+				return ESTALE;
+			}
+			memcpy(&data->store, bytes, sizeof(data->store));
+		}
+		return 0;
+	}
+
+	return ENOENT;
+}
+
+int buxton_snapshot_lookup(BuxtonSnapshotView *view, _BuxtonKey *key,
+			   BuxtonData *data)
+{
+	BuxtonSnapshotHeader *header;
+	uint32_t seq, size, buckets, hash, key_len;
+	uint32_t h;
+	uint64_t now;
+	int ret;
+
+	assert(view);
+	assert(key);
+	assert(data);
+
+	if (!view->map || !key->layer.value || !key->group.value ||
+	    !key->name.value) {
+		return ESTALE;
+	}
+
+	h = hash_bytes(2166136261U, key->layer.value, key->layer.length);
+	h = hash_bytes(h, key->group.value, key->group.length);
+	hash = hash_bytes(h, key->name.value, key->name.length);
+	key_len = key->layer.length + key->group.length + key->name.length;
+
+	/* Values of a buxtond that crashed are not answered for long */
+	now = coarse_ms();
+	if (now - view->checked >= BUXTON_SNAPSHOT_CHECK_MS) {
+		header = (BuxtonSnapshotHeader *)view->map;
+		if (!publisher_alive(__atomic_load_n(&header->pid,
+						     __ATOMIC_RELAXED))) {
+			return ESTALE;
+		}
+		view->checked = now;
+	}
+
+	for (int tries = 0; tries < SNAPSHOT_TRIES; tries++) {
+		header = (BuxtonSnapshotHeader *)view->map;
+		seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+
+		size = header->size;
+		buckets = header->buckets;
+		if (header->magic != BUXTON_SNAPSHOT_MAGIC ||
+		    header->version != BUXTON_SNAPSHOT_VERSION ||
+		    header->closed) {
+			ret = ESTALE;
+		} else if (size > view->map_len) {
+			if (!remap(view, size)) {
+				return ESTALE;
+			}
+			continue;
+		} else {
+			ret = find_entry(view, size, buckets, hash, key_len, key,
+					 data);
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&header->seq, __ATOMIC_RELAXED) == seq) {
+			return ret;
+		}
+		if (!ret && data->type == BUXTON_TYPE_STRING) {
+			free(data->store.d_string.value);
+			data->store.d_string.value = NULL;
+		}
+	}
+
+	return EAGAIN;
+}
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -0,0 +1,188 @@
+/*
+ * This file is part of buxton.
+ *
+ * Copyright (C) 2014 Intel Corporation
+ *
+ * buxton is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ */
+
+/**
+ * \file snapshot.h Internal header
+ * This file is used internally by buxton to publish the values of
+ * read-mostly layers in a shared file that clients map and read
+ * without asking buxtond
+ * \internal
+ */
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+	#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "backend.h"
+#include "buxton.h"
+#include "hashmap.h"
+
+#define BUXTON_SNAPSHOT_MAGIC 0x50535842
+
+#define BUXTON_SNAPSHOT_VERSION 1
+
+/**
+ * Start of the snapshot file. Readers copy out what they need while
+ * seq is even and unchanged, retrying when buxtond rewrote the file
+ * meanwhile. The bucket table follows the header, then the entries.
+ */
+typedef struct BuxtonSnapshotHeader {
+	uint32_t magic; /**<BUXTON_SNAPSHOT_MAGIC */
+	uint32_t version; /**<BUXTON_SNAPSHOT_VERSION */
+	uint32_t seq; /**<Odd while buxtond rewrites the file */
+	uint32_t closed; /**<Set once buxtond stops updating the file */
+	uint32_t size; /**<Bytes of the file in use */
+	uint32_t buckets; /**<Number of buckets, a power of two */
+	uint32_t count; /**<Number of entries */
+	uint32_t pid; /**<buxtond writing the file, keeps the table 8 byte aligned */
+} BuxtonSnapshotHeader;
+
+/**
+ * A published value, found by linear probing from its hash. The key
+ * bytes follow the entry as "layer\0group\0name\0", then the value.
+ */
+typedef struct BuxtonSnapshotEntry {
+	uint32_t hash; /**<Hash of the key bytes */
+	uint32_t key_len; /**<Length of the key bytes */
+	uint32_t type; /**<BuxtonDataType of the value */
+	uint32_t value_len; /**<Length of the value bytes */
+} BuxtonSnapshotEntry;
+
+/**
+ * The values buxtond publishes, kept by layer and group so they can be
+ * updated as keys change and written out again
+ */
+typedef struct BuxtonSnapshot {
+	char *path; /**<Path of the snapshot file */
+	int fd; /**<Open snapshot file */
+	uint8_t *map; /**<Shared mapping of the file */
+	size_t map_len; /**<Length of the mapping */
+	Hashmap *groups; /**<"layer\ngroup" to a Hashmap of name to value */
+	size_t count; /**<Number of values held */
+	size_t dead; /**<Bytes of the file left behind by replaced entries */
+} BuxtonSnapshot;
+
+/**
+ * Most ms a view goes on trusting the snapshot without checking that
+ * buxtond is still alive
+ */
+#define BUXTON_SNAPSHOT_CHECK_MS 100
+
+/**
+ * A client's read-only mapping of the snapshot file
+ */
+typedef struct BuxtonSnapshotView {
+	int fd; /**<Open snapshot file or -1 */
+	uint8_t *map; /**<Mapping of the file or NULL */
+	size_t map_len; /**<Length of the mapping */
+	uint64_t checked; /**<Coarse time in ms buxtond was last seen alive */
+} BuxtonSnapshotView;
+
+/**
+ * Create the snapshot file and publish the layers configured for it
+ * @param config Configuration holding the layers
+ * @param path Path of the snapshot file
+ * @return a new snapshot, or NULL if no layer is published or the file
+ * could not be created
+ */
+BuxtonSnapshot *buxton_snapshot_new(BuxtonConfig *config, const char *path)
+	__attribute__((warn_unused_result));
+
+/**
+ * Mark the snapshot file closed for readers and free the snapshot. The
+ * file is kept, so a restarted buxtond rewrites it for readers that
+ * still map it.
+ * @param snapshot The snapshot to free, may be NULL
+ */
+void buxton_snapshot_free(BuxtonSnapshot *snapshot);
+
+/**
+ * Publish, or stop publishing, a key after it was set or relabelled
+ * @param snapshot The snapshot to update, may be NULL
+ * @param layer Layer the key was written to
+ * @param key The key
+ * @param data The key's value, or NULL to drop the key
+ * @param label The key's label
+ * @param group_label The label of the key's group
+ */
+void buxton_snapshot_update(BuxtonSnapshot *snapshot, BuxtonLayer *layer,
+			    _BuxtonKey *key, BuxtonData *data,
+			    BuxtonString *label, BuxtonString *group_label);
+
+/**
+ * Read a group of a layer into the snapshot again, after its label
+ * changed or it was created or removed
+ * @param snapshot The snapshot to update, may be NULL
+ * @param config Configuration holding the layer
+ * @param layer Layer of the group
+ * @param group Name of the group
+ */
+void buxton_snapshot_reload_group(BuxtonSnapshot *snapshot,
+				  BuxtonConfig *config, BuxtonLayer *layer,
+				  BuxtonString *group);
+
+/**
+ * Check whether a running buxtond publishes values in the snapshot
+ * file, so writes behind its back would leave them stale
+ * @param path Path of the snapshot file
+ * @return true if the file is open for readers and its writer is alive
+ */
+bool buxton_snapshot_published(const char *path)
+	__attribute__((warn_unused_result));
+
+/**
+ * Open a client view of the snapshot file, failing if the buxtond
+ * that wrote it is gone
+ * @param view The view to open
+ * @param path Path of the snapshot file
+ * @return a boolean value, indicating success of the operation
+ */
+bool buxton_snapshot_view_open(BuxtonSnapshotView *view, const char *path)
+	__attribute__((warn_unused_result));
+
+/**
+ * Close a client view of the snapshot file
+ * @param view The view to close
+ */
+void buxton_snapshot_view_close(BuxtonSnapshotView *view);
+
+/**
+ * Look up a key of a given layer in the snapshot
+ * @param view An open view of the snapshot file
+ * @param key The key to look up, with its layer and expected type
+ * @param data Set to the value on success, strings must be freed
+ * @return 0 if found, ENOENT if the key is not published with that
+ * type, ESTALE if the file was closed, is not valid or buxtond died,
+ * or EAGAIN if it was being rewritten on every try
+ * @note Whether buxtond is alive is checked at most every
+ * BUXTON_SNAPSHOT_CHECK_MS
+ */
+int buxton_snapshot_lookup(BuxtonSnapshotView *view, _BuxtonKey *key,
+			   BuxtonData *data)
+	__attribute__((warn_unused_result));
+
+/*
+ * Editor modelines  -	http://www.wireshark.org/tools/modelines.html
+ *
+ * Local variables:
+ * c-basic-offset: 8
+ * tab-width: 8
+ * indent-tabs-mode: t
+ * End:
+ *
+ * vi: set shiftwidth=8 tabstop=8 noexpandtab:
+ * :indentSize=8:tabSize=8:noTabs=false:
+ */
@@ -270,6 +270,44 @@ void key_free(_BuxtonKey *key)
 	free(key);
 }
 
+static int compare_value(const char *a, const char *b)
+{
+	if (!a || !b) {
+		return a == b ? 0 : (a ? 1 : -1);
+	}
+	return strcmp(a, b);
+}
+
+unsigned key_hash_func(const void *p)
+{
+	const _BuxtonKey *k = p;
+	unsigned hash;
+
+	hash = string_hash_func(k->group.value);
+	hash = hash * 31 + (k->name.value ? string_hash_func(k->name.value) : 0);
+	hash = hash * 31 + (k->layer.value ? string_hash_func(k->layer.value) : 0);
+
+	return hash * 31 + (unsigned)k->type;
+}
+
+int key_compare_func(const void *a, const void *b)
+{
+	const _BuxtonKey *x = a;
+	const _BuxtonKey *y = b;
+	int r;
+
+	if ((r = compare_value(x->group.value, y->group.value))) {
+		return r;
+	}
+	if ((r = compare_value(x->name.value, y->name.value))) {
+		return r;
+	}
+	if ((r = compare_value(x->layer.value, y->layer.value))) {
+		return r;
+	}
+	return x->type == y->type ? 0 : (x->type < y->type ? -1 : 1);
+}
+
 const char* buxton_type_as_string(BuxtonDataType type)
 {
 	switch (type) {
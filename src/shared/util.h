@@ -190,6 +190,21 @@ void string_free(BuxtonString *string);
  */
 void key_free(_BuxtonKey *key);
 
+/**
+ * Hash a _BuxtonKey by its group, name, layer and type
+ * @param p The _BuxtonKey to hash
+ * @return the hash of the key
+ */
+unsigned key_hash_func(const void *p);
+
+/**
+ * Compare two _BuxtonKey by group, name, layer and type, for a Hashmap
+ * @param a The first _BuxtonKey
+ * @param b The second _BuxtonKey
+ * @return 0 if the keys are equal
+ */
+int key_compare_func(const void *a, const void *b);
+
 /**
  * Get the group portion of a buxton key
  * @param key Pointer to _BuxtonKey
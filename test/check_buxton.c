@@ -16,19 +16,24 @@
 #include <check.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "backend.h"
 #include "buxton.h"
 #include "buxtonresponse.h"
+#include "cache.h"
 #include "check_utils.h"
+#include "clientcache.h"
 #include "configurator.h"
 #include "direct.h"
 #include "protocol.h"
 #include "serialize.h"
+#include "snapshot.h"
 #include "util.h"
 
 #ifdef NDEBUG
@@ -46,6 +51,27 @@ START_TEST(buxton_direct_open_check)
 }
 END_TEST
 
+START_TEST(buxton_layer_order_check)
+{
+	BuxtonControl c;
+	BuxtonLayer *prev, *l;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(c.config.layer_count != hashmap_size(c.config.layers),
+		"Layer order doesn't hold every layer.");
+	for (size_t n = 1; n < c.config.layer_count; n++) {
+		prev = c.config.layer_order[n - 1];
+		l = c.config.layer_order[n];
+		fail_if(prev->type == LAYER_USER && l->type == LAYER_SYSTEM,
+			"User layer ordered before a system layer.");
+		fail_if(prev->type == l->type && prev->priority < l->priority,
+			"Layer ordered before a higher priority one.");
+	}
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_direct_init_db_check)
 {
 	BuxtonControl c;
@@ -213,11 +239,48 @@ START_TEST(buxton_direct_get_value_check)
 }
 END_TEST
 
+START_TEST(buxton_direct_get_values_check)
+{
+	BuxtonControl c;
+	BuxtonData results[3];
+	int32_t status[3];
+	_BuxtonKey keys[3];
+
+	keys[0].layer = buxton_string_pack("test-gdbm");
+	keys[0].group = buxton_string_pack("bxt_test_group");
+	keys[0].name = buxton_string_pack("bxt_test_key");
+	keys[0].type = BUXTON_TYPE_STRING;
+	keys[1] = keys[0];
+	keys[1].layer = (BuxtonString){ NULL, 0 };
+	keys[2] = keys[0];
+	keys[2].name = buxton_string_pack("bxt_test_missing_key");
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+
+	c.client.uid = getuid();
+	buxton_direct_get_values(&c, keys, 3, results, status, NULL);
+	fail_if(status[0] != 0 || status[1] != 0,
+		"Retrieving values from buxton gdbm backend failed.");
+	fail_if(status[2] == 0, "Retrieved a missing value.");
+	for (int i = 0; i < 2; i++) {
+		fail_if(results[i].type != BUXTON_TYPE_STRING,
+			"Buxton gdbm backend returned incorrect result type.");
+		fail_if(strcmp(results[i].store.d_string.value, "bxt_test_value2") != 0,
+			"Buxton gdbm returned a different value to that set.");
+		free(results[i].store.d_string.value);
+	}
+	buxton_direct_close(&c);
+}
+END_TEST
+
 START_TEST(buxton_memory_backend_check)
 {
 	BuxtonControl c;
 	BuxtonData data, result;
 	BuxtonString dlabel, glabel;
+	BuxtonArray *list = NULL;
+	BuxtonData *name, *value;
 	_BuxtonKey group;
 	_BuxtonKey key;
 
@@ -255,6 +318,417 @@ START_TEST(buxton_memory_backend_check)
 		"Retrieving value from buxton memory backend directly failed.");
 	fail_if(!streq(result.store.d_string.value, "bxt_test_value"),
 		"Buxton memory returned a different value to that set.");
+	fail_if(buxton_direct_get_group(&c, &group, NULL, &list),
+		"Retrieving group from buxton memory backend directly failed.");
+	fail_if(list->len != 2, "Buxton memory returned wrong group size.");
+	name = buxton_array_get(list, 0);
+	value = buxton_array_get(list, 1);
+	fail_if(!streq(name->store.d_string.value, "bxt_mem_test_key"),
+		"Buxton memory returned a different name in group.");
+	fail_if(!streq(value->store.d_string.value, "bxt_test_value"),
+		"Buxton memory returned a different value in group.");
+	buxton_array_free(&list, (buxton_free_func)data_free);
+	buxton_direct_close(&c);
+}
+END_TEST
+
+START_TEST(buxton_direct_value_cache_check)
+{
+	BuxtonControl c;
+	BuxtonData data, result;
+	BuxtonString dlabel;
+	BuxtonValueCache *cache;
+	BuxtonCacheEntry *entry;
+	_BuxtonKey group;
+	_BuxtonKey key;
+	char name[64];
+
+	group.layer = buxton_string_pack("temp");
+	group.group = buxton_string_pack("bxt_cache_test_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_cache_test_key");
+	key.type = BUXTON_TYPE_INT32;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.cache = buxton_value_cache_new();
+
+	c.client.uid = getuid();
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	data.type = BUXTON_TYPE_INT32;
+	data.store.d_int32 = 1;
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value failed.");
+
+	key.layer = (BuxtonString){ NULL, 0 };
+	for (int i = 0; i < 3; i++) {
+		fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, NULL),
+			"Retrieving cached value failed.");
+		fail_if(result.store.d_int32 != 1,
+			"Cache returned a different value to that set.");
+		free(dlabel.value);
+	}
+	fail_if(c.cache->misses != 1 || c.cache->hits != 2,
+		"Cache wasn't used for repeated gets.");
+
+	key.type = BUXTON_TYPE_STRING;
+	fail_if(!buxton_direct_get_value(&c, &key, &result, &dlabel, NULL),
+		"Cache ignored the requested type.");
+	key.type = BUXTON_TYPE_INT32;
+
+	key.layer = group.layer;
+	data.store.d_int32 = 2;
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Updating value failed.");
+	key.layer = (BuxtonString){ NULL, 0 };
+	fail_if(buxton_direct_get_value(&c, &key, &result, &dlabel, NULL),
+		"Retrieving updated value failed.");
+	fail_if(result.store.d_int32 != 2,
+		"Cache returned a stale value after set.");
+	free(dlabel.value);
+
+	key.layer = group.layer;
+	fail_if(buxton_direct_unset_value(&c, &key, NULL) == false,
+		"Unsetting value failed.");
+	key.layer = (BuxtonString){ NULL, 0 };
+	fail_if(!buxton_direct_get_value(&c, &key, &result, &dlabel, NULL),
+		"Cache returned a value after unset.");
+	fail_if(c.cache->count != 0 || c.cache->bytes != 0,
+		"Cache still counts the unset value.");
+
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group failed.");
+	buxton_direct_close(&c);
+	fail_if(c.cache, "Cache wasn't freed on close.");
+
+	/* Large values empty the cache long before it is full of keys */
+	cache = buxton_value_cache_new();
+	for (int i = 0; i < 128; i++) {
+		entry = malloc0(sizeof(BuxtonCacheEntry));
+		fail_if(!entry, "Failed to allocate cache entry.");
+		entry->data.type = BUXTON_TYPE_STRING;
+		entry->data.store.d_string.length = 64 * 1024;
+		entry->data.store.d_string.value = malloc0(64 * 1024);
+		fail_if(!entry->data.store.d_string.value,
+			"Failed to allocate cached value.");
+		snprintf(name, sizeof(name), "bxt_cache_test_key%d", i);
+		key.name = buxton_string_pack(name);
+		buxton_value_cache_put(cache, &key, entry);
+		fail_if(cache->bytes > BUXTON_VALUE_CACHE_BYTES,
+			"Cache went over its byte budget.");
+	}
+	fail_if(cache->count == 0 || cache->count >= 128,
+		"Cache wasn't emptied for its byte budget.");
+	fail_if(buxton_value_cache_get(cache, &key, 0) != entry,
+		"Cache lost the value just added.");
+	buxton_value_cache_free(cache);
+}
+END_TEST
+
+START_TEST(buxton_direct_snapshot_check)
+{
+	BuxtonControl c;
+	BuxtonData data, result;
+	BuxtonSnapshotView view, dead_view;
+	BuxtonLayer *layer;
+	_BuxtonKey group;
+	_BuxtonKey key;
+	char path[] = "test/buxton-snapshot-check";
+	uint32_t pid;
+	pid_t dead;
+	int fd;
+
+	group.layer = buxton_string_pack("test-memory");
+	group.group = buxton_string_pack("bxt_snapshot_test_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_snapshot_test_key");
+	key.type = BUXTON_TYPE_STRING;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+	fail_if(buxton_snapshot_new(&c.config, path),
+		"Created a snapshot without any published layer.");
+	/* Only this test publishes test-memory, so buxtond doesn't load it */
+	layer = hashmap_get(c.config.layers, "test-memory");
+	fail_if(!layer, "No test-memory layer.");
+	layer->snapshot = true;
+	c.snapshot = buxton_snapshot_new(&c.config, path);
+	fail_if(!c.snapshot, "Failed to create snapshot.");
+	fail_if(!buxton_snapshot_published(path), "Snapshot not published.");
+	fail_if(!buxton_snapshot_view_open(&view, path),
+		"Failed to open snapshot view.");
+
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ENOENT,
+		"Snapshot returned an unset key.");
+
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("bxt_snapshot_value");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value failed.");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result),
+		"Snapshot missed a published key.");
+	fail_if(!streq(result.store.d_string.value, "bxt_snapshot_value"),
+		"Snapshot returned a different value to that set.");
+	free(result.store.d_string.value);
+
+	key.type = BUXTON_TYPE_INT32;
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ENOENT,
+		"Snapshot ignored the requested type.");
+	key.type = BUXTON_TYPE_STRING;
+
+	key.layer = buxton_string_pack("test-gdbm");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ENOENT,
+		"Snapshot returned a key of another layer.");
+	key.layer = group.layer;
+
+	/*
+	 * A new snapshot rewrites the file readers still map, reading
+	 * existing values and growing the file for them
+	 */
+	buxton_snapshot_free(c.snapshot);
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ESTALE,
+		"Snapshot used after it was closed.");
+	fail_if(buxton_snapshot_published(path),
+		"Snapshot published after it was closed.");
+	c.snapshot = buxton_snapshot_new(&c.config, path);
+	fail_if(!c.snapshot, "Failed to create snapshot again.");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result),
+		"Snapshot missed a key after it was created again.");
+	free(result.store.d_string.value);
+	data.type = BUXTON_TYPE_INT32;
+	for (int i = 0; i < 1000; i++) {
+		_cleanup_free_ char *name = NULL;
+
+		fail_if(asprintf(&name, "bxt_snapshot_test_key%d", i) == -1,
+			"Failed to allocate key name.");
+		key.name = buxton_string_pack(name);
+		key.type = BUXTON_TYPE_INT32;
+		data.store.d_int32 = i;
+		fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+			"Setting value failed.");
+		fail_if(buxton_snapshot_lookup(&view, &key, &result),
+			"Snapshot missed a published key.");
+		fail_if(result.store.d_int32 != i,
+			"Snapshot returned a different value to that set.");
+	}
+	/* Removing keys leaves the others reachable through their slots */
+	for (int i = 0; i < 1000; i += 2) {
+		_cleanup_free_ char *name = NULL;
+
+		fail_if(asprintf(&name, "bxt_snapshot_test_key%d", i) == -1,
+			"Failed to allocate key name.");
+		key.name = buxton_string_pack(name);
+		fail_if(buxton_direct_unset_value(&c, &key, NULL) == false,
+			"Unsetting value failed.");
+	}
+	for (int i = 0; i < 1000; i++) {
+		_cleanup_free_ char *name = NULL;
+
+		fail_if(asprintf(&name, "bxt_snapshot_test_key%d", i) == -1,
+			"Failed to allocate key name.");
+		key.name = buxton_string_pack(name);
+		if (i % 2) {
+			fail_if(buxton_snapshot_lookup(&view, &key, &result),
+				"Snapshot lost a key when others were removed.");
+			fail_if(result.store.d_int32 != i,
+				"Snapshot returned a different value to that set.");
+		} else {
+			fail_if(buxton_snapshot_lookup(&view, &key, &result) != ENOENT,
+				"Snapshot returned a removed key.");
+		}
+	}
+
+	/* Values that outgrow their entry are moved, shorter ones are not */
+	key.name = buxton_string_pack("bxt_snapshot_test_key");
+	key.type = BUXTON_TYPE_STRING;
+	fail_if(buxton_snapshot_lookup(&view, &key, &result),
+		"Snapshot missed an existing key.");
+	free(result.store.d_string.value);
+	data.type = BUXTON_TYPE_STRING;
+	data.store.d_string = buxton_string_pack("bxt_snapshot_value_grown_past_its_entry");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value failed.");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result),
+		"Snapshot missed a moved key.");
+	fail_if(!streq(result.store.d_string.value,
+		       "bxt_snapshot_value_grown_past_its_entry"),
+		"Snapshot returned a different value to that set.");
+	free(result.store.d_string.value);
+	data.store.d_string = buxton_string_pack("short");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value failed.");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result),
+		"Snapshot missed a rewritten key.");
+	fail_if(!streq(result.store.d_string.value, "short"),
+		"Snapshot returned a different value to that set.");
+	free(result.store.d_string.value);
+
+	fail_if(buxton_direct_unset_value(&c, &key, NULL) == false,
+		"Unsetting value failed.");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ENOENT,
+		"Snapshot returned a value after unset.");
+
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group failed.");
+	key.name = buxton_string_pack("bxt_snapshot_test_key1");
+	key.type = BUXTON_TYPE_INT32;
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ENOENT,
+		"Snapshot returned a value of a removed group.");
+
+	/* A buxtond that dies without closing the file is noticed */
+	key.name = buxton_string_pack("bxt_snapshot_test_key1");
+	dead = fork();
+	fail_if(dead == -1, "Failed to fork.");
+	if (dead == 0) {
+		_exit(EXIT_SUCCESS);
+	}
+	fail_if(waitpid(dead, NULL, 0) != dead, "Failed to reap child.");
+	pid = (uint32_t)dead;
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	fail_if(fd == -1, "Failed to open snapshot file.");
+	fail_if(pwrite(fd, &pid, sizeof(pid),
+		       offsetof(BuxtonSnapshotHeader, pid)) != sizeof(pid),
+		"Failed to write snapshot pid.");
+	fail_if(buxton_snapshot_published(path),
+		"Snapshot of a dead buxtond published.");
+	fail_if(buxton_snapshot_view_open(&dead_view, path),
+		"Opened snapshot of a dead buxtond.");
+	view.checked -= BUXTON_SNAPSHOT_CHECK_MS;
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ESTALE,
+		"Snapshot of a dead buxtond used.");
+	pid = (uint32_t)getpid();
+	fail_if(pwrite(fd, &pid, sizeof(pid),
+		       offsetof(BuxtonSnapshotHeader, pid)) != sizeof(pid),
+		"Failed to write snapshot pid.");
+	close(fd);
+
+	buxton_direct_close(&c);
+	fail_if(c.snapshot, "Snapshot wasn't freed on close.");
+	fail_if(buxton_snapshot_lookup(&view, &key, &result) != ESTALE,
+		"Snapshot used after it was closed.");
+	buxton_snapshot_view_close(&view);
+	fail_if(unlink(path) == -1, "Snapshot file wasn't kept.");
+}
+END_TEST
+
+START_TEST(buxton_direct_snapshot_write_check)
+{
+	BuxtonControl c, direct;
+	BuxtonLayer *layer;
+	_BuxtonKey group;
+
+	group.layer = buxton_string_pack("test-memory");
+	group.group = buxton_string_pack("bxt_snapshot_write_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	fail_if(buxton_direct_open(&direct) == false,
+		"Direct open failed without daemon.");
+	c.client.uid = getuid();
+	direct.client.uid = getuid();
+	layer = hashmap_get(c.config.layers, "test-memory");
+	fail_if(!layer, "No test-memory layer.");
+	layer->snapshot = true;
+	layer = hashmap_get(direct.config.layers, "test-memory");
+	fail_if(!layer, "No test-memory layer.");
+	layer->snapshot = true;
+
+	/* Stands in for buxtond, publishing where clients look */
+	c.snapshot = buxton_snapshot_new(&c.config, buxton_snapshot_path());
+	fail_if(!c.snapshot, "Failed to create snapshot.");
+	fail_if(buxton_direct_create_group(&direct, &group, NULL),
+		"Wrote directly to a published layer.");
+
+	buxton_snapshot_free(c.snapshot);
+	c.snapshot = NULL;
+	fail_if(!buxton_direct_create_group(&direct, &group, NULL),
+		"Refused a direct write once the layer wasn't published.");
+	fail_if(!buxton_direct_remove_group(&direct, &group, NULL),
+		"Removing group failed.");
+
+	buxton_direct_close(&direct);
+	buxton_direct_close(&c);
+	unlink(buxton_snapshot_path());
+}
+END_TEST
+
+START_TEST(buxton_direct_group_cache_check)
+{
+	BuxtonControl c;
+	BuxtonData data;
+	BuxtonGroupEntry *entry;
+	BuxtonLayer *layer;
+	BuxtonString glabel;
+	_BuxtonKey group;
+	_BuxtonKey key;
+
+	group.layer = buxton_string_pack("temp");
+	group.group = buxton_string_pack("bxt_group_cache_test_group");
+	group.name = (BuxtonString){ NULL, 0 };
+	group.type = BUXTON_TYPE_STRING;
+
+	key.layer = group.layer;
+	key.group = group.group;
+	key.name = buxton_string_pack("bxt_group_cache_test_key");
+	key.type = BUXTON_TYPE_INT32;
+	data.type = BUXTON_TYPE_INT32;
+	data.store.d_int32 = 1;
+
+	fail_if(buxton_direct_open(&c) == false,
+		"Direct open failed without daemon.");
+	c.cache = buxton_value_cache_new();
+	c.client.uid = getuid();
+	layer = hashmap_get(c.config.layers, "temp");
+	fail_if(!layer, "Failed to find temp layer.");
+
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL),
+		"Set value in a missing group.");
+	entry = buxton_group_cache_get(c.cache, layer, group.group.value,
+				       c.client.uid);
+	fail_if(!entry || entry->exists, "Missing group wasn't remembered.");
+
+	fail_if(buxton_direct_create_group(&c, &group, NULL) == false,
+		"Creating group failed.");
+	entry = buxton_group_cache_get(c.cache, layer, group.group.value,
+				       c.client.uid);
+	fail_if(!entry || !entry->exists || !streq(entry->label.value, "_"),
+		"Created group wasn't remembered.");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL) == false,
+		"Setting value in a created group failed.");
+
+	glabel = buxton_string_pack("*");
+	fail_if(buxton_direct_set_label(&c, &group, &glabel) == false,
+		"Setting group label failed.");
+	entry = buxton_group_cache_get(c.cache, layer, group.group.value,
+				       c.client.uid);
+	fail_if(!entry || !streq(entry->label.value, "*"),
+		"Group label wasn't updated.");
+	fail_if(hashmap_get(c.cache->labels, "_"),
+		"Kept a label no group entry uses.");
+
+	fail_if(buxton_direct_remove_group(&c, &group, NULL) == false,
+		"Removing group failed.");
+	entry = buxton_group_cache_get(c.cache, layer, group.group.value,
+				       c.client.uid);
+	fail_if(!entry || entry->exists, "Removed group wasn't remembered.");
+	fail_if(hashmap_size(c.cache->labels) != 0,
+		"Kept the label of a removed group.");
+	fail_if(buxton_direct_set_value(&c, &key, &data, NULL),
+		"Set value in a removed group.");
 	buxton_direct_close(&c);
 }
 END_TEST
@@ -519,7 +993,7 @@ START_TEST(send_message_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to setup callbacks");
 
 	out_list = buxton_array_new();
@@ -534,7 +1008,7 @@ START_TEST(send_message_check)
 			      BUXTON_CONTROL_STATUS, NULL),
 		"Failed to write message 1");
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	buxton_array_free(&out_list, NULL);
 	free(dest);
 	free(list);
@@ -581,7 +1055,7 @@ START_TEST(handle_callback_response_check)
 		"Failed to set socket to non blocking");
 
 	/* done just to create a callback to be used */
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialeze response callbacks");
 	out_list = buxton_array_new();
 	data.type = BUXTON_TYPE_INT32;
@@ -598,7 +1072,7 @@ START_TEST(handle_callback_response_check)
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_SET, NULL),
 		"Failed to send message %d", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, bad1, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, bad1, 1);
 	fail_if(test_data, "Failed to set cb data non notify type");
 
 	test_data = true;
@@ -606,7 +1080,7 @@ START_TEST(handle_callback_response_check)
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_NOTIFY, NULL),
 		"Failed to send message %d", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, bad1, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, bad1, 1);
 	fail_if(test_data, "Failed to set notify bad1 data");
 
 	test_data = true;
@@ -614,7 +1088,7 @@ START_TEST(handle_callback_response_check)
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_NOTIFY, NULL),
 		"Failed to send message %d", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, bad2, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, bad2, 1);
 	fail_if(test_data, "Failed to set notify bad2 data");
 
 	test_data = true;
@@ -622,35 +1096,35 @@ START_TEST(handle_callback_response_check)
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_NOTIFY, NULL),
 		"Failed to send message %d", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, good, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, good, 1);
 	fail_if(!test_data, "Set notify good data");
 
 	/* ensure we run callback on duplicate msgid */
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_NOTIFY, NULL),
 		"Failed to send message %d-2", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, good, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, good, 1);
 	fail_if(test_data, "Failed to set notify duplicate msgid");
 
 	test_data = true;
-	lock_mutex();
-	handle_callback_response(BUXTON_CONTROL_CHANGED, msgid, good, 1);
+	lock_mutex(&client);
+	handle_callback_response(&client, BUXTON_CONTROL_CHANGED, msgid, good, 1);
 	fail_if(test_data, "Failed to set changed data");
-	unlock_mutex();
+	unlock_mutex(&client);
 
 	/* ensure we don't remove callback on changed */
 	test_data = true;
-	lock_mutex();
-	handle_callback_response(BUXTON_CONTROL_CHANGED, msgid, good, 1);
+	lock_mutex(&client);
+	handle_callback_response(&client, BUXTON_CONTROL_CHANGED, msgid, good, 1);
 	fail_if(test_data, "Failed to set changed data");
-	unlock_mutex();
+	unlock_mutex(&client);
 
 	test_data = true;
 	msgid = 6;
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_UNNOTIFY, NULL),
 		"Failed to send message %d", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, bad1, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, bad1, 1);
 	fail_if(test_data, "Failed to set unnotify bad1 data");
 
 	test_data = true;
@@ -658,7 +1132,7 @@ START_TEST(handle_callback_response_check)
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_UNNOTIFY, NULL),
 		"Failed to send message %d", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, bad2, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, bad2, 1);
 	fail_if(test_data, "Failed to set unnotify bad2 data");
 
 	test_data = true;
@@ -666,17 +1140,173 @@ START_TEST(handle_callback_response_check)
 	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
 			      &test_data, msgid, BUXTON_CONTROL_UNNOTIFY, NULL),
 		"Failed to send message %d", msgid);
-	handle_callback_response(BUXTON_CONTROL_STATUS, msgid, good_unnotify, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, good_unnotify, 1);
 	fail_if(!test_data, "Set unnotify good data");
 
 	test_data = true;
 	msgid = 4;
-	lock_mutex();
-	handle_callback_response(BUXTON_CONTROL_CHANGED, msgid, good, 1);
+	lock_mutex(&client);
+	handle_callback_response(&client, BUXTON_CONTROL_CHANGED, msgid, good, 1);
 	fail_if(!test_data, "Didn't remove changed callback");
-	unlock_mutex();
+	unlock_mutex(&client);
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
+	free(dest);
+	close(client.fd);
+	close(server);
+}
+END_TEST
+
+static void prefix_response_cb_test(_BuxtonResponse *response, void *data)
+{
+	int *calls = (int *)data;
+
+	fail_if(response->type != BUXTON_CONTROL_CHANGED,
+		"Got unexpected prefix response type");
+	fail_if(!response->key || !streq(response->key->name.value, "name"),
+		"Failed to get changed key of prefix notification");
+	fail_if(response->data->len != 1,
+		"Failed to strip key from prefix notification");
+	(*calls)++;
+}
+
+START_TEST(handle_prefix_callback_response_check)
+{
+	_BuxtonClient client;
+	int server;
+	int calls = 0;
+	uint32_t msgid = 20;
+	uint8_t dest[1] = { 0 };
+	BuxtonData good[] = {
+		{BUXTON_TYPE_INT32, {.d_int32 = 0}}
+	};
+	BuxtonData good_unnotify[] = {
+		{BUXTON_TYPE_INT32,  {.d_int32 = 0}},
+		{BUXTON_TYPE_UINT32, {.d_uint32 = 20}}
+	};
+	BuxtonData changed[] = {
+		{BUXTON_TYPE_STRING, {.d_string = {0}}},
+		{BUXTON_TYPE_STRING, {.d_string = {0}}},
+		{BUXTON_TYPE_INT32, {.d_int32 = 3}}
+	};
+
+	changed[0].store.d_string = buxton_string_pack("group");
+	changed[1].store.d_string = buxton_string_pack("name");
+	setup_socket_pair(&(client.fd), &server);
+	fail_if(!setup_callbacks(&client),
+		"Failed to initialeze response callbacks");
+
+	fail_if(!send_message(&client, dest, sizeof(dest),
+			      prefix_response_cb_test, &calls, msgid,
+			      BUXTON_CONTROL_NOTIFY_PREFIX, NULL),
+		"Failed to send message %d", msgid);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, good, 1);
+	fail_if(calls != 0, "Ran callback on prefix registration");
+
+	lock_mutex(&client);
+	handle_callback_response(&client, BUXTON_CONTROL_CHANGED, msgid, changed, 3);
+	handle_callback_response(&client, BUXTON_CONTROL_CHANGED, msgid, changed, 1);
+	unlock_mutex(&client);
+	fail_if(calls != 1, "Failed to run prefix callback once");
+
+	fail_if(!send_message(&client, dest, sizeof(dest),
+			      prefix_response_cb_test, &calls, msgid + 1,
+			      BUXTON_CONTROL_UNNOTIFY_PREFIX, NULL),
+		"Failed to send message %d", msgid + 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid + 1,
+				 good_unnotify, 2);
+
+	lock_mutex(&client);
+	handle_callback_response(&client, BUXTON_CONTROL_CHANGED, msgid, changed, 3);
+	unlock_mutex(&client);
+	fail_if(calls != 1, "Ran prefix callback after unregistering");
+
+	cleanup_callbacks(&client);
+	close(client.fd);
+	close(server);
+}
+END_TEST
+
+START_TEST(reap_callbacks_check)
+{
+	_BuxtonClient client;
+	BuxtonArray *out_list = NULL;
+	uint8_t *dest = NULL;
+	int server;
+	size_t size;
+	BuxtonData data;
+	bool first = true;
+	bool second = true;
+	bool third = true;
+	BuxtonData good[] = {
+		{BUXTON_TYPE_INT32, {.d_int32 = 0}}
+	};
+	BuxtonString group = buxton_string_pack("group");
+	BuxtonCachedGroup *cached;
+
+	memzero(&client, sizeof(_BuxtonClient));
+	setup_socket_pair(&(client.fd), &server);
+	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(!setup_callbacks(&client), "Failed to initialize callbacks");
+
+	out_list = buxton_array_new();
+	data.type = BUXTON_TYPE_INT32;
+	data.store.d_int32 = 0;
+	fail_if(!buxton_array_add(out_list, &data),
+		"Failed to add data to array");
+	size = buxton_serialize_message(&dest, BUXTON_CONTROL_STATUS, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+
+	/* Each request keeps the timeout it was sent with */
+	set_callback_timeout(&client, 1);
+	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
+			      &first, 0, BUXTON_CONTROL_STATUS, NULL),
+		"Failed to send first message");
+	set_callback_timeout(&client, 60000);
+	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
+			      &second, 1, BUXTON_CONTROL_STATUS, NULL),
+		"Failed to send second message");
+	set_callback_timeout(&client, 1);
+	fail_if(!send_message(&client, dest, size, handle_response_cb_test,
+			      &third, 2, BUXTON_CONTROL_STATUS, NULL),
+		"Failed to send third message");
+	fail_if(client.callbacks->heap_len != 3, "Failed to track requests");
+
+	usleep(20 * 1000);
+	lock_mutex(&client);
+	reap_callbacks(&client);
+	fail_if(client.callbacks->heap_len != 1,
+		"Failed to reap only timed out requests");
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, 0, good, 1);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, 2, good, 1);
+	fail_if(!first || !third, "Ran the callback of a timed out request");
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, 1, good, 1);
+	fail_if(second, "Failed to run the callback of a waiting request");
+	fail_if(client.callbacks->heap_len != 0,
+		"Failed to forget an answered request");
+	unlock_mutex(&client);
+
+	/* A cache registration that times out leaves its group uncached */
+	client.cache = buxton_client_cache_new(16, 4096);
+	fail_if(!client.cache, "Failed to create client cache");
+	set_callback_timeout(&client, 1);
+	fail_if(!buxton_wire_watch_group(&client, &group),
+		"Failed to send group registration");
+	cached = hashmap_get(client.cache->groups, "group");
+	fail_if(!cached || cached->state != BUXTON_WATCH_PENDING,
+		"Failed to record the group registration");
+	usleep(20 * 1000);
+	lock_mutex(&client);
+	reap_callbacks(&client);
+	unlock_mutex(&client);
+	fail_if(cached->state != BUXTON_WATCH_FAILED,
+		"Left a timed out group registration pending");
+	buxton_client_cache_free(client.cache);
+
+	cleanup_callbacks(&client);
+	buxton_array_free(&out_list, NULL);
 	free(dest);
 	close(client.fd);
 	close(server);
@@ -700,7 +1330,7 @@ START_TEST(buxton_wire_handle_response_check)
 		"Failed to set socket to non blocking");
 
 	/* done just to create a callback to be used */
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialeze get response callbacks");
 	out_list = buxton_array_new();
 	data.type = BUXTON_TYPE_INT32;
@@ -724,7 +1354,7 @@ START_TEST(buxton_wire_handle_response_check)
 		"Failed to handle response correctly");
 	fail_if(test_data, "Failed to update data");
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	free(dest);
 	close(client.fd);
 	close(server);
@@ -741,6 +1371,7 @@ START_TEST(buxton_wire_get_response_check)
 	BuxtonData data;
 	bool test_data = true;
 
+	memzero(&client, sizeof(_BuxtonClient));
 	setup_socket_pair(&(client.fd), &server);
 	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -748,7 +1379,7 @@ START_TEST(buxton_wire_get_response_check)
 		"Failed to set socket to non blocking");
 
 	/* done just to create a callback to be used */
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialeze callbacks");
 	out_list = buxton_array_new();
 	data.type = BUXTON_TYPE_INT32;
@@ -772,7 +1403,7 @@ START_TEST(buxton_wire_get_response_check)
 		"Failed to handle response correctly");
 	fail_if(test_data, "Failed to update data");
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	free(dest);
 	close(client.fd);
 	close(server);
@@ -797,7 +1428,7 @@ START_TEST(buxton_wire_set_value_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialeze callbacks");
 
 	key.layer = buxton_string_pack("layer");
@@ -833,7 +1464,7 @@ START_TEST(buxton_wire_set_value_check)
 	free(list[2].store.d_string.value);
 	free(list[3].store.d_string.value);
 	free(list);
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	close(client.fd);
 	close(server);
 }
@@ -859,7 +1490,7 @@ START_TEST(buxton_wire_set_label_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialize callbacks");
 
 	/* first, set a label on a group */
@@ -926,7 +1557,7 @@ START_TEST(buxton_wire_set_label_check)
 	free(list[3].store.d_string.value);
 	free(list);
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	close(client.fd);
 	close(server);
 }
@@ -950,7 +1581,7 @@ START_TEST(buxton_wire_get_value_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialeze callbacks");
 
 	key.layer = buxton_string_pack("layer");
@@ -1010,7 +1641,222 @@ START_TEST(buxton_wire_get_value_check)
 	free(list[1].store.d_string.value);
 	free(list);
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
+	close(client.fd);
+	close(server);
+}
+END_TEST
+
+START_TEST(buxton_wire_register_key_check)
+{
+	_BuxtonClient client;
+	int server;
+	ssize_t size;
+	BuxtonData *list = NULL;
+	uint8_t buf[4096];
+	ssize_t r;
+	_BuxtonKey key;
+	BuxtonControlMessage msg;
+	uint32_t msgid;
+	BuxtonData reply[] = {
+		{BUXTON_TYPE_INT32,  {.d_int32 = 0}},
+		{BUXTON_TYPE_UINT32, {.d_uint32 = 5}}
+	};
+
+	setup_socket_pair(&(client.fd), &server);
+	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	fail_if(!setup_callbacks(&client),
+		"Failed to initialeze callbacks");
+
+	key.layer = buxton_string_pack("layer");
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("name");
+	key.type = BUXTON_TYPE_STRING;
+	fail_if(buxton_wire_register_key(&client, &key, NULL, NULL) != true,
+		"Failed to properly register key");
+
+	r = read(server, buf, 4096);
+	fail_if(r < 0, "Read from client failed 1");
+	size = buxton_deserialize_message(buf, &msg, (size_t)r, &msgid, &list);
+	fail_if(size != 4, "Failed to get valid message from buffer 1");
+	fail_if(msg != BUXTON_CONTROL_REGISTER_KEY,
+		"Failed to get correct control type 1");
+	fail_if(!streq(list[0].store.d_string.value, "layer"),
+		"Failed to set correct layer 1");
+	fail_if(list[3].store.d_uint32 != BUXTON_TYPE_STRING,
+		"Failed to set correct type 1");
+	free(list[0].store.d_string.value);
+	free(list[1].store.d_string.value);
+	free(list[2].store.d_string.value);
+	free(list);
+
+	/* Once buxtond gives the handle, the key is sent by handle */
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, reply,
+				 2);
+	fail_if(buxton_wire_get_value(&client, &key, NULL, NULL) != true,
+		"Failed to properly get value by handle");
+
+	r = read(server, buf, 4096);
+	fail_if(r < 0, "Read from client failed 2");
+	size = buxton_deserialize_message(buf, &msg, (size_t)r, &msgid, &list);
+	fail_if(size != 1, "Failed to get valid message from buffer 2");
+	fail_if(msg != BUXTON_CONTROL_GET_HANDLE,
+		"Failed to get correct control type 2");
+	fail_if(list[0].type != BUXTON_TYPE_UINT32 ||
+		list[0].store.d_uint32 != 5, "Failed to send key handle 2");
+	free(list);
+
+	fail_if(buxton_wire_set_value(&client, &key, "value", NULL,
+				      NULL) != true,
+		"Failed to properly set value by handle");
+
+	r = read(server, buf, 4096);
+	fail_if(r < 0, "Read from client failed 3");
+	size = buxton_deserialize_message(buf, &msg, (size_t)r, &msgid, &list);
+	fail_if(size != 2, "Failed to get valid message from buffer 3");
+	fail_if(msg != BUXTON_CONTROL_SET_HANDLE,
+		"Failed to get correct control type 3");
+	fail_if(list[0].store.d_uint32 != 5, "Failed to send key handle 3");
+	fail_if(list[1].type != BUXTON_TYPE_STRING ||
+		!streq(list[1].store.d_string.value, "value"),
+		"Failed to send value by handle 3");
+	free(list[1].store.d_string.value);
+	free(list);
+
+	/* Keys in another layer were not registered */
+	key.layer.value = NULL;
+	fail_if(buxton_wire_get_value(&client, &key, NULL, NULL) != true,
+		"Failed to properly get value 4");
+
+	r = read(server, buf, 4096);
+	fail_if(r < 0, "Read from client failed 4");
+	size = buxton_deserialize_message(buf, &msg, (size_t)r, &msgid, &list);
+	fail_if(size != 3, "Failed to get valid message from buffer 4");
+	fail_if(msg != BUXTON_CONTROL_GET,
+		"Failed to get correct control type 4");
+	free(list[0].store.d_string.value);
+	free(list[1].store.d_string.value);
+	free(list);
+
+	cleanup_callbacks(&client);
+	close(client.fd);
+	close(server);
+}
+END_TEST
+
+struct list_names_test {
+	int calls;
+	BuxtonControlMessage type;
+	int32_t status;
+	uint32_t count;
+	char names[16];
+};
+static void list_names_cb_test(BuxtonResponse response, void *data)
+{
+	struct list_names_test *t = data;
+	char *name;
+
+	t->calls++;
+	t->type = buxton_response_type(response);
+	t->status = buxton_response_status(response);
+	t->count = buxton_response_list_names_count(response);
+	for (uint32_t i = 0; i < t->count; i++) {
+		name = buxton_response_list_names_item(response, i);
+		fail_if(!name, "Failed to get listed name");
+		strncat(t->names, name, sizeof(t->names) - strlen(t->names) - 1);
+		free(name);
+	}
+}
+START_TEST(buxton_wire_list_names_check)
+{
+	_BuxtonClient client;
+	int server;
+	uint8_t buf[4096];
+	uint32_t msgid;
+	BuxtonString layer, group, prefix;
+	struct list_names_test t;
+	BuxtonData chunk[] = {
+		{BUXTON_TYPE_INT32,  {.d_int32 = 0}},
+		{BUXTON_TYPE_STRING, {.d_string = {"a", 2}}},
+		{BUXTON_TYPE_STRING, {.d_string = {"b", 2}}}
+	};
+	BuxtonData last[] = {
+		{BUXTON_TYPE_INT32,  {.d_int32 = 0}},
+		{BUXTON_TYPE_STRING, {.d_string = {"c", 2}}}
+	};
+	BuxtonData failed[] = {
+		{BUXTON_TYPE_INT32,  {.d_int32 = -1}}
+	};
+
+	setup_socket_pair(&(client.fd), &server);
+	fail_if(fcntl(client.fd, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	fail_if(!setup_callbacks(&client),
+		"Failed to initialeze callbacks");
+
+	layer = buxton_string_pack("layer");
+	group = buxton_string_pack("group");
+	prefix = (BuxtonString){ NULL, 0 };
+
+	/* Chunks are kept until the final status gives every name */
+	memzero(&t, sizeof(t));
+	fail_if(!buxton_wire_list_names(&client, &layer, &group, &prefix,
+					false, list_names_cb_test, &t, &msgid),
+		"Failed to send list names 1");
+	fail_if(read(server, buf, 4096) <= 0, "Read from client failed 1");
+	handle_callback_response(&client, BUXTON_CONTROL_CHUNK, msgid, chunk,
+				 3);
+	fail_if(t.calls != 0, "Callback run for a chunk 1");
+	fail_if(!buxton_wire_waiting(&client, msgid),
+		"Stopped waiting after a chunk 1");
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, last,
+				 2);
+	fail_if(t.calls != 1 || t.type != BUXTON_CONTROL_LIST_NAMES ||
+		t.status != 0, "Failed to run callback once 1");
+	fail_if(t.count != 3 || !streq(t.names, "abc"),
+		"Failed to concatenate chunks 1");
+	fail_if(buxton_wire_waiting(&client, msgid),
+		"Still waiting after the final status 1");
+
+	/* A failed list drops the names of its chunks */
+	memzero(&t, sizeof(t));
+	fail_if(!buxton_wire_list_names(&client, &layer, &group, &prefix,
+					false, list_names_cb_test, &t, &msgid),
+		"Failed to send list names 2");
+	fail_if(read(server, buf, 4096) <= 0, "Read from client failed 2");
+	handle_callback_response(&client, BUXTON_CONTROL_CHUNK, msgid, chunk,
+				 3);
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, failed,
+				 1);
+	fail_if(t.calls != 1 || t.status != -1 || t.count != 0,
+		"Failed to report a failed list 2");
+
+	/* Streamed lists run the callback for each chunk */
+	memzero(&t, sizeof(t));
+	fail_if(!buxton_wire_list_names(&client, &layer, &group, &prefix,
+					true, list_names_cb_test, &t, &msgid),
+		"Failed to send list names 3");
+	fail_if(read(server, buf, 4096) <= 0, "Read from client failed 3");
+	handle_callback_response(&client, BUXTON_CONTROL_CHUNK, msgid, chunk,
+				 3);
+	fail_if(t.calls != 1 || t.type != BUXTON_CONTROL_CHUNK ||
+		t.count != 2, "Failed to run callback for a chunk 3");
+	handle_callback_response(&client, BUXTON_CONTROL_STATUS, msgid, last,
+				 2);
+	fail_if(t.calls != 2 || t.type != BUXTON_CONTROL_LIST_NAMES ||
+		t.count != 1 || !streq(t.names, "abc"),
+		"Failed to run callback for the final status 3");
+	fail_if(buxton_wire_waiting(&client, msgid),
+		"Still waiting after the final status 3");
+
+	cleanup_callbacks(&client);
 	close(client.fd);
 	close(server);
 }
@@ -1035,7 +1881,7 @@ START_TEST(buxton_wire_get_label_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialize callbacks");
 
 	/* first, get a label on a group */
@@ -1092,7 +1938,7 @@ START_TEST(buxton_wire_get_label_check)
 	free(list[2].store.d_string.value);
 	free(list);
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	close(client.fd);
 	close(server);
 }
@@ -1116,7 +1962,7 @@ START_TEST(buxton_wire_unset_value_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialeze callbacks");
 
 	key.layer = buxton_string_pack("layer");
@@ -1151,7 +1997,7 @@ START_TEST(buxton_wire_unset_value_check)
 	free(list[2].store.d_string.value);
 	free(list);
 
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	close(client.fd);
 	close(server);
 }
@@ -1176,7 +2022,7 @@ START_TEST(buxton_wire_create_group_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialize callbacks");
 
 	key.layer = buxton_string_pack("layer");
@@ -1202,7 +2048,7 @@ START_TEST(buxton_wire_create_group_check)
 	free(list[0].store.d_string.value);
 	free(list[1].store.d_string.value);
 	free(list);
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	close(client.fd);
 	close(server);
 }
@@ -1227,7 +2073,7 @@ START_TEST(buxton_wire_remove_group_check)
 	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
 
-	fail_if(!setup_callbacks(),
+	fail_if(!setup_callbacks(&client),
 		"Failed to initialize callbacks");
 
 	key.layer = buxton_string_pack("layer");
@@ -1253,7 +2099,7 @@ START_TEST(buxton_wire_remove_group_check)
 	free(list[0].store.d_string.value);
 	free(list[1].store.d_string.value);
 	free(list);
-	cleanup_callbacks();
+	cleanup_callbacks(&client);
 	close(client.fd);
 	close(server);
 }
@@ -1270,12 +2116,18 @@ buxton_suite(void)
 	tc = tcase_create("buxton_client_lib_functions");
 	tcase_add_test(tc, buxton_direct_init_db_check);
 	tcase_add_test(tc, buxton_direct_open_check);
+	tcase_add_test(tc, buxton_layer_order_check);
 	tcase_add_test(tc, buxton_direct_create_group_check);
 	tcase_add_test(tc, buxton_direct_remove_group_check);
 	tcase_add_test(tc, buxton_direct_set_value_check);
 	tcase_add_test(tc, buxton_direct_get_value_for_layer_check);
 	tcase_add_test(tc, buxton_direct_get_value_check);
+	tcase_add_test(tc, buxton_direct_get_values_check);
 	tcase_add_test(tc, buxton_memory_backend_check);
+	tcase_add_test(tc, buxton_direct_value_cache_check);
+	tcase_add_test(tc, buxton_direct_group_cache_check);
+	tcase_add_test(tc, buxton_direct_snapshot_check);
+	tcase_add_test(tc, buxton_direct_snapshot_write_check);
 	tcase_add_test(tc, buxton_key_check);
 	tcase_add_test(tc, buxton_set_label_check);
 	tcase_add_test(tc, buxton_group_label_check);
@@ -1285,12 +2137,16 @@ buxton_suite(void)
 	tc = tcase_create("buxton_protocol_functions");
 	tcase_add_test(tc, run_callback_check);
 	tcase_add_test(tc, handle_callback_response_check);
+	tcase_add_test(tc, handle_prefix_callback_response_check);
+	tcase_add_test(tc, reap_callbacks_check);
 	tcase_add_test(tc, send_message_check);
 	tcase_add_test(tc, buxton_wire_handle_response_check);
 	tcase_add_test(tc, buxton_wire_get_response_check);
 	tcase_add_test(tc, buxton_wire_set_value_check);
 	tcase_add_test(tc, buxton_wire_set_label_check);
 	tcase_add_test(tc, buxton_wire_get_value_check);
+	tcase_add_test(tc, buxton_wire_register_key_check);
+	tcase_add_test(tc, buxton_wire_list_names_check);
 	tcase_add_test(tc, buxton_wire_get_label_check);
 	tcase_add_test(tc, buxton_wire_unset_value_check);
 	tcase_add_test(tc, buxton_wire_create_group_check);
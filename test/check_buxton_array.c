@@ -78,7 +78,7 @@ START_TEST(buxton_array_add_check)
 		"Failed to update array->len with the size of the array");
 	fail_if(*((int *)array->data[0]) != 1,
 		"Failed to store correct data value to array");
-	array->len = (uint16_t)(0 - 1);
+	array->len = UINT32_MAX;
 	fail_if(buxton_array_add(array, &data1),
 		"Able to add more than max number of elements");
 	array->len = 1;
@@ -153,7 +153,7 @@ START_TEST(buxton_array_check)
 
 	f = buxton_array_get(NULL, 0);
 	fail_if(f, "Got value from NULL array");
-	f = buxton_array_get(array, (uint16_t)(array->len + 1));
+	f = buxton_array_get(array, array->len + 1);
 	fail_if(f, "Got value from index bigger than maximum index");
 	value = (char *)buxton_array_get(array, 0);
 
@@ -14,6 +14,7 @@
 #endif
 
 #include <check.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -370,6 +371,143 @@ START_TEST (sbuxton_remove_group_check)
 }
 END_TEST
 
+static int count_fds(void)
+{
+	DIR *dir;
+	int count = 0;
+
+	dir = opendir("/proc/self/fd");
+	fail_if(!dir, "Unable to list file descriptors");
+	while (readdir(dir)) {
+		count++;
+	}
+	closedir(dir);
+
+	return count;
+}
+
+START_TEST (sbuxton_persistent_connection_check)
+{
+	int fds;
+	errno = 0;
+	sbuxton_set_group("tg_s0", "user");
+	fail_if(errno == ENOTCONN, "Connection failed");
+	fds = count_fds();
+	errno = 0;
+	sbuxton_set_int32("int32key", 11);
+	fail_if(errno == EACCES, "Set int32 failed");
+	for (int i = 0; i < 8; i++) {
+		fail_if(sbuxton_get_int32("int32key") != 11,
+			"Get int32 returned wrong value");
+		fail_if(errno == EACCES, "Get int32 failed");
+	}
+	fail_if(count_fds() != fds, "Connection not kept across calls");
+	sbuxton_close();
+	fail_if(count_fds() != fds - 1, "Connection not closed");
+	fail_if(sbuxton_get_int32("int32key") != 11,
+		"Get int32 after close returned wrong value");
+	fail_if(count_fds() != fds, "Connection not reopened");
+}
+END_TEST
+
+START_TEST (client_key_check)
+{
+	BuxtonKey key;
+	fail_if(!_client_connection(), "Client connection failed- returned 0");
+	key = _client_key("tg_s0", "int32key", "user", BUXTON_TYPE_INT32);
+	fail_if(!key, "Failed to get interned key");
+	fail_if(_client_key("tg_s0", "int32key", "user", BUXTON_TYPE_INT32) != key,
+		"Key created again");
+	fail_if(_client_key("tg_s0", "int32key", "user", BUXTON_TYPE_UINT32) == key,
+		"Key shared across types");
+	fail_if(_client_key("tg_s0", "int32key", NULL, BUXTON_TYPE_INT32) == key,
+		"Key shared across layers");
+	fail_if(_client_key("tg_s0", NULL, "user", BUXTON_TYPE_STRING) == NULL,
+		"Failed to get interned group");
+	_client_disconnect();
+	fail_if(client != NULL, "could not close client connection");
+}
+END_TEST
+
+START_TEST (sbuxton_fork_check)
+{
+	pid_t pid;
+	int status;
+	errno = 0;
+	sbuxton_set_group("tg_s0", "user");
+	fail_if(errno == ENOTCONN, "Connection failed");
+	sbuxton_set_int32("int32key", 12);
+	fail_if(sbuxton_get_int32("int32key") != 12,
+		"Get int32 returned wrong value");
+
+	pid = fork();
+	fail_if(pid < 0, "couldn't fork");
+	if (!pid) {
+		/* The child's replies must not be read by the parent */
+		errno = 0;
+		sbuxton_set_int32("int32key", 13);
+		if (errno || sbuxton_get_int32("int32key") != 13 || errno) {
+			_exit(EXIT_FAILURE);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	fail_if(waitpid(pid, &status, 0) != pid, "waitpid error");
+	fail_if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS,
+		"Child failed to use its own connection");
+	errno = 0;
+	fail_if(sbuxton_get_int32("int32key") != 13,
+		"Parent connection broken by child");
+	fail_if(errno == EACCES, "Get int32 failed");
+}
+END_TEST
+
+START_TEST (sbuxton_enable_cache_check)
+{
+	errno = 0;
+	sbuxton_enable_cache(0, 4096);
+	fail_if(errno != EINVAL, "Enabled cache without values");
+	errno = 0;
+	sbuxton_enable_cache(64, 4096);
+	fail_if(errno, "Failed to enable cache");
+	sbuxton_set_group("tg_s0", "user");
+	fail_if(errno == ENOTCONN, "Connection failed");
+	errno = 0;
+	sbuxton_set_int32("int32key", 14);
+	fail_if(errno == EACCES, "Set int32 failed");
+	fail_if(sbuxton_get_int32("int32key") != 14,
+		"Get int32 returned wrong value");
+	fail_if(sbuxton_get_int32("int32key") != 14,
+		"Cached get int32 returned wrong value");
+	errno = 0;
+	sbuxton_set_int32("int32key", 15);
+	fail_if(errno == EACCES, "Set int32 failed");
+	fail_if(sbuxton_get_int32("int32key") != 15,
+		"Get int32 returned stale value");
+	fail_if(errno == EACCES, "Get int32 failed");
+}
+END_TEST
+
+START_TEST (client_cache_check)
+{
+	BuxtonKey key;
+	vstatus ret;
+	uint64_t hits, misses;
+	fail_if(_client_cache(64, 4096), "Failed to enable cache");
+	fail_if(!_client_connection(), "Client connection failed- returned 0");
+	key = _client_key("tg_s0", "int32key", "user", BUXTON_TYPE_INT32);
+	fail_if(!key, "Failed to get interned key");
+	for (int i = 0; i < 2; i++) {
+		ret.type = BUXTON_TYPE_INT32;
+		fail_if(buxton_get_value(client, key, _bg_cb, &ret, true),
+			"Get int32 call failed");
+		fail_if(!ret.status, "Get int32 failed");
+	}
+	buxton_get_cache_stats(client, &hits, &misses);
+	fail_if(hits != 1 || misses != 1, "Second get not served from cache");
+	_client_disconnect();
+}
+END_TEST
+
 /* Start buxtonsimple-internal tests */
 START_TEST (client_connection_check)
 {
@@ -512,6 +650,11 @@ buxtonsimp_suite(void)
 	tcase_add_test(tc, sbuxton_get_double_check);
 	tcase_add_test(tc, sbuxton_set_bool_check);
 	tcase_add_test(tc, sbuxton_get_bool_check);
+	tcase_add_test(tc, sbuxton_persistent_connection_check);
+	tcase_add_test(tc, sbuxton_fork_check);
+	tcase_add_test(tc, sbuxton_enable_cache_check);
+	tcase_add_test(tc, client_key_check);
+	tcase_add_test(tc, client_cache_check);
 	tcase_add_test(tc, sbuxton_remove_group_check);
 	suite_add_tcase(s, tc);
 
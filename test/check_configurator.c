@@ -86,6 +86,20 @@ START_TEST(configurator_default_buxton_socket)
 }
 END_TEST
 
+START_TEST(configurator_default_client_queue)
+{
+	default_test(buxton_client_queue_limit(), "262144", "buxton_client_queue_limit()");
+	default_test(buxton_client_queue_policy(), "drop", "buxton_client_queue_policy()");
+}
+END_TEST
+
+START_TEST(configurator_default_snapshot_path)
+{
+	default_test(buxton_snapshot_path(), (char*)_BUXTON_SOCKET ".snapshot",
+		     "buxton_snapshot_path()");
+}
+END_TEST
+
 
 START_TEST(configurator_env_conf_file)
 {
@@ -122,6 +136,22 @@ START_TEST(configurator_env_buxton_socket)
 }
 END_TEST
 
+START_TEST(configurator_env_client_queue)
+{
+	putenv("BUXTON_CLIENT_QUEUE_LIMIT=4096");
+	putenv("BUXTON_CLIENT_QUEUE_POLICY=disconnect");
+	default_test(buxton_client_queue_limit(), "4096", "buxton_client_queue_limit()");
+	default_test(buxton_client_queue_policy(), "disconnect", "buxton_client_queue_policy()");
+}
+END_TEST
+
+START_TEST(configurator_env_snapshot_path)
+{
+	putenv("BUXTON_SNAPSHOT_PATH=/nonexistant/buxton_snapshot");
+	default_test(buxton_snapshot_path(), "/nonexistant/buxton_snapshot", "buxton_snapshot_path()");
+}
+END_TEST
+
 
 START_TEST(configurator_cmd_conf_file)
 {
@@ -201,6 +231,21 @@ START_TEST(configurator_conf_buxton_socket)
 }
 END_TEST
 
+START_TEST(configurator_conf_client_queue)
+{
+	putenv("BUXTON_CONF_FILE=" ABS_TOP_SRCDIR "/test/test-configurator.conf");
+	default_test(buxton_client_queue_limit(), "1024", "buxton_client_queue_limit()");
+	default_test(buxton_client_queue_policy(), "disconnect", "buxton_client_queue_policy()");
+}
+END_TEST
+
+START_TEST(configurator_conf_snapshot_path)
+{
+	putenv("BUXTON_CONF_FILE=" ABS_TOP_SRCDIR "/test/test-configurator.conf");
+	default_test(buxton_snapshot_path(), "/snip/snap/snap", "buxton_snapshot_path()");
+}
+END_TEST
+
 START_TEST(configurator_conf_module_dir)
 {
 	char *correct = "/shut/your/mouth";
@@ -225,6 +270,7 @@ START_TEST(configurator_get_layers)
 	fail_strne(layers[0].backend, "gdbm", false);
 	fail_strne(layers[0].description, "Operating System configuration layer", false);
 	fail_ne(layers[0].priority, 0);
+	fail_if(!layers[0].snapshot, "base layer not marked for the snapshot");
 
 	fail_strne(layers[1].name, "isp", false);
 	fail_strne(layers[1].type, "System", false);
@@ -239,6 +285,7 @@ START_TEST(configurator_get_layers)
 	fail_strne(layers[6].backend, "gdbm", false);
 	fail_strne(layers[6].description, "GDBM test db for user", false);
 	fail_ne(layers[6].priority, 6000);
+	fail_if(layers[6].snapshot, "test-gdbm-user layer marked for the snapshot");
 
 
 
@@ -281,6 +328,8 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_default_db_path);
 	tcase_add_test(tc, configurator_default_smack_load_file);
 	tcase_add_test(tc, configurator_default_buxton_socket);
+	tcase_add_test(tc, configurator_default_client_queue);
+	tcase_add_test(tc, configurator_default_snapshot_path);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("env clobbers defaults");
@@ -289,6 +338,8 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_env_db_path);
 	tcase_add_test(tc, configurator_env_smack_load_file);
 	tcase_add_test(tc, configurator_env_buxton_socket);
+	tcase_add_test(tc, configurator_env_client_queue);
+	tcase_add_test(tc, configurator_env_snapshot_path);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("command line clobbers all");
@@ -304,6 +355,8 @@ configurator_suite(void)
 	tcase_add_test(tc, configurator_conf_db_path);
 	tcase_add_test(tc, configurator_conf_smack_load_file);
 	tcase_add_test(tc, configurator_conf_buxton_socket);
+	tcase_add_test(tc, configurator_conf_client_queue);
+	tcase_add_test(tc, configurator_conf_snapshot_path);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("config file works");
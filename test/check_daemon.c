@@ -16,6 +16,7 @@
 #include <check.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stdio.h>
@@ -465,6 +466,133 @@ START_TEST(buxton_get_value_check)
 }
 END_TEST
 
+static void client_get_values_test(BuxtonResponse response, void *data)
+{
+	bool *ran = (bool *)data;
+	char *v;
+
+	fail_if(buxton_response_type(response) != BUXTON_CONTROL_GET_VALUES,
+		"Failed to get get values response type");
+	fail_if(buxton_response_status(response) == 0,
+		"Failed to report the missing key");
+	fail_if(buxton_response_key(response), "Got a key for get values");
+	fail_if(buxton_response_values_count(response) != 3,
+		"Failed to get a result for every key");
+
+	fail_if(buxton_response_values_status(response, 0) != 0,
+		"Failed to get value from a layer");
+	fail_if(buxton_response_values_item_type(response, 0) != BUXTON_TYPE_STRING,
+		"Failed to get value type from a layer");
+	v = buxton_response_values_item(response, 0);
+	fail_if(!v || !streq(v, "bxt_test_value"),
+		"Failed to get correct value from a layer");
+	free(v);
+
+	fail_if(buxton_response_values_status(response, 1) != 0,
+		"Failed to get value without a layer");
+	v = buxton_response_values_item(response, 1);
+	fail_if(!v || !streq(v, "bxt_test_value2"),
+		"Failed to get correct value without a layer");
+	free(v);
+
+	fail_if(buxton_response_values_status(response, 2) == 0,
+		"Got a status of 0 for a missing key");
+	fail_if(buxton_response_values_item(response, 2),
+		"Got a value for a missing key");
+	fail_if(buxton_response_values_item_type(response, 2) != (BuxtonDataType)-1,
+		"Got a value type for a missing key");
+	fail_if(buxton_response_values_status(response, 3) != -1,
+		"Got a status past the last key");
+
+	*ran = true;
+}
+
+START_TEST(buxton_get_values_check)
+{
+	BuxtonClient c = NULL;
+	BuxtonKey keys[3];
+	bool ran = false;
+
+	keys[0] = buxton_key_create("group", "name", "test-gdbm-user",
+				    BUXTON_TYPE_STRING);
+	keys[1] = buxton_key_create("group", "name", NULL, BUXTON_TYPE_STRING);
+	keys[2] = buxton_key_create("group", "missing", NULL,
+				    BUXTON_TYPE_STRING);
+	fail_if(!keys[0] || !keys[1] || !keys[2], "Failed to create keys");
+
+	fail_if(buxton_open(&c) == -1,
+		"Open failed with daemon.");
+	fail_if(buxton_get_values(c, keys, 0, NULL, NULL, true) != EINVAL,
+		"Retrieved values for no keys");
+	fail_if(buxton_get_values(c, keys, BUXTON_MESSAGE_MAX_PARAMS, NULL,
+				  NULL, true) != E2BIG,
+		"Retrieved values for too many keys");
+	fail_if(buxton_get_values(c, keys, 3, client_get_values_test, &ran,
+				  true),
+		"Retrieving values from buxton failed.");
+	fail_if(!ran, "Get values callback didn't run");
+
+	for (int i = 0; i < 3; i++) {
+		buxton_key_free(keys[i]);
+	}
+	buxton_close(c);
+}
+END_TEST
+
+static void client_get_group_test(BuxtonResponse response, void *data)
+{
+	bool *ran = (bool *)data;
+	char *name;
+	char *v;
+
+	fail_if(buxton_response_type(response) != BUXTON_CONTROL_GET_GROUP,
+		"Failed to get get group response type");
+	fail_if(buxton_response_status(response) != 0, "Get group failed");
+	fail_if(buxton_response_group_count(response) != 1,
+		"Failed to get every key in group");
+	name = buxton_response_group_item_name(response, 0);
+	fail_if(!name || !streq(name, "name"),
+		"Failed to get correct name in group");
+	fail_if(buxton_response_group_item_type(response, 0) != BUXTON_TYPE_STRING,
+		"Failed to get correct value type in group");
+	v = buxton_response_group_item_value(response, 0);
+	fail_if(!v || !streq(v, "bxt_test_value"),
+		"Failed to get correct value in group");
+	fail_if(buxton_response_group_item_name(response, 1),
+		"Got a name past the last key");
+	free(name);
+	free(v);
+
+	*ran = true;
+}
+
+START_TEST(buxton_get_group_check)
+{
+	BuxtonClient c = NULL;
+	BuxtonKey key;
+	bool ran = false;
+
+	fail_if(buxton_open(&c) == -1,
+		"Open failed with daemon.");
+
+	key = buxton_key_create("group", "name", "test-gdbm-user",
+				BUXTON_TYPE_STRING);
+	fail_if(!key, "Failed to create key");
+	fail_if(buxton_get_group(c, key, NULL, NULL, true) != EINVAL,
+		"Retrieved a group with a key name");
+	buxton_key_free(key);
+
+	key = buxton_key_create("group", NULL, "test-gdbm-user",
+				BUXTON_TYPE_STRING);
+	fail_if(!key, "Failed to create key");
+	fail_if(buxton_get_group(c, key, client_get_group_test, &ran, true),
+		"Retrieving group from buxton failed.");
+	fail_if(!ran, "Get group callback didn't run");
+	buxton_key_free(key);
+	buxton_close(c);
+}
+END_TEST
+
 static void client_get_label_test(BuxtonResponse response, void *data)
 {
 	BuxtonKey key;
@@ -527,11 +655,456 @@ START_TEST(buxton_get_label_check)
 }
 END_TEST
 
+static void client_batch_op_test(BuxtonResponse response, void *data)
+{
+	int *step = (int *)data;
+	int32_t *value;
+
+	fail_if(buxton_response_status(response) != 0,
+		"Batch request %d failed", *step);
+	switch (*step) {
+	case 0:
+		fail_if(buxton_response_type(response) != BUXTON_CONTROL_SET,
+			"Failed to get set response type in batch");
+		break;
+	case 1:
+		fail_if(buxton_response_type(response) != BUXTON_CONTROL_GET,
+			"Failed to get get response type in batch");
+		value = buxton_response_value(response);
+		fail_if(!value || *value != 672,
+			"Failed to get value set earlier in batch");
+		free(value);
+		break;
+	case 2:
+		fail_if(buxton_response_type(response) != BUXTON_CONTROL_UNSET,
+			"Failed to get unset response type in batch");
+		break;
+	default:
+		fail("Batch request callback run too often");
+	}
+	(*step)++;
+}
+
+static void client_batch_test(BuxtonResponse response, void *data)
+{
+	int *step = (int *)data;
+
+	fail_if(*step != 3, "Batch callback ran before request callbacks");
+	fail_if(buxton_response_type(response) != BUXTON_CONTROL_BATCH,
+		"Failed to get batch response type");
+	fail_if(buxton_response_status(response) != 0, "Batch failed");
+	fail_if(buxton_response_key(response), "Got a key for a batch");
+	(*step)++;
+}
+
+START_TEST(buxton_batch_check)
+{
+	BuxtonClient c = NULL;
+	BuxtonBatch batch;
+	BuxtonKey key;
+	int32_t value = 672;
+	int step = 0;
+
+	key = buxton_key_create("group", "batch", "test-gdbm-user",
+				BUXTON_TYPE_INT32);
+	fail_if(!key, "Failed to create key");
+	batch = buxton_batch_new();
+	fail_if(!batch, "Failed to create batch");
+	fail_if(buxton_open(&c) == -1,
+		"Open failed with daemon.");
+
+	fail_if(buxton_batch_submit(c, batch, NULL, NULL, true) != EINVAL,
+		"Submitted an empty batch");
+	fail_if(buxton_batch_set_value(batch, key, &value,
+				       client_batch_op_test, &step),
+		"Failed to add set to batch");
+	value = 0;
+	fail_if(buxton_batch_get_value(batch, key, client_batch_op_test, &step),
+		"Failed to add get to batch");
+	fail_if(buxton_batch_unset_value(batch, key, client_batch_op_test,
+					 &step),
+		"Failed to add unset to batch");
+	fail_if(buxton_batch_submit(c, batch, client_batch_test, &step, true),
+		"Submitting batch failed");
+	fail_if(step != 4, "Not every batch callback ran");
+	fail_if(buxton_batch_submit(c, batch, NULL, NULL, true) != EINVAL,
+		"Submitted batch was not emptied");
+
+	buxton_batch_free(batch);
+	buxton_key_free(key);
+	buxton_close(c);
+}
+END_TEST
+
+static void client_cached_value_test(BuxtonResponse response, void *data)
+{
+	char **value = (char **)data;
+
+	fail_if(buxton_response_type(response) != BUXTON_CONTROL_GET,
+		"Failed to get get response type");
+	fail_if(buxton_response_status(response) != 0,
+		"Get value failed");
+
+	free(*value);
+	*value = buxton_response_value(response);
+	fail_if(!*value, "Failed to get value");
+}
+
+START_TEST(buxton_enable_cache_check)
+{
+	BuxtonClient c = NULL;
+	BuxtonClient w = NULL;
+	BuxtonKey group, key;
+	struct pollfd pfd[1];
+	char *value = NULL;
+	uint64_t hits, misses;
+	int fd;
+
+	group = buxton_key_create("cache", NULL, "test-gdbm", BUXTON_TYPE_STRING);
+	fail_if(!group, "Failed to create key for group");
+	key = buxton_key_create("cache", "name", "test-gdbm", BUXTON_TYPE_STRING);
+	fail_if(!key, "Failed to create key");
+
+	fd = buxton_open(&c);
+	fail_if(fd == -1, "Open failed with daemon.");
+	fail_if(buxton_open(&w) == -1, "Open failed with daemon.");
+	fail_if(buxton_enable_cache(c, 0, 4096) != EINVAL,
+		"Enabled a cache without room for a value");
+	fail_if(buxton_enable_cache(c, 16, 4096), "Failed to enable cache");
+
+	fail_if(buxton_create_group(c, group, NULL, NULL, true),
+		"Creating group in buxton failed.");
+	fail_if(buxton_set_label(c, group, "*", NULL, NULL, true),
+		"Setting group label in buxton failed.");
+	fail_if(buxton_set_value(c, key, "cached", NULL, NULL, true),
+		"Failed to set value.");
+
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get value");
+	fail_if(!streq(value, "cached"), "Failed to get correct value");
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get cached value");
+	fail_if(!streq(value, "cached"), "Failed to get correct cached value");
+	buxton_get_cache_stats(c, &hits, &misses);
+	fail_if(hits != 1 || misses != 1, "Failed to answer get from cache");
+
+	/* A change from another client is notified and drops the value */
+	fail_if(buxton_set_value(w, key, "changed", NULL, NULL, true),
+		"Failed to change value.");
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	fail_if(poll(pfd, 1, 5000) != 1, "Change was not notified");
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get changed value");
+	fail_if(!streq(value, "changed"), "Got a stale value from cache");
+	buxton_get_cache_stats(c, &hits, &misses);
+	fail_if(hits != 1 || misses != 2, "Answered a changed value from cache");
+
+	/* Setting a label drops the whole group from the cache */
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get cached value");
+	fail_if(buxton_set_label(w, group, "*", NULL, NULL, true),
+		"Setting group label in buxton failed.");
+	pfd[0].revents = 0;
+	fail_if(poll(pfd, 1, 5000) != 1, "Label change was not notified");
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get value after label change");
+	buxton_get_cache_stats(c, &hits, &misses);
+	fail_if(hits != 2 || misses != 3,
+		"Answered a relabelled group from cache");
+
+	free(value);
+	buxton_key_free(group);
+	buxton_key_free(key);
+	buxton_close(w);
+	buxton_close(c);
+}
+END_TEST
+
+static void client_other_get_test(BuxtonResponse response, void *data)
+{
+	int32_t *value = (int32_t *)data;
+	int32_t *v;
+
+	fail_if(buxton_response_status(response) != 0, "Get value failed");
+	v = buxton_response_value(response);
+	fail_if(!v, "Failed to get value");
+	*value = *v;
+	free(v);
+}
+
+START_TEST(buxton_open_clients_check)
+{
+	BuxtonClient a = NULL;
+	BuxtonClient b = NULL;
+	BuxtonKey group, key;
+	struct pollfd pfd[1];
+	int32_t value = 39;
+	int32_t got = 0;
+
+	group = buxton_key_create("clients", NULL, "test-gdbm",
+				  BUXTON_TYPE_STRING);
+	fail_if(!group, "Failed to create key for group");
+	key = buxton_key_create("clients", "name", "test-gdbm",
+				BUXTON_TYPE_INT32);
+	fail_if(!key, "Failed to create key");
+
+	fail_if(buxton_open(&a) == -1, "Open failed with daemon.");
+	pfd[0].fd = buxton_open(&b);
+	fail_if(pfd[0].fd == -1, "Second open failed with daemon.");
+	pfd[0].events = POLLIN;
+
+	fail_if(buxton_create_group(a, group, NULL, NULL, true),
+		"Creating group in buxton failed.");
+	fail_if(buxton_set_label(a, group, "*", NULL, NULL, true),
+		"Setting group label in buxton failed.");
+	fail_if(buxton_set_value(a, key, &value, NULL, NULL, true),
+		"Failed to set value.");
+
+	/* Closing a connection leaves the requests of others pending */
+	fail_if(buxton_get_value(b, key, client_other_get_test, &got, false),
+		"Failed to get value.");
+	buxton_close(a);
+	fail_if(poll(pfd, 1, 5000) != 1, "Reply never came");
+	fail_if(buxton_client_handle_response(b) != 1,
+		"Failed to handle the reply on the other connection");
+	fail_if(got != 39, "Failed to run the other connection's callback");
+
+	buxton_key_free(group);
+	buxton_key_free(key);
+	buxton_close(b);
+}
+END_TEST
+
+static void client_completion_test(BuxtonResponse response, void *data)
+{
+	BuxtonControlMessage types[] = { BUXTON_CONTROL_CREATE_GROUP,
+					 BUXTON_CONTROL_SET_LABEL,
+					 BUXTON_CONTROL_SET,
+					 BUXTON_CONTROL_GET };
+	int *step = (int *)data;
+	int32_t *value;
+
+	fail_if(*step >= 4, "Ran too many callbacks");
+	fail_if(buxton_response_type(response) != types[*step],
+		"Ran callbacks out of order");
+	if (types[*step] == BUXTON_CONTROL_GET) {
+		fail_if(buxton_response_status(response) != 0,
+			"Failed to get value");
+		value = buxton_response_value(response);
+		fail_if(!value || *value != 17, "Failed to get correct value");
+		free(value);
+	} else if (types[*step] != BUXTON_CONTROL_CREATE_GROUP) {
+		fail_if(buxton_response_status(response) != 0,
+			"Queued request failed");
+	}
+	(*step)++;
+}
+
+START_TEST(buxton_drain_completions_check)
+{
+	BuxtonClient c = NULL;
+	BuxtonKey group, key;
+	struct pollfd pfd[1];
+	int32_t value = 17;
+	int step = 0;
+	int fd;
+
+	group = buxton_key_create("completion", NULL, "test-gdbm",
+				  BUXTON_TYPE_STRING);
+	fail_if(!group, "Failed to create key for group");
+	key = buxton_key_create("completion", "name", "test-gdbm",
+				BUXTON_TYPE_INT32);
+	fail_if(!key, "Failed to create key");
+
+	fail_if(buxton_open(&c) == -1, "Open failed with daemon.");
+	fd = buxton_completion_fd(c);
+	fail_if(fd == -1, "Failed to get completion fd");
+	fail_if(buxton_completion_fd(c) != fd, "Got a second completion fd");
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+
+	fail_if(buxton_create_group(c, group, client_completion_test, &step,
+				    false), "Creating group in buxton failed.");
+	fail_if(buxton_set_label(c, group, "*", client_completion_test, &step,
+				 false), "Setting group label in buxton failed.");
+	fail_if(buxton_set_value(c, key, &value, client_completion_test, &step,
+				 false), "Failed to set value.");
+	fail_if(buxton_get_value(c, key, client_completion_test, &step, false),
+		"Failed to get value.");
+	fail_if(step != 0, "Ran a callback before draining");
+
+	fail_if(poll(pfd, 1, 5000) != 1, "Completion fd never became readable");
+	fail_if(buxton_drain_completions(c, 1) != 1,
+		"Failed to run a single callback");
+	fail_if(step != 1, "Failed to run the oldest callback");
+	/* Left over callbacks keep the fd readable */
+	while (step < 4) {
+		fail_if(poll(pfd, 1, 5000) != 1, "Callbacks were left queued");
+		fail_if(buxton_drain_completions(c, 4) < 0,
+			"Failed to drain callbacks");
+	}
+	fail_if(poll(pfd, 1, 0) != 0, "Completion fd readable once drained");
+	fail_if(buxton_drain_completions(c, 4) != 0,
+		"Ran callbacks with nothing queued");
+
+	buxton_key_free(group);
+	buxton_key_free(key);
+	buxton_close(c);
+}
+END_TEST
+
+typedef struct CloseContext {
+	BuxtonClient client;
+	int calls;
+} CloseContext;
+
+static void client_close_test(BuxtonResponse response, void *data)
+{
+	CloseContext *ctx = (CloseContext *)data;
+
+	fail_if(buxton_response_status(response) != 0, "Get value failed");
+	ctx->calls++;
+	buxton_close(ctx->client);
+}
+
+START_TEST(buxton_close_in_callback_check)
+{
+	BuxtonClient c = NULL;
+	BuxtonKey group, key;
+	CloseContext ctx;
+	struct pollfd pfd[1];
+	int32_t value = 23;
+
+	group = buxton_key_create("close-callback", NULL, "test-gdbm",
+				  BUXTON_TYPE_STRING);
+	fail_if(!group, "Failed to create key for group");
+	key = buxton_key_create("close-callback", "name", "test-gdbm",
+				BUXTON_TYPE_INT32);
+	fail_if(!key, "Failed to create key");
+
+	fail_if(buxton_open(&c) == -1, "Open failed with daemon.");
+	fail_if(buxton_create_group(c, group, NULL, NULL, true),
+		"Creating group in buxton failed.");
+	fail_if(buxton_set_label(c, group, "*", NULL, NULL, true),
+		"Setting group label in buxton failed.");
+	fail_if(buxton_set_value(c, key, &value, NULL, NULL, true),
+		"Failed to set value.");
+
+	/* Closed while its reply is handled */
+	ctx.client = NULL;
+	ctx.calls = 0;
+	pfd[0].fd = buxton_open(&ctx.client);
+	fail_if(pfd[0].fd == -1, "Open failed with daemon.");
+	fail_if(buxton_get_value(ctx.client, key, client_close_test, &ctx,
+				 false), "Failed to get value.");
+	pfd[0].events = POLLIN;
+	fail_if(poll(pfd, 1, 5000) != 1, "Reply never arrived");
+	fail_if(buxton_client_handle_response(ctx.client) != 1,
+		"Failed to handle the reply");
+	fail_if(ctx.calls != 1, "Failed to run the callback once");
+
+	/* Closed while a sync request waits for its reply */
+	ctx.client = NULL;
+	ctx.calls = 0;
+	fail_if(buxton_open(&ctx.client) == -1, "Open failed with daemon.");
+	fail_if(buxton_get_value(ctx.client, key, client_close_test, &ctx,
+				 true), "Failed to get value.");
+	fail_if(ctx.calls != 1, "Failed to run the callback once");
+
+	buxton_key_free(group);
+	buxton_key_free(key);
+	buxton_close(c);
+}
+END_TEST
+
+static void client_first_get_test(BuxtonResponse response, void *data)
+{
+	int *step = (int *)data;
+
+	fail_if(buxton_response_status(response) != 0, "Get value failed");
+	fail_if(*step != 0, "Ran a newer callback first");
+	(*step)++;
+}
+
+static void client_second_get_test(BuxtonResponse response, void *data)
+{
+	int *step = (int *)data;
+
+	fail_if(buxton_response_status(response) != 0, "Get value failed");
+	fail_if(*step != 1, "Ran a queued callback after a newer one");
+	(*step)++;
+}
+
+START_TEST(buxton_cache_completions_check)
+{
+	BuxtonClient c = NULL;
+	BuxtonClient w = NULL;
+	BuxtonKey group, key;
+	struct pollfd pfd[1];
+	char *value = NULL;
+	uint64_t hits, misses;
+	int step = 0;
+
+	group = buxton_key_create("cachequeue", NULL, "test-gdbm",
+				  BUXTON_TYPE_STRING);
+	fail_if(!group, "Failed to create key for group");
+	key = buxton_key_create("cachequeue", "name", "test-gdbm",
+				BUXTON_TYPE_STRING);
+	fail_if(!key, "Failed to create key");
+
+	fail_if(buxton_open(&c) == -1, "Open failed with daemon.");
+	fail_if(buxton_open(&w) == -1, "Open failed with daemon.");
+	fail_if(buxton_enable_cache(c, 16, 4096), "Failed to enable cache");
+	pfd[0].fd = buxton_completion_fd(c);
+	fail_if(pfd[0].fd == -1, "Failed to get completion fd");
+	pfd[0].events = POLLIN;
+
+	fail_if(buxton_create_group(c, group, NULL, NULL, true),
+		"Creating group in buxton failed.");
+	fail_if(buxton_set_label(c, group, "*", NULL, NULL, true),
+		"Setting group label in buxton failed.");
+	fail_if(buxton_set_value(c, key, "cached", NULL, NULL, true),
+		"Failed to set value.");
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get value");
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get cached value");
+	fail_if(!streq(value, "cached"), "Failed to get correct cached value");
+
+	/* The change is applied as it is read, not when callbacks drain */
+	fail_if(buxton_set_value(w, key, "changed", NULL, NULL, true),
+		"Failed to change value.");
+	fail_if(poll(pfd, 1, 5000) != 1, "Change was not notified");
+	fail_if(buxton_get_value(c, key, client_cached_value_test, &value,
+				 true), "Failed to get changed value");
+	fail_if(!streq(value, "changed"), "Got a stale value from cache");
+	buxton_get_cache_stats(c, &hits, &misses);
+	fail_if(hits != 1 || misses != 2, "Answered a changed value from cache");
+
+	/* A sync get runs the callbacks queued before it first */
+	fail_if(buxton_get_value(c, key, client_first_get_test, &step, false),
+		"Failed to queue get");
+	fail_if(step != 0, "Ran a callback before draining");
+	fail_if(buxton_get_value(c, key, client_second_get_test, &step, true),
+		"Failed to get value");
+	fail_if(step != 2, "Failed to run both callbacks");
+
+	free(value);
+	buxton_key_free(group);
+	buxton_key_free(key);
+	buxton_close(w);
+	buxton_close(c);
+}
+END_TEST
+
 START_TEST(parse_list_check)
 {
 	BuxtonData l3[2];
 	BuxtonData l2[4];
 	BuxtonData l1[3];
+	BuxtonData l4[4];
 	_BuxtonKey key;
 	BuxtonData *value = NULL;
 
@@ -566,6 +1139,20 @@ START_TEST(parse_list_check)
 		"Failed to set correct notify name");
 	fail_if(key.type != l1[2].store.d_uint32,
 		"Failed to set correct notify type");
+	fail_if(value, "Set an interval for notify without one");
+
+	l4[0] = l1[0];
+	l4[1] = l1[1];
+	l4[2] = l1[2];
+	l4[3].type = BUXTON_TYPE_INT32;
+	fail_if(parse_list(BUXTON_CONTROL_NOTIFY, 4, l4, &key, &value),
+		"Parsed bad notify interval type");
+	l4[3].type = BUXTON_TYPE_UINT32;
+	l4[3].store.d_uint32 = 100;
+	fail_if(!parse_list(BUXTON_CONTROL_NOTIFY, 4, l4, &key, &value),
+		"Unable to parse notify with interval");
+	fail_if(value != &l4[3], "Failed to set notify interval");
+	value = NULL;
 
 	fail_if(parse_list(BUXTON_CONTROL_UNNOTIFY, 2, l1, &key, &value),
 		"Parsed bad unnotify argument count");
@@ -599,6 +1186,22 @@ START_TEST(parse_list_check)
 	fail_if(key.type != l1[2].store.d_uint32,
 		"Failed to set correct unnotify type");
 
+	fail_if(parse_list(BUXTON_CONTROL_NOTIFY_PREFIX, 3, l1, &key, &value),
+		"Parsed bad notify prefix argument count");
+	l1[1].type = BUXTON_TYPE_UINT32;
+	fail_if(parse_list(BUXTON_CONTROL_NOTIFY_PREFIX, 2, l1, &key, &value),
+		"Parsed bad notify prefix type");
+	l1[1].type = BUXTON_TYPE_STRING;
+	l1[1].store.d_string = buxton_string_pack("s4");
+	fail_if(!parse_list(BUXTON_CONTROL_NOTIFY_PREFIX, 2, l1, &key, &value),
+		"Unable to parse valid notify prefix");
+	fail_if(!streq(key.group.value, l1[0].store.d_string.value),
+		"Failed to set correct notify prefix group");
+	fail_if(!streq(key.name.value, l1[1].store.d_string.value),
+		"Failed to set correct notify prefix");
+	fail_if(!parse_list(BUXTON_CONTROL_UNNOTIFY_PREFIX, 2, l1, &key, &value),
+		"Unable to parse valid unnotify prefix");
+
 	fail_if(parse_list(BUXTON_CONTROL_GET, 5, l2, &key, &value),
 		"Parsed bad get argument count");
 	l2[0].type = BUXTON_TYPE_INT32;
@@ -977,6 +1580,7 @@ START_TEST(remove_group_check)
 	BuxtonDaemon server;
 	BuxtonString clabel = buxton_string_pack("_");
 
+	memzero(&server, sizeof(BuxtonDaemon));
 	fail_if(!buxton_direct_open(&server.buxton),
 		"Failed to open buxton direct connection");
 
@@ -1158,6 +1762,9 @@ START_TEST(register_notification_check)
 	BuxtonDaemon server;
 	uint32_t msgid;
 
+	memzero(&client, sizeof(client_list_item));
+	memzero(&no_client, sizeof(client_list_item));
+	memzero(&server, sizeof(BuxtonDaemon));
 	fail_if(!buxton_cache_smack_rules(),
 		"Failed to cache smack rules");
 	if (use_smack())
@@ -1169,15 +1776,13 @@ START_TEST(register_notification_check)
 		"Failed to open buxton direct connection");
 	server.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!server.notify_mapping, "Failed to allocate hashmap");
-	server.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!server.client_key_mapping, "Failed to allocate hashmap");
 
 	key.group = buxton_string_pack("group");
 	key.name = buxton_string_pack("name");
 	key.type = BUXTON_TYPE_STRING;
-	register_notification(&server, &client, &key, 1, &status);
+	register_notification(&server, &client, &key, 1, 0, &status);
 	fail_if(status != 0, "Failed to register notification");
-	register_notification(&server, &client, &key, 1, &status);
+	register_notification(&server, &client, &key, 1, 0, &status);
 	fail_if(status != 0, "Failed to register notification");
 	//FIXME: Figure out what to do with duplicates
 	key.group = buxton_string_pack("no-key");
@@ -1194,12 +1799,26 @@ START_TEST(register_notification_check)
 	fail_if(status != 0,
 		"Unable to unregister from notifications");
 	fail_if(msgid != 1, "Failed to get correct notify message id");
+	fail_if(!client.subscriptions || client.subscriptions->subscription_next,
+		"Failed to unlink the subscription from the client");
+	fail_if(hashmap_size(server.notify_mapping) != 1,
+		"Dropped the key's last value while subscribed");
+	fail_if(hashmap_size(client.watched) != 1 ||
+		hashmap_first(client.watched) != client.subscriptions,
+		"Failed to index the remaining subscription");
+	msgid = unregister_notification(&server, &client, &key, &status);
+	fail_if(status != 0 || msgid != 1,
+		"Unable to unregister the duplicate notification");
+	fail_if(client.subscriptions || hashmap_size(client.watched) != 0,
+		"Failed to unlink the duplicate subscription");
+	fail_if(hashmap_size(server.notify_mapping) != 0,
+		"Kept the key's last value without subscribers");
 	key.group = buxton_string_pack("key2");
-	register_notification(&server, &client, &key, 0, &status);
+	register_notification(&server, &client, &key, 0, 0, &status);
 	fail_if(status == 0, "Registered notification with key not in db");
 
+	hashmap_free(client.watched);
 	hashmap_free(server.notify_mapping);
-	hashmap_free(server.client_key_mapping);
 	buxton_direct_close(&server.buxton);
 }
 END_TEST
@@ -1215,6 +1834,8 @@ START_TEST(buxtond_handle_message_error_check)
 	BuxtonArray *list = NULL;
 	uint16_t control;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1282,6 +1903,8 @@ START_TEST(buxtond_handle_message_create_group_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1301,8 +1924,6 @@ START_TEST(buxtond_handle_message_create_group_check)
 		"Failed to open buxton direct connection");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 
 	out_list1 = buxton_array_new();
 	fail_if(!out_list1, "Failed to allocate list");
@@ -1364,10 +1985,8 @@ START_TEST(buxtond_handle_message_create_group_check)
 	fail_if(msgid != 1, "Failed to get correct message id");
 
 	free(list);
-	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list1, NULL);
 	buxton_array_free(&out_list2, NULL);
@@ -1391,6 +2010,8 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1412,8 +2033,6 @@ START_TEST(buxtond_handle_message_remove_group_check)
 		"Failed to open buxton direct connection");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1444,10 +2063,8 @@ START_TEST(buxtond_handle_message_remove_group_check)
 	fail_if(msgid != 0, "Failed to get correct message id");
 
 	free(list);
-	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1470,6 +2087,8 @@ START_TEST(buxtond_handle_message_set_label_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1491,8 +2110,6 @@ START_TEST(buxtond_handle_message_set_label_check)
 		"Failed to open buxton direct connection");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1527,10 +2144,8 @@ START_TEST(buxtond_handle_message_set_label_check)
 	fail_if(msgid != 0, "Failed to get correct message id");
 
 	free(list);
-	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1553,6 +2168,8 @@ START_TEST(buxtond_handle_message_set_value_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1574,8 +2191,6 @@ START_TEST(buxtond_handle_message_set_value_check)
 		"Failed to open buxton direct connection");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1620,10 +2235,8 @@ START_TEST(buxtond_handle_message_set_value_check)
 	fail_if(msgid != 0, "Failed to get correct message id");
 
 	free(list);
-	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1647,6 +2260,8 @@ START_TEST(buxtond_handle_message_get_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	out_list = buxton_array_new();
 	fail_if(!out_list, "Failed to allocate list");
@@ -1758,6 +2373,8 @@ START_TEST(buxtond_handle_message_get_label_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
 		"Failed to set socket to non blocking");
@@ -1779,8 +2396,6 @@ START_TEST(buxtond_handle_message_get_label_check)
 		"Failed to open buxton direct connection");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -1814,10 +2429,8 @@ START_TEST(buxtond_handle_message_get_label_check)
 		"Failed to get correct label");
 
 	free(list);
-	cleanup_callbacks();
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1840,6 +2453,8 @@ START_TEST(buxtond_handle_message_notify_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	out_list = buxton_array_new();
 	fail_if(!out_list, "Failed to allocate list");
@@ -1854,8 +2469,6 @@ START_TEST(buxtond_handle_message_notify_check)
 	daemon.buxton.client.uid = 1001;
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
@@ -1919,7 +2532,6 @@ START_TEST(buxtond_handle_message_notify_check)
 	free(list);
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
@@ -1942,6 +2554,8 @@ START_TEST(buxtond_handle_message_unset_check)
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
 	out_list = buxton_array_new();
 	fail_if(!out_list, "Failed to allocate list");
@@ -1959,8 +2573,6 @@ START_TEST(buxtond_handle_message_unset_check)
 		"Failed to open buxton direct connection");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 
 	data1.type = BUXTON_TYPE_STRING;
 	data1.store.d_string = buxton_string_pack("base");
@@ -2000,30 +2612,36 @@ START_TEST(buxtond_handle_message_unset_check)
 	free(list);
 	close(client);
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
 	buxton_direct_close(&daemon.buxton);
 	buxton_array_free(&out_list, NULL);
 }
 END_TEST
 
-START_TEST(buxtond_notify_clients_check)
+START_TEST(buxtond_handle_message_batch_check)
 {
-	int client, server;
 	BuxtonDaemon daemon;
-	_BuxtonKey key;
 	BuxtonString slabel;
-	BuxtonData value1, value2;
+	size_t size;
+	BuxtonData layer, group, name, missing, value, type;
+	BuxtonData c_set, c_get, c_unset, c_notify, n3, n4;
 	client_list_item cl;
-	int32_t status;
 	bool r;
 	BuxtonData *list;
+	BuxtonArray *out_list;
 	BuxtonControlMessage msg;
 	ssize_t csize;
+	int client, server;
 	ssize_t s;
 	uint8_t buf[4096];
 	uint32_t msgid;
 
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
 	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
 
 	cl.fd = server;
 	slabel = buxton_string_pack("_");
@@ -2032,64 +2650,826 @@ START_TEST(buxtond_notify_clients_check)
 	else
 		cl.smack_label = NULL;
 	cl.cred.uid = 1002;
-	daemon.notify_mapping = hashmap_new(string_hash_func,
-					    string_compare_func);
-	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
-	fail_if(!buxton_cache_smack_rules(),
-		"Failed to cache Smack rules");
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
 	fail_if(!buxton_direct_open(&daemon.buxton),
 		"Failed to open buxton direct connection");
+	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
 
-	value1.type = BUXTON_TYPE_STRING;
-	value1.store.d_string = buxton_string_pack("dummy value");
-	key.group = buxton_string_pack("dummy");
-	key.name = buxton_string_pack("name");
-	buxtond_notify_clients(&daemon, &cl, &key, &value1);
-
-	value1.store.d_string = buxton_string_pack("real value");
-	key.group = buxton_string_pack("daemon-check");
-	key.name = buxton_string_pack("name");
-	key.layer = buxton_string_pack("base");
-	key.type = BUXTON_TYPE_STRING;
-	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
-	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
-	fail_if(status != 0,
-		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value1);
-
-	value2.type = BUXTON_TYPE_STRING;
-	value2.store.d_string = buxton_string_pack("new value");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+	layer.type = BUXTON_TYPE_STRING;
+	layer.store.d_string = buxton_string_pack("base");
+	group.type = BUXTON_TYPE_STRING;
+	group.store.d_string = buxton_string_pack("daemon-check");
+	name.type = BUXTON_TYPE_STRING;
+	name.store.d_string = buxton_string_pack("batch");
+	missing.type = BUXTON_TYPE_STRING;
+	missing.store.d_string = buxton_string_pack("batch-missing");
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack("batch value");
+	type.type = BUXTON_TYPE_UINT32;
+	type.store.d_uint32 = BUXTON_TYPE_STRING;
+	c_set.type = BUXTON_TYPE_UINT32;
+	c_set.store.d_uint32 = BUXTON_CONTROL_SET;
+	c_get.type = BUXTON_TYPE_UINT32;
+	c_get.store.d_uint32 = BUXTON_CONTROL_GET;
+	c_unset.type = BUXTON_TYPE_UINT32;
+	c_unset.store.d_uint32 = BUXTON_CONTROL_UNSET;
+	c_notify.type = BUXTON_TYPE_UINT32;
+	c_notify.store.d_uint32 = BUXTON_CONTROL_NOTIFY;
+	n3.type = BUXTON_TYPE_UINT32;
+	n3.store.d_uint32 = 3;
+	n4.type = BUXTON_TYPE_UINT32;
+	n4.store.d_uint32 = 4;
+
+	/* set, get, get of a missing key and unset in one message */
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &c_set), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &n4), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &value), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &c_get), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &n4), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &c_get), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &n3), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &missing), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &c_unset), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &n4), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_BATCH, 7,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle batch message");
 
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify string");
-	fail_if(msg != BUXTON_CONTROL_CHANGED,
+	fail_if(csize != 10, "Failed to get correct response to batch");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
 		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_STRING,
-		"Failed to get correct notification value type string");
-	fail_if(!streq(list[0].store.d_string.value, "new value"),
-		"Failed to get correct notification value data string");
-
-	free(list[0].store.d_string.value);
+	fail_if(msgid != 7, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT32 || list[0].store.d_int32 == 0,
+		"Failed to report the failed get in the batch status");
+	fail_if(list[1].store.d_uint32 != 1 || list[2].store.d_int32 != 0,
+		"Failed to set value in batch");
+	fail_if(list[3].store.d_uint32 != 2 || list[4].store.d_int32 != 0,
+		"Failed to get value in batch");
+	fail_if(list[5].type != BUXTON_TYPE_STRING ||
+		!streq(list[5].store.d_string.value, "batch value"),
+		"Failed to get the value set earlier in the batch");
+	fail_if(list[6].store.d_uint32 != 1 || list[7].store.d_int32 == 0,
+		"Got a value for a missing key in batch");
+	fail_if(list[8].store.d_uint32 != 1 || list[9].store.d_int32 != 0,
+		"Failed to unset value in batch");
+	free(list[5].store.d_string.value);
 	free(list);
 
-	key.group = buxton_string_pack("group");
-	key.name.value = NULL;
-	key.name.length = 0;
-	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
-	fail_if(!r, "Unable to create group");
-	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
-	fail_if(!r, "Unable set group label");
-
-	value1.type = BUXTON_TYPE_INT32;
+	/* a request count running past the message is refused */
+	buxton_array_free(&out_list, NULL);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &c_get), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &n4), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_BATCH, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Failed to detect truncated batch");
+
+	/* only value requests may be batched */
+	buxton_array_free(&out_list, NULL);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &c_notify), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &n3), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_BATCH, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Failed to refuse notify request in batch");
+	fail_if(read(client, buf, 4096) > 0, "Got a reply to an invalid batch");
+
+	close(client);
+	hashmap_free(daemon.notify_mapping);
+	buxton_direct_close(&daemon.buxton);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxtond_handle_message_get_values_check)
+{
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	size_t size;
+	BuxtonData layer, no_layer, group, name, missing, value, type;
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonArray *out_list;
+	BuxtonControlMessage msg;
+	_BuxtonKey key;
+	ssize_t csize;
+	int client, server;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	layer.type = BUXTON_TYPE_STRING;
+	layer.store.d_string = buxton_string_pack("base");
+	no_layer.type = BUXTON_TYPE_STRING;
+	no_layer.store.d_string.value = NULL;
+	no_layer.store.d_string.length = 0;
+	group.type = BUXTON_TYPE_STRING;
+	group.store.d_string = buxton_string_pack("daemon-check");
+	name.type = BUXTON_TYPE_STRING;
+	name.store.d_string = buxton_string_pack("get-values");
+	missing.type = BUXTON_TYPE_STRING;
+	missing.store.d_string = buxton_string_pack("get-values-missing");
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack("get values value");
+	type.type = BUXTON_TYPE_UINT32;
+	type.store.d_uint32 = BUXTON_TYPE_STRING;
+
+	key.layer = layer.store.d_string;
+	key.group = group.store.d_string;
+	key.name = name.store.d_string;
+	key.type = BUXTON_TYPE_STRING;
+	set_value(&daemon, &cl, &key, &value, &status);
+	fail_if(status != 0, "Failed to set value for get values");
+
+	/* a key in a layer, the same key in any layer and a missing key */
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &no_layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &missing), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &type), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_VALUES, 8,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle get values message");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 6, "Failed to get correct response to get values");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+	fail_if(msgid != 8, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT32 || list[0].store.d_int32 == 0,
+		"Failed to report the missing key in the status");
+	fail_if(list[1].store.d_int32 != 0 || list[2].type != BUXTON_TYPE_STRING ||
+		!streq(list[2].store.d_string.value, "get values value"),
+		"Failed to get value from a layer");
+	fail_if(list[3].store.d_int32 != 0 || list[4].type != BUXTON_TYPE_STRING ||
+		!streq(list[4].store.d_string.value, "get values value"),
+		"Failed to get value without a layer");
+	fail_if(list[5].type != BUXTON_TYPE_INT32 || list[5].store.d_int32 == 0,
+		"Got a value for a missing key");
+	free(list[2].store.d_string.value);
+	free(list[4].store.d_string.value);
+	free(list);
+
+	/* every key needs all four parameters */
+	buxton_array_free(&out_list, NULL);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &name), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_VALUES, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Failed to detect truncated get values");
+
+	/* the type must come last */
+	fail_if(!buxton_array_add(out_list, &value), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_VALUES, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Failed to detect bad type in get values");
+	fail_if(read(client, buf, 4096) > 0, "Got a reply to an invalid get values");
+
+	unset_value(&daemon, &cl, &key, &status);
+	fail_if(status != 0, "Failed to unset value for get values");
+
+	close(client);
+	buxton_direct_close(&daemon.buxton);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxtond_handle_message_get_group_check)
+{
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	size_t size;
+	BuxtonData layer, group, missing, value;
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonArray *out_list;
+	BuxtonControlMessage msg;
+	_BuxtonKey key;
+	ssize_t csize;
+	int client, server;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+	bool seen[2] = { false, false };
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	layer.type = BUXTON_TYPE_STRING;
+	layer.store.d_string = buxton_string_pack("base");
+	group.type = BUXTON_TYPE_STRING;
+	group.store.d_string = buxton_string_pack("get-group-check");
+	missing.type = BUXTON_TYPE_STRING;
+	missing.store.d_string = buxton_string_pack("get-group-missing");
+
+	key.layer = layer.store.d_string;
+	key.group = group.store.d_string;
+	key.name = (BuxtonString){ NULL, 0 };
+	key.type = BUXTON_TYPE_STRING;
+	create_group(&daemon, &cl, &key, &status);
+	fail_if(status != 0, "Failed to create group for get group");
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack("*");
+	set_label(&daemon, &cl, &key, &value, &status);
+	fail_if(status != 0, "Failed to set group label for get group");
+
+	key.name = buxton_string_pack("string");
+	value.store.d_string = buxton_string_pack("group value");
+	set_value(&daemon, &cl, &key, &value, &status);
+	fail_if(status != 0, "Failed to set string for get group");
+	key.name = buxton_string_pack("int");
+	key.type = BUXTON_TYPE_INT32;
+	value.type = BUXTON_TYPE_INT32;
+	value.store.d_int32 = 672;
+	set_value(&daemon, &cl, &key, &value, &status);
+	fail_if(status != 0, "Failed to set int for get group");
+
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_GROUP, 9,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle get group message");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 5, "Failed to get correct response to get group");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+	fail_if(msgid != 9, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT32 || list[0].store.d_int32 != 0,
+		"Failed to get group");
+	for (int i = 1; i < 5; i += 2) {
+		fail_if(list[i].type != BUXTON_TYPE_STRING,
+			"Failed to get key name in group");
+		if (streq(list[i].store.d_string.value, "string")) {
+			fail_if(list[i + 1].type != BUXTON_TYPE_STRING ||
+				!streq(list[i + 1].store.d_string.value, "group value"),
+				"Failed to get string value in group");
+			free(list[i + 1].store.d_string.value);
+			seen[0] = true;
+		} else if (streq(list[i].store.d_string.value, "int")) {
+			fail_if(list[i + 1].type != BUXTON_TYPE_INT32 ||
+				list[i + 1].store.d_int32 != 672,
+				"Failed to get int value in group");
+			seen[1] = true;
+		}
+		free(list[i].store.d_string.value);
+	}
+	fail_if(!seen[0] || !seen[1], "Failed to get every key in group");
+	free(list);
+
+	/* a missing group only gets a failed status */
+	buxton_array_free(&out_list, NULL);
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+	fail_if(!buxton_array_add(out_list, &missing), "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_GROUP, 10,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle get group message");
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Got keys for a missing group");
+	fail_if(list[0].store.d_int32 == 0, "Got a missing group");
+	free(list);
+
+	key.name = (BuxtonString){ NULL, 0 };
+	key.type = BUXTON_TYPE_STRING;
+	remove_group(&daemon, &cl, &key, &status);
+	fail_if(status != 0, "Failed to remove group for get group");
+
+	close(client);
+	buxton_direct_close(&daemon.buxton);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxtond_handle_message_hello_check)
+{
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	BuxtonStringTable table;
+	size_t size;
+	BuxtonData data1, data2;
+	client_list_item cl;
+	bool r;
+	BuxtonData *list;
+	BuxtonArray *out_list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	int client, server;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
+	memzero(&table, sizeof(BuxtonStringTable));
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+
+	/* Clients newer than buxtond get its version */
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.type = BUXTON_TYPE_UINT32;
+	data1.store.d_uint32 = BUXTON_PROTOCOL_VERSION + 3;
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_HELLO, 0,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle hello message");
+	fail_if(cl.version != BUXTON_PROTOCOL_VERSION,
+		"Failed to agree on protocol version");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	fail_if(*(uint16_t *)buf != BUXTON_CONTROL_CODE,
+		"Hello reply not sent in version 1");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get correct response to hello");
+	fail_if(msg != BUXTON_CONTROL_STATUS,
+		"Failed to get correct control type");
+	fail_if(list[0].store.d_int32 != 0, "Hello refused");
+	fail_if(list[1].type != BUXTON_TYPE_UINT32 ||
+		list[1].store.d_uint32 != BUXTON_PROTOCOL_VERSION,
+		"Failed to get agreed version");
+	free(list);
+
+	/* The version is only agreed on once */
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_HELLO, 1,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle second hello message");
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	fail_if(*(uint16_t *)buf != BUXTON_CONTROL_CODE_V2,
+		"Reply not sent in version 2");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get correct response to hello");
+	fail_if(list[0].store.d_int32 != -1, "Second hello accepted");
+	fail_if(cl.version != BUXTON_PROTOCOL_VERSION,
+		"Second hello changed the version");
+	free(list);
+	buxton_array_free(&out_list, NULL);
+
+	/* Strings sent once are then sent by index */
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.type = BUXTON_TYPE_STRING;
+	data1.store.d_string = buxton_string_pack("base");
+	data2.type = BUXTON_TYPE_STRING;
+	data2.store.d_string = buxton_string_pack("tgroup");
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(out_list, &data2);
+	fail_if(!r, "Failed to add element to array");
+	for (uint32_t i = 2; i < 4; i++) {
+		size = buxton_serialize_message_v2(&cl.data,
+						   BUXTON_CONTROL_CREATE_GROUP,
+						   i, out_list, &table);
+		fail_if(size == 0, "Failed to serialize message");
+		r = buxtond_handle_message(&daemon, &cl, size);
+		free(cl.data);
+		fail_if(!r, "Failed to handle version 2 message");
+		fail_if(cl.decode.count != 2, "Failed to keep client strings");
+
+		s = read(client, buf, 4096);
+		fail_if(s < 0, "Read from client failed");
+		csize = buxton_deserialize_message(buf, &msg, (size_t)s,
+						   &msgid, &list);
+		fail_if(csize != 1, "Failed to get correct response");
+		fail_if(msg != BUXTON_CONTROL_STATUS || msgid != i,
+			"Failed to get correct response header");
+		free(list);
+	}
+
+	/* Indexes the client never gave are refused */
+	buxton_string_table_free(&cl.decode);
+	size = buxton_serialize_message_v2(&cl.data,
+					   BUXTON_CONTROL_CREATE_GROUP, 4,
+					   out_list, &table);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Handled unknown string index");
+
+	close(client);
+	buxton_string_table_free(&table);
+	buxton_string_table_free(&cl.encode);
+	buxton_string_table_free(&cl.decode);
+	free(daemon.params);
+	hashmap_free(daemon.notify_mapping);
+	buxton_direct_close(&daemon.buxton);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxtond_handle_message_key_handle_check)
+{
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	size_t size;
+	BuxtonData data1, data2, data3, data4;
+	client_list_item cl;
+	bool r;
+	BuxtonData *list;
+	BuxtonArray *out_list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	int client, server;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+	uint32_t handle;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(server, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+
+	/* Registering a key returns a handle for it */
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.type = BUXTON_TYPE_STRING;
+	data1.store.d_string = buxton_string_pack("base");
+	data2.type = BUXTON_TYPE_STRING;
+	data2.store.d_string = buxton_string_pack("daemon-check");
+	data3.type = BUXTON_TYPE_STRING;
+	data3.store.d_string = buxton_string_pack("name");
+	data4.type = BUXTON_TYPE_UINT32;
+	data4.store.d_uint32 = BUXTON_TYPE_STRING;
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(out_list, &data2);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(out_list, &data3);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(out_list, &data4);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_REGISTER_KEY,
+					1, out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle register key message");
+	buxton_array_free(&out_list, NULL);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get correct response to register key");
+	fail_if(msg != BUXTON_CONTROL_STATUS || msgid != 1,
+		"Failed to get correct response header");
+	fail_if(list[0].store.d_int32 != 0, "Failed to register key");
+	fail_if(list[1].type != BUXTON_TYPE_UINT32 ||
+		list[1].store.d_uint32 == 0, "Failed to get key handle");
+	handle = list[1].store.d_uint32;
+	free(list);
+	fail_if(cl.n_handles != 1, "Failed to keep key handle");
+
+	/* Sets and gets by handle act on the registered key */
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.type = BUXTON_TYPE_UINT32;
+	data1.store.d_uint32 = handle;
+	data2.type = BUXTON_TYPE_STRING;
+	data2.store.d_string = buxton_string_pack("bxt_test_value3");
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	r = buxton_array_add(out_list, &data2);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_SET_HANDLE, 2,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle set by handle message");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get correct response to set");
+	fail_if(msg != BUXTON_CONTROL_STATUS || msgid != 2,
+		"Failed to get correct response header");
+	fail_if(list[0].store.d_int32 != 0, "Failed to set by handle");
+	free(list);
+	buxton_array_free(&out_list, NULL);
+
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_HANDLE, 3,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle get by handle message");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 2, "Failed to get correct response to get");
+	fail_if(msg != BUXTON_CONTROL_STATUS || msgid != 3,
+		"Failed to get correct response header");
+	fail_if(list[0].store.d_int32 != 0, "Failed to get by handle");
+	fail_if(list[1].type != BUXTON_TYPE_STRING ||
+		!streq(list[1].store.d_string.value, "bxt_test_value3"),
+		"Failed to get correct value by handle");
+	free(list[1].store.d_string.value);
+	free(list);
+
+	/* Notifications by handle are for the key in any layer */
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_NOTIFY_HANDLE,
+					4, out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(!r, "Failed to handle notify by handle message");
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1, "Failed to get correct response to notify");
+	fail_if(list[0].store.d_int32 != 0, "Failed to notify by handle");
+	free(list);
+	fail_if(!hashmap_get(daemon.notify_mapping, "daemon-check\nname"),
+		"Failed to register notification by handle");
+	buxton_array_free(&out_list, NULL);
+
+	/* Unknown handles and values of another type are refused */
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	data1.store.d_uint32 = handle + 1;
+	r = buxton_array_add(out_list, &data1);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_GET_HANDLE, 5,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Handled unknown key handle");
+
+	data1.store.d_uint32 = handle;
+	data2.type = BUXTON_TYPE_INT32;
+	data2.store.d_int32 = 7;
+	r = buxton_array_add(out_list, &data2);
+	fail_if(!r, "Failed to add element to array");
+	size = buxton_serialize_message(&cl.data, BUXTON_CONTROL_SET_HANDLE, 6,
+					out_list);
+	fail_if(size == 0, "Failed to serialize message");
+	r = buxtond_handle_message(&daemon, &cl, size);
+	free(cl.data);
+	fail_if(r, "Set a value of the wrong type by handle");
+
+	close(client);
+	for (uint32_t i = 0; i < cl.n_handles; i++) {
+		free(cl.handles[i].key.group.value);
+		free(cl.handles[i].key.name.value);
+		free(cl.handles[i].key.layer.value);
+		free(cl.handles[i].name);
+	}
+	free(cl.handles);
+	free(daemon.params);
+	buxton_direct_close(&daemon.buxton);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxtond_notify_clients_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	_BuxtonKey key;
+	BuxtonString slabel;
+	BuxtonData value1, value2;
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
+	setup_socket_pair(&client, &server);
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.notify_mapping = hashmap_new(string_hash_func,
+					    string_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	value1.type = BUXTON_TYPE_STRING;
+	value1.store.d_string = buxton_string_pack("dummy value");
+	key.group = buxton_string_pack("dummy");
+	key.name = buxton_string_pack("name");
+	buxtond_notify_clients(&daemon, &cl, &key, &value1);
+
+	value1.store.d_string = buxton_string_pack("real value");
+	key.group = buxton_string_pack("daemon-check");
+	key.name = buxton_string_pack("name");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value1);
+
+	value2.type = BUXTON_TYPE_STRING;
+	value2.store.d_string = buxton_string_pack("new value");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1,
+		"Failed to get correct response to notify string");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_STRING,
+		"Failed to get correct notification value type string");
+	fail_if(!streq(list[0].store.d_string.value, "new value"),
+		"Failed to get correct notification value data string");
+
+	free(list[0].store.d_string.value);
+	free(list);
+
+	key.group = buxton_string_pack("group");
+	key.name.value = NULL;
+	key.name.length = 0;
+	r = buxton_direct_create_group(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Unable to create group");
+	r = buxton_direct_set_label(&daemon.buxton, &key, &slabel);
+	fail_if(!r, "Unable set group label");
+
+	value1.type = BUXTON_TYPE_INT32;
 	value1.store.d_int32 = 1;
 	value2.type = BUXTON_TYPE_INT32;
 	value2.store.d_int32 = 2;
@@ -2099,7 +3479,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2129,7 +3509,7 @@ START_TEST(buxtond_notify_clients_check)
 	r = buxton_direct_set_value(&daemon.buxton, &key,
 				    &value1, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
 	buxtond_notify_clients(&daemon, &cl, &key, &value2);
@@ -2149,156 +3529,549 @@ START_TEST(buxtond_notify_clients_check)
 
 	free(list);
 
-	value1.type = BUXTON_TYPE_INT64;
-	value1.store.d_int64 = 2;
-	value2.type = BUXTON_TYPE_INT64;
-	value2.store.d_int64 = 3;
-	key.group = buxton_string_pack("group");
-	key.name = buxton_string_pack("name64");
-	key.type = BUXTON_TYPE_INT64;
+	value1.type = BUXTON_TYPE_INT64;
+	value1.store.d_int64 = 2;
+	value2.type = BUXTON_TYPE_INT64;
+	value2.store.d_int64 = 3;
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("name64");
+	key.type = BUXTON_TYPE_INT64;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1,
+		"Failed to get correct response to notify int64");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_INT64,
+		"Failed to get correct notification value type int 64");
+	fail_if(list[0].store.d_int64 != 3,
+		"Failed to get correct notification value data int64");
+
+	free(list);
+
+	value1.type = BUXTON_TYPE_UINT64;
+	value1.store.d_uint64 = 2;
+	value2.type = BUXTON_TYPE_UINT64;
+	value2.store.d_uint64 = 3;
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("nameu64");
+	key.type = BUXTON_TYPE_UINT64;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1,
+		"Failed to get correct response to notify uint64");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_UINT64,
+		"Failed to get correct notification value type uint64");
+	fail_if(list[0].store.d_uint64 != 3,
+		"Failed to get correct notification value data uint64");
+
+	free(list);
+
+	value1.type = BUXTON_TYPE_FLOAT;
+	value1.store.d_float = 3.1F;
+	value2.type = BUXTON_TYPE_FLOAT;
+	value2.store.d_float = 3.14F;
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("namef");
+	key.type = BUXTON_TYPE_FLOAT;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1,
+		"Failed to get correct response to notify float");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_FLOAT,
+		"Failed to get correct notification value type float");
+	fail_if(list[0].store.d_float != 3.14F,
+		"Failed to get correct notification value data float");
+
+	free(list);
+
+	value1.type = BUXTON_TYPE_DOUBLE;
+	value1.store.d_double = 3.141F;
+	value2.type = BUXTON_TYPE_DOUBLE;
+	value2.store.d_double = 3.1415F;
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("named");
+	key.type = BUXTON_TYPE_DOUBLE;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1,
+		"Failed to get correct response to notify double");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_DOUBLE,
+		"Failed to get correct notification value type double");
+	fail_if(list[0].store.d_double != 3.1415F,
+		"Failed to get correct notification value data double");
+
+	free(list);
+
+	value1.type = BUXTON_TYPE_BOOLEAN;
+	value1.store.d_boolean = false;
+	value2.type = BUXTON_TYPE_BOOLEAN;
+	value2.store.d_int32 = true;
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("nameb");
+	key.type = BUXTON_TYPE_BOOLEAN;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl, &key, 0, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1,
+		"Failed to get correct response to notify bool");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 0, "Failed to get correct message id");
+	fail_if(list[0].type != BUXTON_TYPE_BOOLEAN,
+		"Failed to get correct notification value type bool");
+	fail_if(list[0].store.d_boolean != true,
+		"Failed to get correct notification value data bool");
+
+	free(list);
+	close(client);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+START_TEST(buxtond_notify_shared_value_check)
+{
+	int client1, server1, client2, server2;
+	BuxtonDaemon daemon;
+	_BuxtonKey key;
+	BuxtonData value1, value2;
+	client_list_item cl1, cl2;
+	BuxtonWatch *watch;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl1, sizeof(client_list_item));
+	memzero(&cl2, sizeof(client_list_item));
+	setup_socket_pair(&client1, &server1);
+	setup_socket_pair(&client2, &server2);
+	fail_if(fcntl(client1, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(client2, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	cl1.fd = server1;
+	cl1.cred.uid = 1002;
+	cl2.fd = server2;
+	cl2.cred.uid = 1002;
+	cl2.version = BUXTON_PROTOCOL_VERSION;
+	daemon.notify_mapping = hashmap_new(string_hash_func,
+					    string_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	value1.type = BUXTON_TYPE_STRING;
+	value1.store.d_string = buxton_string_pack("shared value");
+	key.group = buxton_string_pack("daemon-check");
+	key.name = buxton_string_pack("shared");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_set_value(&daemon.buxton, &key,
+				    &value1, NULL);
+	fail_if(!r, "Failed to set value for notify");
+	register_notification(&daemon, &cl1, &key, 1, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+	register_notification(&daemon, &cl2, &key, 2, 0, &status);
+	fail_if(status != 0,
+		"Failed to register notification for notify");
+
+	/* Both subscribers share the key's last value */
+	fail_if(hashmap_size(daemon.notify_mapping) != 1,
+		"Failed to share the key's last value");
+	watch = hashmap_get(daemon.notify_mapping, "daemon-check\nshared");
+	fail_if(!watch, "Failed to find the key's last value");
+	fail_if(!watch->value || watch->version != 0,
+		"Failed to start from the registered value");
+
+	/* The registered value is known, so nothing is sent */
+	buxtond_notify_clients(&daemon, &cl1, &key, &value1);
+	fail_if(read(client1, buf, 4096) >= 0,
+		"Notified of an unchanged value");
+	fail_if(read(client2, buf, 4096) >= 0,
+		"Notified of an unchanged value");
+
+	/* A longer value with the same start is a change */
+	value2.type = BUXTON_TYPE_STRING;
+	value2.store.d_string = buxton_string_pack("shared value too");
+	buxtond_notify_clients(&daemon, &cl1, &key, &value2);
+	buxtond_notify_clients(&daemon, &cl1, &key, &value2);
+	fail_if(watch->version != 1, "Failed to version the changed value");
+
+	s = read(client1, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	fail_if(*(uint16_t *)buf != BUXTON_CONTROL_CODE,
+		"Notification not sent in version 1");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1 || msgid != 1,
+		"Failed to get correct version 1 notification");
+	free(list[0].store.d_string.value);
+	free(list);
+
+	/* Version 2 subscribers share a frame that gives no string an index */
+	s = read(client2, buf, 4096);
+	fail_if(s < 0, "Read from client failed");
+	fail_if(*(uint16_t *)buf != BUXTON_CONTROL_CODE_V2,
+		"Notification not sent in version 2");
+	fail_if(cl2.encode.count != 0,
+		"Notification changed the client's string table");
+	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
+	fail_if(csize != 1,
+		"Failed to get correct response to notify string");
+	fail_if(msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct control type");
+	fail_if(msgid != 2, "Failed to get correct message id");
+	fail_if(!streq(list[0].store.d_string.value, "shared value too"),
+		"Failed to get correct notification value data string");
+	fail_if((size_t)s != buxton_get_message_size(buf, (size_t)s),
+		"Notified more than once of one change");
+	free(list[0].store.d_string.value);
+	free(list);
+
+	/* An unset is a change, unsetting again is not */
+	buxtond_notify_clients(&daemon, &cl1, &key, NULL);
+	buxtond_notify_clients(&daemon, &cl1, &key, NULL);
+	fail_if(watch->value, "Failed to record the unset value");
+	fail_if(watch->version != 2, "Failed to version the unset value");
+
+	/* Unregistering keeps the last value until the last subscriber */
+	msgid = unregister_notification(&daemon, &cl1, &key, &status);
+	fail_if(status != 0 || msgid != 1,
+		"Failed to unregister from notifications");
+	fail_if(hashmap_size(daemon.notify_mapping) != 1,
+		"Dropped the last value while subscribed");
+	msgid = unregister_notification(&daemon, &cl2, &key, &status);
+	fail_if(status != 0 || msgid != 2,
+		"Failed to unregister from notifications");
+	fail_if(hashmap_size(daemon.notify_mapping) != 0,
+		"Failed to drop the last value");
+
+	hashmap_free(daemon.notify_mapping);
+	close(client1);
+	close(server1);
+	close(client2);
+	close(server2);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
+START_TEST(buxtond_notify_coalesced_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	_BuxtonKey key;
+	BuxtonData value;
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	uint8_t buf[4096];
+	uint32_t msgid;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	cl.fd = server;
+	cl.cred.uid = 1002;
+	daemon.notify_mapping = hashmap_new(string_hash_func,
+					    string_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	value.type = BUXTON_TYPE_INT32;
+	value.store.d_int32 = 0;
+	key.group = buxton_string_pack("daemon-check");
+	key.name = buxton_string_pack("coalesced");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_INT32;
 	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+				    &value, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
+	register_notification(&daemon, &cl, &key, 3, 50, &status);
 	fail_if(status != 0,
 		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+
+	/* The first change goes out, the next ones wait for the interval */
+	for (int32_t i = 1; i <= 3; i++) {
+		value.store.d_int32 = i;
+		buxtond_notify_clients(&daemon, &cl, &key, &value);
+	}
+	fail_if(!daemon.pending || !daemon.timer_due,
+		"Failed to hold back changes within the interval");
+	fail_if(cl.coalesced != 1, "Failed to count the replaced change");
 
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
+	fail_if((size_t)s != buxton_get_message_size(buf, (size_t)s),
+		"Sent changes within the interval");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify int64");
-	fail_if(msg != BUXTON_CONTROL_CHANGED,
-		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_INT64,
-		"Failed to get correct notification value type int 64");
-	fail_if(list[0].store.d_int64 != 3,
-		"Failed to get correct notification value data int64");
-
+	fail_if(csize != 1 || msgid != 3 || list[0].store.d_int32 != 1,
+		"Failed to send the first change");
 	free(list);
 
-	value1.type = BUXTON_TYPE_UINT64;
-	value1.store.d_uint64 = 2;
-	value2.type = BUXTON_TYPE_UINT64;
-	value2.store.d_uint64 = 3;
-	key.group = buxton_string_pack("group");
-	key.name = buxton_string_pack("nameu64");
-	key.type = BUXTON_TYPE_UINT64;
-	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
-	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
-	fail_if(status != 0,
-		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+	/* Nothing is due yet */
+	buxtond_send_pending(&daemon);
+	fail_if(!daemon.pending, "Sent a change before the interval passed");
+	fail_if(read(client, buf, 4096) >= 0,
+		"Sent a change before the interval passed");
 
+	usleep(60000);
+	buxtond_send_pending(&daemon);
+	fail_if(daemon.pending || daemon.timer_due,
+		"Failed to send the pending change");
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify uint64");
+	fail_if(csize != 1, "Failed to get the pending change");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_UINT64,
-		"Failed to get correct notification value type uint64");
-	fail_if(list[0].store.d_uint64 != 3,
-		"Failed to get correct notification value data uint64");
-
+	fail_if(msgid != 3, "Failed to get correct message id");
+	fail_if(list[0].store.d_int32 != 3,
+		"Failed to send the latest value");
 	free(list);
 
-	value1.type = BUXTON_TYPE_FLOAT;
-	value1.store.d_float = 3.1F;
-	value2.type = BUXTON_TYPE_FLOAT;
-	value2.store.d_float = 3.14F;
-	key.group = buxton_string_pack("group");
-	key.name = buxton_string_pack("namef");
-	key.type = BUXTON_TYPE_FLOAT;
-	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
-	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
-	fail_if(status != 0,
-		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+	/* A pending change is forgotten with its subscriber */
+	value.store.d_int32 = 4;
+	buxtond_notify_clients(&daemon, &cl, &key, &value);
+	fail_if(!daemon.pending, "Sent a change within the interval");
+	msgid = unregister_notification(&daemon, &cl, &key, &status);
+	fail_if(status != 0 || msgid != 3,
+		"Failed to unregister from notifications");
+	fail_if(daemon.pending, "Kept the change of an unregistered client");
 
-	s = read(client, buf, 4096);
-	fail_if(s < 0, "Read from client failed");
-	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify float");
-	fail_if(msg != BUXTON_CONTROL_CHANGED,
-		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_FLOAT,
-		"Failed to get correct notification value type float");
-	fail_if(list[0].store.d_float != 3.14F,
-		"Failed to get correct notification value data float");
+	hashmap_free(daemon.notify_mapping);
+	close(client);
+	close(server);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
 
-	free(list);
+START_TEST(buxtond_notify_prefix_clients_check)
+{
+	int client, server;
+	BuxtonDaemon daemon;
+	_BuxtonKey key = { {0}, {0}, {0}, 0};
+	BuxtonString slabel;
+	BuxtonData value;
+	client_list_item cl;
+	int32_t status;
+	bool r;
+	BuxtonData *list;
+	BuxtonControlMessage msg;
+	ssize_t csize;
+	ssize_t s;
+	size_t size;
+	uint8_t buf[4096];
+	uint32_t msgid;
 
-	value1.type = BUXTON_TYPE_DOUBLE;
-	value1.store.d_double = 3.141F;
-	value2.type = BUXTON_TYPE_DOUBLE;
-	value2.store.d_double = 3.1415F;
-	key.group = buxton_string_pack("group");
-	key.name = buxton_string_pack("named");
-	key.type = BUXTON_TYPE_DOUBLE;
-	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	memzero(&cl, sizeof(client_list_item));
+	setup_socket_pair(&client, &server);
+	fail_if(fcntl(client, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+
+	cl.fd = server;
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl.smack_label = &slabel;
+	else
+		cl.smack_label = NULL;
+	cl.cred.uid = 1002;
+	daemon.notify_prefixes = buxton_trie_new();
+	fail_if(!daemon.notify_prefixes, "Failed to allocate trie");
+	fail_if(!buxton_cache_smack_rules(),
+		"Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+
+	key.group = buxton_string_pack("no-such-group");
+	register_prefix_notification(&daemon, &cl, &key, 4, &status);
+	fail_if(status == 0, "Registered prefix notification on missing group");
+
+	key.group = buxton_string_pack("daemon-check");
+	register_prefix_notification(&daemon, &cl, &key, 5, &status);
+	fail_if(status != 0, "Failed to register group notification");
+	key.name = buxton_string_pack("na");
+	register_prefix_notification(&daemon, &cl, &key, 7, &status);
+	fail_if(status != 0, "Failed to register prefix notification");
+
+	value.type = BUXTON_TYPE_STRING;
+	value.store.d_string = buxton_string_pack("prefix value");
+	key.name = buxton_string_pack("name");
+	key.layer = buxton_string_pack("base");
+	key.type = BUXTON_TYPE_STRING;
+	r = buxton_direct_set_value(&daemon.buxton, &key, &value, NULL);
 	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
-	fail_if(status != 0,
-		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+	buxtond_notify_clients(&daemon, &cl, &key, &value);
 
+	/* Both the group and the prefix match, the group comes first */
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
-	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify double");
+	size = buxton_get_message_size(buf, (size_t)s);
+	fail_if(size == 0 || size >= (size_t)s,
+		"Failed to get both prefix notifications");
+	csize = buxton_deserialize_message(buf, &msg, size, &msgid, &list);
+	fail_if(csize != 3, "Failed to get correct prefix notification");
 	fail_if(msg != BUXTON_CONTROL_CHANGED,
 		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_DOUBLE,
-		"Failed to get correct notification value type double");
-	fail_if(list[0].store.d_double != 3.1415F,
-		"Failed to get correct notification value data double");
-
+	fail_if(msgid != 5, "Failed to get group notification message id");
+	fail_if(!streq(list[0].store.d_string.value, "daemon-check"),
+		"Failed to get notification group");
+	fail_if(!streq(list[1].store.d_string.value, "name"),
+		"Failed to get notification name");
+	fail_if(!streq(list[2].store.d_string.value, "prefix value"),
+		"Failed to get notification value");
+	for (int i = 0; i < csize; i++) {
+		free(list[i].store.d_string.value);
+	}
+	free(list);
+	csize = buxton_deserialize_message(buf + size, &msg, (size_t)s - size,
+					   &msgid, &list);
+	fail_if(csize != 3, "Failed to get correct prefix notification");
+	fail_if(msgid != 7, "Failed to get prefix notification message id");
+	for (int i = 0; i < csize; i++) {
+		free(list[i].store.d_string.value);
+	}
 	free(list);
 
-	value1.type = BUXTON_TYPE_BOOLEAN;
-	value1.store.d_boolean = false;
-	value2.type = BUXTON_TYPE_BOOLEAN;
-	value2.store.d_int32 = true;
-	key.group = buxton_string_pack("group");
-	key.name = buxton_string_pack("nameb");
-	key.type = BUXTON_TYPE_BOOLEAN;
-	r = buxton_direct_set_value(&daemon.buxton, &key,
-				    &value1, NULL);
-	fail_if(!r, "Failed to set value for notify");
-	register_notification(&daemon, &cl, &key, 0, &status);
-	fail_if(status != 0,
-		"Failed to register notification for notify");
-	buxtond_notify_clients(&daemon, &cl, &key, &value2);
+	key.name = buxton_string_pack("na");
+	msgid = unregister_prefix_notification(&daemon, &cl, &key, &status);
+	fail_if(status != 0, "Failed to unregister prefix notification");
+	fail_if(msgid != 7, "Failed to get prefix notification message id");
+	msgid = unregister_prefix_notification(&daemon, &cl, &key, &status);
+	fail_if(status == 0, "Unregistered prefix notification twice");
 
+	/* An unset carries no value */
+	key.name = buxton_string_pack("name");
+	buxtond_notify_clients(&daemon, &cl, &key, NULL);
 	s = read(client, buf, 4096);
 	fail_if(s < 0, "Read from client failed");
 	csize = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid, &list);
-	fail_if(csize != 1,
-		"Failed to get correct response to notify bool");
-	fail_if(msg != BUXTON_CONTROL_CHANGED,
-		"Failed to get correct control type");
-	fail_if(msgid != 0, "Failed to get correct message id");
-	fail_if(list[0].type != BUXTON_TYPE_BOOLEAN,
-		"Failed to get correct notification value type bool");
-	fail_if(list[0].store.d_boolean != true,
-		"Failed to get correct notification value data bool");
+	fail_if(csize != 2, "Failed to get correct unset notification");
+	fail_if(msgid != 5, "Failed to get group notification message id");
+	for (int i = 0; i < csize; i++) {
+		free(list[i].store.d_string.value);
+	}
+	free(list);
+
+	/* Without the label of a key that is gone, labelled clients aren't told */
+	r = buxton_direct_unset_value(&daemon.buxton, &key, NULL);
+	fail_if(!r, "Failed to unset value for notify");
+	buxtond_notify_clients(&daemon, &cl, &key, NULL);
+	s = read(client, buf, 4096);
+	if (use_smack()) {
+		fail_if(s >= 0, "Notified labelled client of unknown unset");
+	} else {
+		fail_if(s < 0, "Failed to notify client of unset");
+	}
 
+	/* Only the whole group is told of a group change, without a name */
+	key.name = buxton_string_pack("na");
+	register_prefix_notification(&daemon, &cl, &key, 8, &status);
+	fail_if(status != 0, "Failed to register prefix notification");
+	buxtond_notify_group(&daemon, &key);
+	s = read(client, buf, 4096);
+	fail_if(s < 0, "Failed to notify group change");
+	size = buxton_get_message_size(buf, (size_t)s);
+	fail_if(size != (size_t)s, "Notified a prefix of a group change");
+	csize = buxton_deserialize_message(buf, &msg, size, &msgid, &list);
+	fail_if(csize != 2 || msg != BUXTON_CONTROL_CHANGED,
+		"Failed to get correct group notification");
+	fail_if(msgid != 5, "Failed to get group notification message id");
+	fail_if(!streq(list[0].store.d_string.value, "daemon-check") ||
+		list[1].store.d_string.length != 1,
+		"Group notification named a key");
+	for (int i = 0; i < csize; i++) {
+		free(list[i].store.d_string.value);
+	}
 	free(list);
+	msgid = unregister_prefix_notification(&daemon, &cl, &key, &status);
+	fail_if(status != 0 || msgid != 8,
+		"Failed to unregister prefix notification");
+
+	key.name.value = NULL;
+	key.name.length = 0;
+	msgid = unregister_prefix_notification(&daemon, &cl, &key, &status);
+	fail_if(status != 0, "Failed to unregister group notification");
+	fail_if(msgid != 5, "Failed to get group notification message id");
+	fail_if(cl.prefixes, "Prefix notifications left on client");
+	fail_if(daemon.notify_prefixes->child, "Prefix trie not pruned");
+
 	close(client);
+	close(server);
+	buxton_trie_free(daemon.notify_prefixes);
 	buxton_direct_close(&daemon.buxton);
 }
 END_TEST
@@ -2323,77 +4096,93 @@ START_TEST(identify_client_check)
 }
 END_TEST
 
-START_TEST(add_pollfd_check)
+START_TEST(add_event_source_check)
 {
 	BuxtonDaemon daemon;
-	int fd;
-	short events;
-	bool a;
+	BuxtonEventSource source;
+	struct epoll_event ev;
+	int client, server;
 
-	fd = 3;
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
+	setup_socket_pair(&client, &server);
 	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
-	events = 1;
-	a = true;
-	add_pollfd(&daemon, fd, events, a);
+	daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fail_if(daemon.epoll_fd < 0, "Failed to create epoll fd");
+	source.type = BUXTON_EVENT_CLIENT;
+	source.fd = server;
+	source.client = NULL;
+	fail_if(!add_event_source(&daemon, &source, EPOLLIN),
+		"Failed to add event source");
 	fail_if(daemon.nfds != 1, "Failed to increase nfds");
-	fail_if(daemon.pollfds[0].fd != fd, "Failed to set pollfd");
-	fail_if(daemon.pollfds[0].events != events, "Failed to set events");
-	fail_if(daemon.pollfds[0].revents != 0, "Failed to set revents");
-	fail_if(daemon.accepting[0] != a, "Failed to set accepting status");
-	free(daemon.pollfds);
-	free(daemon.accepting);
+	fail_if(add_event_source(&daemon, &source, EPOLLIN),
+		"Added event source twice");
+	fail_if(daemon.nfds != 1, "Increased nfds on failure");
+
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 0,
+		"Got event without data");
+	fail_if(write(client, "x", 1) != 1, "Failed to write to socket");
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 1,
+		"Failed to get event with data");
+	fail_if(ev.data.ptr != &source, "Failed to set event source");
+	fail_if(!(ev.events & EPOLLIN), "Failed to set events");
+
+	close(daemon.epoll_fd);
+	close(client);
+	close(server);
 }
 END_TEST
 
-START_TEST(del_pollfd_check)
+START_TEST(del_event_source_check)
 {
 	BuxtonDaemon daemon;
-	int fd;
-	short events;
-	bool a;
-
-	fd = 3;
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
+	BuxtonEventSource source1, source2;
+	BuxtonEventSource *source3;
+	struct epoll_event ev;
+	int client1, server1;
+	int client2, server2;
+
+	setup_socket_pair(&client1, &server1);
+	setup_socket_pair(&client2, &server2);
 	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
-	events = 1;
-	a = true;
-	add_pollfd(&daemon, fd, events, a);
-	fail_if(daemon.nfds != 1, "Failed to add pollfd");
-	del_pollfd(&daemon, 0);
-	fail_if(daemon.nfds != 0, "Failed to decrease nfds 1");
-
-	fd = 4;
-	events = 2;
-	a = false;
-	add_pollfd(&daemon, fd, events, a);
-	fail_if(daemon.nfds != 1, "Failed to increase nfds after del");
-	fail_if(daemon.pollfds[0].fd != fd, "Failed to set pollfd after del");
-	fail_if(daemon.pollfds[0].events != events,
-		"Failed to set events after del");
-	fail_if(daemon.pollfds[0].revents != 0,
-		"Failed to set revents after del");
-	fail_if(daemon.accepting[0] != a,
-		"Failed to set accepting status after del");
-	fd = 5;
-	events = 3;
-	a = true;
-	add_pollfd(&daemon, fd, events, a);
-	del_pollfd(&daemon, 0);
-	fail_if(daemon.nfds != 1, "Failed to delete fd 2");
-	fail_if(daemon.pollfds[0].fd != fd, "Failed to set pollfd after del2");
-	fail_if(daemon.pollfds[0].events != events,
-		"Failed to set events after del2");
-	fail_if(daemon.pollfds[0].revents != 0,
-		"Failed to set revents after del2");
-	fail_if(daemon.accepting[0] != a,
-		"Failed to set accepting status after del2");
+	daemon.sources = NULL;
+	daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fail_if(daemon.epoll_fd < 0, "Failed to create epoll fd");
+	source1.type = BUXTON_EVENT_CLIENT;
+	source1.fd = server1;
+	source2.type = BUXTON_EVENT_CLIENT;
+	source2.fd = server2;
+	fail_if(!add_event_source(&daemon, &source1, EPOLLIN),
+		"Failed to add event source 1");
+	fail_if(!add_event_source(&daemon, &source2, EPOLLIN),
+		"Failed to add event source 2");
+	fail_if(daemon.nfds != 2, "Failed to add event sources");
+	del_event_source(&daemon, &source1);
+	fail_if(daemon.nfds != 1, "Failed to decrease nfds 1");
+
+	fail_if(write(client1, "x", 1) != 1, "Failed to write to socket 1");
+	fail_if(write(client2, "x", 1) != 1, "Failed to write to socket 2");
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 1,
+		"Failed to get event after del");
+	fail_if(ev.data.ptr != &source2, "Got event for deleted source");
+	del_event_source(&daemon, &source2);
+	fail_if(daemon.nfds != 0, "Failed to decrease nfds 2");
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 0,
+		"Got event for deleted source 2");
+
+	source3 = add_event_fd(&daemon, server1, EPOLLIN, BUXTON_EVENT_LISTEN);
+	fail_if(!source3, "Failed to add event fd");
+	fail_if(daemon.sources != source3, "Failed to track event fd");
+	fail_if(source3->type != BUXTON_EVENT_LISTEN, "Failed to set type");
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 1,
+		"Failed to get event for event fd");
+	fail_if(ev.data.ptr != source3, "Failed to set event fd source");
+	del_event_source(&daemon, source3);
+	free(source3);
+
+	close(daemon.epoll_fd);
+	close(client1);
+	close(server1);
+	close(client2);
+	close(server2);
 }
 END_TEST
 
@@ -2415,12 +4204,8 @@ START_TEST(terminate_client_check)
 	client_list_item *client;
 	BuxtonDaemon daemon;
 	int dummy;
-	BuxtonList *n_list = NULL;
-	BuxtonList *key_list = NULL;
-	char *key_name = strdup("groupkey");
-	char *key_name_copy = strdup("groupkey");
+	BuxtonWatch *watch = NULL;
 	int ret = -1;
-	uint64_t *fd = NULL;
 	BuxtonNotification *nitem = NULL;
 
 	client = malloc0(sizeof(client_list_item));
@@ -2429,50 +4214,407 @@ START_TEST(terminate_client_check)
 	fail_if(!client->smack_label, "smack label malloc failed");
 	daemon.client_list = client;
 	setup_socket_pair(&client->fd, &dummy);
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
 	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
-	add_pollfd(&daemon, client->fd, 2, false);
-	fail_if(daemon.nfds != 1, "Failed to add pollfd");
+	daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fail_if(daemon.epoll_fd < 0, "Failed to create epoll fd");
+	client->source.type = BUXTON_EVENT_CLIENT;
+	client->source.fd = client->fd;
+	client->source.client = client;
+	fail_if(!add_event_source(&daemon, &client->source, EPOLLIN),
+		"Failed to add event source");
+	fail_if(daemon.nfds != 1, "Failed to add event source");
 	client->smack_label->value = strdup("dummy");
 	client->smack_label->length = 6;
 	fail_if(!client->smack_label->value, "label strdup failed");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
 
 	nitem = malloc0(sizeof(BuxtonNotification));
 	fail_if(!nitem,"Failed to allocate notification item\n");
 	nitem->client = client;
-	nitem->old_data = NULL;
 	nitem->msgid = 0;
 
-	ret = buxton_list_append(&n_list, nitem);
-	fail_if(!ret, "Failed to append to list\n");
-	ret = buxton_list_append(&key_list, key_name_copy);
-	fail_if(!ret, "Failed to append to list\n");
+	watch = malloc0(sizeof(BuxtonWatch));
+	fail_if(!watch, "Failed to allocate watch\n");
+	watch->name = strdup("groupkey");
+	fail_if(!watch->name, "Failed to allocate key name\n");
+	nitem->watch = watch;
+	LIST_PREPEND(BuxtonNotification, subscriber, watch->subscribers, nitem);
+	LIST_PREPEND(BuxtonNotification, subscription, client->subscriptions,
+		     nitem);
 
-	fd = malloc0(sizeof(uint64_t));
-	fail_if(!fd, "Failed to allocate fd\n");
-	*fd = (uint64_t)client->fd;
-
-	ret = hashmap_put(daemon.notify_mapping, key_name, n_list);
-	fail_if(ret < 0,"Failed to put in hashmap\n");
-	ret = hashmap_put(daemon.client_key_mapping, fd, key_list);
+	ret = hashmap_put(daemon.notify_mapping, watch->name, watch);
 	fail_if(ret < 0,"Failed to put in hashmap\n");
 
-	terminate_client(&daemon, client, 0);
+	terminate_client(&daemon, client);
 	fail_if(daemon.client_list, "Failed to set client list item to NULL");
+	fail_if(daemon.nfds != 0, "Failed to remove event source");
+	fail_if(hashmap_size(daemon.notify_mapping) != 0,
+		"Failed to remove the key's last value");
 
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	close(daemon.epoll_fd);
 	close(dummy);
 }
 END_TEST
 
+static void add_client_source(BuxtonDaemon *daemon, client_list_item *cl)
+{
+	cl->source.type = BUXTON_EVENT_CLIENT;
+	cl->source.fd = cl->fd;
+	cl->source.client = cl;
+	fail_if(!add_event_source(daemon, &cl->source, EPOLLIN),
+		"Failed to add client event source");
+}
+
+START_TEST(queue_message_check)
+{
+	client_list_item *cl;
+	BuxtonDaemon daemon;
+	struct epoll_event ev;
+	uint8_t *msg;
+	uint8_t buf[4096];
+	int sndbuf = 4096;
+	/* a version 2 message without parameters */
+	uint8_t tail[BUXTON_MSGID_OFFSET + sizeof(uint32_t) + 1];
+	size_t queued;
+	size_t last = 0;
+	ssize_t l;
+	BuxtonControlMessage type;
+	BuxtonData *list = NULL;
+	uint32_t msgid;
+	int peer;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fail_if(daemon.epoll_fd < 0, "Failed to create epoll fd");
+	daemon.queue_limit = 4 * sizeof(buf);
+	daemon.queue_policy = BUXTON_QUEUE_DROP;
+	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
+	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
+
+	cl = malloc0(sizeof(client_list_item));
+	fail_if(!cl, "client malloc failed");
+	setup_socket_pair(&cl->fd, &peer);
+	fail_if(fcntl(cl->fd, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(setsockopt(cl->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf,
+			   sizeof(sndbuf)) < 0, "Failed to shrink send buffer");
+	daemon.client_list = cl;
+	add_client_source(&daemon, cl);
+
+	/* fill the socket until the daemon has to queue */
+	while (cl->out_count == 0) {
+		msg = malloc0(sizeof(buf));
+		fail_if(!msg, "Failed to allocate message");
+		fail_if(!queue_message(&daemon, cl, msg, sizeof(buf), false),
+			"Failed to send message");
+	}
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 0,
+		"Client with queued output should wait for EPOLLOUT");
+
+	/* notifications beyond the limit are dropped */
+	while (cl->dropped == 0) {
+		msg = malloc0(sizeof(buf));
+		fail_if(!msg, "Failed to allocate message");
+		fail_if(!queue_message(&daemon, cl, msg, sizeof(buf), true),
+			"Dropping a notification should keep the client");
+	}
+	fail_if(cl->out_bytes > daemon.queue_limit,
+		"Output queue grew beyond its limit");
+	fail_if(cl->closing, "Client disconnected for a dropped notification");
+	fail_if(!cl->overflowed, "Failed to record the dropped notification");
+	queued = cl->out_bytes;
+
+	/* draining the peer lets the whole queue flush */
+	cl->version = BUXTON_PROTOCOL_VERSION;
+	while (cl->out_count > 0) {
+		fail_if(read(peer, buf, sizeof(buf)) <= 0,
+			"Failed to read queued output");
+		fail_if(!flush_client(&daemon, cl), "Failed to flush client");
+	}
+	fail_if(cl->out_bytes != 0, "Queue drained with bytes left");
+	fail_if(queued == 0, "Nothing was queued");
+
+	/* then the client is told it missed notifications */
+	fail_if(cl->overflowed, "Failed to send the overflow notice");
+	fail_if(fcntl(peer, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	while ((l = read(peer, buf, sizeof(buf))) > 0) {
+		if ((size_t)l >= sizeof(tail)) {
+			memcpy(tail, buf + l - (ssize_t)sizeof(tail),
+			       sizeof(tail));
+		} else {
+			memmove(tail, tail + l, sizeof(tail) - (size_t)l);
+			memcpy(tail + sizeof(tail) - (size_t)l, buf, (size_t)l);
+		}
+		last += (size_t)l;
+	}
+	fail_if(last < sizeof(tail), "Failed to read the overflow notice");
+	fail_if(buxton_deserialize_message(tail, &type, sizeof(tail), &msgid,
+					   &list) != 0 ||
+		type != BUXTON_CONTROL_OVERFLOW,
+		"Failed to get the overflow notice last");
+	free(list);
+	cl->version = 0;
+	fail_if(fcntl(peer, F_SETFL, 0), "Failed to set socket to blocking");
+
+	/* a response over the limit always disconnects */
+	while (cl->out_count == 0) {
+		msg = malloc0(sizeof(buf));
+		fail_if(!msg, "Failed to allocate message");
+		fail_if(!queue_message(&daemon, cl, msg, sizeof(buf), false),
+			"Failed to send message");
+	}
+	while (!cl->closing) {
+		msg = malloc0(sizeof(buf));
+		fail_if(!msg, "Failed to allocate message");
+		(void)queue_message(&daemon, cl, msg, sizeof(buf), false);
+	}
+	msg = malloc0(sizeof(buf));
+	fail_if(!msg, "Failed to allocate message");
+	fail_if(queue_message(&daemon, cl, msg, sizeof(buf), true),
+		"Queued a message for a closing client");
+	fail_if(epoll_wait(daemon.epoll_fd, &ev, 1, 0) != 1,
+		"Disconnected client not reported by epoll");
+
+	terminate_client(&daemon, cl);
+	fail_if(daemon.client_list, "Failed to terminate client");
+
+	hashmap_free(daemon.notify_mapping);
+	close(daemon.epoll_fd);
+	close(peer);
+}
+END_TEST
+
+#define LIST_STREAM_KEYS 300
+
+START_TEST(buxtond_handle_message_list_names_check)
+{
+	BuxtonDaemon daemon;
+	BuxtonString slabel;
+	BuxtonStringTable table;
+	client_list_item *cl;
+	BuxtonData layer, group, prefix, value;
+	BuxtonData *list;
+	BuxtonData *params = NULL;
+	size_t params_size = 0;
+	BuxtonArray *out_list;
+	BuxtonControlMessage msg;
+	_BuxtonKey key;
+	const char *layers[] = { "base", "temp" };
+	char name[256];
+	char pad[200];
+	bool seen[LIST_STREAM_KEYS];
+	uint8_t *buf;
+	size_t have, msize, size, names;
+	ssize_t s, count;
+	int32_t status;
+	uint32_t msgid;
+	int sndbuf = 4096;
+	int chunks;
+	int peer;
+	int removed;
+	int n;
+	bool done;
+
+	memzero(&daemon, sizeof(BuxtonDaemon));
+	daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fail_if(daemon.epoll_fd < 0, "Failed to create epoll fd");
+	cl = malloc0(sizeof(client_list_item));
+	fail_if(!cl, "client malloc failed");
+	setup_socket_pair(&cl->fd, &peer);
+	fail_if(fcntl(cl->fd, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(fcntl(peer, F_SETFL, O_NONBLOCK),
+		"Failed to set socket to non blocking");
+	fail_if(setsockopt(cl->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf,
+			   sizeof(sndbuf)) < 0, "Failed to shrink send buffer");
+	add_client_source(&daemon, cl);
+	LIST_PREPEND(client_list_item, item, daemon.client_list, cl);
+
+	slabel = buxton_string_pack("_");
+	if (use_smack())
+		cl->smack_label = &slabel;
+	else
+		cl->smack_label = NULL;
+	cl->cred.uid = 1002;
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
+	buf = malloc(BUXTON_MESSAGE_MAX_LENGTH * 2);
+	fail_if(!buf, "Failed to allocate buffer");
+
+	group.type = BUXTON_TYPE_STRING;
+	group.store.d_string = buxton_string_pack("list-stream-check");
+	prefix.type = BUXTON_TYPE_STRING;
+	prefix.store.d_string = (BuxtonString){ NULL, 0 };
+	value.type = BUXTON_TYPE_INT32;
+	/* Long names keep the list over a message with few keys */
+	memset(pad, 'x', sizeof(pad) - 1);
+	pad[sizeof(pad) - 1] = 0;
+
+	for (int l = 0; l < 2; l++) {
+		layer.type = BUXTON_TYPE_STRING;
+		layer.store.d_string = buxton_string_pack((char *)layers[l]);
+		key.layer = layer.store.d_string;
+		key.group = group.store.d_string;
+		key.name = (BuxtonString){ NULL, 0 };
+		key.type = BUXTON_TYPE_STRING;
+		create_group(&daemon, cl, &key, &status);
+		fail_if(status != 0, "Failed to create group for list names");
+		key.type = BUXTON_TYPE_INT32;
+		for (int i = 0; i < LIST_STREAM_KEYS; i++) {
+			snprintf(name, sizeof(name), "list-stream-key-%04d-%s",
+				 i, pad);
+			key.name = buxton_string_pack(name);
+			value.store.d_int32 = i;
+			set_value(&daemon, cl, &key, &value, &status);
+			fail_if(status != 0, "Failed to set value for list names");
+		}
+
+		out_list = buxton_array_new();
+		fail_if(!out_list, "Failed to allocate list");
+		fail_if(!buxton_array_add(out_list, &layer), "Failed to add element to array");
+		fail_if(!buxton_array_add(out_list, &group), "Failed to add element to array");
+		fail_if(!buxton_array_add(out_list, &prefix), "Failed to add element to array");
+
+		/* Older clients get a failure for a list over a message */
+		cl->version = 0;
+		size = buxton_serialize_message(&cl->data,
+						BUXTON_CONTROL_LIST_NAMES, 6,
+						out_list);
+		fail_if(size == 0, "Failed to serialize message");
+		fail_if(!buxtond_handle_message(&daemon, cl, size),
+			"Failed to handle list names message");
+		free(cl->data);
+		cl->data = NULL;
+		s = read(peer, buf, BUXTON_MESSAGE_MAX_LENGTH);
+		fail_if(s <= 0, "Read from client failed");
+		count = buxton_deserialize_message(buf, &msg, (size_t)s, &msgid,
+						   &list);
+		fail_if(count != 1 || msg != BUXTON_CONTROL_STATUS ||
+			list[0].store.d_int32 != -1,
+			"Failed to refuse a list over a message");
+		free(list);
+
+		/* Version 3 clients get it in chunks, paused while queued */
+		cl->version = BUXTON_PROTOCOL_VERSION;
+		memzero(&table, sizeof(BuxtonStringTable));
+		memzero(seen, sizeof(seen));
+		size = buxton_serialize_message(&cl->data,
+						BUXTON_CONTROL_LIST_NAMES, 7,
+						out_list);
+		fail_if(size == 0, "Failed to serialize message");
+		fail_if(!buxtond_handle_message(&daemon, cl, size),
+			"Failed to handle list names message");
+		free(cl->data);
+		cl->data = NULL;
+		fail_if(!cl->stream || cl->out_count == 0,
+			"List not paused for a full socket");
+
+		/* Removing the key the list stopped on must not fail it */
+		fail_if(!cl->stream->cursor.value ||
+			sscanf(cl->stream->cursor.value + group.store.d_string.length,
+			       "list-stream-key-%d", &removed) != 1,
+			"Paused list has no cursor");
+		snprintf(name, sizeof(name), "%s", cl->stream->cursor.value +
+			 group.store.d_string.length);
+		key.name = buxton_string_pack(name);
+		unset_value(&daemon, cl, &key, &status);
+		fail_if(status != 0, "Failed to unset the list cursor");
+		key.name = (BuxtonString){ NULL, 0 };
+
+		have = 0;
+		names = 0;
+		chunks = 0;
+		done = false;
+		while (!done) {
+			s = read(peer, buf + have,
+				 BUXTON_MESSAGE_MAX_LENGTH * 2 - have);
+			if (s <= 0) {
+				fail_if(s < 0 && errno != EAGAIN,
+					"Read from client failed");
+				fail_if(cl->out_count == 0,
+					"Stream stalled with nothing queued");
+				fail_if(!flush_client(&daemon, cl),
+					"Failed to flush client");
+				if (cl->out_count == 0) {
+					fail_if(!buxtond_continue_stream(&daemon, cl),
+						"Failed to continue stream");
+				}
+				continue;
+			}
+			have += (size_t)s;
+
+			while (have >= BUXTON_MESSAGE_HEADER_LENGTH) {
+				msize = buxton_get_message_size(buf, have);
+				fail_if(msize == 0 ||
+					msize > BUXTON_MESSAGE_MAX_LENGTH,
+					"Got a chunk over a message");
+				if (msize > have) {
+					break;
+				}
+				count = buxton_deserialize_message_view(buf, &msg,
+									msize,
+									&msgid,
+									&params,
+									&params_size,
+									&table);
+				fail_if(count < 1, "Failed to read chunk");
+				fail_if(msgid != 7, "Chunk of another message");
+				fail_if(params[0].type != BUXTON_TYPE_INT32 ||
+					params[0].store.d_int32 != 0,
+					"Failed to list names");
+				if (msg == BUXTON_CONTROL_CHUNK) {
+					chunks++;
+				} else {
+					fail_if(msg != BUXTON_CONTROL_STATUS,
+						"Failed to end the stream");
+					done = true;
+				}
+				for (ssize_t i = 1; i < count; i++) {
+					fail_if(params[i].type != BUXTON_TYPE_STRING ||
+						sscanf(params[i].store.d_string.value,
+						       "list-stream-key-%d", &n) != 1 ||
+						n < 0 || n >= LIST_STREAM_KEYS || seen[n],
+						"Got a wrong name");
+					seen[n] = true;
+					names++;
+				}
+				memmove(buf, buf + msize, have - msize);
+				have -= msize;
+			}
+		}
+		fail_if(have != 0, "Got data past the end of the stream");
+		fail_if(chunks < 2, "List not sent in chunks");
+		fail_if(names != LIST_STREAM_KEYS, "Failed to get every name");
+		fail_if(!seen[removed], "Lost the name the list stopped on");
+		fail_if(cl->stream, "Stream kept after its end");
+		buxton_string_table_free(&table);
+		buxton_string_table_free(&cl->encode);
+		buxton_array_free(&out_list, NULL);
+
+		key.name = (BuxtonString){ NULL, 0 };
+		key.type = BUXTON_TYPE_STRING;
+		remove_group(&daemon, cl, &key, &status);
+		fail_if(status != 0, "Failed to remove group for list names");
+	}
+
+	LIST_REMOVE(client_list_item, item, daemon.client_list, cl);
+	free(buf);
+	free(params);
+	free(daemon.params);
+	free(cl->out);
+	close(cl->fd);
+	free(cl);
+	close(peer);
+	close(daemon.epoll_fd);
+	buxton_direct_close(&daemon.buxton);
+}
+END_TEST
+
 START_TEST(handle_client_check)
 {
 	BuxtonDaemon daemon;
@@ -2508,19 +4650,21 @@ START_TEST(handle_client_check)
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	daemon.nfds_alloc = 0;
-	daemon.accepting_alloc = 0;
 	daemon.nfds = 0;
-	daemon.pollfds = NULL;
-	daemon.accepting = NULL;
+	daemon.params = NULL;
+	daemon.params_size = 0;
+	daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fail_if(daemon.epoll_fd < 0, "Failed to create epoll fd");
 	daemon.notify_mapping = hashmap_new(string_hash_func, string_compare_func);
 	fail_if(!daemon.notify_mapping, "Failed to allocate hashmap");
-	daemon.client_key_mapping = hashmap_new(uint64_hash_func, uint64_compare_func);
-	fail_if(!daemon.client_key_mapping, "Failed to allocate hashmap");
+	daemon.buxton.client.uid = 1001;
+	fail_if(!buxton_cache_smack_rules(), "Failed to cache Smack rules");
+	fail_if(!buxton_direct_open(&daemon.buxton),
+		"Failed to open buxton direct connection");
 
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
-	fail_if(daemon.nfds != 1, "Failed to add pollfd 1");
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 1");
+	add_client_source(&daemon, daemon.client_list);
+	fail_if(daemon.nfds != 1, "Failed to add event source 1");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 1");
 	fail_if(daemon.client_list, "Failed to terminate client with no data");
 	close(dummy);
 
@@ -2528,17 +4672,17 @@ START_TEST(handle_client_check)
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
-	fail_if(daemon.nfds != 1, "Failed to add pollfd 2");
+	add_client_source(&daemon, daemon.client_list);
+	fail_if(daemon.nfds != 1, "Failed to add event source 2");
 	do_write(dummy, buf, 1);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 2");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 2");
 	fail_if(!daemon.client_list, "Terminated client with insufficient data");
 	fail_if(daemon.client_list->data, "Didn't clean up left over client data 1");
 
 	bsize = 0;
 	memcpy(message + BUXTON_LENGTH_OFFSET, &bsize, sizeof(uint32_t));
 	do_write(dummy, message, BUXTON_MESSAGE_HEADER_LENGTH);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 3");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 3");
 	fail_if(daemon.client_list, "Failed to terminate client with bad size 1");
 	close(dummy);
 
@@ -2546,12 +4690,12 @@ START_TEST(handle_client_check)
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
-	fail_if(daemon.nfds != 1, "Failed to add pollfd 3");
+	add_client_source(&daemon, daemon.client_list);
+	fail_if(daemon.nfds != 1, "Failed to add event source 3");
 	bsize = BUXTON_MESSAGE_MAX_LENGTH + 1;
 	memcpy(message + BUXTON_LENGTH_OFFSET, &bsize, sizeof(uint32_t));
 	do_write(dummy, message, BUXTON_MESSAGE_HEADER_LENGTH);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 4");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 4");
 	fail_if(daemon.client_list, "Failed to terminate client with bad size 2");
 	close(dummy);
 
@@ -2559,21 +4703,22 @@ START_TEST(handle_client_check)
 	fail_if(!daemon.client_list, "client malloc failed");
 	setup_socket_pair(&daemon.client_list->fd, &dummy);
 	fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK);
-	add_pollfd(&daemon, daemon.client_list->fd, 2, false);
-	fail_if(daemon.nfds != 1, "Failed to add pollfd 4");
+	add_client_source(&daemon, daemon.client_list);
+	fail_if(daemon.nfds != 1, "Failed to add event source 4");
 	bsize = (uint32_t)ret;
 	memcpy(message + BUXTON_LENGTH_OFFSET, &bsize, sizeof(uint32_t));
 	do_write(dummy, message, ret);
-	fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 5");
+	fail_if(handle_client(&daemon, daemon.client_list), "More data available 5");
 	fail_if(!daemon.client_list, "Terminated client with correct data length");
 
 	for (int i = 0; i < 33; i++) {
 		do_write(dummy, message, ret);
 	}
-	fail_if(!handle_client(&daemon, daemon.client_list, 0), "No more data available");
+	fail_if(!handle_client(&daemon, daemon.client_list), "No more data available");
 	fail_if(!daemon.client_list, "Terminated client with correct data length");
-	terminate_client(&daemon, daemon.client_list, 0);
+	terminate_client(&daemon, daemon.client_list);
 	fail_if(daemon.client_list, "Failed to remove client 1");
+	fail_if(daemon.nfds != 0, "Failed to remove event sources");
 	close(dummy);
 
 	//FIXME: add SIGPIPE handler
@@ -2581,15 +4726,16 @@ START_TEST(handle_client_check)
 	/* fail_if(!daemon.client_list, "client malloc failed"); */
 	/* setup_socket_pair(&daemon.client_list->fd, &dummy); */
 	/* fcntl(daemon.client_list->fd, F_SETFL, O_NONBLOCK); */
-	/* add_pollfd(&daemon, daemon.client_list->fd, 2, false); */
-	/* fail_if(daemon.nfds != 1, "Failed to add pollfd 5"); */
+	/* add_client_source(&daemon, daemon.client_list); */
+	/* fail_if(daemon.nfds != 1, "Failed to add event source 5"); */
 	/* write(dummy, message, ret); */
 	/* close(dummy); */
-	/* fail_if(handle_client(&daemon, daemon.client_list, 0), "More data available 6"); */
+	/* fail_if(handle_client(&daemon, daemon.client_list), "More data available 6"); */
 	/* fail_if(daemon.client_list, "Failed to terminate client"); */
 
 	hashmap_free(daemon.notify_mapping);
-	hashmap_free(daemon.client_key_mapping);
+	buxton_direct_close(&daemon.buxton);
+	close(daemon.epoll_fd);
 }
 END_TEST
 
@@ -2961,15 +5107,12 @@ START_TEST(buxtond_fuzz_commands)
 			fclose(f);
 			free(random_layer);
 			free(random_group);
-
-			reap_callbacks();
 		} while (keep_going);
 	} else {		/* child */
 		exec_daemon();
 	}
 
 	usleep(3 * 1000);
-	reap_callbacks();
 }
 END_TEST
 
@@ -2990,7 +5133,15 @@ daemon_suite(void)
 	tcase_add_test(tc, buxton_set_label_check);
 	tcase_add_test(tc, buxton_get_value_for_layer_check);
 	tcase_add_test(tc, buxton_get_value_check);
+	tcase_add_test(tc, buxton_get_values_check);
+	tcase_add_test(tc, buxton_get_group_check);
 	tcase_add_test(tc, buxton_get_label_check);
+	tcase_add_test(tc, buxton_batch_check);
+	tcase_add_test(tc, buxton_enable_cache_check);
+	tcase_add_test(tc, buxton_drain_completions_check);
+	tcase_add_test(tc, buxton_cache_completions_check);
+	tcase_add_test(tc, buxton_close_in_callback_check);
+	tcase_add_test(tc, buxton_open_clients_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("buxton_daemon_functions");
@@ -3011,13 +5162,23 @@ daemon_suite(void)
 	tcase_add_test(tc, buxtond_handle_message_get_label_check);
 	tcase_add_test(tc, buxtond_handle_message_notify_check);
 	tcase_add_test(tc, buxtond_handle_message_unset_check);
+	tcase_add_test(tc, buxtond_handle_message_batch_check);
+	tcase_add_test(tc, buxtond_handle_message_get_values_check);
+	tcase_add_test(tc, buxtond_handle_message_get_group_check);
+	tcase_add_test(tc, buxtond_handle_message_hello_check);
+	tcase_add_test(tc, buxtond_handle_message_key_handle_check);
 	tcase_add_test(tc, buxtond_notify_clients_check);
+	tcase_add_test(tc, buxtond_notify_shared_value_check);
+	tcase_add_test(tc, buxtond_notify_coalesced_check);
+	tcase_add_test(tc, buxtond_notify_prefix_clients_check);
 	tcase_add_test(tc, identify_client_check);
-	tcase_add_test(tc, add_pollfd_check);
-	tcase_add_test(tc, del_pollfd_check);
+	tcase_add_test(tc, add_event_source_check);
+	tcase_add_test(tc, del_event_source_check);
 	tcase_add_test(tc, handle_smack_label_check);
 	tcase_add_test(tc, terminate_client_check);
 	tcase_add_test(tc, handle_client_check);
+	tcase_add_test(tc, queue_message_check);
+	tcase_add_test(tc, buxtond_handle_message_list_names_check);
 	suite_add_tcase(s, tc);
 
 	tc = tcase_create("buxton daemon evil tests");
@@ -24,7 +24,9 @@
 
 #include "backend.h"
 #include "buxtonlist.h"
+#include "buxtontrie.h"
 #include "check_utils.h"
+#include "clientcache.h"
 #include "hashmap.h"
 #include "log.h"
 #include "serialize.h"
@@ -36,6 +38,41 @@
 #error "re-run configure with --enable-debug"
 #endif
 
+/* Linked with --wrap, so allocations can be counted around a call */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+static bool count_allocations = false;
+static size_t allocations = 0;
+
+void *__wrap_malloc(size_t size)
+{
+	if (count_allocations) {
+		allocations++;
+	}
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	if (count_allocations) {
+		allocations++;
+	}
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	if (count_allocations) {
+		allocations++;
+	}
+	return __real_realloc(ptr, size);
+}
+
 START_TEST(log_write_check)
 {
 	char log_file[] = "log-check-stderr-file";
@@ -97,6 +134,154 @@ START_TEST(hashmap_check)
 }
 END_TEST
 
+static void count_item(void *item, void *user_data)
+{
+	(*(int *)item)++;
+	(*(int *)user_data)++;
+}
+
+START_TEST(buxton_trie_check)
+{
+	BuxtonTrie *trie;
+	int group = 0, prefix = 0, other = 0, exact = 0;
+	int visited = 0;
+
+	trie = buxton_trie_new();
+	fail_if(!trie, "Failed to allocate trie");
+
+	fail_if(!buxton_trie_add(trie, "group\n", &group),
+		"Failed to add group to trie");
+	fail_if(!buxton_trie_add(trie, "group\nna", &prefix),
+		"Failed to add prefix to trie");
+	fail_if(!buxton_trie_add(trie, "group\nother", &other),
+		"Failed to add other prefix to trie");
+	fail_if(!buxton_trie_add(trie, "group\nname", &exact),
+		"Failed to add name to trie");
+
+	fail_if(buxton_trie_foreach_prefix(trie, "group\nname", count_item,
+					   &visited) != 3,
+		"Failed to visit every matching prefix");
+	fail_if(group != 1 || prefix != 1 || exact != 1 || other != 0,
+		"Visited the wrong items");
+	fail_if(buxton_trie_foreach_prefix(trie, "group2\nname", count_item,
+					   &visited) != 0,
+		"Matched a prefix of another group");
+	fail_if(buxton_trie_foreach_prefix(trie, "group\nn", count_item,
+					   &visited) != 1,
+		"Matched keys longer than the key");
+	fail_if(visited != 4, "Failed to pass user data");
+	fail_if(buxton_trie_count(trie) != 4, "Failed to count items");
+	fail_if(!buxton_trie_match_prefix(trie, "group\nnamex") ||
+		buxton_trie_match_prefix(trie, "group2\nname") ||
+		buxton_trie_match_prefix(trie, "group"),
+		"Failed to match prefixes");
+
+	fail_if(!buxton_trie_get(trie, "group\nna") ||
+		buxton_trie_get(trie, "group\nna")->data != &prefix ||
+		buxton_trie_get(trie, "group\nna")->next,
+		"Failed to get the items of a key");
+	fail_if(buxton_trie_get(trie, "group\nn") ||
+		buxton_trie_get(trie, "group\nnamex"),
+		"Got items of a key never added");
+
+	fail_if(buxton_trie_remove(trie, "group\nn", &prefix),
+		"Removed an item from the wrong key");
+	fail_if(!buxton_trie_remove(trie, "group\nna", &prefix),
+		"Failed to remove prefix from trie");
+	fail_if(buxton_trie_remove(trie, "group\nna", &prefix),
+		"Removed prefix from trie twice");
+	fail_if(buxton_trie_foreach_prefix(trie, "group\nname", count_item,
+					   &visited) != 2,
+		"Visited a removed item");
+
+	fail_if(!buxton_trie_remove(trie, "group\nname", &exact) ||
+		!buxton_trie_remove(trie, "group\nother", &other) ||
+		!buxton_trie_remove(trie, "group\n", &group),
+		"Failed to empty trie");
+	fail_if(trie->child || trie->items, "Failed to prune empty nodes");
+	fail_if(buxton_trie_count(trie) != 0 ||
+		buxton_trie_match_prefix(trie, "group\nname"),
+		"Counted removed items");
+
+	buxton_trie_free(trie);
+}
+END_TEST
+
+START_TEST(buxton_client_cache_check)
+{
+	BuxtonClientCache *cache;
+	_BuxtonKey key;
+	BuxtonData data, out;
+	bool watch;
+
+	cache = buxton_client_cache_new(2, 4096);
+	fail_if(!cache, "Failed to allocate client cache");
+
+	memzero(&key, sizeof(_BuxtonKey));
+	key.group = buxton_string_pack("group");
+	key.name = buxton_string_pack("a");
+	key.type = BUXTON_TYPE_INT32;
+	data.type = BUXTON_TYPE_INT32;
+	data.store.d_int32 = 1;
+
+	fail_if(buxton_client_cache_get(cache, &key, &out, &watch),
+		"Got a value from an empty cache");
+	fail_if(!watch, "Failed to ask for a registration");
+	buxton_client_cache_watch(cache, &key.group, 10);
+	buxton_client_cache_put(cache, 9, &key, &data);
+	fail_if(buxton_client_cache_get(cache, &key, &out, &watch),
+		"Kept a value got before the registration");
+	fail_if(watch, "Asked for a second registration");
+	buxton_client_cache_put(cache, 11, &key, &data);
+	fail_if(!buxton_client_cache_get(cache, &key, &out, &watch),
+		"Failed to keep a value");
+	fail_if(out.store.d_int32 != 1, "Failed to get the kept value");
+
+	key.name = buxton_string_pack("b");
+	data.store.d_int32 = 2;
+	buxton_client_cache_put(cache, 12, &key, &data);
+	key.layer = buxton_string_pack("base");
+	data.store.d_int32 = 3;
+	buxton_client_cache_put(cache, 13, &key, &data);
+	fail_if(cache->count != 2, "Failed to evict past the bound");
+	fail_if(!buxton_client_cache_get(cache, &key, &out, &watch) ||
+		out.store.d_int32 != 3, "Failed to keep the layer's value");
+	key.layer.value = NULL;
+	key.layer.length = 0;
+	fail_if(!buxton_client_cache_get(cache, &key, &out, &watch) ||
+		out.store.d_int32 != 2, "Failed to keep the layerless value");
+	key.name = buxton_string_pack("a");
+	fail_if(buxton_client_cache_get(cache, &key, &out, &watch),
+		"Failed to evict the least recently used value");
+
+	key.name = buxton_string_pack("b");
+	buxton_client_cache_invalidate(cache, &key);
+	fail_if(cache->count != 0 || cache->bytes != 0,
+		"Failed to drop every layer of a changed key");
+	fail_if(cache->hits != 3 || cache->misses != 3,
+		"Failed to count hits and misses");
+
+	key.group = buxton_string_pack("other");
+	buxton_client_cache_watch(cache, &key.group, 14);
+	buxton_client_cache_watch_failed(cache, &key.group);
+	buxton_client_cache_put(cache, 15, &key, &data);
+	fail_if(cache->count != 0, "Kept a value of a refused group");
+
+	/* Missed notifications drop every value but keep registrations */
+	key.group = buxton_string_pack("group");
+	buxton_client_cache_put(cache, 16, &key, &data);
+	fail_if(cache->count != 1, "Failed to keep a value");
+	buxton_client_cache_flush(cache);
+	fail_if(cache->count != 0 || cache->bytes != 0,
+		"Failed to drop every value");
+	buxton_client_cache_put(cache, 17, &key, &data);
+	fail_if(!buxton_client_cache_get(cache, &key, &out, &watch) || watch,
+		"Failed to keep the registration");
+
+	buxton_client_cache_free(cache);
+}
+END_TEST
+
 START_TEST(get_layer_path_check)
 {
 	BuxtonLayer layer;
@@ -710,6 +895,368 @@ START_TEST(buxton_get_message_size_check)
 }
 END_TEST
 
+START_TEST(buxton_copy_message_check)
+{
+	BuxtonControlMessage msg;
+	BuxtonData dsource;
+	BuxtonData *list = NULL;
+	uint8_t *packed = NULL;
+	uint8_t *copy;
+	BuxtonArray *out_list = NULL;
+	uint32_t msgid;
+	ssize_t count;
+	size_t ret;
+
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	dsource.type = BUXTON_TYPE_STRING;
+	dsource.store.d_string = buxton_string_pack("test-value");
+	fail_if(!buxton_array_add(out_list, &dsource),
+		"Failed to add element to array");
+	ret = buxton_serialize_message(&packed, BUXTON_CONTROL_CHANGED, 0,
+				       out_list);
+	fail_if(ret == 0, "Failed to serialize message");
+
+	copy = buxton_copy_message(packed, ret, 42);
+	count = buxton_deserialize_message(copy, &msg, ret, &msgid, &list);
+	fail_if(count != 1, "Failed to deserialize copied message");
+	fail_if(msg != BUXTON_CONTROL_CHANGED, "Copied wrong control code");
+	fail_if(msgid != 42, "Failed to set message id of copy");
+	fail_if(!streq(list[0].store.d_string.value, "test-value"),
+		"Failed to copy message parameters");
+	fail_if(buxton_get_message_size(packed, ret) != ret,
+		"Changed the original message");
+
+	free(list[0].store.d_string.value);
+	free(list);
+	free(copy);
+	free(packed);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxton_deserialize_message_view_check)
+{
+	BuxtonControlMessage msg;
+	BuxtonData dsource;
+	BuxtonData *list = NULL;
+	BuxtonData *view = NULL;
+	size_t view_size = 0;
+	uint8_t *packed = NULL;
+	BuxtonArray *out_list = NULL;
+	char value[4096];
+	uint32_t msgid;
+	ssize_t count;
+	size_t ret;
+
+	memset(value, 'a', sizeof(value) - 1);
+	value[sizeof(value) - 1] = 0x00;
+
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	dsource.type = BUXTON_TYPE_STRING;
+	dsource.store.d_string = buxton_string_pack("base");
+	fail_if(!buxton_array_add(out_list, &dsource),
+		"Failed to add element to array");
+	dsource.store.d_string = buxton_string_pack("group");
+	fail_if(!buxton_array_add(out_list, &dsource),
+		"Failed to add element to array");
+	dsource.store.d_string = buxton_string_pack("name");
+	fail_if(!buxton_array_add(out_list, &dsource),
+		"Failed to add element to array");
+	dsource.store.d_string = buxton_string_pack(value);
+	fail_if(!buxton_array_add(out_list, &dsource),
+		"Failed to add element to array");
+	ret = buxton_serialize_message(&packed, BUXTON_CONTROL_SET, 7,
+				       out_list);
+	fail_if(ret == 0, "Failed to serialize message");
+
+	/* Copying allocates the list and every string */
+	allocations = 0;
+	count_allocations = true;
+	count = buxton_deserialize_message(packed, &msg, ret, &msgid, &list);
+	count_allocations = false;
+	fail_if(count != 4, "Failed to deserialize message");
+	fail_if(allocations != 5, "Copied message with %zu allocations",
+		allocations);
+	for (ssize_t i = 0; i < count; i++) {
+		free(list[i].store.d_string.value);
+	}
+	free(list);
+
+	/* A view only grows its list, once */
+	allocations = 0;
+	count_allocations = true;
+	count = buxton_deserialize_message_view(packed, &msg, ret, &msgid,
+						&view, &view_size, NULL);
+	count_allocations = false;
+	fail_if(count != 4, "Failed to deserialize message view");
+	fail_if(allocations != 1, "Viewed message with %zu allocations",
+		allocations);
+	fail_if(view_size != 4, "Failed to grow view list");
+	fail_if(msg != BUXTON_CONTROL_SET || msgid != 7,
+		"Failed to get message header");
+	fail_if(!streq(view[3].store.d_string.value, value),
+		"Failed to get viewed string");
+	fail_if(view[3].store.d_string.length != sizeof(value),
+		"Failed to get viewed string length");
+	fail_if((uint8_t *)view[3].store.d_string.value < packed ||
+		(uint8_t *)view[3].store.d_string.value >= packed + ret,
+		"Viewed string not in the message");
+
+	allocations = 0;
+	count_allocations = true;
+	count = buxton_deserialize_message_view(packed, &msg, ret, &msgid,
+						&view, &view_size, NULL);
+	count_allocations = false;
+	fail_if(count != 4, "Failed to deserialize message view again");
+	fail_if(allocations != 0, "Viewed message again with %zu allocations",
+		allocations);
+
+	/* Strings must still be terminated */
+	packed[ret - 1] = 'a';
+	fail_if(buxton_deserialize_message_view(packed, &msg, ret, &msgid,
+						&view, &view_size, NULL) != -1,
+		"Viewed an unterminated string");
+
+	free(view);
+	free(packed);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxton_serialize_message_v2_check)
+{
+	BuxtonStringTable encode, decode, fresh;
+	BuxtonControlMessage msg;
+	BuxtonArray *out_list = NULL;
+	BuxtonData params[9];
+	BuxtonData *view = NULL;
+	BuxtonData *list = NULL;
+	size_t view_size = 0;
+	uint8_t *v1 = NULL, *first = NULL, *second = NULL, *transcoded = NULL;
+	size_t v1_size, first_size, second_size, transcoded_size;
+	ssize_t count;
+	uint32_t msgid;
+
+	memzero(&encode, sizeof(BuxtonStringTable));
+	memzero(&decode, sizeof(BuxtonStringTable));
+	memzero(&fresh, sizeof(BuxtonStringTable));
+
+	params[0].type = BUXTON_TYPE_STRING;
+	params[0].store.d_string = buxton_string_pack("user");
+	params[1].type = BUXTON_TYPE_STRING;
+	params[1].store.d_string = buxton_string_pack("TimingTest");
+	params[2].type = BUXTON_TYPE_INT32;
+	params[2].store.d_int32 = -300;
+	params[3].type = BUXTON_TYPE_UINT64;
+	params[3].store.d_uint64 = 1ULL << 40;
+	params[4].type = BUXTON_TYPE_DOUBLE;
+	params[4].store.d_double = 3.25;
+	params[5].type = BUXTON_TYPE_BOOLEAN;
+	params[5].store.d_boolean = true;
+	params[6].type = BUXTON_TYPE_STRING;
+	params[6].store.d_string.value = NULL;
+	params[6].store.d_string.length = 0;
+	params[7].type = BUXTON_TYPE_STRING;
+	params[7].store.d_string = buxton_string_pack("user");
+	params[8].type = BUXTON_TYPE_FLOAT;
+	params[8].store.d_float = 1.5f;
+
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	for (int i = 0; i < 9; i++) {
+		fail_if(!buxton_array_add(out_list, &params[i]),
+			"Failed to add parameter");
+	}
+
+	v1_size = buxton_serialize_message(&v1, BUXTON_CONTROL_SET, 5,
+					   out_list);
+	fail_if(v1_size == 0, "Failed to serialize version 1 message");
+	first_size = buxton_serialize_message_v2(&first, BUXTON_CONTROL_SET, 5,
+						 out_list, &encode);
+	fail_if(first_size == 0, "Failed to serialize version 2 message");
+	fail_if(first_size >= v1_size, "Version 2 message not smaller");
+	fail_if(buxton_get_message_size(first, first_size) != first_size,
+		"Failed to get version 2 message size");
+	fail_if(encode.count != 2, "Failed to give strings an index");
+
+	count = buxton_deserialize_message_view(first, &msg, first_size, &msgid,
+						&view, &view_size, &decode);
+	fail_if(count != 9, "Failed to deserialize version 2 message");
+	fail_if(msg != BUXTON_CONTROL_SET || msgid != 5,
+		"Failed to get message header");
+	fail_if(decode.count != 2, "Failed to keep strings given an index");
+	fail_if(!streq(view[0].store.d_string.value, "user") ||
+		!streq(view[1].store.d_string.value, "TimingTest") ||
+		!streq(view[7].store.d_string.value, "user"),
+		"Failed to get strings");
+	fail_if(view[6].type != BUXTON_TYPE_STRING ||
+		view[6].store.d_string.value || view[6].store.d_string.length,
+		"Failed to get empty string");
+	fail_if(view[2].store.d_int32 != -300 ||
+		view[3].store.d_uint64 != 1ULL << 40 ||
+		view[4].store.d_double != 3.25 ||
+		!view[5].store.d_boolean || view[8].store.d_float != 1.5f,
+		"Failed to get values");
+
+	/* Strings already sent go by index */
+	second_size = buxton_serialize_message_v2(&second, BUXTON_CONTROL_SET,
+						  6, out_list, &encode);
+	fail_if(second_size == 0 || second_size >= first_size,
+		"Failed to send strings by index");
+	count = buxton_deserialize_message_view(second, &msg, second_size,
+						&msgid, &view, &view_size,
+						&decode);
+	fail_if(count != 9 || msgid != 6,
+		"Failed to deserialize message with string indexes");
+	fail_if(!streq(view[1].store.d_string.value, "TimingTest") ||
+		view[1].store.d_string.length != sizeof("TimingTest"),
+		"Failed to get string by index");
+	fail_if(view[1].store.d_string.value != decode.strings[1].value,
+		"String by index not in the table");
+
+	/* Indexes need a table, and must be whole */
+	fail_if(buxton_deserialize_message(second, &msg, second_size, &msgid,
+					   &list) != -1,
+		"Deserialized string indexes without a table");
+	fail_if(buxton_deserialize_message_view(second, &msg, second_size - 1,
+						&msgid, &view, &view_size,
+						&decode) != -1,
+		"Deserialized truncated message");
+
+	/* Transcoding matches encoding directly */
+	transcoded_size = buxton_transcode_message_v2(v1, v1_size, &fresh,
+						      &transcoded);
+	fail_if(transcoded_size != first_size ||
+		memcmp(transcoded, first, first_size),
+		"Failed to transcode version 1 message");
+	free(transcoded);
+	transcoded = NULL;
+
+	/* A message taken back gives its strings an index again */
+	buxton_string_table_truncate(&fresh, 0);
+	fail_if(fresh.count != 0 || hashmap_size(fresh.index) != 0,
+		"Failed to truncate string table");
+	transcoded_size = buxton_transcode_message_v2(v1, v1_size, &fresh,
+						      &transcoded);
+	fail_if(transcoded_size != first_size ||
+		memcmp(transcoded, first, first_size),
+		"Failed to index strings again after truncating");
+	free(transcoded);
+	transcoded = NULL;
+	fail_if(buxton_transcode_message_v2(first, first_size, &fresh,
+					    &transcoded) != 0,
+		"Transcoded a version 2 message");
+
+	/* Without a table every string is sent in full */
+	free(first);
+	first_size = buxton_serialize_message_v2(&first, BUXTON_CONTROL_SET, 7,
+						 out_list, NULL);
+	fail_if(first_size == 0, "Failed to serialize without a table");
+	count = buxton_deserialize_message(first, &msg, first_size, &msgid,
+					   &list);
+	fail_if(count != 9, "Failed to deserialize message without indexes");
+	fail_if(!streq(list[7].store.d_string.value, "user"),
+		"Failed to copy string");
+	for (ssize_t i = 0; i < count; i++) {
+		if (list[i].type == BUXTON_TYPE_STRING) {
+			free(list[i].store.d_string.value);
+		}
+	}
+	free(list);
+
+	buxton_string_table_free(&encode);
+	buxton_string_table_free(&decode);
+	buxton_string_table_free(&fresh);
+	free(view);
+	free(v1);
+	free(first);
+	free(second);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
+START_TEST(buxton_string_table_keys_check)
+{
+	BuxtonStringTable encode, decode;
+	BuxtonControlMessage msg;
+	BuxtonArray *out_list = NULL;
+	BuxtonData params[4];
+	BuxtonData *view = NULL;
+	size_t view_size = 0;
+	uint8_t *data = NULL;
+	size_t size;
+	ssize_t count;
+	uint32_t msgid;
+	char name[32], value[32];
+
+	memzero(&encode, sizeof(BuxtonStringTable));
+	memzero(&decode, sizeof(BuxtonStringTable));
+
+	params[0].type = BUXTON_TYPE_STRING;
+	params[0].store.d_string = buxton_string_pack("base");
+	params[1].type = BUXTON_TYPE_STRING;
+	params[1].store.d_string = buxton_string_pack("group");
+	params[2].type = BUXTON_TYPE_STRING;
+	params[3].type = BUXTON_TYPE_STRING;
+
+	/* Names and values never take a slot, however many are sent */
+	for (uint32_t i = 0; i < BUXTON_STRING_TABLE_SIZE + 44; i++) {
+		snprintf(name, sizeof(name), "name%u", i);
+		snprintf(value, sizeof(value), "value%u", i);
+		params[2].store.d_string = buxton_string_pack(name);
+		params[3].store.d_string = buxton_string_pack(value);
+		out_list = buxton_array_new();
+		fail_if(!out_list, "Failed to allocate list");
+		for (int j = 0; j < 4; j++) {
+			fail_if(!buxton_array_add(out_list, &params[j]),
+				"Failed to add parameter");
+		}
+		size = buxton_serialize_message_v2(&data, BUXTON_CONTROL_SET, i,
+						   out_list, &encode);
+		fail_if(size == 0, "Failed to serialize version 2 message");
+		count = buxton_deserialize_message_view(data, &msg, size,
+							&msgid, &view,
+							&view_size, &decode);
+		fail_if(count != 4, "Failed to deserialize version 2 message");
+		free(data);
+		buxton_array_free(&out_list, NULL);
+	}
+	fail_if(encode.count != 2 || decode.count != 2,
+		"Gave an index to names or values");
+
+	/* A layer first sent after them is still sent by index */
+	params[0].store.d_string = buxton_string_pack("other");
+	out_list = buxton_array_new();
+	fail_if(!out_list, "Failed to allocate list");
+	for (int j = 0; j < 2; j++) {
+		fail_if(!buxton_array_add(out_list, &params[j]),
+			"Failed to add parameter");
+	}
+	for (uint32_t i = 0; i < 2; i++) {
+		size = buxton_serialize_message_v2(&data,
+						   BUXTON_CONTROL_CREATE_GROUP,
+						   i, out_list, &encode);
+		fail_if(size == 0, "Failed to serialize version 2 message");
+		count = buxton_deserialize_message_view(data, &msg, size,
+							&msgid, &view,
+							&view_size, &decode);
+		fail_if(count != 2, "Failed to deserialize version 2 message");
+		free(data);
+	}
+	fail_if(encode.count != 3, "Failed to give the layer an index");
+	fail_if(view[0].store.d_string.value != decode.strings[2].value ||
+		view[1].store.d_string.value != decode.strings[1].value,
+		"Layer and group not sent by index");
+
+	buxton_string_table_free(&encode);
+	buxton_string_table_free(&decode);
+	free(view);
+	buxton_array_free(&out_list, NULL);
+}
+END_TEST
+
 static Suite *
 shared_lib_suite(void)
 {
@@ -725,6 +1272,14 @@ shared_lib_suite(void)
 	tcase_add_test(tc, hashmap_check);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("trie_functions");
+	tcase_add_test(tc, buxton_trie_check);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("client_cache_functions");
+	tcase_add_test(tc, buxton_client_cache_check);
+	suite_add_tcase(s, tc);
+
 	tc = tcase_create("util_functions");
 	tcase_add_test(tc, get_layer_path_check);
 	tcase_add_test(tc, buxton_data_copy_check);
@@ -736,6 +1291,10 @@ shared_lib_suite(void)
 	tcase_add_test(tc, buxton_db_serialize_check);
 	tcase_add_test(tc, buxton_message_serialize_check);
 	tcase_add_test(tc, buxton_get_message_size_check);
+	tcase_add_test(tc, buxton_copy_message_check);
+	tcase_add_test(tc, buxton_deserialize_message_view_check);
+	tcase_add_test(tc, buxton_serialize_message_v2_check);
+	tcase_add_test(tc, buxton_string_table_keys_check);
 	suite_add_tcase(s, tc);
 
 	return s;
@@ -172,6 +172,116 @@ START_TEST(smack_access_check)
 }
 END_TEST
 
+START_TEST(smack_load_rules_check)
+{
+	BuxtonString subject;
+	BuxtonString object;
+
+	fail_if(!buxton_smack_load_rules(ABS_TOP_SRCDIR "/test/test.load2"),
+		"Failed to load Smack rules");
+
+	subject = buxton_string_pack("system");
+	object = buxton_string_pack("base/sample/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access was denied, but should have been granted");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access was granted, but should have been denied");
+
+	object = buxton_string_pack("system/sample/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access was denied");
+
+	/* Both labels are known, but no rule pairs them */
+	subject = buxton_string_pack("user");
+	object = buxton_string_pack("System");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access granted without a rule");
+
+	subject = buxton_string_pack("subjecttest");
+	object = buxton_string_pack("base/sample/key");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access granted for unrecognized subject");
+
+	/* Reloading keeps the labels and replaces the rules */
+	fail_if(!buxton_smack_load_rules(ABS_TOP_SRCDIR "/test/test.load2"),
+		"Failed to reload Smack rules");
+	subject = buxton_string_pack("user");
+	object = buxton_string_pack("user/sample/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Write access was denied after reload");
+}
+END_TEST
+
+START_TEST(smack_load_corrupt_rules_check)
+{
+	char path[] = "check_smack_XXXXXX";
+	BuxtonString subject;
+	BuxtonString object;
+	int fd;
+
+	fail_if(!buxton_smack_load_rules(ABS_TOP_SRCDIR "/test/test.load2"),
+		"Failed to load Smack rules");
+
+	fd = mkstemp(path);
+	fail_if(fd < 0, "Failed to create rule file");
+	fail_if(write(fd, "system base/sample/key rw\nuser\n", 31) != 31,
+		"Failed to write rule file");
+	close(fd);
+	fail_if(buxton_smack_load_rules(path), "Loaded corrupt Smack rules");
+	unlink(path);
+
+	/* The rules loaded before are kept */
+	subject = buxton_string_pack("system");
+	object = buxton_string_pack("base/sample/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access was denied after a failed reload");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_WRITE),
+		"Rule from the corrupt file was applied");
+}
+END_TEST
+
+START_TEST(smack_reload_labels_check)
+{
+	char path[] = "check_smack_XXXXXX";
+	BuxtonString subject;
+	BuxtonString object;
+	size_t labels;
+	int fd;
+
+	fail_if(!buxton_smack_load_rules(ABS_TOP_SRCDIR "/test/test.load2"),
+		"Failed to load Smack rules");
+	labels = buxton_smack_label_count();
+	fail_if(labels == 0, "No labels held for the rules");
+
+	fd = mkstemp(path);
+	fail_if(fd < 0, "Failed to create rule file");
+	fail_if(write(fd, "system other/key r\n", 19) != 19,
+		"Failed to write rule file");
+	close(fd);
+	fail_if(!buxton_smack_load_rules(path), "Failed to load Smack rules");
+	unlink(path);
+
+	/* Only the labels of the new rule are left */
+	fail_if(buxton_smack_label_count() != 2,
+		"Labels of the replaced rules were kept");
+	subject = buxton_string_pack("system");
+	object = buxton_string_pack("other/key");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access was denied by the new rules");
+	object = buxton_string_pack("base/sample/key");
+	fail_if(buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access granted by a replaced rule");
+
+	/* Dropped labels come back with the rules naming them */
+	fail_if(!buxton_smack_load_rules(ABS_TOP_SRCDIR "/test/test.load2"),
+		"Failed to reload Smack rules");
+	fail_if(buxton_smack_label_count() != labels,
+		"Failed to hold the labels of the reloaded rules");
+	fail_if(!buxton_check_smack_access(&subject, &object, ACCESS_READ),
+		"Read access was denied after reload");
+}
+END_TEST
+
 static Suite *
 daemon_suite(void)
 {
@@ -192,9 +302,15 @@ daemon_suite(void)
 		tcase_add_test(tc, smack_access_check);
 		suite_add_tcase(s, tc);
 	} else {
-		buxton_log("Smack support not detected; skipping this test suite\n");
+		buxton_log("Smack support not detected; skipping the smackfs tests\n");
 	}
 
+	tc = tcase_create("smack rule loading");
+	tcase_add_test(tc, smack_load_rules_check);
+	tcase_add_test(tc, smack_load_corrupt_rules_check);
+	tcase_add_test(tc, smack_reload_labels_check);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
 